@@ -1,11 +1,13 @@
 %
 %   arFastSensis
 %
-%   Enables or disables fast sensitivity computation. For the computation
-%   of fast sensitivities, the RHS must be full rank. For this, the model
-%   has to be reduced to a form where there are no more conserved moieties.
-%   Use arReduce after model loading, but before data loading to accomplish
-%   this.
+%   Enables or disables fast sensitivity computation. The pre-equilibrations
+%   are then simulated without sensitivities and arSimuCalc determines the
+%   sensitivities of the steady state from the implicit function theorem.
+%   Conserved moieties are accounted for by keeping the sensitivities of
+%   the conserved totals, so the model does not have to be reduced with
+%   arReduce. Only when a conservation law depends on the parameters (e.g.
+%   estimated compartment sizes), the sensitivities are integrated instead.
 %
 
 function arFastSensis()
@@ -22,15 +24,6 @@ function arFastSensis()
         return;
     end
     
-    % Check whether this model is suitable for fast sensitivities
-    for m = 1 : numel( ar.model )
-        arConservedPools(m);
-        if numel( ar.model(m).pools.states ) > 0
-            error( 'There are conserved moieties in model. Please run arReduce after arLoadModel and before loading data.' );
-        end
-    end
-    
-    % We're good!
     arFprintf(2, 'Enabled fast sensitivity computation\n');
     ar.config.turboSSSensi = 1;
 end
\ No newline at end of file
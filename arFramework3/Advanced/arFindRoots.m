@@ -108,7 +108,8 @@ function [xnew, S, failedCheck] = arFindRoots(jm, jc, condis, useConserved, debu
         else
             % Have we reduced the model, then we can rootfind faster
             if ( isfield( ar.config, 'C_rootfinding' ) && ( ar.config.C_rootfinding == 1 ) )
-                % Have we compiled with rootfinding capabilities, then use the direct method inside the C-file
+                % Damped Newton inside the C-file (falls back to integrating
+                % the condition when it does not converge)
                 ar.model(jm).(condis)(jc).x0_override = x0i;
                 feval(ar.fkt, ar, true, sensi, true, false, condis, threads, 2);
                 xnew = ar.model(jm).(condis)(jc).xFineSimu(end,:);
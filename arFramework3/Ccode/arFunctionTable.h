@@ -0,0 +1,57 @@
+#ifndef _MY_ARFUNCTIONTABLE
+#define _MY_ARFUNCTIONTABLE
+
+#include <cvodes/cvodes.h>
+#include <cvodes/cvodes_dense.h>
+#include <cvodes/cvodes_sparse.h>
+#include <cvodes/cvodes_spils.h>
+#include <nvector/nvector_serial.h>
+#include <sundials/sundials_types.h>
+
+/* Generated functions of a condition (arSimuCalcFunctions.c). The code generation fills one entry per     */
+/* condition in the order of the members below; the dispatchers index the table by model and condition,  */
+/* so that their cost does not grow with the number of conditions. Members which were not generated for   */
+/* the current configuration (the sensitivity right hand sides without useSensiRHS) are NULL.             */
+typedef struct {
+    CVRhsFn                 fx;
+    void                    (*fxdouble)(realtype t, N_Vector x, double *xdot, void *user_data);
+    void                    (*fx0)(N_Vector x0, void *user_data);
+    CVDlsDenseJacFn         dfxdx;
+    CVSlsSparseJacFn        dfxdx_sparse;
+    int                     (*dfxdx_out)(realtype t, N_Vector x, realtype *J, void *user_data);
+    CVSpilsJacTimesVecFn    dfxdx_times;
+    CVRhsFnB                fxB;
+    CVQuadRhsFnB            fqB;
+    CVDlsDenseJacFnB        dfxBdxB;
+    CVRootFn                froot;
+    void                    (*dfrootdxp)(realtype t, N_Vector x, double *dgdx, double *dgdp, double *dgdt, void *user_data);
+    void                    (*fsx0)(int ip, N_Vector sx0, void *user_data);
+    void                    (*subfsx0)(int ip, N_Vector sx0, void *user_data);
+    CVSensRhs1Fn            fsx;
+    CVSensRhs1Fn            subfsx;
+    CVSensRhsFn             fsxall;
+    void                    (*csv)(realtype t, N_Vector x, int ip, N_Vector sx, void *user_data);
+    void                    (*fu)(void *user_data, double t);
+    void                    (*fsu)(void *user_data, double t);
+    void                    (*fv)(realtype t, N_Vector x, void *user_data);
+    void                    (*fvreaction)(realtype t, N_Vector x, int iv, void *user_data);
+    void                    (*dvdx)(realtype t, N_Vector x, void *user_data);
+    void                    (*dvdu)(realtype t, N_Vector x, void *user_data);
+    void                    (*dvdp)(realtype t, N_Vector x, void *user_data);
+    void                    (*dfxdp0)(realtype t, N_Vector x, double *dfxdp0, void *user_data);
+    void                    (*dfxdp)(realtype t, N_Vector x, double *dfxdp, void *user_data);
+    void                    (*fz)(double t, int nt, int it, int nz, int nx, int nu, int iruns, double *z, double *p, double *u, double *x);
+    void                    (*dfzdx)(double t, int nt, int it, int nz, int nx, int nu, int iruns, double *dfzdx, double *z, double *p, double *u, double *x);
+    void                    (*fsz)(double t, int nt, int it, int np, double *sz, double *p, double *u, double *x, double *z, double *su, double *sx);
+    } ConditionFunctions;
+
+/* Generated functions of a data set, indexed by model and data set */
+typedef struct {
+    void    (*fy)(double t, int nt, int it, int ntlink, int itlink, int ny, int nx, int nz, int iruns, double *y, double *p, double *u, double *x, double *z);
+    void    (*fy_scale)(double t, int nt, int it, int ntlink, int itlink, int ny, int nx, int nz, int iruns, double *y_scale, double *p, double *u, double *x, double *z, double *dfzdx);
+    void    (*fystd)(double t, int nt, int it, int ntlink, int itlink, double *ystd, double *y, double *p, double *u, double *x, double *z);
+    void    (*fsy)(double t, int nt, int it, int ntlink, int itlink, double *sy, double *p, double *u, double *x, double *z, double *su, double *sx, double *sz);
+    void    (*fsystd)(double t, int nt, int it, int ntlink, int itlink, double *systd, double *p, double *y, double *u, double *x, double *z, double *sy, double *su, double *sx, double *sz);
+    } DataFunctions;
+
+#endif /* _MY_ARFUNCTIONTABLE */
@@ -69,18 +69,13 @@ double DLUT_bilinear( double x, double y, int NX, int NY, const double data[], i
         return (fxmaymi*(xmi - x*(NX - 1)) - fxmiymi*(xmi - x*(NX - 1) + 1))*(NY - 1) - (fxmayma*(xmi - x*(NX - 1)) - fxmiyma*(xmi - x*(NX - 1) + 1))*(NY - 1);
 }
 
-/* Spline with fixed time points and coefficients */
+/* Spline with fixed time points and coefficients (evaluated directly from the cached coefficients) */
 double inputfastspline( double t, int ID, double **splineCache, int *idCache, const int n, const double ts[], const double us[])
 {
-    double uout;
-    double b[MAX_LONG_SPLINE];
-    double c[MAX_LONG_SPLINE];
-    double d[MAX_LONG_SPLINE];
-    
-    clongmonotoneSpline( n, ts, us, b, c, d, ID, splineCache, idCache );
-    uout = seval_fixed( n, t, ts, us, b, c, d, &(idCache[ID]));
+    double *coeffs;
     
-    return uout;
+    coeffs = clongmonotoneSpline( n, ts, us, ID, splineCache, idCache );
+    return seval_fixed( n, t, ts, us, coeffs, coeffs + n, coeffs + 2*n, &(idCache[ID]));
 }
 
 double interpolateLinear( double t, int n, const double time[], const double data[] )
@@ -153,19 +148,10 @@ double splineFixCoeffs( double t, int n, const double time[], const double data[
     return val;
 }
 
-/* Spline with fixed time points and coefficients */
+/* Spline with fixed time points and coefficients (without cache only the interval around t is computed) */
 double inputspline( double t, const int n, const double ts[], const double us[])
 {
-    double uout;
-    
-    double b[MAX_LONG_SPLINE];
-    double c[MAX_LONG_SPLINE];
-    double d[MAX_LONG_SPLINE];
- 
-    longMonotoneSpline( n, ts, us, b, c, d );
-    uout = seval( n, t, ts, us, b, c, d );
-    
-    return uout;
+    return longMonotoneSplineEval( n, ts, us, t );
 }
 
 double step1(double t, double u1, double t1, double u2) {
@@ -938,10 +924,10 @@ int cspline(int n, int end1, int end2, double slope1, double slope2, const doubl
 {
     int j;
     
-    /* Nothing in the cache? Allocate memory and fill (free-ing is handled in arSimuCalc.c) */
+    /* Nothing in the cache? Allocate memory and fill (released with the arena of the simulation, see udata.c) */
     if ( splineCache[cacheID] == NULL )
     {
-        splineCache[cacheID] = (double*) malloc(3 * n * sizeof(double));
+        splineCache[cacheID] = (double*) simAlloc(3 * n * sizeof(double));
         spline(n, end1, end2, slope1, slope2, x, y, b, c, d);
         for ( j = 0; j < n; j++ )
         {
@@ -966,10 +952,10 @@ int cmonotoneSpline( int n, const double x[], const double y[], double b[], doub
 {
     int j;
     
-    /* Nothing in the cache? Allocate memory and fill (free-ing is handled in arSimuCalc.c) */
+    /* Nothing in the cache? Allocate memory and fill (released with the arena of the simulation, see udata.c) */
     if ( splineCache[cacheID] == NULL )
     {
-        splineCache[cacheID] = (double*) malloc(3 * n * sizeof(double));
+        splineCache[cacheID] = (double*) simAlloc(3 * n * sizeof(double));
         monotoneSpline(n, x, y, b, c, d);
         for ( j = 0; j < n; j++ )
         {
@@ -990,32 +976,21 @@ int cmonotoneSpline( int n, const double x[], const double y[], double b[], doub
     } 
 }
 
-int clongmonotoneSpline( int n, const double x[], const double y[], double b[], double c[], double d[], int cacheID, double **splineCache, int *IDcache )
+/* Long splines are not copied out of the cache: returns the cached coefficients b, c, d (each of length n) */
+double *clongmonotoneSpline( int n, const double x[], const double y[], int cacheID, double **splineCache, int *IDcache )
 {
-    int j;
+    double *coeffs = splineCache[cacheID];
     
-    /* Nothing in the cache? Allocate memory and fill (free-ing is handled in arSimuCalc.c) */
-    if ( splineCache[cacheID] == NULL )
+    /* Nothing in the cache? Allocate memory and fill (released with the arena of the simulation, see udata.c) */
+    if ( coeffs == NULL )
     {
-        splineCache[cacheID] = (double*) malloc(3 * n * sizeof(double));
-        longMonotoneSpline(n, x, y, b, c, d);
-        for ( j = 0; j < n; j++ )
-        {
-            splineCache[cacheID][j]     = b[j];
-            splineCache[cacheID][j+n]   = c[j];
-            splineCache[cacheID][j+2*n] = d[j];
-        }
+        coeffs = (double*) simAlloc(3 * n * sizeof(double));
+        longMonotoneSpline(n, x, y, coeffs, coeffs + n, coeffs + 2*n);
+        splineCache[cacheID] = coeffs;
         IDcache[cacheID] = 0;
     }
-    else
-    {
-        for ( j = 0; j < n; j++ )
-        {
-            b[j] = splineCache[cacheID][j];
-            c[j] = splineCache[cacheID][j+n];
-            d[j] = splineCache[cacheID][j+2*n];
-        }        
-    } 
+    
+    return coeffs;
 }
 
 double fastspline3(double t, int ID, double **splineCache, int *idCache, double t1, double p1, double t2, double p2, double t3, double p3, int ss, double dudt) {   
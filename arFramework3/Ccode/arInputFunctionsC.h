@@ -2,6 +2,10 @@
 #define _ARINPUTFUNCTIONS_C_
 
 #include <math.h>
+#include <stddef.h>
+
+/* Memory for the spline caches, allocated from the arena of the running simulation (udata.c) */
+void *simAlloc( size_t size );
 
 /* general input functions */
 double heaviside(double t);
@@ -23,7 +27,7 @@ double inputfastspline( double t, int ID, double **splineCache, int *idCache, co
 
 int cspline(int n, int end1, int end2, double slope1, double slope2, const double x[], const double y[], double b[], double c[], double d[], int cacheID, double **splineCache, int *IDcache);
 int cmonotoneSpline( int n, const double x[], const double y[], double b[], double c[], double d[], int cacheID, double **splineCache, int *IDcache );
-int clongmonotoneSpline( int n, const double x[], const double y[], double b[], double c[], double d[], int cacheID, double **splineCache, int *IDcache );
+double *clongmonotoneSpline( int n, const double x[], const double y[], int cacheID, double **splineCache, int *IDcache );
 
 /* splines */
 double spline3(double t, double t1, double p1, double t2, double p2, double t3, double p3, int ss, double dudt);
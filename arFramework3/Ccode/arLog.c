@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "arLog.h"
+
+#ifdef HAS_PTHREAD
+#include <pthread.h>
+
+typedef struct {
+    char            *buffer;
+    int             length;
+    int             dropped;     /* messages which did not fit into the buffer */
+    pthread_mutex_t mutex;       /* only contended while the main thread flushes */
+    } LogBuffer;
+
+LogBuffer       logBuffers[NMAXTHREADS];
+int             logNThreads = 0;
+int             logMutexes = 0;  /* number of buffers with an initialized mutex */
+int             logKeyCreated = 0;
+pthread_key_t   logKey;
+
+/* Prepare the buffers of the threads 0 ... nthreads-1 (main thread only) */
+void logInit( int nthreads )
+{
+    int j;
+
+    if ( logKeyCreated == 0 ) {
+        pthread_key_create( &logKey, NULL );
+        logKeyCreated = 1;
+    }
+    if ( nthreads > NMAXTHREADS ) nthreads = NMAXTHREADS;
+
+    for ( j = logMutexes; j < nthreads; j++ ) {
+        pthread_mutex_init( &(logBuffers[j].mutex), NULL );
+        logBuffers[j].buffer = NULL;
+        logBuffers[j].length = 0;
+        logBuffers[j].dropped = 0;
+        logMutexes++;
+    }
+    for ( j = 0; j < nthreads; j++ ) {
+        if ( logBuffers[j].buffer == NULL )
+            logBuffers[j].buffer = (char *) malloc( LOG_BUFFER_SIZE );
+    }
+    if ( nthreads > logNThreads ) logNThreads = nthreads;
+}
+
+/* Direct the output of the calling thread to the buffer of thread id */
+void logBindThread( int id )
+{
+    if ( ( logKeyCreated == 1 ) && ( id >= 0 ) && ( id < logMutexes ) )
+        pthread_setspecific( logKey, &(logBuffers[id]) );
+}
+
+/* printf style output which may be called from any thread */
+void logPrint( const char* format, ... )
+{
+    char      message[LOG_MESSAGE_SIZE];
+    va_list   args;
+    LogBuffer *log = NULL;
+    int       n;
+
+    va_start( args, format );
+    n = vsnprintf( message, LOG_MESSAGE_SIZE, format, args );
+    va_end( args );
+    if ( n < 0 ) return;
+    if ( n >= LOG_MESSAGE_SIZE ) n = LOG_MESSAGE_SIZE - 1;
+
+    if ( logKeyCreated == 1 )
+        log = (LogBuffer *) pthread_getspecific( logKey );
+
+    /* main thread: print right away */
+    if ( log == NULL ) {
+        mexPrintf( "%s", message );
+        mexEvalString( "drawnow;" );
+        return;
+    }
+
+    pthread_mutex_lock( &(log->mutex) );
+    if ( ( log->buffer != NULL ) && ( log->length + n <= LOG_BUFFER_SIZE ) ) {
+        memcpy( log->buffer + log->length, message, n );
+        log->length += n;
+    } else {
+        log->dropped++;
+    }
+    pthread_mutex_unlock( &(log->mutex) );
+}
+
+/* Print and clear the buffered messages of all threads (main thread only) */
+void logFlush( void )
+{
+    static char text[LOG_BUFFER_SIZE + 1];
+    int j, length, dropped;
+    int printed = 0;
+
+    for ( j = 0; j < logNThreads; j++ ) {
+        /* copy out, so that the thread can continue while we print */
+        pthread_mutex_lock( &(logBuffers[j].mutex) );
+        length = logBuffers[j].length;
+        dropped = logBuffers[j].dropped;
+        if ( length > 0 ) memcpy( text, logBuffers[j].buffer, length );
+        logBuffers[j].length = 0;
+        logBuffers[j].dropped = 0;
+        pthread_mutex_unlock( &(logBuffers[j].mutex) );
+
+        if ( length > 0 ) {
+            text[length] = '\0';
+            mexPrintf( "%s", text );
+            printed = 1;
+        }
+        if ( dropped > 0 ) {
+            mexPrintf( "[thread %d: %d messages dropped (log buffer full)]\n", j, dropped );
+            printed = 1;
+        }
+    }
+
+    if ( printed ) mexEvalString( "drawnow;" );
+}
+#else
+/* Without threads everything runs on the main thread and is printed right away */
+void logInit( int nthreads )
+{
+}
+
+void logBindThread( int id )
+{
+}
+
+void logPrint( const char* format, ... )
+{
+    char    message[LOG_MESSAGE_SIZE];
+    va_list args;
+
+    va_start( args, format );
+    vsnprintf( message, LOG_MESSAGE_SIZE, format, args );
+    va_end( args );
+
+    mexPrintf( "%s", message );
+    mexEvalString( "drawnow;" );
+}
+
+void logFlush( void )
+{
+}
+#endif
@@ -0,0 +1,26 @@
+#include <mex.h>
+
+#ifndef _MY_ARLOG
+#define _MY_ARLOG
+
+/* Thread safe diagnostics. Worker threads must not call mexPrintf, so messages printed by a  */
+/* thread which was bound with logBindThread are collected in a buffer owned by that thread.  */
+/* The main thread prints the buffered messages with logFlush (while waiting and after the    */
+/* join). Messages printed from the main thread are passed to mexPrintf right away.           */
+
+#define LOG_BUFFER_SIZE     65536   /* bytes buffered per thread before messages are dropped */
+#define LOG_MESSAGE_SIZE    1024    /* maximal length of a single message */
+
+/* Prepare the buffers of the threads 0 ... nthreads-1 (main thread only) */
+void logInit( int nthreads );
+
+/* Direct the output of the calling thread to the buffer of thread id */
+void logBindThread( int id );
+
+/* printf style output which may be called from any thread */
+void logPrint( const char* format, ... );
+
+/* Print and clear the buffered messages of all threads (main thread only) */
+void logFlush( void );
+
+#endif /* _MY_ARLOG */
@@ -0,0 +1,120 @@
+#ifndef _MY_ARRANDOM
+#define _MY_ARRANDOM
+
+#include <stdint.h>
+#include <math.h>
+
+/* Counter based random numbers (Philox4x32-10, Salmon et al., SC 2011) for the stochastic simulations.   */
+/* Every random number is a function of the key and a counter only, so that each thread can draw from its  */
+/* own stream without any shared state. A stream is keyed by the seed, the condition and the run, which    */
+/* makes every trajectory reproducible, independent of the thread it was simulated on.                     */
+
+#define PHILOX_M0       0xD2511F53u
+#define PHILOX_M1       0xCD9E8D57u
+#define PHILOX_W0       0x9E3779B9u
+#define PHILOX_W1       0xBB67AE85u
+#define PHILOX_ROUNDS   10
+
+typedef struct {
+    uint32_t key[2];
+    uint32_t ctr[4];        /* ctr[0], ctr[1]: number of the block, ctr[2], ctr[3]: run and condition */
+    uint32_t out[4];
+    int      used;          /* numbers of out which were handed out already */
+    } RandomStream;
+
+static inline void philoxRound( uint32_t *ctr, const uint32_t *key )
+{
+    uint64_t p0 = (uint64_t) PHILOX_M0 * ctr[0];
+    uint64_t p1 = (uint64_t) PHILOX_M1 * ctr[2];
+    uint32_t c1 = ctr[1], c3 = ctr[3];
+
+    ctr[0] = (uint32_t) ( p1 >> 32 ) ^ c1 ^ key[0];
+    ctr[1] = (uint32_t) p1;
+    ctr[2] = (uint32_t) ( p0 >> 32 ) ^ c3 ^ key[1];
+    ctr[3] = (uint32_t) p0;
+}
+
+/* Encrypt the current counter into the next four numbers and advance the counter */
+static inline void rngRefill( RandomStream *rng )
+{
+    uint32_t key[2];
+    int j;
+
+    key[0] = rng->key[0];
+    key[1] = rng->key[1];
+    for ( j = 0; j < 4; j++ ) rng->out[j] = rng->ctr[j];
+    for ( j = 0; j < PHILOX_ROUNDS; j++ ) {
+        philoxRound( rng->out, key );
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+    if ( ++(rng->ctr[0]) == 0 ) ++(rng->ctr[1]);
+    rng->used = 0;
+}
+
+/* Stream of run irun of condition ic of model im */
+static inline void rngInit( RandomStream *rng, uint32_t seed, int im, int ic, int irun )
+{
+    rng->key[0] = seed;
+    rng->key[1] = (uint32_t) im;
+    rng->ctr[0] = 0;
+    rng->ctr[1] = 0;
+    rng->ctr[2] = (uint32_t) irun;
+    rng->ctr[3] = (uint32_t) ic;
+    rng->used = 4;
+}
+
+static inline uint32_t rngNext( RandomStream *rng )
+{
+    if ( rng->used == 4 ) rngRefill( rng );
+    return rng->out[rng->used++];
+}
+
+/* Uniformly distributed in the open interval (0,1) with 53 random bits */
+static inline double rngUniform( RandomStream *rng )
+{
+    uint32_t a = rngNext( rng ) >> 5;
+    uint32_t b = rngNext( rng ) >> 6;
+
+    return ( (double) a * 67108864.0 + (double) b + 0.5 ) / 9007199254740992.0;
+}
+
+/* Poisson distributed with mean mu: inversion by sequential search for small means and the transformed */
+/* rejection with squeeze PTRS (Hoermann, Insurance Math. Econom. 12, 1993) for mu >= 10.                */
+static inline double rngPoisson( RandomStream *rng, double mu )
+{
+    double slam, loglam, a, b, invalpha, vr, u, v, us, k, p, q;
+
+    if ( mu <= 0 ) return 0;
+
+    if ( mu < 10 ) {
+        k = 0;
+        p = exp( -mu );
+        q = p;
+        u = rngUniform( rng );
+        while ( ( u > q ) && ( k < 1000 ) ) {
+            k++;
+            p *= mu / k;
+            q += p;
+        }
+        return k;
+    }
+
+    slam = sqrt( mu );
+    loglam = log( mu );
+    b = 0.931 + 2.53 * slam;
+    a = -0.059 + 0.02483 * b;
+    invalpha = 1.1239 + 1.1328 / ( b - 3.4 );
+    vr = 0.9277 - 3.6224 / ( b - 2 );
+    while ( 1 ) {
+        u = rngUniform( rng ) - 0.5;
+        v = rngUniform( rng );
+        us = 0.5 - fabs( u );
+        k = floor( ( 2 * a / us + b ) * u + mu + 0.43 );
+        if ( ( us >= 0.07 ) && ( v <= vr ) ) return k;
+        if ( ( k < 0 ) || ( ( us < 0.013 ) && ( v > us ) ) ) continue;
+        if ( log( v ) + log( invalpha ) - log( a / ( us * us ) + b ) <= -mu + k * loglam - lgamma( k + 1 ) ) return k;
+    }
+}
+
+#endif /* _MY_ARRANDOM */
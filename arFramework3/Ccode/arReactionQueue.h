@@ -0,0 +1,84 @@
+#ifndef _MY_ARREACTIONQUEUE
+#define _MY_ARREACTIONQUEUE
+
+/* Indexed binary min-heap of the absolute firing times of the reactions for the next reaction method    */
+/* (Gibson and Bruck, J. Phys. Chem. A 104, 2000). heap[0] is the reaction which fires next, pos[k] is the */
+/* position of reaction k in the heap, so that the time of any reaction can be changed in O(log nv).       */
+
+typedef struct {
+    double  *time;          /* firing time of reaction k */
+    int     *heap;          /* reactions ordered by their firing times */
+    int     *pos;           /* heap[pos[k]] == k */
+    int     n;
+    } ReactionQueue;
+
+static inline void rqSwap( ReactionQueue *q, int i, int j )
+{
+    int k = q->heap[i];
+
+    q->heap[i] = q->heap[j];
+    q->heap[j] = k;
+    q->pos[q->heap[i]] = i;
+    q->pos[q->heap[j]] = j;
+}
+
+static inline void rqSiftUp( ReactionQueue *q, int i )
+{
+    int parent;
+
+    while ( i > 0 ) {
+        parent = ( i - 1 ) / 2;
+        if ( q->time[q->heap[parent]] <= q->time[q->heap[i]] ) break;
+        rqSwap( q, i, parent );
+        i = parent;
+    }
+}
+
+static inline void rqSiftDown( ReactionQueue *q, int i )
+{
+    int child;
+
+    while ( ( child = 2 * i + 1 ) < q->n ) {
+        if ( ( child + 1 < q->n ) && ( q->time[q->heap[child+1]] < q->time[q->heap[child]] ) ) child++;
+        if ( q->time[q->heap[i]] <= q->time[q->heap[child]] ) break;
+        rqSwap( q, i, child );
+        i = child;
+    }
+}
+
+/* Build the heap from the times of all n reactions */
+static inline void rqInit( ReactionQueue *q, double *time, int *heap, int *pos, int n )
+{
+    int i;
+
+    q->time = time;
+    q->heap = heap;
+    q->pos = pos;
+    q->n = n;
+    for ( i = 0; i < n; i++ ) {
+        heap[i] = i;
+        pos[i] = i;
+    }
+    for ( i = n / 2 - 1; i >= 0; i-- )
+        rqSiftDown( q, i );
+}
+
+/* Reaction which fires next */
+static inline int rqTop( const ReactionQueue *q )
+{
+    return q->heap[0];
+}
+
+/* Change the firing time of reaction k */
+static inline void rqUpdate( ReactionQueue *q, int k, double time )
+{
+    double old = q->time[k];
+
+    q->time[k] = time;
+    if ( time < old )
+        rqSiftUp( q, q->pos[k] );
+    else
+        rqSiftDown( q, q->pos[k] );
+}
+
+#endif /* _MY_ARREACTIONQUEUE */
@@ -10,8 +10,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 #include <mex.h>
 #include "inverseC.h"
+#include "arLog.h"
+#include "arRandom.h"
+#include "arReactionQueue.h"
 #ifndef MACRO_DEBUGPRINT
 #include <stdarg.h>
 #endif
@@ -54,12 +58,12 @@ void timersub(struct timeval* tvp, struct timeval* uvp, struct timeval* vvp)
 #ifndef MACRO_DEBUGPRINT
     void debugPrint( int debugMode, int level, const char* format, ... );
 #else
-    /* Macro for the debug printer */
-    #define DEBUGPRINT0(DBGMODE, LVL, STR) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR ); mexEvalString("drawnow;"); } }
-    #define DEBUGPRINT1(DBGMODE, LVL, STR, ARG1) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1 ); mexEvalString("drawnow;"); } }
-    #define DEBUGPRINT2(DBGMODE, LVL, STR, ARG1, ARG2) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1, ARG2 ); mexEvalString("drawnow;"); } }
-    #define DEBUGPRINT3(DBGMODE, LVL, STR, ARG1, ARG2, ARG3) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1, ARG2, ARG3 ); mexEvalString("drawnow;"); } }
-    #define DEBUGPRINT4(DBGMODE, LVL, STR, ARG1, ARG2, ARG3, ARG4) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1, ARG2, ARG3, ARG4 ); mexEvalString("drawnow;"); } }
+    /* Macro for the debug printer (thread safe, see arLog.h) */
+    #define DEBUGPRINT0(DBGMODE, LVL, STR) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR ); } }
+    #define DEBUGPRINT1(DBGMODE, LVL, STR, ARG1) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1 ); } }
+    #define DEBUGPRINT2(DBGMODE, LVL, STR, ARG1, ARG2) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1, ARG2 ); } }
+    #define DEBUGPRINT3(DBGMODE, LVL, STR, ARG1, ARG2, ARG3) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1, ARG2, ARG3 ); } }
+    #define DEBUGPRINT4(DBGMODE, LVL, STR, ARG1, ARG2, ARG3, ARG4) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1, ARG2, ARG3, ARG4 ); } }
 #endif
             
 #include <cvodes/cvodes.h>           /* prototypes for CVODES fcts. and consts. */
@@ -71,14 +75,24 @@ void timersub(struct timeval* tvp, struct timeval* uvp, struct timeval* vvp)
 /*#include <cvodes/cvodes_superlumt.h> */  /* prototype for CVSUPERLUMT */
 #include <sundials/sundials_sparse.h> /* definitions SlsMat */
 #include <cvodes/cvodes_klu.h> /* definition of CVKLU sparse solver */
+#include <cvodes/cvodes_spgmr.h> /* Krylov solvers, useSparseJac 2 and 3 */
+#include <cvodes/cvodes_spbcgs.h>
 
 /* Accessor macros */
 #define Ith(v, i)     NV_Ith_S(v, i-1)        /* i-th vector component i=1..neq */
 #define IJth(A, i, j) DENSE_ELEM(A, i-1, j-1) /* (i,j)-th matrix component i,j=1..neq */
 
 #define MXSTRING		32
+#define INTERRUPT_POLL_USEC 50000   /* interval at which the main thread checks for CTRL+C while waiting */
 #define MXNCF        20
 #define MXNEF        20
+#define ADJOINT_CHECKPOINT_STEPS 100    /* integration steps between checkpoints of the forward pass in adjoint mode */
+#define MAX_TRIGGERS 1000               /* state dependent events between two output points before the solution is considered chattering */
+#define SSA_NCRITICAL 10                /* reactions which can fire fewer times before a reactant is exhausted are simulated exactly */
+#define SSA_EXACT_FACTOR 10             /* leaps shorter than SSA_EXACT_FACTOR mean reaction times ... */
+#define SSA_EXACT_STEPS 100             /* ... are replaced by SSA_EXACT_STEPS steps of the direct method */
+#define SSA_REACTION_ORDER 2            /* assumed highest order of the reactions in the leap size selection */
+#define SSA_NEWTON_MAXITER 10           /* Newton iterations of an implicit leap */
 
 #ifdef HAS_PTHREAD
 struct thread_data_x {
@@ -89,24 +103,90 @@ struct thread_data_x {
 int threadStatus[NMAXTHREADS];
 int threadAbortSignal[NMAXTHREADS];
 
+/* Sensitivity blocks. When ar.config.sensiBlockSize > 0, the sensitivity parameters of large conditions are */
+/* split into blocks which are simulated as separate tasks, each with its own CVODES instance integrating    */
+/* the states alongside its share of the sensitivities. Block 0 stores the states, inputs and fluxes, the    */
+/* block which finishes last evaluates the derived variables and observables of the condition.               */
+/* Stochastic simulations are split the same way, but each block simulates a range of the runs instead.      */
+typedef struct {
+    int     im;
+    int     ic;
+    int     nblocks;
+    int     pending;            /* blocks which have not finished yet (protected by schedMutex) */
+    int     started;
+    double  status;             /* first nonzero status reported by any of the blocks */
+    struct timeval t2;          /* start of the first block */
+    } *SensGroup;
+
+typedef struct {
+    SensGroup group;
+    int      iblock;
+    int      npBlock;
+    int32_T  *sensIndices;      /* parameters integrated by this block */
+    int32_T  *mapping;          /* for every parameter: index in this block, -1 = not sensitized, -2 = other block */
+    int      firstRun;          /* SSA: runs firstRun ... lastRun-1 are simulated by this block */
+    int      lastRun;
+    double   status;
+    } *SensBlock;
+
+#ifdef HAS_PTHREAD
+/* Work stealing scheduler. Every thread owns the task list it was assigned in arLink (arthread(id).ms/cs) and  */
+/* takes tasks from its front. Threads which run out of work steal pending tasks from the back of the longest   */
+/* remaining list, so that a single expensive condition does not leave the other cores idle.                    */
+int             dynamicScheduling;
+int             schedNThreads;
+int             *schedMs[NMAXTHREADS];
+int             *schedCs[NMAXTHREADS];
+int             schedHead[NMAXTHREADS];
+int             schedTail[NMAXTHREADS];
+SensBlock       *schedBlocks[NMAXTHREADS];
+int             schedLength[NMAXTHREADS];
+int             schedSplit;
+pthread_mutex_t schedMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Maximal number of parameters per sensitivity block (0 = never split) and number of cores available for them */
+int             sensiBlockSize;
+int             nCores;
+
+/* Persistent worker pool. The workers stay alive between calls of the MEX file, wait on poolWork until   */
+/* mexFunction hands them a thread id to process and are torn down when MATLAB unloads the MEX file.    */
+int             persistentThreads;
+int             poolSize = 0;
+int             poolShutdown = 0;
+int             poolJob[NMAXTHREADS];
+pthread_t       poolThreads[NMAXTHREADS];
+struct thread_data_x poolData[NMAXTHREADS];
+pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  poolWork = PTHREAD_COND_INITIALIZER;
+
+/* Number of threads of the current call which have not finished their task list yet. Workers signal */
+/* threadsDone when they are finished, so that the main thread can sleep instead of spinning.        */
+int             threadsPending = 0;
+pthread_mutex_t threadsMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  threadsDone = PTHREAD_COND_INITIALIZER;
+#endif
+
 mxArray *armodel;
 mxArray *arthread;
 
 int    rootFinding;
-int    done;
 int    fine;
 int    globalsensi;
 int    dynamics;
 int    ssa;
 int    jacobian;
-int    setSparse;
+int    setSparse;             /* linear solver: 0 dense, 1 KLU, 2 SPGMR, 3 SPBCG */
+int    krylovBandwidth;       /* half bandwidth of the preconditioner of the Krylov solvers */
 int    ms;
 int    events;
 int    parallel;
 int    sensirhs;
 int    debugMode;
 int    sensitivitySubset;
-/*int    fiterrors;*/
+int    useSolverCache;
+int    adjoint;
+int    fiterrors;
+int    turboSSSensi;
 int    cvodes_maxsteps;
 double cvodes_maxstepsize;
 int    cvodes_atolV;
@@ -134,6 +214,54 @@ struct timeval t1;
 
 double  mintau;
 int     nruns;
+uint32_t ssaSeed;             /* key of the random number streams of the SSA runs */
+int     ssaMethod;            /* 0: direct method, 1: next reaction method, 2: explicit and 3: implicit tau-leaping, 4: hybrid */
+double  ssaTauEps;            /* tau-leaping: allowed relative change of the propensities per leap */
+double  ssaHybridThreshold;   /* hybrid: firings per output interval and reactant molecules of the fast reactions */
+
+/* Field numbers of the MATLAB structs which are read during the simulation. They are resolved  */
+/* once per call (initFieldIndices), so that the simulation does not search the field names of  */
+/* every condition and data struct with mxGetField. Each model has its own condition and data   */
+/* struct arrays, which may order their fields differently, so the numbers are kept per model.  */
+#define MODEL_FIELDS \
+    FIELD(N) FIELD(data) FIELD(nnz) FIELD(qPositiveX) FIELD(ssaDepIdx) FIELD(ssaDepPtr) FIELD(ssaInputDep) \
+    FIELD(tLim) FIELD(triggerA) FIELD(triggerB) FIELD(triggerDirection) FIELD(xs)
+#define CONDITION_FIELDS \
+    FIELD(allocStats) FIELD(backwardIndices) FIELD(chi2Grad) FIELD(dLink) FIELD(ddxdtdp) FIELD(dfdpNum) FIELD(dfdxNum) FIELD(dvdpNum) \
+    FIELD(dvduNum) FIELD(dvdxNum) FIELD(dxdt) FIELD(dzdx) FIELD(has_tExp) FIELD(modsx_A) FIELD(modsx_B) \
+    FIELD(modx_A) FIELD(modx_B) FIELD(pNum) FIELD(qEvents) FIELD(qMS) FIELD(scale_v_ssa) \
+    FIELD(scale_x_ssa) FIELD(sensIndices) FIELD(splines) FIELD(src) FIELD(ssStates) FIELD(start) \
+    FIELD(status) FIELD(stepsTaken) FIELD(stop) FIELD(stop_data) FIELD(suExpSimu) FIELD(suFineSimu) \
+    FIELD(suNum) FIELD(svExpSimu) FIELD(svFineSimu) FIELD(svNum) FIELD(sxExpSimu) FIELD(sxFineSimu) \
+    FIELD(szExpSimu) FIELD(szFineSimu) FIELD(tEq) FIELD(tEvents) FIELD(tExp) FIELD(tFine) FIELD(tMS) \
+    FIELD(tstart) FIELD(uExpSimu) FIELD(uFineSimu) FIELD(uNum) FIELD(vExpSimu) FIELD(vFineSimu) \
+    FIELD(vNum) FIELD(x0_override) FIELD(x0_ssa) FIELD(xExpSSA) FIELD(xExpSimu) FIELD(xFineSSA) \
+    FIELD(xFineSSA_lb) FIELD(xFineSSA_ub) FIELD(xFineSimu) FIELD(y_atol) FIELD(zExpSimu) FIELD(zFineSimu)
+#define DATA_FIELDS \
+    FIELD(cLink) FIELD(chi2Grad) FIELD(has_tExp) FIELD(has_yExp) FIELD(logfitting) FIELD(pNum) FIELD(qFit) \
+    FIELD(syExpSimu) FIELD(syFineSimu) FIELD(systdExpSimu) FIELD(systdFineSimu) FIELD(tExp) FIELD(tFine) \
+    FIELD(tLinkExp) FIELD(tLinkFine) FIELD(y) FIELD(yExp) FIELD(yExpSimu) FIELD(yExpStd) FIELD(yFineSimu) \
+    FIELD(y_scale) FIELD(ystdExpSimu) FIELD(ystdFineSimu)
+
+#define FIELD(name) MF_##name,
+enum { MODEL_FIELDS NMODELFIELDS };
+#undef FIELD
+#define FIELD(name) CF_##name,
+enum { CONDITION_FIELDS NCONDITIONFIELDS };
+#undef FIELD
+#define FIELD(name) DF_##name,
+enum { DATA_FIELDS NDATAFIELDS };
+#undef FIELD
+
+typedef struct {
+    int conditionList;                  /* ar.model(im).(condition_name) */
+    int model[NMODELFIELDS];
+    int condition[NCONDITIONFIELDS];
+    int data[NDATAFIELDS];
+} FieldIndex;
+
+FieldIndex  *fieldIndex = NULL;
+int         fieldIndexSize = 0;
 
 /* Prototype of undocumented MATLAB function */
 #ifdef ALLOW_INTERRUPTS
@@ -143,10 +271,31 @@ extern bool utIsInterruptPending(void);
 /* Prototypes of private functions */
 #ifdef HAS_PTHREAD
 void *thread_calc(void *threadarg);
+int initScheduler(int nthreads);
+int splitSensitivities(int nthreads);
+int splitRuns(int nthreads);
+int countSensBlocks(int im, int ic, int maxBlocks);
+void freeScheduler(void);
+int nextTask(int id, int *im, int *ic, SensBlock *block);
+void calc_block(int id, SensBlock block);
+int threadId(int ithreads);
+void *pool_worker(void *threadarg);
+void growPool(int nworkers);
+void dispatchPool(int nworkers);
+void finishThread(void);
+void waitThreads(int nthreads);
+void shutdownPool(void);
 #else
 void thread_calc(int id);
 #endif
-void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *abortSignal, int rootFinding, int debugMode, int sensitivitySubset);
+void cleanupMex(void);
+void initFieldIndices(void);
+mxArray *modelField(int im, int field);
+mxArray *conditionList(int im);
+mxArray *conditionField(mxArray *arcondition, int im, int ic, int field);
+mxArray *dataField(mxArray *ardata, int im, int id, int field);
+void calc_tasks(int id);
+void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *abortSignal, int rootFinding, int debugMode, int sensitivitySubset, SensBlock block);
 void z_calc(int im, int ic, int isim, mxArray *arcondition, int sensi);
 void y_calc(int im, int id, mxArray *ardata, mxArray *arcondition, int sensi);
 
@@ -158,8 +307,8 @@ void y_checkNaN(int nt, int ny, int it, double *y, double *yexp, double *ystd);
 
 int ewt(N_Vector y, N_Vector w, void *user_data);
 void thr_error( const char* msg );
-int fetch_vector( mxArray* arcondition, int ic, double **vector, const char* fieldname, int desiredLength );
-int init_list( mxArray* arcondition, int ic, double tstart, int* nPoints, double** timePoints, int* currentIndex, const char* flagFieldName, const char* timePointFieldName );
+int fetch_vector( mxArray* field, double **vector, int desiredLength );
+int init_list( mxArray* flagField, mxArray* timePointField, double tstart, int* nPoints, double** timePoints, int* currentIndex );
 void copyStates( N_Vector x, double *returnx, double *qpositivex, int neq, int nout, int offset );
 void copyResult( double* data, double *returnvec, int nu, int nout, int offset );
 void copyNVMatrixToDouble( N_Vector* sx, double *returnsx, int nps, int neq, int nout, int offset );
@@ -168,26 +317,84 @@ void subCopyNVMatrixToDouble( N_Vector* sx, double *returnsx, int nps, int neq,
 /* user functions */
 #include "arSimuCalcFunctions.c"
 
+/* Condition data shared by the stochastic simulation engines */
+typedef struct {
+    int     im, ic;
+    int     nx, nv, nt, ntexp;
+    double  tstart;
+    double  *x0, *scale_x, *scale_v, *N;
+    double  *tfine, *texp;
+    double  *xssa, *xssa_lb, *xssa_ub, *xssaexp;
+    int32_T *depPtr, *depIdx;   /* reactions depIdx[depPtr[j]] ... depIdx[depPtr[j+1]-1] change when j fires */
+    int     inputDep;           /* propensities depend on inputs, derived variables or time */
+    } SSAProblem;
+
+/* Work memory of the tau-leaping and hybrid engines */
+typedef struct {
+    double  *alpha;             /* propensities (nv) */
+    double  *alphaNew;          /* propensities at the end of an implicit leap (nv) */
+    double  *alphaTmp;          /* propensities of the finite differences (nv) */
+    double  *fired;             /* firings of every reaction in the current leap (nv) */
+    double  *y;                 /* molecules at the end of an implicit leap (nx) */
+    double  *res;               /* Newton residual (nx) */
+    double  *c;                 /* constant part of the implicit leap equation (nx) */
+    double  *xsave;             /* state before the leap (nx) */
+    double  *jac;               /* Newton matrix of the implicit leap (nx*nx) */
+    mwSignedIndex *ipiv;
+    int     *critical;          /* reactions which are close to exhausting a reactant, hybrid: slow reactions (nv) */
+    int     *fast;              /* hybrid: reactions which are integrated deterministically (nv) */
+    } SSAWork;
+
+/* User data of the CVODES instance of the hybrid method. The state is the vector of species followed */
+/* by the integral of the propensities of the slow reactions, which fire when it reaches xi.          */
+typedef struct {
+    SimMemory   sim_mem;
+    SSAProblem  *problem;
+    SSAWork     *work;
+    double      xi;
+    } *HybridData;
+
 void storeSimulation( UserData data, int im, int isim, int is, int nu, int nv, int neq, int nout, N_Vector x, double *returnx, double *returnu, double *returnv, double *qpositivex );
 void storeSensitivities( UserData data, int im, int isim, int is, int np, int nu, int nv, int neq, int nout, N_Vector x, N_Vector *sx, double *returnsx, double *returnsu, double *returnsv, int sensitivitySubset, int32_T *sensitivityMapping );
-void findRoots( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double eq_tol, int neq, int nu, int nv, int nout, double* returnx, double* returnu, double* returnv, double* qpositivex, double* returnsx, double* returnsu, double* returnsv, int sensi, int ysensi, int npSensi, int has_tExp );
-void storeIntegrationInfo( SimMemory sim_mem, mxArray *arcondition, int ic );
+int findRoots( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double eq_tol, int neq, int nu, int nv, int nout, int nnz, double* returnx, double* returnu, double* returnv, double* qpositivex, double* returnsx, double* returnsu, double* returnsv, int sensi, int ysensi, int npSensi, int has_tExp );
+void storeIntegrationInfo( SimMemory sim_mem, mxArray *arcondition, int im, int ic );
 void terminate_x_calc( SimMemory sim_mem, double status );
-void initializeDataCVODES( SimMemory sim_mem, double tstart, int *abortSignal, mxArray *arcondition, double *qpositivex, int ic, int nsplines, int sensitivitySubset );
-int allocateSimMemoryCVODES( SimMemory sim_mem, int neq, int np, int sensi, int npSensi );
+void initializeDataCVODES( SimMemory sim_mem, double tstart, int *abortSignal, mxArray *arcondition, double *qpositivex, int im, int ic, int nsplines, int sensitivitySubset );
+int allocateSimMemoryCVODES( SimMemory sim_mem, int neq, int np, int sensi, int npSensi, SolverCache cache );
+int privateBlockBuffers( SimMemory sim_mem, mxArray *arcondition, int im, int ic, double **returnx, double **returnu, double **returnv, double **returnsu, double **returndxdt, double **returndfdp0, double **teq );
 int allocateSimMemorySSA( SimMemory sim_mem, int nx );
+int initializeDataSSA( SimMemory sim_mem, int *abortSignal, mxArray *arcondition, int im, int ic, int privateBuffers );
+void storeSSAOutputs( SimMemory sim_mem, SSAProblem *problem, int iruns, double tnext, int *it, int *itexp );
+int nextReactionRun( SimMemory sim_mem, SSAProblem *problem, ReactionQueue *queue, double *alpha, RandomStream *rng, int iruns );
+int initializeSSAWork( SimMemory sim_mem, SSAProblem *problem, SSAWork *work );
+double ssaPropensities( UserData data, SSAProblem *problem, double t, N_Vector x, double *alpha );
+int ssaSelect( double *alpha, int *mask, int nv, double target );
+void ssaFire( SimMemory sim_mem, SSAProblem *problem, int iv, double count );
+double leapSize( SimMemory sim_mem, SSAProblem *problem, SSAWork *work, int implicit );
+int implicitLeap( SimMemory sim_mem, SSAProblem *problem, SSAWork *work, double t, double tau );
+int tauLeapingRun( SimMemory sim_mem, SSAProblem *problem, SSAWork *work, RandomStream *rng, int iruns, int implicit );
+int initializeHybrid( SimMemory sim_mem, HybridData hybrid );
+void hybridPartition( SimMemory sim_mem, HybridData hybrid, double t );
+int hybridRhs( realtype t, N_Vector y, N_Vector ydot, void *user_data );
+int hybridRoot( realtype t, N_Vector y, realtype *gout, void *user_data );
+int hybridRun( SimMemory sim_mem, HybridData hybrid, RandomStream *rng, int iruns );
 int applyInitialConditionsODE( SimMemory sim_mem, double tstart, int im, int isim, double *returndxdt, double *returndfdp0, mxArray *x0_override, int sensitivitySubset );
-int initializeEvents( SimMemory sim_mem, mxArray *arcondition, int ic, double tstart );
+int initializeEvents( SimMemory sim_mem, mxArray *arcondition, int im, int ic, double tstart );
+int initializeTriggers( SimMemory sim_mem, int im );
+int initializeKrylov( SimMemory sim_mem, int im, int isim, int nnz );
 void evaluateObservations( mxArray *arcondition, int im, int ic, int sensi, int has_tExp );
+int adjointGradient( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double *ts, int nout );
+int steadyStateSensi( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double t, int nout );
 
 int handle_event( SimMemory sim_mem, int sensi_meth, int reinitSolver );
-int equilibrate(void *cvode_mem, UserData user_data, N_Vector x, realtype t, double *equilibrated, double *returndxdt, double *teq, int neq, int im, int ic, int *abortSignal );
+int handleTrigger( SimMemory sim_mem, int im, int isim, realtype t, int sensi_meth );
+int equilibrate(void *cvode_mem, UserData user_data, N_Vector x, realtype t, double *equilibrated, double *returndxdt, double *teq, int neq, int im, int ic, int *abortSignal, SimMemory sim_mem, int sensi_meth );
 
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     int nthreads, ithreads, tid;
 
 #ifdef HAS_PTHREAD
-    int rc;
+    int rc, nworkers;
     pthread_t threads_x[NMAXTHREADS];
     struct thread_data_x thread_data_x_array[NMAXTHREADS];
 #endif
@@ -198,7 +405,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     ticks_stop = mxGetData(mxGetField(prhs[0], 0, "stop"));
     gettimeofday(&t1, NULL);
     
-    srand( (unsigned)time(NULL) );
+    /* Worker threads and cached solvers are released when MATLAB unloads the MEX file */
+    mexAtExit(cleanupMex);
     
     /* get ar.model */
     armodel = mxGetField(prhs[0], 0, "model");
@@ -217,6 +425,9 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     if ( mxGetString(prhs[6], threads_name, MXSTRING ) != 0 )
         mexErrMsgTxt("Failed to provide name of condition list to arSimuCalc. Aborting ...");    
 
+    /* Look up the fields which the simulation reads once, instead of by name for every condition */
+    initFieldIndices();
+
     /* Is the equilibrium found by rootfinding and must we immediately terminate? */
     if ( nrhs > 7 ) {
         rootFinding = (int) mxGetScalar(prhs[7]);
@@ -224,6 +435,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         rootFinding = 0;
     }
     
+    /* Is the gradient of the data chi2 computed by adjoint sensitivities instead of forward sensitivities? */
+    if ( nrhs > 8 ) {
+        adjoint = (int) mxGetScalar(prhs[8]);
+    } else {
+        adjoint = 0;
+    }
+    
     /* get ar.config */
     arconfig = mxGetField(prhs[0], 0, "config");
     parallel = (int) mxGetScalar(mxGetField(arconfig, 0, "useParallel"));
@@ -235,6 +453,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     cvodes_atol = mxGetScalar(mxGetField(arconfig, 0, "atol"));
     cvodes_maxsteps = (int) mxGetScalar(mxGetField(arconfig, 0, "maxsteps"));
     cvodes_maxstepsize = mxGetScalar(mxGetField(arconfig, 0, "maxstepsize"));
+    fiterrors = (int) mxGetScalar(mxGetField(arconfig, 0, "fiterrors"));
     
     /* Do we want debug mode? */
     debugMode = 0;
@@ -245,15 +464,60 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     if ( mxGetField(arconfig, 0, "sensitivitySubset" ) )
         sensitivitySubset = (int) mxGetScalar(mxGetField(arconfig, 0, "sensitivitySubset"));
     
-    /* In debug mode we have to disable threading, since otherwise the mexPrintf can lead to a race condition which may crash MATLAB */
-    if ( debugMode > 0 )
-    {
-        mexPrintf("[DEBUG MODE: Parallelization disabled]\n");
-        parallel = 0;
-    }
+    /* Half bandwidth of the preconditioner of the Krylov solvers */
+    krylovBandwidth = 2;
+    if ( mxGetField(arconfig, 0, "krylovBandwidth" ) )
+        krylovBandwidth = (int) mxGetScalar(mxGetField(arconfig, 0, "krylovBandwidth"));
+    
+    /* Are the sensitivities of pre-equilibrations computed from the implicit function theorem? */
+    turboSSSensi = 0;
+    if ( mxGetField(arconfig, 0, "turboSSSensi" ) )
+        turboSSSensi = (int) mxGetScalar(mxGetField(arconfig, 0, "turboSSSensi"));
+    
+    /* Keep the CVODES memory of every condition alive between calls? */
+    useSolverCache = 0;
+    if ( mxGetField(arconfig, 0, "useSolverCache" ) )
+        useSolverCache = (int) mxGetScalar(mxGetField(arconfig, 0, "useSolverCache"));
+    if ( useSolverCache == 0 ) clearSolverCache();
+    
+#ifdef HAS_PTHREAD
+    /* Let idle threads take over conditions from busy ones? */
+    dynamicScheduling = 0;
+    if ( mxGetField(arconfig, 0, "useDynamicScheduling" ) )
+        dynamicScheduling = (int) mxGetScalar(mxGetField(arconfig, 0, "useDynamicScheduling"));
+    
+    /* Reuse worker threads from previous calls? */
+    persistentThreads = 0;
+    if ( mxGetField(arconfig, 0, "usePersistentThreads" ) )
+        persistentThreads = (int) mxGetScalar(mxGetField(arconfig, 0, "usePersistentThreads"));
+    
+    /* Split the sensitivities of large conditions over several threads? */
+    sensiBlockSize = 0;
+    if ( mxGetField(arconfig, 0, "sensiBlockSize" ) )
+        sensiBlockSize = (int) mxGetScalar(mxGetField(arconfig, 0, "sensiBlockSize"));
+    nCores = 1;
+    if ( mxGetField(arconfig, 0, "nCore" ) )
+        nCores = (int) mxGetScalar(mxGetField(arconfig, 0, "nCore"));
+#endif
     
     mintau = mxGetScalar(mxGetField(arconfig, 0, "ssa_min_tau"));
     nruns = (int) mxGetScalar(mxGetField(arconfig, 0, "ssa_runs"));
+    
+    /* Seed of the stochastic simulations (0 = draw a new one on every call) */
+    ssaSeed = 0;
+    if ( mxGetField(arconfig, 0, "ssa_seed" ) )
+        ssaSeed = (uint32_t) mxGetScalar(mxGetField(arconfig, 0, "ssa_seed"));
+    if ( ssaSeed == 0 )
+        ssaSeed = (uint32_t) time(NULL);
+    ssaMethod = 0;
+    if ( mxGetField(arconfig, 0, "ssa_method" ) )
+        ssaMethod = (int) mxGetScalar(mxGetField(arconfig, 0, "ssa_method"));
+    ssaTauEps = 0.03;
+    if ( mxGetField(arconfig, 0, "ssa_tau_eps" ) )
+        ssaTauEps = mxGetScalar(mxGetField(arconfig, 0, "ssa_tau_eps"));
+    ssaHybridThreshold = 100;
+    if ( mxGetField(arconfig, 0, "ssa_hybrid_threshold" ) )
+        ssaHybridThreshold = mxGetScalar(mxGetField(arconfig, 0, "ssa_hybrid_threshold"));
     ms = (int) mxGetScalar(mxGetField(arconfig, 0, "useMS"));
     events = (int) mxGetScalar(mxGetField(arconfig, 0, "useEvents"));
     max_eq_steps = (int) mxGetScalar(mxGetField(arconfig, 0, "max_eq_steps"));
@@ -281,11 +545,27 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 #endif
         
 #ifdef HAS_PTHREAD
+    /* stealing only makes sense when the threads actually run concurrently */
+    if ( parallel == 0 ) dynamicScheduling = 0;
+    nworkers = nthreads;
+    if ( dynamicScheduling == 1 ) nworkers = initScheduler(nthreads);
+    if ( parallel == 0 ) persistentThreads = 0;
+    
+    /* worker threads buffer their diagnostics, the main thread prints them */
+    if ( parallel == 1 ) logInit(nworkers);
+    arenaInit();
+    
     /* loop over threads parallel */
-    for(ithreads=0; ithreads<nthreads; ++ithreads){
+    for(ithreads=0; ithreads<nworkers; ++ithreads){
         threadStatus[ithreads] = 0;
         threadAbortSignal[ithreads] = 0;
-        tid = (int) mxGetScalar(mxGetField(arthread, ithreads, "id"));
+    }
+    if ( parallel == 1 ) threadsPending = nworkers;
+    if ( persistentThreads == 1 ) {
+        growPool(nworkers);
+        dispatchPool(nworkers);
+    } else for(ithreads=0; ithreads<nworkers; ++ithreads){
+        tid = threadId(ithreads);
         
         thread_data_x_array[tid].id = tid;
 
@@ -301,31 +581,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     }
     
     /* wait for termination of condition threads, but make sure program is interruptible */
-    #ifdef ALLOW_INTERRUPTS
-    if (parallel==1) {
-        done = 0;
-        while(done == 0) {
-            done = 1;
-            for(ithreads=0; ithreads<nthreads; ++ithreads){
-                if ( threadStatus[ithreads] == 0 ) {
-                    done = 0;
-                }
-            }
-            if (utIsInterruptPending()) {
-                for(ithreads=0; ithreads<nthreads; ++ithreads){
-                    threadAbortSignal[ithreads] = 1;
-                }
-                mexPrintf( "Interrupt detected => Aborting simulation\n" );
-                done = 1;
-            }
-        }
-    }
-    #endif
+    if ( parallel == 1 ) waitThreads(nworkers);
+    logFlush();
     
     /* join condition threads */
-    if(parallel==1){
-        for(ithreads=0; ithreads<nthreads; ++ithreads){
-            tid = (int) mxGetScalar(mxGetField(arthread, ithreads, "id"));
+    if ( ( persistentThreads == 0 ) && ( parallel == 1 ) ) {
+        for(ithreads=0; ithreads<nworkers; ++ithreads){
+            tid = threadId(ithreads);
             
             rc = pthread_join(threads_x[tid], NULL);
             if (rc){
@@ -333,11 +595,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
             }
         }
     }
+    
+    if ( dynamicScheduling == 1 ) freeScheduler();
 #else
     /* loop over threads sequential */
     for(ithreads=0; ithreads<nthreads; ++ithreads){
         tid = (int) mxGetScalar(mxGetField(arthread, ithreads, "id"));
-        thread_calc(tid);
+        calc_tasks(tid);
     }
 #endif    
 
@@ -350,35 +614,607 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 #ifdef HAS_PTHREAD
 void *thread_calc(void *threadarg) {
     struct thread_data_x *my_data = (struct thread_data_x *) threadarg;
-    int id = my_data->id;
-#else
-void thread_calc(int id) {
-#endif
+    if(parallel==1) {logBindThread(my_data->id); bindArena(my_data->id);}
+    calc_tasks(my_data->id);
     
-    int n = (int) mxGetScalar(mxGetField(arthread, id, "n"));
-    int *ms = (int *) mxGetData(mxGetField(arthread, id, "ms"));
-    int *cs = (int *) mxGetData(mxGetField(arthread, id, "cs"));
-    int in;
+    if(parallel==1) {finishThread(); pthread_exit(NULL);}
+    return NULL;
+}
+#endif
+
+/* simulate the conditions assigned to thread id */
+void calc_tasks(int id) {
+    int n, in;
+    int *ms, *cs;
+#ifdef HAS_PTHREAD
+    int im, ic;
+    SensBlock block;
+#endif
     
     /* printf("computing thread #%i\n", id); */
     DEBUGPRINT0( debugMode, 2, "Calling conditions\n" );
+#ifdef HAS_PTHREAD
+    /* Note: workers beyond the threads in arthread (sensitivity blocks) only steal */
+    if ( dynamicScheduling == 1 ) {
+        while ( nextTask(id, &im, &ic, &block) ) {
+            if ( block == NULL )
+                x_calc(im, ic, globalsensi, setSparse, &threadStatus[id], &threadAbortSignal[id], rootFinding, debugMode, sensitivitySubset, NULL);
+            else
+                calc_block(id, block);
+        }
+        return;
+    }
+#endif
+    n = (int) mxGetScalar(mxGetField(arthread, id, "n"));
+    ms = (int *) mxGetData(mxGetField(arthread, id, "ms"));
+    cs = (int *) mxGetData(mxGetField(arthread, id, "cs"));
     for(in=0; in<n; ++in){
         /* printf("computing thread #%i, task %i/%i (m=%i, c=%i)\n", id, in, n, ms[in], cs[in]); */
-        x_calc(ms[in], cs[in], globalsensi, setSparse, &threadStatus[id], &threadAbortSignal[id], rootFinding, debugMode, sensitivitySubset);
+        x_calc(ms[in], cs[in], globalsensi, setSparse, &threadStatus[id], &threadAbortSignal[id], rootFinding, debugMode, sensitivitySubset, NULL);
     }
     /* printf("computing thread #%i(done)\n", id); */
-    
+}
+
 #ifdef HAS_PTHREAD
-    if(parallel==1) {pthread_exit(NULL);}
+/* Set up the task lists of the work stealing scheduler. Must be called before any thread is started.  */
+/* Returns the number of workers to start. This exceeds nthreads when conditions were split into        */
+/* sensitivity blocks; the additional workers start with an empty list and only steal.                  */
+int initScheduler(int nthreads) {
+    int ithreads, tid;
+    int nworkers = nthreads;
+    
+    schedNThreads = nthreads;
+    schedSplit = 0;
+    for(ithreads=0; ithreads<nthreads; ++ithreads){
+        tid = (int) mxGetScalar(mxGetField(arthread, ithreads, "id"));
+        schedMs[tid] = (int *) mxGetData(mxGetField(arthread, tid, "ms"));
+        schedCs[tid] = (int *) mxGetData(mxGetField(arthread, tid, "cs"));
+        schedBlocks[tid] = NULL;
+        schedHead[tid] = 0;
+        schedTail[tid] = (int) mxGetScalar(mxGetField(arthread, tid, "n"));
+    }
+    
+    if ( ( nCores > 1 ) && ( ( ( sensiBlockSize > 0 ) && splitSensitivities(nthreads) ) || splitRuns(nthreads) ) ) {
+        nworkers = ( nCores < NMAXTHREADS ) ? nCores : NMAXTHREADS;
+        if ( nworkers < nthreads ) nworkers = nthreads;
+        for(tid=nthreads; tid<nworkers; ++tid){
+            schedBlocks[tid] = NULL;
+            schedHead[tid] = 0;
+            schedTail[tid] = 0;
+        }
+        schedNThreads = nworkers;
+    }
+    
+    return nworkers;
+}
+
+/* Number of sensitivity blocks condition ic of model im is split into (1 = simulate as a whole) */
+int countSensBlocks(int im, int ic, int maxBlocks) {
+    mxArray *arcondition;
+    int npSensi, nblocks;
+    
+    if ( im >= (int) mxGetNumberOfElements(armodel) ) return 1;
+    arcondition = conditionList(im);
+    if ( ( arcondition == NULL ) || ( ic >= (int) mxGetNumberOfElements(arcondition) ) ) return 1;
+    if ( ( fine == 0 ) && ( (int) mxGetScalar(conditionField(arcondition, im, ic, CF_has_tExp)) == 0 ) ) return 1;
+    
+    if ( sensitivitySubset == 1 )
+        npSensi = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_sensIndices));
+    else
+        npSensi = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_pNum));
+    
+    nblocks = ( npSensi + sensiBlockSize - 1 ) / sensiBlockSize;
+    if ( nblocks > maxBlocks ) nblocks = maxBlocks;
+    
+    return ( nblocks > 1 ) ? nblocks : 1;
+}
+
+/* Replace conditions with many sensitivity parameters by one task per sensitivity block. The blocks of a */
+/* condition stay next to each other in the list of the thread, so that idle threads steal them one by one. */
+/* Returns 1 when at least one condition was split.                                                        */
+int splitSensitivities(int nthreads) {
+    int tid, in, n, k, nb, ib, ip, jp, np, npSensi, first, last, maxBlocks;
+    int *newMs, *newCs;
+    int32_T *sensIndices;
+    SensBlock *newBlocks;
+    SensGroup group;
+    SensBlock block;
+    mxArray *arcondition;
+    
+    /* Blocks need the plain CVODES path: no SSA, rootfinding, multiple shooting or adjoint gradients */
+    if ( ( globalsensi != 1 ) || ( dynamics != 1 ) || ( ssa != 0 ) || ( rootFinding != 0 ) || ( ms != 0 ) || ( adjoint != 0 ) ) return 0;
+    maxBlocks = ( nCores < NMAXTHREADS ) ? nCores : NMAXTHREADS;
+    
+    for(tid=0; tid<nthreads; ++tid){
+        for(in=0; in<schedTail[tid]; ++in){
+            if ( countSensBlocks(schedMs[tid][in], schedCs[tid][in], maxBlocks) > 1 ) schedSplit = 1;
+        }
+    }
+    if ( schedSplit == 0 ) return 0;
+    
+    for(tid=0; tid<nthreads; ++tid){
+        n = 0;
+        for(in=0; in<schedTail[tid]; ++in)
+            n += countSensBlocks(schedMs[tid][in], schedCs[tid][in], maxBlocks);
+        
+        newMs = (int *) malloc(n * sizeof(int));
+        newCs = (int *) malloc(n * sizeof(int));
+        newBlocks = (SensBlock *) malloc(n * sizeof(SensBlock));
+        if ( ( newMs == NULL ) || ( newCs == NULL ) || ( newBlocks == NULL ) ) mexErrMsgTxt("ERROR allocating sensitivity blocks");
+        
+        k = 0;
+        for(in=0; in<schedTail[tid]; ++in){
+            nb = countSensBlocks(schedMs[tid][in], schedCs[tid][in], maxBlocks);
+            if ( nb == 1 ) {
+                newMs[k] = schedMs[tid][in];
+                newCs[k] = schedCs[tid][in];
+                newBlocks[k] = NULL;
+                k++;
+                continue;
+            }
+            
+            group = (SensGroup) malloc(sizeof *group);
+            if ( group == NULL ) mexErrMsgTxt("ERROR allocating sensitivity blocks");
+            group->im = schedMs[tid][in];
+            group->ic = schedCs[tid][in];
+            group->nblocks = nb;
+            group->pending = nb;
+            group->started = 0;
+            group->status = 0;
+            
+            arcondition = conditionList(group->im);
+            np = (int) mxGetNumberOfElements(conditionField(arcondition, group->im, group->ic, CF_pNum));
+            if ( sensitivitySubset == 1 ) {
+                sensIndices = (int32_T *) mxGetData(conditionField(arcondition, group->im, group->ic, CF_sensIndices));
+                npSensi = (int) mxGetNumberOfElements(conditionField(arcondition, group->im, group->ic, CF_sensIndices));
+            } else {
+                sensIndices = NULL;
+                npSensi = np;
+            }
+            
+            for(ib=0; ib<nb; ++ib){
+                first = ( ib * npSensi ) / nb;
+                last = ( ( ib + 1 ) * npSensi ) / nb;
+                
+                block = (SensBlock) malloc(sizeof *block);
+                if ( block == NULL ) mexErrMsgTxt("ERROR allocating sensitivity blocks");
+                block->group = group;
+                block->iblock = ib;
+                block->npBlock = last - first;
+                block->firstRun = 0;
+                block->lastRun = 0;
+                block->status = 0;
+                block->sensIndices = (int32_T *) malloc(block->npBlock * sizeof(int32_T));
+                block->mapping = (int32_T *) malloc(np * sizeof(int32_T));
+                if ( ( block->sensIndices == NULL ) || ( block->mapping == NULL ) ) mexErrMsgTxt("ERROR allocating sensitivity blocks");
+                
+                /* Zeros for parameters without sensitivities are written by the first block only */
+                for(jp=0; jp<np; ++jp) block->mapping[jp] = ( ib == 0 ) ? -1 : -2;
+                for(ip=0; ip<npSensi; ++ip){
+                    jp = ( sensitivitySubset == 1 ) ? sensIndices[ip] : ip;
+                    if ( ( ip >= first ) && ( ip < last ) ) {
+                        block->sensIndices[ip - first] = jp;
+                        block->mapping[jp] = ip - first;
+                    } else {
+                        block->mapping[jp] = -2;
+                    }
+                }
+                
+                newMs[k] = group->im;
+                newCs[k] = group->ic;
+                newBlocks[k] = block;
+                k++;
+            }
+            DEBUGPRINT3( debugMode, 2, "Split condition %d of model %d into %d sensitivity blocks\n", group->ic, group->im, nb );
+        }
+        
+        schedMs[tid] = newMs;
+        schedCs[tid] = newCs;
+        schedBlocks[tid] = newBlocks;
+        schedLength[tid] = n;
+        schedTail[tid] = n;
+    }
+    
+    return 1;
+}
+
+/* Replace every condition of a stochastic simulation by one task per block of runs, so that the runs */
+/* of a single condition are spread over all cores. Returns 1 when at least one condition was split.  */
+int splitRuns(int nthreads) {
+    int tid, in, k, nb, ib, maxBlocks;
+    int *newMs, *newCs;
+    SensBlock *newBlocks;
+    SensGroup group;
+    SensBlock block;
+    
+    if ( ( dynamics != 1 ) || ( ssa == 0 ) || ( nruns < 2 ) ) return 0;
+    maxBlocks = ( nCores < NMAXTHREADS ) ? nCores : NMAXTHREADS;
+    nb = ( nruns < maxBlocks ) ? nruns : maxBlocks;
+    
+    for(tid=0; tid<nthreads; ++tid){
+        if ( schedTail[tid] == 0 ) continue;
+        
+        newMs = (int *) malloc(nb * schedTail[tid] * sizeof(int));
+        newCs = (int *) malloc(nb * schedTail[tid] * sizeof(int));
+        newBlocks = (SensBlock *) malloc(nb * schedTail[tid] * sizeof(SensBlock));
+        if ( ( newMs == NULL ) || ( newCs == NULL ) || ( newBlocks == NULL ) ) mexErrMsgTxt("ERROR allocating blocks of runs");
+        
+        k = 0;
+        for(in=0; in<schedTail[tid]; ++in){
+            group = (SensGroup) malloc(sizeof *group);
+            if ( group == NULL ) mexErrMsgTxt("ERROR allocating blocks of runs");
+            group->im = schedMs[tid][in];
+            group->ic = schedCs[tid][in];
+            group->nblocks = nb;
+            group->pending = nb;
+            group->started = 0;
+            group->status = 0;
+            
+            for(ib=0; ib<nb; ++ib){
+                block = (SensBlock) malloc(sizeof *block);
+                if ( block == NULL ) mexErrMsgTxt("ERROR allocating blocks of runs");
+                block->group = group;
+                block->iblock = ib;
+                block->npBlock = 0;
+                block->sensIndices = NULL;
+                block->mapping = NULL;
+                block->firstRun = ( ib * nruns ) / nb;
+                block->lastRun = ( ( ib + 1 ) * nruns ) / nb;
+                block->status = 0;
+                
+                newMs[k] = group->im;
+                newCs[k] = group->ic;
+                newBlocks[k] = block;
+                k++;
+            }
+        }
+        
+        schedMs[tid] = newMs;
+        schedCs[tid] = newCs;
+        schedBlocks[tid] = newBlocks;
+        schedLength[tid] = k;
+        schedTail[tid] = k;
+        schedSplit = 1;
+    }
+    DEBUGPRINT1( debugMode, 2, "Split the stochastic simulations into %d blocks of runs per condition\n", nb );
+    
+    return schedSplit;
+}
+
+/* Release the task lists and blocks allocated by splitSensitivities and splitRuns */
+void freeScheduler(void) {
+    int tid, in;
+    SensBlock block;
+    
+    if ( schedSplit == 0 ) return;
+    
+    for(tid=0; tid<schedNThreads; ++tid){
+        if ( schedBlocks[tid] == NULL ) continue;
+        
+        for(in=0; in<schedLength[tid]; ++in){
+            block = schedBlocks[tid][in];
+            if ( block == NULL ) continue;
+            
+            /* the first block owns the group */
+            if ( block->iblock == 0 ) free(block->group);
+            free(block->sensIndices);
+            free(block->mapping);
+            free(block);
+        }
+        free(schedMs[tid]);
+        free(schedCs[tid]);
+        free(schedBlocks[tid]);
+        schedBlocks[tid] = NULL;
+    }
+    schedSplit = 0;
+}
+
+/* Fetch the next task for thread id. Returns 0 when no work is left. block is set to NULL */
+/* when the whole condition is to be simulated.                                           */
+int nextTask(int id, int *im, int *ic, SensBlock *block) {
+    int victim, jthreads, left, mostLeft;
+    int found = 0;
+    
+    *block = NULL;
+    
+    /* stop handing out work once the simulation was aborted */
+    if ( threadAbortSignal[id] == 1 ) return 0;
+    
+    pthread_mutex_lock(&schedMutex);
+    if ( schedHead[id] < schedTail[id] ) {
+        /* own list: take from the front */
+        *im = schedMs[id][schedHead[id]];
+        *ic = schedCs[id][schedHead[id]];
+        if ( schedBlocks[id] != NULL ) *block = schedBlocks[id][schedHead[id]];
+        schedHead[id]++;
+        found = 1;
+    } else {
+        /* steal from the back of the thread with the most pending tasks */
+        victim = -1;
+        mostLeft = 0;
+        for(jthreads=0; jthreads<schedNThreads; ++jthreads){
+            left = schedTail[jthreads] - schedHead[jthreads];
+            if ( left > mostLeft ) {
+                mostLeft = left;
+                victim = jthreads;
+            }
+        }
+        if ( victim >= 0 ) {
+            schedTail[victim]--;
+            *im = schedMs[victim][schedTail[victim]];
+            *ic = schedCs[victim][schedTail[victim]];
+            if ( schedBlocks[victim] != NULL ) *block = schedBlocks[victim][schedTail[victim]];
+            found = 1;
+            DEBUGPRINT3( debugMode, 2, "Thread %d took condition %d from thread %d\n", id, *ic, victim );
+        }
+    }
+    pthread_mutex_unlock(&schedMutex);
+    
+    return found;
+}
+
+/* Simulate one sensitivity block. The block which finishes last merges the status of all blocks of */
+/* the condition and evaluates what x_calc skips for blocks: derived variables, observables, timings. */
+void calc_block(int id, SensBlock block) {
+    SensGroup group = block->group;
+    mxArray *arcondition, *src;
+    struct timeval t3, t4, tdiff;
+    double *status, *ticks_start, *ticks_stop, *ticks_stop_data;
+    int isim, last;
+    
+    pthread_mutex_lock(&schedMutex);
+    if ( group->started == 0 ) {
+        gettimeofday(&group->t2, NULL);
+        group->started = 1;
+    }
+    pthread_mutex_unlock(&schedMutex);
+    
+    x_calc(group->im, group->ic, globalsensi, setSparse, &threadStatus[id], &threadAbortSignal[id], rootFinding, debugMode, sensitivitySubset, block);
+    
+    pthread_mutex_lock(&schedMutex);
+    if ( ( group->status == 0 ) && ( block->status != 0 ) ) group->status = block->status;
+    group->pending--;
+    last = ( group->pending == 0 );
+    pthread_mutex_unlock(&schedMutex);
+    
+    if ( !last ) return;
+    
+    arcondition = conditionList(group->im);
+    status = mxGetData(conditionField(arcondition, group->im, group->ic, CF_status));
+    status[0] = group->status;
+    
+    src = conditionField(arcondition, group->im, group->ic, CF_src);
+    if ( src == NULL )
+        isim = group->ic;
+    else
+        isim = (int) (*((double *) mxGetData(src))) - 1;
+    
+    if ( group->status == 0 ) {
+        z_calc(group->im, group->ic, isim, arcondition, globalsensi);
+        gettimeofday(&t3, NULL);
+        evaluateObservations(arcondition, group->im, group->ic, globalsensi, (int) mxGetScalar(conditionField(arcondition, group->im, group->ic, CF_has_tExp)));
+    } else {
+        gettimeofday(&t3, NULL);
+    }
+    gettimeofday(&t4, NULL);
+    
+    ticks_start = mxGetData(conditionField(arcondition, group->im, group->ic, CF_start));
+    ticks_stop = mxGetData(conditionField(arcondition, group->im, group->ic, CF_stop));
+    ticks_stop_data = mxGetData(conditionField(arcondition, group->im, group->ic, CF_stop_data));
+    timersub(&group->t2, &t1, &tdiff);
+    ticks_start[0] = ((double) tdiff.tv_usec) + ((double) tdiff.tv_sec * 1e6);
+    timersub(&t3, &t1, &tdiff);
+    ticks_stop_data[0] = ((double) tdiff.tv_usec) + ((double) tdiff.tv_sec * 1e6);
+    timersub(&t4, &t1, &tdiff);
+    ticks_stop[0] = ((double) tdiff.tv_usec) + ((double) tdiff.tv_sec * 1e6);
+}
+
+/* Thread id of the ithreads-th worker. Workers beyond the threads in arthread are numbered consecutively */
+int threadId(int ithreads) {
+    if ( ithreads < (int) mxGetNumberOfElements(arthread) )
+        return (int) mxGetScalar(mxGetField(arthread, ithreads, "id"));
+    else
+        return ithreads;
+}
+
+/* Body of a persistent worker: sleep until a task list is handed out, process it and report back */
+void *pool_worker(void *threadarg) {
+    struct thread_data_x *my_data = (struct thread_data_x *) threadarg;
+    int id = my_data->id;
+    
+    logBindThread(id);
+    bindArena(id);
+    pthread_mutex_lock(&poolMutex);
+    while ( 1 ) {
+        while ( ( poolJob[id] == 0 ) && ( poolShutdown == 0 ) )
+            pthread_cond_wait(&poolWork, &poolMutex);
+        if ( poolShutdown == 1 ) break;
+        
+        poolJob[id] = 0;
+        pthread_mutex_unlock(&poolMutex);
+        
+        calc_tasks(id);
+        finishThread();
+        
+        pthread_mutex_lock(&poolMutex);
+    }
+    pthread_mutex_unlock(&poolMutex);
+    
     return NULL;
+}
+
+/* Make sure the pool holds workers for the thread ids 0 ... nthreads-1 */
+void growPool(int nthreads) {
+    int rc;
+    
+    while ( poolSize < nthreads ) {
+        poolJob[poolSize] = 0;
+        poolData[poolSize].id = poolSize;
+        rc = pthread_create(&poolThreads[poolSize], NULL, pool_worker, (void *) &poolData[poolSize]);
+        if (rc){
+            mexErrMsgTxt("ERROR at pthread_create");
+        }
+        poolSize++;
+    }
+}
+
+/* Hand the task lists of all workers to the pool */
+void dispatchPool(int nworkers) {
+    int ithreads, tid;
+    
+    pthread_mutex_lock(&poolMutex);
+    for(ithreads=0; ithreads<nworkers; ++ithreads){
+        tid = threadId(ithreads);
+        poolJob[tid] = 1;
+    }
+    pthread_cond_broadcast(&poolWork);
+    pthread_mutex_unlock(&poolMutex);
+}
+
+/* Called by a thread when it has finished its task list */
+void finishThread(void) {
+    pthread_mutex_lock(&threadsMutex);
+    threadsPending--;
+    if ( threadsPending == 0 ) pthread_cond_signal(&threadsDone);
+    pthread_mutex_unlock(&threadsMutex);
+}
+
+/* Sleep until all threads have finished. With ALLOW_INTERRUPTS the wait times out regularly to check */
+/* whether the user pressed CTRL+C, in which case all threads are told to abort. In debug mode the     */
+/* wait also times out to print the diagnostics of the threads while they are running.                */
+void waitThreads(int nthreads) {
+    int poll = ( debugMode > 0 );
+    struct timeval now;
+    struct timespec timeout;
+#ifdef ALLOW_INTERRUPTS
+    int ithreads;
+    int interrupted = 0;
+    
+    poll = 1;
+#endif
+    
+    pthread_mutex_lock(&threadsMutex);
+    while ( threadsPending > 0 ) {
+        if ( poll == 0 ) {
+            pthread_cond_wait(&threadsDone, &threadsMutex);
+            continue;
+        }
+        
+        gettimeofday(&now, NULL);
+        now.tv_usec += INTERRUPT_POLL_USEC;
+        timeout.tv_sec = now.tv_sec + now.tv_usec / 1000000;
+        timeout.tv_nsec = (now.tv_usec % 1000000) * 1000;
+        pthread_cond_timedwait(&threadsDone, &threadsMutex, &timeout);
+        
+        if ( threadsPending > 0 ) {
+            pthread_mutex_unlock(&threadsMutex);
+            logFlush();
+#ifdef ALLOW_INTERRUPTS
+            if ( ( interrupted == 0 ) && utIsInterruptPending() ) {
+                for(ithreads=0; ithreads<nthreads; ++ithreads){
+                    threadAbortSignal[ithreads] = 1;
+                }
+                mexPrintf( "Interrupt detected => Aborting simulation\n" );
+                interrupted = 1;
+            }
+#endif
+            pthread_mutex_lock(&threadsMutex);
+        }
+    }
+    pthread_mutex_unlock(&threadsMutex);
+}
+
+/* Terminate and join all workers */
+void shutdownPool(void) {
+    int ithreads;
+    
+    pthread_mutex_lock(&poolMutex);
+    poolShutdown = 1;
+    pthread_cond_broadcast(&poolWork);
+    pthread_mutex_unlock(&poolMutex);
+    
+    for(ithreads=0; ithreads<poolSize; ++ithreads)
+        pthread_join(poolThreads[ithreads], NULL);
+    
+    poolSize = 0;
+    poolShutdown = 0;
+}
 #endif
+
+/* Release everything that outlives a single call (registered with mexAtExit) */
+void cleanupMex(void) {
+#ifdef HAS_PTHREAD
+    shutdownPool();
+#endif
+    clearSolverCache();
+    freeArenas();
+    free( fieldIndex );
+    fieldIndex = NULL;
+    fieldIndexSize = 0;
+}
+
+/* Resolve the field numbers of all models (main thread, before the simulation starts) */
+void initFieldIndices(void) {
+#define FIELD(name) #name,
+    static const char *modelFieldNames[NMODELFIELDS] = { MODEL_FIELDS };
+    static const char *conditionFieldNames[NCONDITIONFIELDS] = { CONDITION_FIELDS };
+    static const char *dataFieldNames[NDATAFIELDS] = { DATA_FIELDS };
+#undef FIELD
+    int nm, im, j;
+    mxArray *arcondition, *ardata;
+    
+    nm = (int) mxGetNumberOfElements(armodel);
+    if ( nm > fieldIndexSize ) {
+        free( fieldIndex );
+        fieldIndex = (FieldIndex *) malloc( nm * sizeof(FieldIndex) );
+        if ( fieldIndex == NULL ) {
+            fieldIndexSize = 0;
+            mexErrMsgTxt("Failed to allocate field index. Aborting ...");
+        }
+        fieldIndexSize = nm;
+    }
+    
+    for ( im = 0; im < nm; im++ ) {
+        /* All models share one struct array */
+        for ( j = 0; j < NMODELFIELDS; j++ )
+            fieldIndex[im].model[j] = mxGetFieldNumber(armodel, modelFieldNames[j]);
+        fieldIndex[im].conditionList = mxGetFieldNumber(armodel, condition_name);
+        
+        arcondition = conditionList(im);
+        for ( j = 0; j < NCONDITIONFIELDS; j++ )
+            fieldIndex[im].condition[j] = ( arcondition && mxIsStruct(arcondition) ) ? mxGetFieldNumber(arcondition, conditionFieldNames[j]) : -1;
+        
+        ardata = modelField(im, MF_data);
+        for ( j = 0; j < NDATAFIELDS; j++ )
+            fieldIndex[im].data[j] = ( ardata && mxIsStruct(ardata) ) ? mxGetFieldNumber(ardata, dataFieldNames[j]) : -1;
+    }
+}
+
+/* Counterparts of mxGetField which use the field numbers of initFieldIndices (NULL if the field does not exist) */
+mxArray *modelField(int im, int field) {
+    int fnum = fieldIndex[im].model[field];
+    return ( fnum < 0 ) ? NULL : mxGetFieldByNumber(armodel, im, fnum);
+}
+
+mxArray *conditionList(int im) {
+    int fnum = fieldIndex[im].conditionList;
+    return ( fnum < 0 ) ? NULL : mxGetFieldByNumber(armodel, im, fnum);
+}
+
+mxArray *conditionField(mxArray *arcondition, int im, int ic, int field) {
+    int fnum = fieldIndex[im].condition[field];
+    return ( fnum < 0 ) ? NULL : mxGetFieldByNumber(arcondition, ic, fnum);
+}
+
+mxArray *dataField(mxArray *ardata, int im, int id, int field) {
+    int fnum = fieldIndex[im].data[field];
+    return ( fnum < 0 ) ? NULL : mxGetFieldByNumber(ardata, id, fnum);
 }
 
 /* Handle CVODES errors */
-/* CAUTION: this function is NOT thread safe! */
 void errorHandler(int error_code, const char *module, const char *func, char *msg, void *eh_data)
 {
-	mexPrintf( "Error code %d in module %s and function %s:\n%s\n", error_code, module, func, msg );
+	logPrint( "Error code %d in module %s and function %s:\n%s\n", error_code, module, func, msg );
 };
 
 /* Function which can be used for debugging purposes */
@@ -391,7 +1227,7 @@ void waitForKey()
 };
 
 /* calculate dynamics */
-void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *abortSignal, int rootFinding, int debugMode, int sensitivitySubset) {
+void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *abortSignal, int rootFinding, int debugMode, int sensitivitySubset, SensBlock block) {
     mxArray    *x0_override;
     mxArray    *arcondition;
     
@@ -414,6 +1250,7 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
 
     /* Multiple shooting and events */
     int qMS, qEvents;
+    int nTriggers;
     EventData event_data;
 
     void *cvode_mem;
@@ -423,13 +1260,19 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
     double tstart;
     double inf;
     realtype *atolV_tmp;
-    realtype *sxtmp;
     
     /* SSA variables */
     double tfin, tau, meantau;
     double r1, r2;
     double alpha0, sumalpha;
     int iruns, it, itexp, ix, iv;
+    int firstRun, lastRun;
+    RandomStream rng;
+    SSAProblem problem;
+    ReactionQueue queue;
+    double *alpha;
+    SSAWork work;
+    HybridData hybrid;
     double lasttau[] = {1,1,1,1,1,1,1,1,1,1};
     int ilasttau = 0;
     double *texp;
@@ -461,6 +1304,23 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
        
     /* List of indices which map the sensitivities back to the output ones */
     int32_T *sensitivityMapping;
+    int     subset;
+    
+    /* Solver memory kept from a previous simulation */
+    SolverCache cache;
+    int     solverKey[SOLVER_KEY_SIZE];
+    int     solverSignature[SOLVER_SIGNATURE_SIZE];
+    int     reused;
+    
+    /* Gradient by backward integration of the adjoint system */
+    int     qAdjoint;
+    int     ncheck;
+    
+    /* Steady state sensitivities from the implicit function theorem */
+    int     qSteadySensi;
+    
+    /* Only the first sensitivity block stores states, inputs and fluxes */
+    int     storeAll = ( block == NULL ) || ( block->iblock == 0 );
        
     /* Pointer to centralized container for the heap memory */
     SimMemory sim_mem = NULL;
@@ -481,6 +1341,8 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
     int sensi_meth = CV_SIMULTANEOUS; /* CV_SIMULTANEOUS or CV_STAGGERED */
     bool error_corr = TRUE;
     only_sim = 0;
+    qAdjoint = 0;
+    qSteadySensi = 0;
     
     DEBUGPRINT0( debugMode, 4, "Entry point x_calc\n" );
     
@@ -496,7 +1358,7 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
     }
     
     /* get ar.model(im).condition */
-    arcondition = mxGetField(armodel, im, condition_name);
+    arcondition = conditionList(im);
     if(arcondition==NULL){ *threadStatus = 1; return; }
     
     /* check if ic in range */
@@ -504,18 +1366,21 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
     if(nc<=ic) { thr_error("ic > length(ar.model.condition)\n"); *threadStatus = 1; return; }
     
     /* Initialize memory to facilitate easier cleanup */
-    status = mxGetData(mxGetField(arcondition, ic, "status"));
+    if ( block == NULL )
+        status = mxGetData(conditionField(arcondition, im, ic, CF_status));
+    else
+        status = &(block->status);
     sim_mem = simCreate( threadStatus, status );
     
     /* Get double handle to store equilibrium value */
-    teq = mxGetData(mxGetField(arcondition, ic, "tEq"));
+    teq = mxGetData(conditionField(arcondition, im, ic, CF_tEq));
     
-    has_tExp = (int) mxGetScalar(mxGetField(arcondition, ic, "has_tExp"));
+    has_tExp = (int) mxGetScalar(conditionField(arcondition, im, ic, CF_has_tExp));
     if(has_tExp == 0 && fine == 0) { terminate_x_calc( sim_mem, 0 ); DEBUGPRINT0( debugMode, 4, "Terminated simulation since tExp simulation was requested (fine = 0) and there are no experimental points.\n" ); return; }
 
-    ticks_start = mxGetData(mxGetField(arcondition, ic, "start"));
-    ticks_stop = mxGetData(mxGetField(arcondition, ic, "stop"));
-    ticks_stop_data = mxGetData(mxGetField(arcondition, ic, "stop_data"));
+    ticks_start = mxGetData(conditionField(arcondition, im, ic, CF_start));
+    ticks_stop = mxGetData(conditionField(arcondition, im, ic, CF_stop));
+    ticks_stop_data = mxGetData(conditionField(arcondition, im, ic, CF_stop_data));
 
     gettimeofday(&t2, NULL);
     
@@ -529,68 +1394,87 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
             /* but for steady state simulation, isim is redirected using the ar.model(#).condition(#).src field */
             
             /* get MATLAB values */
-            qpositivex = mxGetData(mxGetField(armodel, im, "qPositiveX"));
-            tstart = mxGetScalar(mxGetField(arcondition, ic, "tstart"));
-            neq = (int) mxGetNumberOfElements(mxGetField(armodel, im, "xs"));
-            nnz = (int) mxGetScalar(mxGetField(armodel, im, "nnz"));
+            qpositivex = mxGetData(modelField(im, MF_qPositiveX));
+            tstart = mxGetScalar(conditionField(arcondition, im, ic, CF_tstart));
+            neq = (int) mxGetNumberOfElements(modelField(im, MF_xs));
+            nnz = (int) mxGetScalar(modelField(im, MF_nnz));
+            
+            /* With adjoint gradients the forward pass only integrates the states */
+            qAdjoint = ( adjoint == 1 ) && ( sensi == 1 ) && ( fine == 0 ) && ( block == NULL ) && ( sensitivitySubset == 0 );
+            if ( qAdjoint ) sensi = 0;
+            
+            /* With turboSSSensi the pre-equilibration only integrates the states */
+            qSteadySensi = ( turboSSSensi == 1 ) && ( sensi == 1 ) && ( fine == 1 ) && ( block == NULL ) && ( sensitivitySubset == 0 )
+                        && ( rootFinding == 0 ) && ( strcmp( condition_name, "ss_condition" ) == 0 );
+            if ( qSteadySensi ) sensi = 0;
      
             if(fine == 1){
                 DEBUGPRINT0( debugMode, 4, "Performing fine simulation\n" );
-                ts = mxGetData(mxGetField(arcondition, ic, "tFine"));
-                nout = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tFine"));
+                ts = mxGetData(conditionField(arcondition, im, ic, CF_tFine));
+                nout = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tFine));
                 
-                returnu = mxGetData(mxGetField(arcondition, ic, "uFineSimu"));
-                returnv = mxGetData(mxGetField(arcondition, ic, "vFineSimu"));
-                returnx = mxGetData(mxGetField(arcondition, ic, "xFineSimu"));
-                y_max_scale = mxGetData(mxGetField(arcondition, ic, "y_atol"));
+                returnu = mxGetData(conditionField(arcondition, im, ic, CF_uFineSimu));
+                returnv = mxGetData(conditionField(arcondition, im, ic, CF_vFineSimu));
+                returnx = mxGetData(conditionField(arcondition, im, ic, CF_xFineSimu));
+                y_max_scale = mxGetData(conditionField(arcondition, im, ic, CF_y_atol));
                 if (sensi == 1) {
-                    returnsu = mxGetData(mxGetField(arcondition, ic, "suFineSimu"));
-                    returnsv = mxGetData(mxGetField(arcondition, ic, "svFineSimu"));
-                    returnsx = mxGetData(mxGetField(arcondition, ic, "sxFineSimu"));
+                    returnsu = mxGetData(conditionField(arcondition, im, ic, CF_suFineSimu));
+                    returnsv = mxGetData(conditionField(arcondition, im, ic, CF_svFineSimu));
+                    returnsx = mxGetData(conditionField(arcondition, im, ic, CF_sxFineSimu));
                 }
             }
             else{
                 DEBUGPRINT0( debugMode, 4, "Performing experiment simulation\n" );
-                ts = mxGetData(mxGetField(arcondition, ic, "tExp"));
-                nout = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tExp"));
+                ts = mxGetData(conditionField(arcondition, im, ic, CF_tExp));
+                nout = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tExp));
                 
-                returnu = mxGetData(mxGetField(arcondition, ic, "uExpSimu"));
-                returnv = mxGetData(mxGetField(arcondition, ic, "vExpSimu"));
-                returnx = mxGetData(mxGetField(arcondition, ic, "xExpSimu"));
+                returnu = mxGetData(conditionField(arcondition, im, ic, CF_uExpSimu));
+                returnv = mxGetData(conditionField(arcondition, im, ic, CF_vExpSimu));
+                returnx = mxGetData(conditionField(arcondition, im, ic, CF_xExpSimu));
                 
-                y_max_scale = mxGetData(mxGetField(arcondition, ic, "y_atol"));
+                y_max_scale = mxGetData(conditionField(arcondition, im, ic, CF_y_atol));
                 
                 if (sensi == 1) {
-                    returnsu = mxGetData(mxGetField(arcondition, ic, "suExpSimu"));
-                    returnsv = mxGetData(mxGetField(arcondition, ic, "svExpSimu"));
-                    returnsx = mxGetData(mxGetField(arcondition, ic, "sxExpSimu"));
+                    returnsu = mxGetData(conditionField(arcondition, im, ic, CF_suExpSimu));
+                    returnsv = mxGetData(conditionField(arcondition, im, ic, CF_svExpSimu));
+                    returnsx = mxGetData(conditionField(arcondition, im, ic, CF_sxExpSimu));
                 }
             }
             
-            returndxdt = mxGetData(mxGetField(arcondition, ic, "dxdt"));
+            returndxdt = mxGetData(conditionField(arcondition, im, ic, CF_dxdt));
             if (sensi == 1) {
-                returndfdp0 = mxGetData(mxGetField(arcondition, ic, "ddxdtdp"));
+                returndfdp0 = mxGetData(conditionField(arcondition, im, ic, CF_ddxdtdp));
                 DEBUGPRINT0( debugMode, 4, "Sensitivities enabled\n" );
                 
                 /* Obtain indices which map the computed sensitivities back to the output ones */
-                if ( sensitivitySubset == 1 )
+                if ( block != NULL )
+                {
+                    DEBUGPRINT1( debugMode, 4, "Using sensitivity block %d\n", block->iblock );
+                    sensitivityMapping = block->mapping;
+                }
+                else if ( sensitivitySubset == 1 )
                 {
                     DEBUGPRINT0( debugMode, 4, "Using sensitivity subset\n" );
-                    sensitivityMapping = (int32_T *) mxGetData(mxGetField(arcondition, ic, "backwardIndices"));
+                    sensitivityMapping = (int32_T *) mxGetData(conditionField(arcondition, im, ic, CF_backwardIndices));
                 }                    
             }
+            
+            /* A sensitivity block is simulated like a sensitivity subset */
+            subset = sensitivitySubset || ( block != NULL );
 
             /* Fetch number of inputs, parameters and fluxes */
-            nu = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "uNum"));
-            np = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "pNum"));
-            nv = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "vNum"));
-            if ( mxGetField(arcondition, ic, "splines") )
-                nsplines = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "splines"));
+            nu = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_uNum));
+            np = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_pNum));
+            nv = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_vNum));
+            if ( conditionField(arcondition, im, ic, CF_splines) )
+                nsplines = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_splines));
             else
                 nsplines = 0;      
             
-            if ( sensitivitySubset == 1 )
-                npSensi = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "sensIndices"));
+            if ( block != NULL )
+                npSensi = block->npBlock;
+            else if ( sensitivitySubset == 1 )
+                npSensi = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_sensIndices));
             else
                 npSensi = np;
             
@@ -598,9 +1482,41 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
             ysensi = sensi;
             if (npSensi==0) sensi = 0;
             
+            /* Override which condition to simulate. For normal conditions isim is equal to ic (both are condition indices) */
+            /* For steady state simulations, isim is equal to another condition, since the index which indicates the location in ar.ss_conditions differs from the condition referenced in ar.conditions */
+            src = conditionField(arcondition, im, ic, CF_src);
+            if (src == NULL) {
+                only_sim    = 0;
+                isim        = ic;
+            } else {
+                isrc        = mxGetData(src);
+                isim        = (int) (*isrc) - 1;
+                only_sim    = 1;
+            }
+            
+            /* Reuse the solver of the previous simulation of this condition when the problem structure is unchanged */
+            cache = NULL;
+            if ( ( useSolverCache == 1 ) && !qAdjoint ) {
+                solverKey[0] = ( strcmp( condition_name, "condition" ) != 0 );
+                solverKey[1] = im;
+                solverKey[2] = ic;
+                solverKey[3] = ( block != NULL ) ? block->iblock : -1;
+                solverSignature[0] = neq;
+                solverSignature[1] = npSensi;
+                solverSignature[2] = isim;
+                solverSignature[3] = nnz;
+                solverSignature[4] = setSparse;
+                solverSignature[5] = jacobian;
+                solverSignature[6] = sensirhs;
+                solverSignature[7] = subset;
+                solverSignature[8] = ( debugMode > 0 );
+                cache = fetchSolver( solverKey, solverSignature );
+            }
+            reused = ( cache != NULL ) && ( cache->solverInit == 1 );
+            
             /* Allocate heap memory required for simulation */
             DEBUGPRINT0( debugMode, 4, "Attempting to allocate CVODES memory\n" );
-            if ( allocateSimMemoryCVODES( sim_mem, neq, np, sensi, npSensi ) )
+            if ( allocateSimMemoryCVODES( sim_mem, neq, np, sensi, npSensi, cache ) )
             {
                 /* Generate some local references to avoid having sim_mem-> littered everywhere */
                 x = sim_mem->x;
@@ -617,42 +1533,44 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
             
             /* User data structure */
             DEBUGPRINT0( debugMode, 4, "Initialize CVODES data\n" );
-            initializeDataCVODES( sim_mem, tstart, abortSignal, arcondition, qpositivex, ic, nsplines, sensitivitySubset );
+            initializeDataCVODES( sim_mem, tstart, abortSignal, arcondition, qpositivex, im, ic, nsplines, sensitivitySubset );
+            if ( block != NULL ) {
+                data->sensIndices = block->sensIndices;
+                
+                /* The other blocks run concurrently with the first one and get private output and work buffers */
+                if ( !storeAll && !privateBlockBuffers( sim_mem, arcondition, im, ic, &returnx, &returnu, &returnv, &returnsu, &returndxdt, &returndfdp0, &teq ) )
+                    return;
+            }
             
             /* Initialize event system */
             qEvents = 0;
             if ( events )
             {
-                qEvents = initializeEvents( sim_mem, arcondition, ic, tstart );
+                qEvents = initializeEvents( sim_mem, arcondition, im, ic, tstart );
                 DEBUGPRINT0( debugMode, 4, "Events initialized\n" );
             }
             
-            /* Initialize multiple shooting list */
-            if (ms==1) 
-                qMS = init_list(arcondition, ic, tstart, &(event_data->nMS), &(event_data->tMS), &(event_data->iMS), "qMS", "tMS");
+            /* State dependent events are part of the model */
+            if ( initializeTriggers( sim_mem, im ) < 0 ) {thr_error("Invalid triggerA, triggerB or triggerDirection"); terminate_x_calc( sim_mem, 68 ); return;}
             
-            /* Override which condition to simulate. For normal conditions isim is equal to ic (both are condition indices) */
-            /* For steady state simulations, isim is equal to another condition, since the index which indicates the location in ar.ss_conditions differs from the condition referenced in ar.conditions */
-            src = mxGetField(arcondition, ic, "src");
-            if (src == NULL) {
-                only_sim    = 0;
-                isim        = ic;
-            } else {
-                isrc        = mxGetData(src);
-                isim        = (int) (*isrc) - 1;
-                only_sim    = 1;
-            }
+            /* Preconditioner of the Krylov solvers */
+            if ( ( setSparse >= 2 ) && ( neq > 0 ) && !initializeKrylov( sim_mem, im, isim, nnz ) ) {terminate_x_calc( sim_mem, 1 ); return;}
+            
+            /* Initialize the multiple shooting nodes of this segment */
+            qMS = 0;
+            if (ms==1) 
+                qMS = init_list(conditionField(arcondition, im, ic, CF_qMS), conditionField(arcondition, im, ic, CF_tMS), tstart, &(event_data->nMS), &(event_data->tMS), &(event_data->iMS));
             
             /* Is there a list which states to equilibrate? */
-            if ( mxGetField( arcondition, ic, "ssStates" ) ) {
-                equilibrated = mxGetData(mxGetField(arcondition, ic, "ssStates"));
+            if ( conditionField(arcondition, im, ic, CF_ssStates) ) {
+                equilibrated = mxGetData(conditionField(arcondition, im, ic, CF_ssStates));
             } else {
                 equilibrated = NULL;
             }
 	    DEBUGPRINT0( debugMode, 4, "Apply initial conditions \n" );
             /* Apply ODE initial conditions */
-            x0_override = mxGetField(arcondition, ic, "x0_override");
-            if ( !applyInitialConditionsODE( sim_mem, tstart, im, isim, returndxdt, returndfdp0, x0_override, sensitivitySubset ) )
+            x0_override = conditionField(arcondition, im, ic, CF_x0_override);
+            if ( !applyInitialConditionsODE( sim_mem, tstart, im, isim, returndxdt, returndfdp0, x0_override, subset ) )
 	        return;
 	   
 
@@ -667,17 +1585,25 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                 }
             }            
             
-            /* Check if we are only simulating dxdt */
+            /* Check if we are only simulating dxdt or finding the steady state by Newton */
             if ( rootFinding > 0 )
             {
-                findRoots( sim_mem, arcondition, im, ic, isim, tstart, eq_tol, neq, nu, nv, nout, returnx, returnu, returnv, qpositivex, returnsx, returnsu, returnsv, sensi, ysensi, npSensi, has_tExp );
-                return;
+                if ( findRoots( sim_mem, arcondition, im, ic, isim, tstart, eq_tol, neq, nu, nv, nout, nnz, returnx, returnu, returnv, qpositivex, returnsx, returnsu, returnsv, sensi, ysensi, npSensi, has_tExp ) )
+                    return;
             }
             
             if(neq>0){
                 /* Allocate space for CVODES */
-                DEBUGPRINT0( debugMode, 4, "Allocating memory for CVODES\n" );
-                flag = AR_CVodeInit(cvode_mem, x, tstart, im, isim);
+                if ( reused ) {
+                    DEBUGPRINT0( debugMode, 4, "Reinitializing cached CVODES memory\n" );
+                    flag = CVodeReInit(cvode_mem, RCONST(tstart), x);
+                } else {
+                    DEBUGPRINT0( debugMode, 4, "Allocating memory for CVODES\n" );
+                    flag = AR_CVodeInit(cvode_mem, x, tstart, im, isim);
+                }
+                /* A stop time which was not reached in the previous simulation would still be active on reuse. */
+                /* Fresh and reused solvers get the same stop time, so that both take the same steps.          */
+                if ( ( flag >= 0 ) && ( nout > 0 ) ) flag = CVodeSetStopTime(cvode_mem, RCONST(ts[nout-1]+1.0));
                 if (flag < 0) {terminate_x_calc( sim_mem, 4 ); return;}
                 
                 DEBUGPRINT0( debugMode, 4, "Setting CVODES options\n" );
@@ -728,20 +1654,42 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                 flag = CVodeSetUserData(cvode_mem, data);
                 if (flag < 0) {terminate_x_calc( sim_mem, 6 ); return;}
                 
-                /* Attach linear solver */
-                if(setSparse == 0){
-                    /* Dense solver */
-                    flag = CVDense(cvode_mem, neq);
-                }else{              
-                    /* sparse linear solver KLU */
-                    flag = CVKLU(cvode_mem, neq, nnz);
-                }
-                if (flag < 0) {terminate_x_calc( sim_mem, 7 ); return;}
-                
-                /* Jacobian-related settings */
-                if (jacobian == 1) {
-                    flag = AR_CVDlsSetDenseJacFn(cvode_mem, im, isim, setSparse);
-                    if (flag < 0) {terminate_x_calc( sim_mem, 8 ); return;}
+                /* Attach linear solver (a cached solver keeps its linear solver and the KLU symbolic factorization) */
+                if ( !reused ) {
+                    if(setSparse == 0){
+                        /* Dense solver */
+                        flag = CVDense(cvode_mem, neq);
+                    }else if(setSparse == 1){              
+                        /* sparse linear solver KLU */
+                        flag = CVKLU(cvode_mem, neq, nnz);
+                    }else{
+                        /* Krylov solvers with a banded preconditioner from the sparse Jacobian */
+                        if (setSparse == 2)
+                            flag = CVSpgmr(cvode_mem, PREC_LEFT, 0);
+                        else
+                            flag = CVSpbcg(cvode_mem, PREC_LEFT, 0);
+                        if (flag >= 0) flag = CVSpilsSetPreconditioner(cvode_mem, krylovPrecSetup, krylovPrecSolve);
+                    }
+                    if (flag < 0) {terminate_x_calc( sim_mem, 7 ); return;}
+                    
+                    /* Jacobian-related settings (the Krylov solvers only need products J*v) */
+                    if ((jacobian == 1) && (setSparse < 2)) {
+                        flag = AR_CVDlsSetDenseJacFn(cvode_mem, im, isim, setSparse);
+                        if (flag < 0) {terminate_x_calc( sim_mem, 8 ); return;}
+                    } else if (jacobian == 1) {
+                        flag = AR_CVSpilsSetJacTimesVecFn(cvode_mem, im, isim);
+                        if (flag < 0) {terminate_x_calc( sim_mem, 8 ); return;}
+                    }
+                    
+                    /* Root functions of the state dependent events (kept by a cached solver) */
+                    if ( event_data->nRoots > 0 ) {
+                        flag = AR_CVodeRootInit(cvode_mem, event_data->nRoots, im, isim);
+                        if (flag >= 0) flag = CVodeSetRootDirection(cvode_mem, event_data->rootDirection);
+                        if (flag >= 0) flag = CVodeSetNoInactiveRootWarn(cvode_mem);
+                        if (flag < 0) {terminate_x_calc( sim_mem, 68 ); return;}
+                    }
+                    
+                    if ( cache ) cache->solverInit = 1;
                 }
                 
                 /* custom error weight function */
@@ -757,7 +1705,12 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
             if (sensi == 1) {
                 DEBUGPRINT0( debugMode, 4, "Initializing sensitivities\n" );
                 if(neq>0){
-                    flag = AR_CVodeSensInit1(cvode_mem, npSensi, sensi_meth, sensirhs, sx, im, isim, sensitivitySubset);
+                    if ( reused && ( cache->sensInit == 1 ) ) {
+                        flag = CVodeSensReInit(cvode_mem, sensi_meth, sx);
+                    } else {
+                        flag = AR_CVodeSensInit1(cvode_mem, npSensi, sensi_meth, sensirhs, sx, im, isim, subset);
+                        if ( ( flag >= 0 ) && cache ) cache->sensInit = 1;
+                    }
                      
                     if(flag < 0) {terminate_x_calc( sim_mem, 10 ); return;}
                     
@@ -766,7 +1719,7 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                         if(flag < 0) {terminate_x_calc( sim_mem, 11 ); return;}
                      */
                     
-                    if ( sensitivitySubset == 1 )
+                    if ( subset == 1 )
                         flag = CVodeSetSensParams(cvode_mem, NULL, NULL, NULL);                     /* Parameters only need to be specified when sensis are computed */
                     else
                         flag = CVodeSetSensParams(cvode_mem, data->p, NULL, NULL);
@@ -811,6 +1764,21 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                     flag = CVodeSetSensErrCon(cvode_mem, error_corr);
                     if(flag < 0) {terminate_x_calc( sim_mem, 13 ); return;}
                 }
+            } else if ( reused && ( cache->sensInit == 1 ) ) {
+                /* The cached solver last integrated sensitivities */
+                flag = CVodeSensToggleOff(cvode_mem);
+                if(flag < 0) {terminate_x_calc( sim_mem, 10 ); return;}
+            }
+            
+            /* Store checkpoints of the forward solution for the backward pass */
+            if ( qAdjoint && ( neq > 0 ) ) {
+                if ( qEvents || ( event_data->nRoots > 0 ) ) {thr_error("Adjoint gradients do not support events"); terminate_x_calc( sim_mem, 66 ); return;}
+                for (is=0; is < nout; is++) {
+                    if ( ts[is] == inf ) {thr_error("Adjoint gradients do not support steady state time points"); terminate_x_calc( sim_mem, 66 ); return;}
+                }
+                
+                flag = CVodeAdjInit(cvode_mem, ADJOINT_CHECKPOINT_STEPS, CV_HERMITE);
+                if (flag < 0) {terminate_x_calc( sim_mem, 61 ); return;}
             }
 
             /********************************/
@@ -835,10 +1803,18 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                                     CVodeSetStopTime(cvode_mem, ts[nout-1]+1.0);
                             }
                             
+                            /* A shooting segment ends at its node, do not step past it into the next segment */
+                            if (qMS==1){
+                                while ((event_data->iMS < event_data->nMS) && (event_data->tMS[event_data->iMS] < ts[is]))
+                                    (event_data->iMS)++;
+                                if ((event_data->iMS < event_data->nMS) && !((qEvents==1) && (event_data->i < event_data->n) && (event_data->t[event_data->i] < event_data->tMS[event_data->iMS])))
+                                    CVodeSetStopTime(cvode_mem, RCONST(event_data->tMS[event_data->iMS]));
+                            }
+                            
                             if ( ts[is] == inf ) {
                                 /* Equilibrate the system */
                                 DEBUGPRINT1( debugMode, 4, "Equilibrating the system (t=%g)...\n", data->t );
-                                flag = equilibrate(cvode_mem, data, x, t, equilibrated, returndxdt, teq, neq, im, isim, abortSignal);
+                                flag = equilibrate(cvode_mem, data, x, t, equilibrated, returndxdt, teq, neq, im, isim, abortSignal, sim_mem, sensi_meth);
                                 DEBUGPRINT1( debugMode, 4, "[ OK ] (teq=%g)\n", teq[0] );
                                 CVodeGetCurrentTime( cvode_mem, &(data->t) );
                                 
@@ -854,7 +1830,20 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                                 }
                             } else {
                                 /* Simulate up to the next time point */
-                                flag = CVode(cvode_mem, RCONST(ts[is]), x, &t, CV_NORMAL);
+                                if ( qAdjoint )
+                                    flag = CVodeF(cvode_mem, RCONST(ts[is]), x, &t, CV_NORMAL, &ncheck);
+                                else
+                                    flag = CVode(cvode_mem, RCONST(ts[is]), x, &t, CV_NORMAL);
+                                
+                                /* A trigger fired before ts[is]: apply the event and continue from there */
+                                nTriggers = 0;
+                                while ( flag == CV_ROOT_RETURN ) {
+                                    DEBUGPRINT1( debugMode, 5, "Handling state dependent event at t=%g\n", t );
+                                    if ( ++nTriggers > MAX_TRIGGERS ) {thr_error("Too many state dependent events (chattering)"); terminate_x_calc( sim_mem, 68 ); return;}
+                                    flag = handleTrigger( sim_mem, im, isim, t, sensi_meth );
+                                    if (flag < 0) {thr_error("Failed to reinitialize solver at state dependent event"); terminate_x_calc( sim_mem, 16 ); return;}
+                                    flag = CVode(cvode_mem, RCONST(ts[is]), x, &t, CV_NORMAL);
+                                }
                                 data->t = ts[is];
                             }
                             
@@ -897,15 +1886,15 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                                 if (flag < 0) {terminate_x_calc( sim_mem, 14 ); return;}
                             }
                         }
-                        storeSensitivities( data, im, isim, is, np, nu, nv, neq, nout, x, sx, returnsx, returnsu, returnsv, sensitivitySubset, sensitivityMapping );
+                        storeSensitivities( data, im, isim, is, np, nu, nv, neq, nout, x, sx, returnsx, returnsu, returnsv, subset, sensitivityMapping );
                     }
                 } else {
                     /* Store empty output sensitivities in case of an error */
                     if (sensi == 1) {
                         DEBUGPRINT0( debugMode, 6, "Storing zeroed sensitivities\n" );
                         for(js=0; js < np; js++) {
+                            if ( ( block != NULL ) && ( sensitivityMapping[js] == -2 ) ) continue;
                             if(neq>0) {
-                                sxtmp = NV_DATA_S(sx[js]);
                                 for(ks=0; ks < neq; ks++) {
                                     returnsx[js*neq*nout + ks*nout + is] = 0.0;
                                 }
@@ -929,7 +1918,7 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                     
                     storeSimulation( data, im, isim, is, nu, nv, neq, nout, x, returnx, returnu, returnv, qpositivex );
                     if ( sensi == 1 )
-                        storeSensitivities( data, im, isim, is, np, nu, nv, neq, nout, x, sx, returnsx, returnsu, returnsv, sensitivitySubset, sensitivityMapping );
+                        storeSensitivities( data, im, isim, is, np, nu, nv, neq, nout, x, sx, returnsx, returnsu, returnsv, subset, sensitivityMapping );
                     
                     qEvents = 1;
                     (event_data->i)++;
@@ -939,20 +1928,28 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
             } /* End of simulation loop */
             
             /* Store dfxdx */
-            {
+            if ( storeAll ) {
                 double *dfdx, *dfdp;
                 if( cvode_mem != NULL ) CVodeGetCurrentTime( cvode_mem, &t );
                 DEBUGPRINT1( debugMode, 6, "Storing final dfdx and dfdp at %g\n", t );
-                dfdx = mxGetData(mxGetField(arcondition, ic, "dfdxNum"));
-                dfdp = mxGetData(mxGetField(arcondition, ic, "dfdpNum"));
+                dfdx = mxGetData(conditionField(arcondition, im, ic, CF_dfdxNum));
+                dfdp = mxGetData(conditionField(arcondition, im, ic, CF_dfdpNum));
                 
                 fsv(data, t, x, im, isim);                             /* Updates dvdp, dvdu, dvdx */
                 getdfxdx(im, isim, t, x, dfdx, data);                  /* Updates dvdx and stores dfxdx */
                 dfxdp(data, t, x, dfdp, im, isim);                     /* Stores dfxdp. Needs dvdp, dvdx and dvdu to be up to date */
             }
             
+            /* Sensitivities of the equilibrium, needs dfdx and dfdp of the final time point */
+            if ( qSteadySensi && ( status[0] == 0.0 ) && ( neq > 0 ) ) {
+                DEBUGPRINT0( debugMode, 5, "Computing steady state sensitivities\n" );
+                if ( !steadyStateSensi( sim_mem, arcondition, im, ic, isim, tstart, t, nout ) )
+                    return;
+                sensi = 1;
+            }
+            
             /* Store number of iteration steps */
-            storeIntegrationInfo( sim_mem, arcondition, ic );
+            if ( storeAll ) storeIntegrationInfo( sim_mem, arcondition, im, ic );
             
             /**** end of CVODES ****/
         } else {
@@ -967,27 +1964,34 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
              *     r2 <  1/alpha0 \sum_{i=1}^j     alpha_i(t)
              *     Update the number of reactants and products of the j-th reaction
              * (e) Go to (a) with t = t + tau 
+             *
+             * This direct method is the reference implementation. With ar.config.ssa_method = 1 the runs
+             * use the next reaction method instead (nextReactionRun), which only recomputes the propensities
+             * of the reactions affected by the last event and picks the next one from an indexed heap.
+             * Models with fast reactions, for which the direct method stops at ssa_min_tau, can be simulated
+             * by explicit (2) or implicit (3) tau-leaping (tauLeapingRun) or by the hybrid method (4,
+             * hybridRun), which integrates the fast reactions deterministically.
              */
                         
             /* MATLAB values */
-            double *x0 = mxGetData(mxGetField(arcondition, ic, "x0_ssa"));
-            double *scale_x = mxGetData(mxGetField(arcondition, ic, "scale_x_ssa"));
-            double *scale_v = mxGetData(mxGetField(arcondition, ic, "scale_v_ssa"));
+            double *x0 = mxGetData(conditionField(arcondition, im, ic, CF_x0_ssa));
+            double *scale_x = mxGetData(conditionField(arcondition, im, ic, CF_scale_x_ssa));
+            double *scale_v = mxGetData(conditionField(arcondition, im, ic, CF_scale_v_ssa));
             
-            double *N = mxGetData(mxGetField(armodel, im, "N"));
-            double *tlim = mxGetData(mxGetField(armodel, im, "tLim"));
-            double *tfine = mxGetData(mxGetField(arcondition, ic, "tFine"));
-            double *xssa = mxGetData(mxGetField(arcondition, ic, "xFineSSA"));
-            double *xssa_lb = mxGetData(mxGetField(arcondition, ic, "xFineSSA_lb"));
-            double *xssa_ub = mxGetData(mxGetField(arcondition, ic, "xFineSSA_ub"));
-            int nx = (int) mxGetNumberOfElements(mxGetField(armodel, im, "xs"));
-            int nt = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tFine"));
-            int nv = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "vNum"));
+            double *N = mxGetData(modelField(im, MF_N));
+            double *tlim = mxGetData(modelField(im, MF_tLim));
+            double *tfine = mxGetData(conditionField(arcondition, im, ic, CF_tFine));
+            double *xssa = mxGetData(conditionField(arcondition, im, ic, CF_xFineSSA));
+            double *xssa_lb = mxGetData(conditionField(arcondition, im, ic, CF_xFineSSA_lb));
+            double *xssa_ub = mxGetData(conditionField(arcondition, im, ic, CF_xFineSSA_ub));
+            int nx = (int) mxGetNumberOfElements(modelField(im, MF_xs));
+            int nt = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tFine));
+            int nv = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_vNum));
             
             if(has_tExp==1) {
-                texp = mxGetData(mxGetField(arcondition, ic, "tExp"));
-                ntexp = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tExp"));
-                xssaexp = mxGetData(mxGetField(arcondition, ic, "xExpSSA"));
+                texp = mxGetData(conditionField(arcondition, im, ic, CF_tExp));
+                ntexp = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tExp));
+                xssaexp = mxGetData(conditionField(arcondition, im, ic, CF_xExpSSA));
             }
             
             /* Allocate state memory and user data memory */
@@ -1000,13 +2004,81 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                 x_ub = sim_mem->x_ub;
             } else return;
             
-            data->abort = abortSignal;
-            data->u = mxGetData(mxGetField(arcondition, ic, "uNum"));
-            data->p = mxGetData(mxGetField(arcondition, ic, "pNum"));
-            data->v = mxGetData(mxGetField(arcondition, ic, "vNum"));            
+            if ( !initializeDataSSA( sim_mem, abortSignal, arcondition, im, ic, block != NULL ) )
+                return;
+            
+            problem.im = im;
+            problem.ic = ic;
+            problem.nx = nx;
+            problem.nv = nv;
+            problem.nt = nt;
+            problem.ntexp = ( has_tExp == 1 ) ? ntexp : 0;
+            problem.tstart = tlim[0];
+            problem.x0 = x0;
+            problem.scale_x = scale_x;
+            problem.scale_v = scale_v;
+            problem.N = N;
+            problem.tfine = tfine;
+            problem.texp = ( has_tExp == 1 ) ? texp : NULL;
+            problem.xssa = xssa;
+            problem.xssa_lb = xssa_lb;
+            problem.xssa_ub = xssa_ub;
+            problem.xssaexp = ( has_tExp == 1 ) ? xssaexp : NULL;
+            
+            /* Next reaction method: dependency graph from arSSA and the memory of the reaction queue */
+            if ( ssaMethod == 1 ) {
+                if ( ( modelField(im, MF_ssaDepPtr) == NULL ) || ( modelField(im, MF_ssaDepIdx) == NULL ) || ( modelField(im, MF_ssaInputDep) == NULL )
+                    || ( (int) mxGetNumberOfElements(modelField(im, MF_ssaDepPtr)) != nv + 1 ) ) {
+                    thr_error("Reaction dependency graph missing, call arSSA for the next reaction method");
+                    terminate_x_calc( sim_mem, 69 ); return;
+                }
+                problem.depPtr = (int32_T *) mxGetData(modelField(im, MF_ssaDepPtr));
+                problem.depIdx = (int32_T *) mxGetData(modelField(im, MF_ssaDepIdx));
+                problem.inputDep = (int) mxGetScalar(modelField(im, MF_ssaInputDep));
+                
+                alpha = (double *) arenaAlloc(sim_mem->arena, 2 * nv * sizeof(double));
+                queue.heap = (int *) arenaAlloc(sim_mem->arena, 2 * nv * sizeof(int));
+                if ( ( alpha == NULL ) || ( queue.heap == NULL ) ) { terminate_x_calc( sim_mem, 1 ); return; }
+                queue.time = alpha + nv;
+                queue.pos = queue.heap + nv;
+            }
+            
+            /* Tau-leaping and hybrid method */
+            if ( ssaMethod >= 2 ) {
+                if ( !initializeSSAWork( sim_mem, &problem, &work ) )
+                    return;
+            }
+            if ( ssaMethod == 4 ) {
+                hybrid = (HybridData) arenaAlloc(sim_mem->arena, sizeof *hybrid);
+                if ( hybrid == NULL ) { terminate_x_calc( sim_mem, 1 ); return; }
+                hybrid->sim_mem = sim_mem;
+                hybrid->problem = &problem;
+                hybrid->work = &work;
+                if ( !initializeHybrid( sim_mem, hybrid ) )
+                    return;
+            }
+            
+            /* A block only simulates its share of the runs */
+            firstRun = ( block != NULL ) ? block->firstRun : 0;
+            lastRun = ( block != NULL ) ? block->lastRun : nruns;
             
             /* nruns loop */
-            for (iruns=0; iruns<nruns; iruns++) {
+            for (iruns=firstRun; iruns<lastRun; iruns++) {
+                /* every run draws from its own stream, independent of the thread which simulates it */
+                rngInit( &rng, ssaSeed, im, ic, iruns );
+                
+                if ( ssaMethod > 0 ) {
+                    if ( ssaMethod == 1 )
+                        nextReactionRun( sim_mem, &problem, &queue, alpha, &rng, iruns );
+                    else if ( ssaMethod == 4 )
+                        hybridRun( sim_mem, hybrid, &rng, iruns );
+                    else
+                        tauLeapingRun( sim_mem, &problem, &work, &rng, iruns, ssaMethod == 3 );
+                    if ( *abortSignal == 1 )
+                        break;
+                    continue;
+                }
+                
                 it = 0;
                 itexp = 0;
                 t = tlim[0];
@@ -1026,11 +2098,8 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                 while((t<=tfin) & (it<nt)){
                     
                     /* (a) */
-                    r1 = ((double)rand()/(double)RAND_MAX);
-                    r2 = ((double)rand()/(double)RAND_MAX);
-                    
-                    if(r1==1){r1 = 0.5;}
-                    if(r2==1){r2 = 0.5;}
+                    r1 = rngUniform( &rng );
+                    r2 = rngUniform( &rng );
                     
                     /* (b modified) */
                     fvSSA(data, t, x, im, ic);
@@ -1048,40 +2117,20 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                     
                     /* printf("r1=%g, r2=%g, alpha0=%g, tau=%g\n", r1, r2, alpha0, tau); */
                     if(tau<=0) {
-                        printf("\nmodel #%i, condition #%i, run #%i at t=%f: STOP (tau=%g < 0)\n", im+1, ic+1, iruns+1, t, tau);
+                        logPrint("\nmodel #%i, condition #%i, run #%i at t=%f: STOP (tau=%g < 0)\n", im+1, ic+1, iruns+1, t, tau);
                         break;
                     }
                     
                     /* (d) */
                     iv = 0;
                     sumalpha = alpha0*data->v[0];
-                    while(r2 >= sumalpha){
+                    while((r2 >= sumalpha) && (iv < nv-1)){
                         iv = iv + 1;
                         sumalpha = sumalpha + (alpha0*data->v[iv]);
                     }
                     
                     /* update values before reaction occurs */
-                    while((tfine[it]<(t+tau)) & (it<nt)){
-                        for (ix=0; ix<nx; ix++) {
-                            xssa[it+nt*ix+nt*nx*iruns] = Ith(x, ix+1);
-                            xssa_lb[it+nt*ix+nt*nx*iruns] = Ith(x_lb, ix+1);
-                            xssa_ub[it+nt*ix+nt*nx*iruns] = Ith(x_ub, ix+1);
-                        }
-                        it += 1;
-                        
-                        for (ix=0; ix<nx; ix++) {
-                            Ith(x_lb, ix+1) = Ith(x, ix+1);
-                            Ith(x_ub, ix+1) = Ith(x, ix+1);
-                        }
-                    }
-                    if((has_tExp==1) & (ntexp>0)) {
-                        while((itexp<ntexp) & (texp[itexp]<(t+tau))){
-                            for (ix=0; ix<nx; ix++) {
-                                xssaexp[itexp+ntexp*ix+ntexp*nx*iruns] = Ith(x, ix+1);
-                            }
-                            itexp += 1;
-                        }
-                    }
+                    storeSSAOutputs( sim_mem, &problem, iruns, t+tau, &it, &itexp );
                     
                     /* i-th reaction occurs */
                     for (ix=0; ix<nx; ix++) {
@@ -1096,7 +2145,7 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
                     meantau /= 10;
                     
                     if(meantau < mintau) {
-                        printf("\nmodel #%i, condition #%i, run #%i at t=%f: STOP (mean(tau)=%g < %g)\n", im+1, ic+1, iruns+1, t, meantau, mintau);
+                        logPrint("\nmodel #%i, condition #%i, run #%i at t=%f: STOP (mean(tau)=%g < %g)\n", im+1, ic+1, iruns+1, t, meantau, mintau);
                         break;
                     }
                     
@@ -1116,6 +2165,12 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
         /* call z_calc */
         DEBUGPRINT0( debugMode, 5, "Calling z-calc\n" );
 
+        /* Sensitivity blocks leave derived variables, observables and timings to calc_block */
+        if ( block != NULL ) {
+            terminate_x_calc( sim_mem, *status );
+            return;
+        }
+        
         z_calc(im, ic, isim, arcondition, sensi);
     }
 
@@ -1126,6 +2181,13 @@ void x_calc(int im, int ic, int sensi, int setSparse, int *threadStatus, int *ab
     DEBUGPRINT0( debugMode, 5, "Evaluating observations\n" );
     evaluateObservations(arcondition, im, ic, ysensi, has_tExp);
     
+    /* Backward pass for the chi2 gradient */
+    if ( qAdjoint && ( *status == 0.0 ) ) {
+        DEBUGPRINT0( debugMode, 5, "Computing adjoint gradient\n" );
+        if ( !adjointGradient( sim_mem, arcondition, im, ic, isim, tstart, ts, nout ) )
+            return;
+    }
+    
     gettimeofday(&t4, NULL);
     timersub(&t2, &t1, &tdiff);
     ticks_start[0] = ((double) tdiff.tv_usec) + ((double) tdiff.tv_sec * 1e6);
@@ -1192,6 +2254,7 @@ void storeSensitivities( UserData data, int im, int isim, int is, int np, int nu
             subCopyNVMatrixToDouble( sx, returnsx, np, neq, nout, is, sensitivityMapping );
             for(jss=0; jss < np; jss++) {
                 js = sensitivityMapping[jss];                                   
+                if (js == -2) continue;
                 if (js < 0) {
                     for(ks=0; ks < nv; ks++) returnsv[(jss*nv+ks)*nout + is] = 0.0;
                 } else {
@@ -1216,25 +2279,36 @@ void storeSensitivities( UserData data, int im, int isim, int is, int np, int nu
 /* Two rootfinding procedures have been implemented */
 /* The first is to simply apply the initial condition, store intermediate arrays and terminate immediately. In this case, the rootfinding is handled on the MATLAB side */
 /* The second case is to do rootfinding within C++ (rootFinding = 2) */
-void findRoots( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double eq_tol, int neq, int nu, int nv, int nout, double* returnx, double* returnu, double* returnv, double* qpositivex, double* returnsx, double* returnsu, double* returnsv, int sensi, int ysensi, int npSensi, int has_tExp )
+/* Returns 0 when Newton did not converge; the condition is then simulated by time integration instead */
+int findRoots( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double eq_tol, int neq, int nu, int nv, int nout, int nnz, double* returnx, double* returnu, double* returnv, double* qpositivex, double* returnsx, double* returnsu, double* returnsv, int sensi, int ysensi, int npSensi, int has_tExp )
 {                
     double tEq = tstart;
     UserData data = sim_mem->data;
+    double *x0;
+    int flag;
 
     /* No equations. Terminate now. */
-    if ( neq == 0 ) { terminate_x_calc( sim_mem, 0 ); return; };
+    if ( neq == 0 ) { terminate_x_calc( sim_mem, 0 ); return 1; };
 
     DEBUGPRINT1( debugMode, 4, "Rootfinding mode at t=%g\n", tEq );
 
     if ( rootFinding == 2 )
     {
-        #ifdef ROOT_FINDING
-            solveSS( debugMode, arcondition, im, ic, isim, tEq, sim_mem->x, data, eq_tol );
-            DEBUGPRINT0( debugMode, 4, "Root finding terminated\n" );
-        #else
-            DEBUGPRINT0( debugMode, 4, "Mex file was compiled without rootfinding ...\n" );
-            terminate_x_calc( sim_mem, 0 ); return;
-        #endif
+        /* Keep the initial condition, in case Newton does not converge */
+        x0 = (double *) arenaAlloc( sim_mem->arena, sizeof(double) * neq );
+        if ( x0 == NULL ) { terminate_x_calc( sim_mem, 1 ); return 1; }
+        memcpy( x0, N_VGetArrayPointer(sim_mem->x), sizeof(double) * neq );
+        flag = solveSS( debugMode, im, isim, tEq, sim_mem->x, data, eq_tol, setSparse, nnz );
+        if ( flag == -2 ) { terminate_x_calc( sim_mem, 1 ); return 1; }
+        if ( flag != 0 )
+        {
+            /* Fall back to time integration from the initial condition */
+            DEBUGPRINT0( debugMode, 4, "Rootfinding did not converge, integrating instead\n" );
+            memcpy( N_VGetArrayPointer(sim_mem->x), x0, sizeof(double) * neq );
+            return 0;
+        }
+        fx( tEq, sim_mem->x, mxGetData(conditionField(arcondition, im, ic, CF_dxdt)), data, im, isim );
+        DEBUGPRINT0( debugMode, 4, "Root finding terminated\n" );
     }
 
     /* Copy states and state sensitivities */
@@ -1259,8 +2333,8 @@ void findRoots( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isi
 
     {
         double *dfdx, *dfdp;
-        dfdx = mxGetData(mxGetField(arcondition, ic, "dfdxNum"));
-        dfdp = mxGetData(mxGetField(arcondition, ic, "dfdpNum"));
+        dfdx = mxGetData(conditionField(arcondition, im, ic, CF_dfdxNum));
+        dfdp = mxGetData(conditionField(arcondition, im, ic, CF_dfdpNum));
         fsv(data, tEq, sim_mem->x, im, isim);                  /* Updates dvdp, dvdu, dvdx */
         getdfxdx(im, isim, tEq, sim_mem->x, dfdx, data);       /* Updates dvdx and stores dfxdx */
         dfxdp(data, tEq, sim_mem->x, dfdp, im, isim);          /* Stores dfxdp. Needs dvdp, dvdx and dvdu to be up to date */                
@@ -1270,31 +2344,43 @@ void findRoots( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isi
     evaluateObservations(arcondition, im, ic, ysensi, has_tExp);
     DEBUGPRINT0( debugMode, 4, "Terminating ...\n" );
     terminate_x_calc( sim_mem, 0 );
+    return 1;
 }
 
 /* Store some information regarding the integration */
-void storeIntegrationInfo( SimMemory sim_mem, mxArray *arcondition, int ic )
+void storeIntegrationInfo( SimMemory sim_mem, mxArray *arcondition, int im, int ic )
 {
-    mxArray *stepField;
+    mxArray *stepField, *allocField;
     int64_T* stepData;
     long int nsteps;
+    ArenaStats stats;
     
     if ( sim_mem && ( sim_mem->cvode_mem ) )
        CVodeGetNumSteps( sim_mem->cvode_mem, &nsteps );
     else
         nsteps = -1;
             
-    stepField = mxGetField( arcondition, ic, "stepsTaken" );
+    stepField = conditionField(arcondition, im, ic, CF_stepsTaken);
     if ( stepField )
     {
         stepData = (int64_T*)mxGetData( stepField );
         stepData[0] = (int64_T) nsteps;
     }
+    
+    /* Allocations of this simulation: [arena allocations, of which needed malloc, bytes] */
+    allocField = conditionField( arcondition, im, ic, CF_allocStats );
+    if ( allocField && sim_mem && ( mxGetNumberOfElements( allocField ) >= 3 ) )
+    {
+        arenaStats( sim_mem->arena, &stats );
+        stepData = (int64_T*)mxGetData( allocField );
+        stepData[0] = (int64_T) stats.allocations;
+        stepData[1] = (int64_T) stats.systemAllocations;
+        stepData[2] = (int64_T) stats.bytes;
+    }
 }     
 
-int safeGetToggle( mxArray *data, int idx, const char *fieldName )
+int safeGetToggle( mxArray *field )
 {
-    mxArray *field = mxGetField(data, idx, fieldName);
     if ( !field || ( mxIsEmpty(field) ) ) {
         return 0;
 	} else {
@@ -1310,16 +2396,16 @@ void evaluateObservations( mxArray *arcondition, int im, int ic, int sensi, int
     int     id, nd, ids;
    
     DEBUGPRINT1( debugMode, 4, "Evaluating observations for condition %d\n", ic );
-    ardata = mxGetField(armodel, im, "data");
+    ardata = modelField(im, MF_data);
 	if(ardata!=NULL){
-        dLink = mxGetField(arcondition, ic, "dLink");
+        dLink = conditionField(arcondition, im, ic, CF_dLink);
         dLinkints = mxGetData(dLink);
         nd = (int) mxGetNumberOfElements(dLink);
         /* loop over data */
         for(ids=0; ids<nd; ++ids){
             id = ((int) dLinkints[ids]) - 1;
             DEBUGPRINT2( debugMode, 4, "Evaluating data with idx %d for condition %d\n", id, ic );            
-            has_tExp = safeGetToggle(ardata, id, "has_tExp");
+            has_tExp = safeGetToggle(dataField(ardata, im, id, DF_has_tExp));
                         
             if((has_tExp == 1) | (fine == 1)) {
                 y_calc(im, id, ardata, arcondition, sensi);
@@ -1329,6 +2415,274 @@ void evaluateObservations( mxArray *arcondition, int im, int ic, int sensi, int
     DEBUGPRINT1( debugMode, 4, "Finished evaluating observations for condition %d\n", ic );
 }
 
+/* Gradient of the chi2 of the data of a condition by backward integration of the adjoint system    */
+/* along the checkpoints which CVodeF stored during the forward pass. Each data point contributes a  */
+/* jump w * dy/dx to the adjoint states at its time point, with w = dchi2/dy. The gradient w.r.t.     */
+/* the condition parameters (via the states) is stored in condition.chi2Grad, the explicit part      */
+/* w.r.t. the data parameters (via inputs, derived variables and observation functions) in           */
+/* data.chi2Grad. Assumes that errors are not fitted (ystd does not depend on the parameters).       */
+int adjointGradient( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double *ts, int nout )
+{
+    UserData data = sim_mem->data;
+    void     *cvode_mem = sim_mem->cvode_mem;
+    int      neq = sim_mem->neq;
+    int      np = sim_mem->np;
+    mxArray  *ardata;
+    mxArray  *field;
+    double   *dLink, *condGrad, *dataGrad;
+    double   *seeds, *lambda0, *dydx, *xbuf, *zbuf, *ubuf, *sxzero, *szbuf, *sybuf;
+    double   *t, *tlink, *y, *yexp, *yexpstd, *ystdsimu, *qfit, *qlogy, *pd, *pc;
+    double   *u, *x, *z, *dzdx, *xB_tmp, *qB_tmp;
+    double   ystd, w, tB, tout, tret;
+    int      nd, ids, id, nt, it, ntlink, itlink, ny, iy, npd, ip, nu, nz, is, ix, k, which, flag;
+    
+    field = conditionField(arcondition, im, ic, CF_chi2Grad);
+    if ( ( field == NULL ) || ( (int) mxGetNumberOfElements(field) != np ) ) {
+        thr_error("Adjoint gradients require condition.chi2Grad");
+        terminate_x_calc( sim_mem, 66 ); return 0;
+    }
+    condGrad = mxGetData(field);
+    for (ip=0; ip < np; ip++) condGrad[ip] = 0.0;
+    
+    pc = mxGetData(conditionField(arcondition, im, ic, CF_pNum));
+    nu = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_uNum));
+    u = mxGetData(conditionField(arcondition, im, ic, CF_uExpSimu));
+    x = mxGetData(conditionField(arcondition, im, ic, CF_xExpSimu));
+    z = mxGetData(conditionField(arcondition, im, ic, CF_zExpSimu));
+    dzdx = mxGetData(conditionField(arcondition, im, ic, CF_dzdx));
+    ntlink = nout;
+    nz = ( ntlink > 0 ) ? (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_zExpSimu)) / ntlink : 0;
+    
+    /* The explicit parts are evaluated with the sensitivity functions at zero state sensitivities */
+    data->su = mxGetData(conditionField(arcondition, im, ic, CF_suNum));
+    data->sv = mxGetData(conditionField(arcondition, im, ic, CF_svNum));
+    
+    seeds = (double *) arenaAlloc(sim_mem->arena, neq * nout * sizeof(double));
+    lambda0 = (double *) arenaAlloc(sim_mem->arena, neq * sizeof(double));
+    xbuf = (double *) arenaAlloc(sim_mem->arena, neq * sizeof(double));
+    zbuf = (double *) arenaAlloc(sim_mem->arena, nz * sizeof(double));
+    ubuf = (double *) arenaAlloc(sim_mem->arena, nu * sizeof(double));
+    sxzero = (double *) arenaAlloc(sim_mem->arena, neq * np * sizeof(double));
+    szbuf = (double *) arenaAlloc(sim_mem->arena, nz * np * sizeof(double));
+    if ( !seeds || !lambda0 || !xbuf || !zbuf || !ubuf || !sxzero || !szbuf ) { terminate_x_calc( sim_mem, 1 ); return 0; }
+    for (k=0; k < neq * nout; k++) seeds[k] = 0.0;
+    for (k=0; k < neq * np; k++) sxzero[k] = 0.0;
+    for (k=0; k < neq; k++) lambda0[k] = 0.0;
+    
+    /* Derivatives of the chi2 w.r.t. the states at the time points and explicit data parameter part */
+    ardata = modelField(im, MF_data);
+    if ( ardata != NULL ) {
+        dLink = mxGetData(conditionField(arcondition, im, ic, CF_dLink));
+        nd = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_dLink));
+        for (ids=0; ids < nd; ids++) {
+            id = ((int) dLink[ids]) - 1;
+            field = dataField(ardata, im, id, DF_chi2Grad);
+            npd = (int) mxGetNumberOfElements(dataField(ardata, im, id, DF_pNum));
+            if ( ( field == NULL ) || ( (int) mxGetNumberOfElements(field) != npd ) ) {
+                thr_error("Adjoint gradients require data.chi2Grad");
+                terminate_x_calc( sim_mem, 66 ); return 0;
+            }
+            dataGrad = mxGetData(field);
+            for (ip=0; ip < npd; ip++) dataGrad[ip] = 0.0;
+            if ( safeGetToggle(dataField(ardata, im, id, DF_has_yExp)) != 1 ) continue;
+            
+            ny = (int) mxGetNumberOfElements(dataField(ardata, im, id, DF_y));
+            nt = (int) mxGetNumberOfElements(dataField(ardata, im, id, DF_tExp));
+            t = mxGetData(dataField(ardata, im, id, DF_tExp));
+            tlink = mxGetData(dataField(ardata, im, id, DF_tLinkExp));
+            y = mxGetData(dataField(ardata, im, id, DF_yExpSimu));
+            yexp = mxGetData(dataField(ardata, im, id, DF_yExp));
+            yexpstd = mxGetData(dataField(ardata, im, id, DF_yExpStd));
+            ystdsimu = mxGetData(dataField(ardata, im, id, DF_ystdExpSimu));
+            qfit = mxGetData(dataField(ardata, im, id, DF_qFit));
+            qlogy = mxGetData(dataField(ardata, im, id, DF_logfitting));
+            pd = mxGetData(dataField(ardata, im, id, DF_pNum));
+            
+            dydx = (double *) arenaAlloc(sim_mem->arena, ny * neq * sizeof(double));
+            sybuf = (double *) arenaAlloc(sim_mem->arena, ny * npd * sizeof(double));
+            if ( !dydx || !sybuf ) { terminate_x_calc( sim_mem, 1 ); return 0; }
+            
+            for (it=0; it < nt; it++) {
+                itlink = (int) tlink[it] - 1;
+                for (k=0; k < ny * neq; k++) dydx[k] = 0.0;
+                fy_scale(t[it], 1, 0, ntlink, itlink, ny, neq, nz, 0, dydx, pd, u, x, z, dzdx, im, id);
+                
+                fu(data, t[it], im, isim);
+                fsu(data, t[it], im, isim);
+                for (k=0; k < neq; k++) xbuf[k] = x[itlink + ntlink*k];
+                for (k=0; k < nz; k++) zbuf[k] = z[itlink + ntlink*k];
+                for (k=0; k < nu; k++) ubuf[k] = u[itlink + ntlink*k];
+                for (k=0; k < nz * np; k++) szbuf[k] = 0.0;
+                for (k=0; k < ny * npd; k++) sybuf[k] = 0.0;
+                fsz(t[it], 1, 0, np, szbuf, pc, ubuf, xbuf, zbuf, data->su, sxzero, im, isim);
+                fsy(t[it], 1, 0, 1, 0, sybuf, pd, ubuf, xbuf, zbuf, data->su, sxzero, szbuf, im, id);
+                
+                for (iy=0; iy < ny; iy++) {
+                    if ( qfit[iy] != 1.0 ) continue;
+                    if ( mxIsNaN(yexp[it + nt*iy]) || mxIsInf(yexp[it + nt*iy]) ) continue;
+                    
+                    /* Standard deviation as selected by arCalcRes */
+                    ystd = yexpstd[it + nt*iy];
+                    if ( ( fiterrors == 0 ) && mxIsNaN(ystd) ) ystd = ystdsimu[it + nt*iy];
+                    
+                    /* dchi2/dy, the observation functions provide the derivatives of the non-log observable */
+                    w = -2.0 * ( yexp[it + nt*iy] - y[it + nt*iy] ) / ( ystd * ystd );
+                    if ( qlogy[iy] > 0.5 ) w = w / pow(10.0, y[it + nt*iy]) / log(10.0);
+                    if ( mxIsNaN(w) || mxIsInf(w) ) continue;
+                    
+                    for (ix=0; ix < neq; ix++) seeds[ix + neq*itlink] += w * dydx[iy + ny*ix];
+                    for (ip=0; ip < npd; ip++) dataGrad[ip] += w * sybuf[iy + ny*ip];
+                }
+            }
+        }
+    }
+    
+    /* Integrate the adjoint system backwards, adding the jumps at the time points */
+    if ( ( neq > 0 ) && ( np > 0 ) ) {
+        if ( ( nout > 0 ) && ( ts[nout-1] > tstart ) ) {
+            tB = ts[nout-1];
+            
+            flag = CVodeCreateB(cvode_mem, CV_BDF, CV_NEWTON, &which);
+            if (flag < 0) {terminate_x_calc( sim_mem, 62 ); return 0;}
+            
+            sim_mem->xB = N_VNew_Serial(neq);
+            sim_mem->qB = N_VNew_Serial(np);
+            if ( ( sim_mem->xB == NULL ) || ( sim_mem->qB == NULL ) ) {terminate_x_calc( sim_mem, 1 ); return 0;}
+            xB_tmp = NV_DATA_S(sim_mem->xB);
+            qB_tmp = NV_DATA_S(sim_mem->qB);
+            for (k=0; k < neq; k++) xB_tmp[k] = seeds[k + neq*(nout-1)];
+            for (ip=0; ip < np; ip++) qB_tmp[ip] = 0.0;
+            
+            flag = AR_CVodeInitB(cvode_mem, which, sim_mem->xB, tB, im, isim);
+            if (flag < 0) {terminate_x_calc( sim_mem, 63 ); return 0;}
+            flag = CVodeSStolerancesB(cvode_mem, which, RCONST(cvodes_rtol), RCONST(cvodes_atol));
+            if (flag < 0) {terminate_x_calc( sim_mem, 5 ); return 0;}
+            flag = CVodeSetUserDataB(cvode_mem, which, data);
+            if (flag < 0) {terminate_x_calc( sim_mem, 6 ); return 0;}
+            flag = CVodeSetMaxNumStepsB(cvode_mem, which, cvodes_maxsteps);
+            if (flag < 0) {terminate_x_calc( sim_mem, 15 ); return 0;}
+            flag = CVDenseB(cvode_mem, which, neq);
+            if (flag < 0) {terminate_x_calc( sim_mem, 7 ); return 0;}
+            if (jacobian == 1) {
+                flag = AR_CVDlsSetDenseJacFnB(cvode_mem, which, im, isim);
+                if (flag < 0) {terminate_x_calc( sim_mem, 8 ); return 0;}
+            }
+            flag = AR_CVodeQuadInitB(cvode_mem, which, sim_mem->qB, im, isim);
+            if (flag < 0) {terminate_x_calc( sim_mem, 64 ); return 0;}
+            flag = CVodeQuadSStolerancesB(cvode_mem, which, RCONST(cvodes_rtol), RCONST(cvodes_atol));
+            if (flag < 0) {terminate_x_calc( sim_mem, 64 ); return 0;}
+            flag = CVodeSetQuadErrConB(cvode_mem, which, TRUE);
+            if (flag < 0) {terminate_x_calc( sim_mem, 64 ); return 0;}
+            
+            for (is=nout-2; is >= -1; is--) {
+                /* Time points at tstart contribute to the adjoint at the initial condition */
+                tout = ( ( is >= 0 ) && ( ts[is] > tstart ) ) ? ts[is] : tstart;
+                if ( tout < tB ) {
+                    flag = CVodeB(cvode_mem, RCONST(tout), CV_NORMAL);
+                    if (flag < 0) {terminate_x_calc( sim_mem, 65 ); return 0;}
+                    
+                    flag = CVodeGetB(cvode_mem, which, &tret, sim_mem->xB);
+                    if (flag >= 0) flag = CVodeGetQuadB(cvode_mem, which, &tret, sim_mem->qB);
+                    if (flag < 0) {terminate_x_calc( sim_mem, 65 ); return 0;}
+                    tB = tout;
+                }
+                if ( ( is < 0 ) || ( ts[is] <= tstart ) ) break;
+                
+                for (k=0; k < neq; k++) xB_tmp[k] += seeds[k + neq*is];
+                flag = CVodeReInitB(cvode_mem, which, RCONST(tB), sim_mem->xB);
+                if (flag >= 0) flag = CVodeQuadReInitB(cvode_mem, which, sim_mem->qB);
+                if (flag < 0) {terminate_x_calc( sim_mem, 65 ); return 0;}
+            }
+            
+            for (k=0; k < neq; k++) lambda0[k] = xB_tmp[k];
+            for (ip=0; ip < np; ip++) condGrad[ip] = qB_tmp[ip];
+        }
+        
+        /* Jumps at time points which coincide with tstart */
+        for (is=0; ( is < nout ) && ( ts[is] <= tstart ); is++)
+            for (k=0; k < neq; k++) lambda0[k] += seeds[k + neq*is];
+        
+        /* Contribution of the initial condition, lambda(tstart)' * dx0/dp */
+        if ( sim_mem->xB == NULL ) {
+            sim_mem->xB = N_VNew_Serial(neq);
+            if ( sim_mem->xB == NULL ) {terminate_x_calc( sim_mem, 1 ); return 0;}
+        }
+        xB_tmp = NV_DATA_S(sim_mem->xB);
+        fu(data, tstart, im, isim);
+        fsu(data, tstart, im, isim);
+        for (ip=0; ip < np; ip++) {
+            for (k=0; k < neq; k++) xB_tmp[k] = 0.0;
+            fsx0(ip, sim_mem->xB, data, im, isim, 0);
+            for (k=0; k < neq; k++) condGrad[ip] += lambda0[k] * xB_tmp[k];
+        }
+    }
+    
+    return 1;
+}
+
+/* Sensitivities of an equilibrated condition which was simulated without sensitivities (turboSSSensi). At the */
+/* steady state dfdx sx = -dfdp holds. Conserved moieties make dfdx singular, the conserved totals then keep  */
+/* the sensitivities of the initial state (see steadyStateSensitivities in inverseC.c). The result is stored  */
+/* in the last time point of sxFineSimu, suFineSimu and svFineSimu. Returns 0 after terminate_x_calc.         */
+int steadyStateSensi( SimMemory sim_mem, mxArray *arcondition, int im, int ic, int isim, double tstart, double t, int nout )
+{
+    UserData data = sim_mem->data;
+    int      neq = sim_mem->neq;
+    int      is = nout - 1;
+    int      np, nu, nv, ip, k, flag;
+    double   *dfdx, *dfdp, *sx0, *sx, *sx_tmp;
+    double   *returnsx, *returnsu, *returnsv;
+    
+    np = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_pNum));
+    nu = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_uNum));
+    nv = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_vNum));
+    if ( np == 0 ) return 1;
+    
+    dfdx = mxGetData(conditionField(arcondition, im, ic, CF_dfdxNum));
+    dfdp = mxGetData(conditionField(arcondition, im, ic, CF_dfdpNum));
+    returnsx = mxGetData(conditionField(arcondition, im, ic, CF_sxFineSimu));
+    returnsu = mxGetData(conditionField(arcondition, im, ic, CF_suFineSimu));
+    returnsv = mxGetData(conditionField(arcondition, im, ic, CF_svFineSimu));
+    
+    sx0 = (double *) arenaAlloc(sim_mem->arena, neq * np * sizeof(double));
+    sx = (double *) arenaAlloc(sim_mem->arena, neq * np * sizeof(double));
+    if ( sim_mem->xB == NULL ) sim_mem->xB = N_VNew_Serial(neq);
+    if ( !sx0 || !sx || ( sim_mem->xB == NULL ) ) {terminate_x_calc( sim_mem, 1 ); return 0;}
+    sx_tmp = NV_DATA_S(sim_mem->xB);
+    
+    /* Sensitivities of the initial state */
+    fu(data, tstart, im, isim);
+    fsu(data, tstart, im, isim);
+    for (ip=0; ip < np; ip++) {
+        for (k=0; k < neq; k++) sx_tmp[k] = 0.0;
+        fsx0(ip, sim_mem->xB, data, im, isim, 0);
+        for (k=0; k < neq; k++) sx0[ip*neq + k] = sx_tmp[k];
+    }
+    
+    flag = steadyStateSensitivities( dfdx, dfdp, sx0, sx, neq, np );
+    if ( flag != 0 ) {
+        if ( flag > 0 ) thr_error("Singular dfdx: the conservation laws depend on the parameters");
+        terminate_x_calc( sim_mem, 67 );
+        return 0;
+    }
+    
+    /* Store the sensitivities of the final time point */
+    fu(data, t, im, isim);
+    fsu(data, t, im, isim);
+    fsv(data, t, sim_mem->x, im, isim);
+    for (ip=0; ip < np; ip++) {
+        for (k=0; k < neq; k++) {
+            sx_tmp[k] = sx[ip*neq + k];
+            returnsx[ip*neq*nout + k*nout + is] = sx_tmp[k];
+        }
+        csv(t, sim_mem->x, ip, sim_mem->xB, data, im, isim);
+        for (k=0; k < nv; k++) returnsv[(ip*nv + k)*nout + is] = data->sv[k];
+        for (k=0; k < nu; k++) returnsu[(ip*nu + k)*nout + is] = data->su[ip*nu + k];
+    }
+    
+    return 1;
+}
+
 void copyStates( N_Vector x, double *returnx, double *qpositivex, int neq, int nout, int offset )
 {
     int js;
@@ -1369,6 +2723,7 @@ void subCopyNVMatrixToDouble( N_Vector* sx, double *returnsx, int nps, int neq,
     for(jss=0; jss < nps; jss++)
     {
         js = targetIdx[jss];
+        if ( js == -2 ) continue;     /* stored by another sensitivity block */
         if ( js < 0 )
         {
             for(ks=0; ks < neq; ks++) {
@@ -1384,8 +2739,9 @@ void subCopyNVMatrixToDouble( N_Vector* sx, double *returnsx, int nps, int neq,
 }
 
 /* Equilibrate the system until the RHS is under a specified threshold */
-int equilibrate(void *cvode_mem, UserData data, N_Vector x, realtype t, double *equilibrated, double *returndxdt, double *teq, int neq, int im, int ic, int *abortSignal ) {
+int equilibrate(void *cvode_mem, UserData data, N_Vector x, realtype t, double *equilibrated, double *returndxdt, double *teq, int neq, int im, int ic, int *abortSignal, SimMemory sim_mem, int sensi_meth ) {
     int    i;
+    int    nTriggers;
     int    step;
     int    flag;
     double time;
@@ -1407,6 +2763,14 @@ int equilibrate(void *cvode_mem, UserData data, N_Vector x, realtype t, double *
         /* Simulate up to next checkpoint */
         CVodeSetStopTime(cvode_mem, RCONST(time));
         flag = CVode(cvode_mem, RCONST(time), x, &t, CV_NORMAL);
+        
+        /* State dependent events on the way */
+        nTriggers = 0;
+        while ( flag == CV_ROOT_RETURN ) {
+            if ( ++nTriggers > MAX_TRIGGERS ) { flag = CV_TOO_MUCH_WORK; break; }
+            flag = handleTrigger( sim_mem, im, ic, t, sensi_meth );
+            if ( flag >= 0 ) flag = CVode(cvode_mem, RCONST(time), x, &t, CV_NORMAL);
+        }
 
         DEBUGPRINT3( debugMode, 8, "Equilibrating ... (Step %d, current time: %g, target time %g)\n", step, t, time );
         
@@ -1452,7 +2816,7 @@ int equilibrate(void *cvode_mem, UserData data, N_Vector x, realtype t, double *
 /* This function can be used to display errors from the threaded environment 
    mexErrMsgTxt crashes on R2013b when called from a thread */
 void thr_error( const char* msg ) {
-    printf( msg );
+    logPrint( "%s", msg );
 }
 
 /* Event handler */
@@ -1541,6 +2905,85 @@ int handle_event( SimMemory sim_mem, int sensi_meth, int reinitSolver )
     return flag;
 }
 
+/* State dependent event: one or more trigger functions g crossed zero at time t. The states are reset to   */
+/* Ax+B as for the events at fixed time points. Since the event time tau depends on the parameters, the      */
+/* sensitivities additionally jump by (A f- - f+) dtau/dp, where dtau/dp = -(dgdx sx + dgdp) / (dgdx f- + dgdt) */
+/* and f-, f+ are the right hand sides before and after the reset.                                           */
+int handleTrigger( SimMemory sim_mem, int im, int isim, realtype t, int sensi_meth )
+{
+    int neq     = sim_mem->neq;
+    int sensi   = sim_mem->sensi;
+    int32_T* idx;
+    
+    void* cvode_mem         = sim_mem->cvode_mem;
+    EventData event_data    = sim_mem->event_data;
+    UserData data           = sim_mem->data;
+    N_Vector x              = sim_mem->x;
+    N_Vector* sx            = sim_mem->sx;
+    int nRoots              = event_data->nRoots;
+    
+    double A, gdot, dtaudp;
+    int ir, state, pars, ip, flag;
+    realtype tret;
+    realtype* sxtmp;
+    
+    flag = CVodeGetRootInfo(cvode_mem, event_data->rootsFound);
+    if (flag < 0) return flag;
+    
+    /* Sensitivities at the event time */
+    if (sensi==1) {
+        flag = CVodeGetSens(cvode_mem, &tret, sx);
+        if (flag < 0) return flag;
+    }
+    idx = data->sensIndices;
+    
+    for (ir=0; ir<nRoots; ir++) {
+        if (event_data->rootsFound[ir] == 0) continue;
+        
+        /* Rate of change of the trigger along the solution */
+        if (sensi==1) {
+            fx(t, x, event_data->fPre, data, im, isim);
+            getdfrootdxp(im, isim, t, x, event_data->dgdx, event_data->dgdp, event_data->dgdt, data);
+            gdot = event_data->dgdt[ir];
+            for (state=0; state<neq; state++)
+                gdot += event_data->dgdx[state*nRoots+ir] * event_data->fPre[state];
+        }
+        
+        /* Override state variables */
+        for (state=0; state<neq; state++)
+            Ith(x, state+1) = event_data->rootValue_A[state*nRoots+ir] * Ith(x, state+1) + event_data->rootValue_B[state*nRoots+ir];
+        
+        /* Override sensitivities, a trigger which only touches zero leaves the event time undetermined */
+        if (sensi==1) {
+            fx(t, x, event_data->fPost, data, im, isim);
+            for (pars=0; pars<sim_mem->npSensi; pars++) {
+                ip = ( idx == NULL ) ? pars : idx[pars];
+                sxtmp = NV_DATA_S(sx[pars]);
+                
+                dtaudp = 0.0;
+                if (gdot != 0.0) {
+                    dtaudp = event_data->dgdp[ip*nRoots+ir];
+                    for (state=0; state<neq; state++)
+                        dtaudp += event_data->dgdx[state*nRoots+ir] * sxtmp[state];
+                    dtaudp = -dtaudp / gdot;
+                }
+                
+                for (state=0; state<neq; state++) {
+                    A = event_data->rootValue_A[state*nRoots+ir];
+                    sxtmp[state] = A * sxtmp[state] + ( A * event_data->fPre[state] - event_data->fPost[state] ) * dtaudp;
+                }
+            }
+        }
+    }
+    
+    /* Reinitialize the solver */
+    flag = CVodeReInit(cvode_mem, t, x);
+    if ( (flag>=0) && (sensi==1) )
+        flag = CVodeSensReInit(cvode_mem, sensi_meth, sx);
+    
+    return flag;
+}
+
 /* Apply initial conditions for solving using numerical ODE integration */
 int applyInitialConditionsODE( SimMemory sim_mem, double tstart, int im, int isim, double *returndxdt, double *returndfdp0, mxArray *x0_override, int sensitivitySubset )
 {
@@ -1606,7 +3049,7 @@ int applyInitialConditionsODE( SimMemory sim_mem, double tstart, int im, int isi
 }
 
 /* Allocate memory used by the SUNDIALS solver */
-int allocateSimMemoryCVODES( SimMemory sim_mem, int neq, int np, int sensi, int npSensi )
+int allocateSimMemoryCVODES( SimMemory sim_mem, int neq, int np, int sensi, int npSensi, SolverCache cache )
 {
     int is, js, ks;
     realtype *atolV_tmp;
@@ -1617,14 +3060,25 @@ int allocateSimMemoryCVODES( SimMemory sim_mem, int neq, int np, int sensi, int
     sim_mem->sensi = sensi;
     
     /* Allocate userdata */
-    sim_mem->data = (UserData) malloc(sizeof *sim_mem->data);
+    sim_mem->data = (UserData) arenaAlloc(sim_mem->arena, sizeof *sim_mem->data);
     if (sim_mem->data == NULL) { terminate_x_calc( sim_mem, 1 ); return 0; }
            
     /* Allocate event structure */
-    sim_mem->event_data = (EventData) malloc(sizeof *sim_mem->event_data);
+    sim_mem->event_data = (EventData) arenaAlloc(sim_mem->arena, sizeof *sim_mem->event_data);
     if (sim_mem->event_data == NULL) { terminate_x_calc( sim_mem, 1 ); return 0; }    
     
-    if ( neq > 0 ) {
+    /* Take over the solver of a previous simulation of this condition (returned to the cache by simFree) */
+    sim_mem->cache = cache;
+    if ( cache && cache->cvode_mem ) {
+        sim_mem->cvode_mem = cache->cvode_mem;  cache->cvode_mem = NULL;
+        sim_mem->x         = cache->x;          cache->x = NULL;
+        sim_mem->atolV     = cache->atolV;      cache->atolV = NULL;
+        sim_mem->sx        = cache->sx;         cache->sx = NULL;
+        sim_mem->atols_ss  = cache->atols_ss;   cache->atols_ss = NULL;
+        sim_mem->atolV_ss  = cache->atolV_ss;   cache->atolV_ss = NULL;
+    }
+    
+    if ( ( neq > 0 ) && ( sim_mem->cvode_mem == NULL ) ) {
         /* Create CVODES object */
         sim_mem->cvode_mem = CVodeCreate(CV_BDF, CV_NEWTON);
         if (sim_mem->cvode_mem == NULL) { terminate_x_calc( sim_mem, 3 ); return 0; }        
@@ -1638,8 +3092,10 @@ int allocateSimMemoryCVODES( SimMemory sim_mem, int neq, int np, int sensi, int
         
         for (is=0; is<neq; is++) 
             Ith(sim_mem->atolV, is+1) = 0.0;
-        
-        if (sensi == 1) {
+    }
+    
+    if ( neq > 0 ) {
+        if ( ( sensi == 1 ) && ( sim_mem->sx == NULL ) ) {
             (sim_mem->sx) = N_VCloneVectorArray_Serial(npSensi, sim_mem->x);
             if (sim_mem->sx == NULL) { terminate_x_calc( sim_mem, 2 ); return 0; }
 
@@ -1666,7 +3122,7 @@ int allocateSimMemorySSA( SimMemory sim_mem, int nx )
     sim_mem->neq = nx;
     
     /* Allocate userdata */
-    sim_mem->data = (UserData) malloc(sizeof *sim_mem->data);
+    sim_mem->data = (UserData) arenaAlloc(sim_mem->arena, sizeof *sim_mem->data);
     if (sim_mem->data == NULL) { terminate_x_calc( sim_mem, 1 ); return 0; }    
     
     if ( nx > 0 ) {
@@ -1681,8 +3137,623 @@ int allocateSimMemorySSA( SimMemory sim_mem, int nx )
     return 1;
 }
 
+/* Initialize the UserData structure for the stochastic simulation. Blocks of runs of the same condition */
+/* are simulated concurrently, so they get private copies of the inputs and fluxes which fvSSA updates. */
+int initializeDataSSA( SimMemory sim_mem, int *abortSignal, mxArray *arcondition, int im, int ic, int privateBuffers )
+{
+    UserData data = sim_mem->data;
+    mxArray *uNum = conditionField(arcondition, im, ic, CF_uNum);
+    mxArray *vNum = conditionField(arcondition, im, ic, CF_vNum);
+    mxArray *splines = conditionField(arcondition, im, ic, CF_splines);
+    int nu = (int) mxGetNumberOfElements(uNum);
+    int nv = (int) mxGetNumberOfElements(vNum);
+    int nsplines = ( splines != NULL ) ? (int) mxGetNumberOfElements(splines) : 0;
+    int j;
+    
+    data->abort = abortSignal;
+    data->p = mxGetData(conditionField(arcondition, im, ic, CF_pNum));
+    data->u = mxGetData(uNum);
+    data->v = mxGetData(vNum);
+    data->sensIndices = NULL;
+    data->prec = NULL;
+    data->cse = NULL;
+    data->splines = NULL;
+    data->nsplines = 0;
+    
+    if ( nsplines > 0 ) {
+        data->splines = (double**) arenaAlloc(sim_mem->arena, nsplines * sizeof(double*));
+        data->splineIndices = (int *) arenaAlloc(sim_mem->arena, nsplines * sizeof(int));
+        if ( ( data->splines == NULL ) || ( data->splineIndices == NULL ) ) { terminate_x_calc( sim_mem, 1 ); return 0; }
+        data->nsplines = nsplines;
+        for ( j = 0; j < nsplines; j++ )
+            data->splines[j] = NULL;
+    }
+    
+    if ( privateBuffers ) {
+        data->u = (double *) arenaAlloc(sim_mem->arena, nu * sizeof(double));
+        data->v = (double *) arenaAlloc(sim_mem->arena, nv * sizeof(double));
+        if ( ( data->u == NULL ) || ( data->v == NULL ) ) { terminate_x_calc( sim_mem, 1 ); return 0; }
+        memcpy( data->u, mxGetData(uNum), nu * sizeof(double) );
+        memcpy( data->v, mxGetData(vNum), nv * sizeof(double) );
+    }
+    
+    return 1;
+}
+
+/* Store the state of a stochastic run at the output times before tnext, at which the next reaction occurs. */
+/* The bounds are the extremes of the state since the previous output time.                                 */
+void storeSSAOutputs( SimMemory sim_mem, SSAProblem *problem, int iruns, double tnext, int *it, int *itexp )
+{
+    N_Vector x = sim_mem->x;
+    N_Vector x_lb = sim_mem->x_lb;
+    N_Vector x_ub = sim_mem->x_ub;
+    int nx = problem->nx;
+    int nt = problem->nt;
+    int ntexp = problem->ntexp;
+    int ix;
+    
+    while ( ( *it < nt ) && ( problem->tfine[*it] < tnext ) ) {
+        for (ix=0; ix<nx; ix++) {
+            problem->xssa[*it+nt*ix+nt*nx*iruns] = Ith(x, ix+1);
+            problem->xssa_lb[*it+nt*ix+nt*nx*iruns] = Ith(x_lb, ix+1);
+            problem->xssa_ub[*it+nt*ix+nt*nx*iruns] = Ith(x_ub, ix+1);
+        }
+        *it += 1;
+        
+        for (ix=0; ix<nx; ix++) {
+            Ith(x_lb, ix+1) = Ith(x, ix+1);
+            Ith(x_ub, ix+1) = Ith(x, ix+1);
+        }
+    }
+    while ( ( *itexp < ntexp ) && ( problem->texp[*itexp] < tnext ) ) {
+        for (ix=0; ix<nx; ix++) {
+            problem->xssaexp[*itexp+ntexp*ix+ntexp*nx*iruns] = Ith(x, ix+1);
+        }
+        *itexp += 1;
+    }
+}
+
+/* One run of the next reaction method (Gibson and Bruck, J. Phys. Chem. A 104, 2000). Every reaction keeps */
+/* the absolute time at which it fires next in the reaction queue. After an event only the reactions which  */
+/* depend on the changed species are recomputed; their pending times are rescaled by the ratio of the old   */
+/* and new propensity, so that each event needs a single new random number. Propensities which depend on    */
+/* inputs are frozen between two events, as in the direct method. Returns 0 if the run was stopped early.   */
+int nextReactionRun( SimMemory sim_mem, SSAProblem *problem, ReactionQueue *queue, double *alpha, RandomStream *rng, int iruns )
+{
+    UserData data = sim_mem->data;
+    N_Vector x = sim_mem->x;
+    N_Vector x_lb = sim_mem->x_lb;
+    N_Vector x_ub = sim_mem->x_ub;
+    int nx = problem->nx;
+    int nv = problem->nv;
+    double *time = queue->time;
+    double lasttau[] = {1,1,1,1,1,1,1,1,1,1};
+    int ilasttau = 0;
+    double t = problem->tstart;
+    double tnext, anew, meantau;
+    int it = 0, itexp = 0;
+    int ix, iv, jv, jdep;
+    
+    for (ix=0; ix<nx; ix++) {
+        Ith(x, ix+1) = problem->x0[ix];
+        Ith(x_lb, ix+1) = problem->x0[ix];
+        Ith(x_ub, ix+1) = problem->x0[ix];
+    }
+    
+    /* all propensities and firing times once per run */
+    fvSSA(data, t, x, problem->im, problem->ic);
+    for (iv=0; iv<nv; iv++) {
+        alpha[iv] = data->v[iv] * problem->scale_v[iv];
+        time[iv] = ( alpha[iv] > 0 ) ? t - log( rngUniform( rng ) ) / alpha[iv] : INFINITY;
+    }
+    rqInit( queue, time, queue->heap, queue->pos, nv );
+    
+    while ( it < problem->nt ) {
+        iv = ( nv > 0 ) ? rqTop( queue ) : 0;
+        tnext = ( nv > 0 ) ? time[iv] : INFINITY;
+        
+        /* update values before reaction occurs, no reaction left: constant until the end */
+        storeSSAOutputs( sim_mem, problem, iruns, tnext, &it, &itexp );
+        if ( isinf( tnext ) )
+            break;
+        
+        lasttau[ilasttau] = tnext - t;
+        ilasttau = (ilasttau+1) % 10;
+        t = tnext;
+        
+        /* iv-th reaction occurs */
+        ssaFire( sim_mem, problem, iv, 1 );
+        
+        /* affected propensities only */
+        if ( problem->inputDep )
+            fuSSA(data, t, problem->im, problem->ic);
+        for (jdep=problem->depPtr[iv]; jdep<problem->depPtr[iv+1]; jdep++) {
+            jv = problem->depIdx[jdep];
+            fvSSAreaction(data, t, x, problem->im, problem->ic, jv);
+            anew = data->v[jv] * problem->scale_v[jv];
+            if ( anew <= 0 )
+                tnext = INFINITY;
+            else if ( ( jv != iv ) && ( alpha[jv] > 0 ) && !isinf( time[jv] ) )
+                tnext = t + ( alpha[jv] / anew ) * ( time[jv] - t );
+            else
+                tnext = t - log( rngUniform( rng ) ) / anew;
+            alpha[jv] = anew;
+            rqUpdate( queue, jv, tnext );
+        }
+        
+        meantau = 0;
+        for (ix=0; ix<10; ix++) meantau += lasttau[ix];
+        meantau /= 10;
+        
+        if(meantau < mintau) {
+            logPrint("\nmodel #%i, condition #%i, run #%i at t=%f: STOP (mean(tau)=%g < %g)\n", problem->im+1, problem->ic+1, iruns+1, t, meantau, mintau);
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+/* Work memory of the tau-leaping and hybrid engines */
+int initializeSSAWork( SimMemory sim_mem, SSAProblem *problem, SSAWork *work )
+{
+    int nx = problem->nx;
+    int nv = problem->nv;
+    double *mem = (double *) arenaAlloc(sim_mem->arena, ( 4 * nv + 4 * nx + nx * nx + 1 ) * sizeof(double));
+    int *flags = (int *) arenaAlloc(sim_mem->arena, ( 2 * nv + 1 ) * sizeof(int));
+    
+    work->ipiv = (mwSignedIndex *) arenaAlloc(sim_mem->arena, ( nx + 1 ) * sizeof(mwSignedIndex));
+    if ( ( mem == NULL ) || ( flags == NULL ) || ( work->ipiv == NULL ) ) { terminate_x_calc( sim_mem, 1 ); return 0; }
+    
+    work->alpha = mem;
+    work->alphaNew = work->alpha + nv;
+    work->alphaTmp = work->alphaNew + nv;
+    work->fired = work->alphaTmp + nv;
+    work->y = work->fired + nv;
+    work->res = work->y + nx;
+    work->c = work->res + nx;
+    work->xsave = work->c + nx;
+    work->jac = work->xsave + nx;
+    work->critical = flags;
+    work->fast = flags + nv;
+    
+    return 1;
+}
+
+/* Scaled propensities of all reactions at state x, returns their sum */
+double ssaPropensities( UserData data, SSAProblem *problem, double t, N_Vector x, double *alpha )
+{
+    double alpha0 = 0;
+    int iv;
+    
+    fvSSA(data, t, x, problem->im, problem->ic);
+    for (iv=0; iv<problem->nv; iv++) {
+        alpha[iv] = data->v[iv] * problem->scale_v[iv];
+        alpha0 += alpha[iv];
+    }
+    
+    return alpha0;
+}
+
+/* Reaction at which the cumulative propensity of the reactions in mask (NULL = all) exceeds target */
+int ssaSelect( double *alpha, int *mask, int nv, double target )
+{
+    double sumalpha = 0;
+    int iv, last = 0;
+    
+    for (iv=0; iv<nv; iv++) {
+        if ( ( ( mask == NULL ) || mask[iv] ) && ( alpha[iv] > 0 ) ) {
+            last = iv;
+            sumalpha += alpha[iv];
+            if ( target < sumalpha ) return iv;
+        }
+    }
+    
+    return last;
+}
+
+/* Reaction iv fires count times */
+void ssaFire( SimMemory sim_mem, SSAProblem *problem, int iv, double count )
+{
+    N_Vector x = sim_mem->x;
+    N_Vector x_lb = sim_mem->x_lb;
+    N_Vector x_ub = sim_mem->x_ub;
+    int nx = problem->nx;
+    int ix;
+    
+    for (ix=0; ix<nx; ix++) {
+        Ith(x, ix+1) = Ith(x, ix+1) + count * (problem->N[ix+iv*nx] / problem->scale_x[ix]);
+        if(Ith(x, ix+1)<0) Ith(x, ix+1) = 0;
+        if(Ith(x, ix+1)<Ith(x_lb, ix+1)) Ith(x_lb, ix+1) = Ith(x, ix+1);
+        if(Ith(x, ix+1)>Ith(x_ub, ix+1)) Ith(x_ub, ix+1) = Ith(x, ix+1);
+    }
+}
+
+/* Leap size of Cao, Gillespie and Petzold (J. Chem. Phys. 124, 2006): the expected change and the standard */
+/* deviation of every reactant may only change by a fraction ssaTauEps within the leap. Reactions which are  */
+/* about to exhaust one of their reactants are marked critical and excluded from the leap. The implicit     */
+/* leap is only limited by the expected change, so that fast reactions which are in partial equilibrium and */
+/* whose firings cancel do not restrict it.                                                                */
+double leapSize( SimMemory sim_mem, SSAProblem *problem, SSAWork *work, int implicit )
+{
+    N_Vector x = sim_mem->x;
+    int nx = problem->nx;
+    int nv = problem->nv;
+    double *N = problem->N;
+    double *alpha = work->alpha;
+    double tau = INFINITY;
+    double nmol, nmax, mu, sigma2, bound;
+    int ix, iv, reactant;
+    
+    for (iv=0; iv<nv; iv++) {
+        nmax = INFINITY;
+        for (ix=0; ix<nx; ix++) {
+            if ( N[ix+iv*nx] < 0 ) {
+                nmol = floor( Ith(x, ix+1) * problem->scale_x[ix] / ( -N[ix+iv*nx] ) + 1e-9 );
+                if ( nmol < nmax ) nmax = nmol;
+            }
+        }
+        work->critical[iv] = ( alpha[iv] > 0 ) && ( nmax < SSA_NCRITICAL );
+    }
+    
+    for (ix=0; ix<nx; ix++) {
+        mu = 0;
+        sigma2 = 0;
+        reactant = 0;
+        for (iv=0; iv<nv; iv++) {
+            if ( work->critical[iv] || ( N[ix+iv*nx] == 0 ) ) continue;
+            mu += N[ix+iv*nx] * alpha[iv];
+            sigma2 += N[ix+iv*nx] * N[ix+iv*nx] * alpha[iv];
+            if ( N[ix+iv*nx] < 0 ) reactant = 1;
+        }
+        if ( !reactant ) continue;
+        
+        bound = ssaTauEps * Ith(x, ix+1) * problem->scale_x[ix] / SSA_REACTION_ORDER;
+        if ( bound < 1 ) bound = 1;
+        if ( ( mu != 0 ) && ( bound / fabs(mu) < tau ) ) tau = bound / fabs(mu);
+        if ( !implicit && ( sigma2 > 0 ) && ( bound * bound / sigma2 < tau ) ) tau = bound * bound / sigma2;
+    }
+    
+    return tau;
+}
+
+/* Implicit tau-leap (Rathinam, Petzold, Cao and Gillespie, J. Chem. Phys. 119, 2003). The molecules y at the */
+/* end of the leap solve y = c + tau * N * alpha(y) with c = x + N * ( P - tau * alpha(x) ), where P are the   */
+/* Poisson firings in work->fired. They are replaced by round( P - tau * alpha(x) + tau * alpha(y) ). The     */
+/* Newton matrix is built from finite differences of the propensities and factorized once per leap. Returns  */
+/* -1 if the iteration fails, the explicit firings are kept in that case.                                    */
+int implicitLeap( SimMemory sim_mem, SSAProblem *problem, SSAWork *work, double t, double tau )
+{
+    UserData data = sim_mem->data;
+    N_Vector x = sim_mem->x;
+    int nx = problem->nx;
+    int nv = problem->nv;
+    double *N = problem->N;
+    double *scale_x = problem->scale_x;
+    double *y = work->y;
+    double *c = work->c;
+    double *res = work->res;
+    double h, step, ymax;
+    int ix, jx, iv, iter, converged = 0;
+    
+    if ( nx == 0 ) return 0;
+    
+    /* explicit estimate y and constant part c over the leaped reactions */
+    for (ix=0; ix<nx; ix++) {
+        work->xsave[ix] = Ith(x, ix+1);
+        y[ix] = Ith(x, ix+1) * scale_x[ix];
+        for (iv=0; iv<nv; iv++)
+            y[ix] += N[ix+iv*nx] * work->fired[iv];
+        c[ix] = y[ix];
+        for (iv=0; iv<nv; iv++)
+            if ( !work->critical[iv] ) c[ix] -= tau * N[ix+iv*nx] * work->alpha[iv];
+    }
+    
+    /* Newton matrix I - tau * N * dalpha/dy at the explicit estimate */
+    for (ix=0; ix<nx; ix++) Ith(x, ix+1) = y[ix] / scale_x[ix];
+    ssaPropensities( data, problem, t + tau, x, work->alphaNew );
+    for (jx=0; jx<nx; jx++) {
+        h = 1e-6 * fabs(y[jx]) + 1e-3;
+        Ith(x, jx+1) = ( y[jx] + h ) / scale_x[jx];
+        ssaPropensities( data, problem, t + tau, x, work->alphaTmp );
+        Ith(x, jx+1) = y[jx] / scale_x[jx];
+        for (ix=0; ix<nx; ix++) {
+            work->jac[ix+jx*nx] = ( ix == jx ) ? 1 : 0;
+            for (iv=0; iv<nv; iv++)
+                if ( !work->critical[iv] )
+                    work->jac[ix+jx*nx] -= tau * N[ix+iv*nx] * ( work->alphaTmp[iv] - work->alphaNew[iv] ) / h;
+        }
+    }
+    
+    /* simplified Newton iteration */
+    if ( denseFactor( work->jac, work->ipiv, nx ) == 0 ) {
+        for (iter=0; iter<SSA_NEWTON_MAXITER; iter++) {
+            for (ix=0; ix<nx; ix++) Ith(x, ix+1) = y[ix] / scale_x[ix];
+            ssaPropensities( data, problem, t + tau, x, work->alphaNew );
+            for (ix=0; ix<nx; ix++) {
+                res[ix] = y[ix] - c[ix];
+                for (iv=0; iv<nv; iv++)
+                    if ( !work->critical[iv] ) res[ix] -= tau * N[ix+iv*nx] * work->alphaNew[iv];
+            }
+            if ( denseSolve( work->jac, work->ipiv, res, nx ) != 0 ) break;
+            
+            step = 0;
+            ymax = 1;
+            for (ix=0; ix<nx; ix++) {
+                y[ix] -= res[ix];
+                if ( fabs(res[ix]) > step ) step = fabs(res[ix]);
+                if ( fabs(y[ix]) > ymax ) ymax = fabs(y[ix]);
+            }
+            if ( step < 1e-6 * ymax ) {
+                converged = 1;
+                break;
+            }
+        }
+    }
+    
+    if ( converged ) {
+        for (ix=0; ix<nx; ix++) Ith(x, ix+1) = y[ix] / scale_x[ix];
+        ssaPropensities( data, problem, t + tau, x, work->alphaNew );
+        for (iv=0; iv<nv; iv++) {
+            if ( work->critical[iv] ) continue;
+            work->fired[iv] = floor( work->fired[iv] + tau * ( work->alphaNew[iv] - work->alpha[iv] ) + 0.5 );
+            if ( work->fired[iv] < 0 ) work->fired[iv] = 0;
+        }
+    }
+    
+    for (ix=0; ix<nx; ix++) Ith(x, ix+1) = work->xsave[ix];
+    
+    return converged ? 0 : -1;
+}
+
+/* One run of tau-leaping. Every leap fires the non-critical reactions a Poisson distributed number of times */
+/* and at most one critical reaction (Cao, Gillespie and Petzold, J. Chem. Phys. 122, 2005). Leaps which     */
+/* would drive a species negative are halved. When the leap is not worth it, because it covers only a few   */
+/* reactions, the run continues with SSA_EXACT_STEPS steps of the direct method.                            */
+int tauLeapingRun( SimMemory sim_mem, SSAProblem *problem, SSAWork *work, RandomStream *rng, int iruns, int implicit )
+{
+    UserData data = sim_mem->data;
+    N_Vector x = sim_mem->x;
+    N_Vector x_lb = sim_mem->x_lb;
+    N_Vector x_ub = sim_mem->x_ub;
+    int nx = problem->nx;
+    int nv = problem->nv;
+    double *N = problem->N;
+    double *alpha = work->alpha;
+    double *fired = work->fired;
+    double t = problem->tstart;
+    double alpha0, alpha0c, tau, tau1, tau2, nmol;
+    int it = 0, itexp = 0, exactSteps = 0;
+    int ix, iv, feasible;
+    
+    for (ix=0; ix<nx; ix++) {
+        Ith(x, ix+1) = problem->x0[ix];
+        Ith(x_lb, ix+1) = problem->x0[ix];
+        Ith(x_ub, ix+1) = problem->x0[ix];
+    }
+    
+    while ( it < problem->nt ) {
+        alpha0 = ssaPropensities( data, problem, t, x, alpha );
+        if ( !( alpha0 > 0 ) ) {
+            /* no reaction left: constant until the end */
+            storeSSAOutputs( sim_mem, problem, iruns, INFINITY, &it, &itexp );
+            break;
+        }
+        
+        if ( exactSteps == 0 ) {
+            tau1 = leapSize( sim_mem, problem, work, implicit );
+            if ( tau1 < SSA_EXACT_FACTOR / alpha0 )
+                exactSteps = SSA_EXACT_STEPS;
+        }
+        
+        /* step of the direct method */
+        if ( exactSteps > 0 ) {
+            exactSteps--;
+            tau = -log( rngUniform( rng ) ) / alpha0;
+            iv = ssaSelect( alpha, NULL, nv, rngUniform( rng ) * alpha0 );
+            storeSSAOutputs( sim_mem, problem, iruns, t + tau, &it, &itexp );
+            ssaFire( sim_mem, problem, iv, 1 );
+            t += tau;
+            continue;
+        }
+        
+        /* time to the next critical reaction */
+        alpha0c = 0;
+        for (iv=0; iv<nv; iv++)
+            if ( work->critical[iv] ) alpha0c += alpha[iv];
+        tau2 = ( alpha0c > 0 ) ? -log( rngUniform( rng ) ) / alpha0c : INFINITY;
+        
+        do {
+            tau = ( tau1 < tau2 ) ? tau1 : tau2;
+            for (iv=0; iv<nv; iv++)
+                fired[iv] = work->critical[iv] ? 0 : rngPoisson( rng, alpha[iv] * tau );
+            if ( tau2 <= tau1 )
+                fired[ssaSelect( alpha, work->critical, nv, rngUniform( rng ) * alpha0c )] = 1;
+            if ( implicit )
+                implicitLeap( sim_mem, problem, work, t, tau );
+            
+            feasible = 1;
+            for (ix=0; ( ix<nx ) && feasible; ix++) {
+                nmol = Ith(x, ix+1) * problem->scale_x[ix];
+                for (iv=0; iv<nv; iv++)
+                    nmol += N[ix+iv*nx] * fired[iv];
+                if ( nmol < -1e-6 ) feasible = 0;
+            }
+            if ( !feasible ) tau1 /= 2;
+        } while ( !feasible );
+        
+        storeSSAOutputs( sim_mem, problem, iruns, t + tau, &it, &itexp );
+        for (iv=0; iv<nv; iv++)
+            if ( fired[iv] > 0 ) ssaFire( sim_mem, problem, iv, fired[iv] );
+        t += tau;
+    }
+    
+    return 1;
+}
+
+/* CVODES instance of the hybrid method, kept in sim_mem so that simFree releases it */
+int initializeHybrid( SimMemory sim_mem, HybridData hybrid )
+{
+    int neq = hybrid->problem->nx + 1;
+    int flag;
+    
+    sim_mem->xHybrid = N_VNew_Serial(neq);
+    if ( sim_mem->xHybrid == NULL ) { terminate_x_calc( sim_mem, 2 ); return 0; }
+    N_VConst(0.0, sim_mem->xHybrid);
+    
+    sim_mem->cvode_mem = CVodeCreate(CV_BDF, CV_NEWTON);
+    if ( sim_mem->cvode_mem == NULL ) { terminate_x_calc( sim_mem, 5 ); return 0; }
+    flag = CVodeInit(sim_mem->cvode_mem, hybridRhs, hybrid->problem->tstart, sim_mem->xHybrid);
+    if ( flag < 0 ) { terminate_x_calc( sim_mem, 6 ); return 0; }
+    flag = CVodeSStolerances(sim_mem->cvode_mem, cvodes_rtol, cvodes_atol);
+    if ( flag < 0 ) { terminate_x_calc( sim_mem, 7 ); return 0; }
+    flag = CVodeSetUserData(sim_mem->cvode_mem, hybrid);
+    if ( flag < 0 ) { terminate_x_calc( sim_mem, 8 ); return 0; }
+    flag = CVodeSetMaxNumSteps(sim_mem->cvode_mem, cvodes_maxsteps);
+    if ( flag < 0 ) { terminate_x_calc( sim_mem, 9 ); return 0; }
+    flag = CVDense(sim_mem->cvode_mem, neq);
+    if ( flag < 0 ) { terminate_x_calc( sim_mem, 10 ); return 0; }
+    flag = CVodeRootInit(sim_mem->cvode_mem, 1, hybridRoot);
+    if ( flag < 0 ) { terminate_x_calc( sim_mem, 68 ); return 0; }
+    
+    return 1;
+}
+
+/* Reactions which fire at least ssaHybridThreshold times per output interval and whose reactants all have */
+/* at least ssaHybridThreshold molecules are integrated deterministically until the next output time       */
+void hybridPartition( SimMemory sim_mem, HybridData hybrid, double t )
+{
+    SSAProblem *problem = hybrid->problem;
+    SSAWork *work = hybrid->work;
+    N_Vector x = sim_mem->x;
+    int nx = problem->nx;
+    int nv = problem->nv;
+    double dt = ( problem->nt > 1 ) ? ( problem->tfine[problem->nt-1] - problem->tfine[0] ) / ( problem->nt - 1 ) : 1;
+    int ix, iv;
+    
+    ssaPropensities( sim_mem->data, problem, t, x, work->alpha );
+    for (iv=0; iv<nv; iv++) {
+        work->fast[iv] = ( work->alpha[iv] * dt >= ssaHybridThreshold );
+        for (ix=0; ( ix<nx ) && work->fast[iv]; ix++)
+            if ( ( problem->N[ix+iv*nx] < 0 ) && ( Ith(x, ix+1) * problem->scale_x[ix] < ssaHybridThreshold ) )
+                work->fast[iv] = 0;
+        work->critical[iv] = !work->fast[iv];
+    }
+}
+
+/* Fast reactions change the species deterministically, the slow ones add their propensity to the last state */
+int hybridRhs( realtype t, N_Vector y, N_Vector ydot, void *user_data )
+{
+    HybridData hybrid = (HybridData) user_data;
+    SSAProblem *problem = hybrid->problem;
+    SSAWork *work = hybrid->work;
+    N_Vector x = hybrid->sim_mem->x;
+    int nx = problem->nx;
+    int nv = problem->nv;
+    int ix, iv;
+    
+    for (ix=0; ix<nx; ix++) {
+        Ith(x, ix+1) = Ith(y, ix+1);
+        Ith(ydot, ix+1) = 0;
+    }
+    Ith(ydot, nx+1) = 0;
+    
+    ssaPropensities( hybrid->sim_mem->data, problem, t, x, work->alphaTmp );
+    for (iv=0; iv<nv; iv++) {
+        if ( work->fast[iv] ) {
+            for (ix=0; ix<nx; ix++)
+                Ith(ydot, ix+1) += problem->N[ix+iv*nx] * work->alphaTmp[iv] / problem->scale_x[ix];
+        } else {
+            Ith(ydot, nx+1) += work->alphaTmp[iv];
+        }
+    }
+    
+    return 0;
+}
+
+/* A slow reaction fires when the integrated propensity reaches xi */
+int hybridRoot( realtype t, N_Vector y, realtype *gout, void *user_data )
+{
+    HybridData hybrid = (HybridData) user_data;
+    
+    gout[0] = Ith(y, hybrid->problem->nx+1) - hybrid->xi;
+    return 0;
+}
+
+/* One run of the hybrid method (Salis and Kaznessis, J. Chem. Phys. 122, 2005). The fast reactions are     */
+/* integrated as ODEs by CVODES, together with the integral of the propensities of the slow reactions. A    */
+/* slow reaction fires when this integral reaches an exponentially distributed threshold; it is selected by */
+/* the slow propensities at that time. The partition is updated at every output time.                      */
+int hybridRun( SimMemory sim_mem, HybridData hybrid, RandomStream *rng, int iruns )
+{
+    SSAProblem *problem = hybrid->problem;
+    SSAWork *work = hybrid->work;
+    void *cvode_mem = sim_mem->cvode_mem;
+    N_Vector y = sim_mem->xHybrid;
+    N_Vector x = sim_mem->x;
+    N_Vector x_lb = sim_mem->x_lb;
+    N_Vector x_ub = sim_mem->x_ub;
+    int nx = problem->nx;
+    int nv = problem->nv;
+    double t = problem->tstart;
+    double tout, alpha0;
+    realtype tret;
+    int it = 0, itexp = 0;
+    int ix, iv, flag;
+    
+    for (ix=0; ix<nx; ix++) {
+        Ith(x, ix+1) = problem->x0[ix];
+        Ith(x_lb, ix+1) = problem->x0[ix];
+        Ith(x_ub, ix+1) = problem->x0[ix];
+    }
+    hybrid->xi = -log( rngUniform( rng ) );
+    Ith(y, nx+1) = 0;
+    hybridPartition( sim_mem, hybrid, t );
+    
+    while ( it < problem->nt ) {
+        tout = problem->tfine[it];
+        if ( ( itexp < problem->ntexp ) && ( problem->texp[itexp] < tout ) ) tout = problem->texp[itexp];
+        
+        /* output time reached, continue with a new partition */
+        if ( tout <= t ) {
+            storeSSAOutputs( sim_mem, problem, iruns, nextafter( t, INFINITY ), &it, &itexp );
+            hybridPartition( sim_mem, hybrid, t );
+            continue;
+        }
+        
+        for (ix=0; ix<nx; ix++) Ith(y, ix+1) = Ith(x, ix+1);
+        flag = CVodeReInit(cvode_mem, t, y);
+        if ( flag >= 0 ) flag = CVode(cvode_mem, tout, y, &tret, CV_NORMAL);
+        if ( flag < 0 ) {
+            logPrint("\nmodel #%i, condition #%i, run #%i at t=%f: STOP (CVODES flag %i in the hybrid method)\n", problem->im+1, problem->ic+1, iruns+1, t, flag);
+            return 0;
+        }
+        
+        t = tret;
+        for (ix=0; ix<nx; ix++) {
+            Ith(x, ix+1) = ( Ith(y, ix+1) > 0 ) ? Ith(y, ix+1) : 0;
+            if(Ith(x, ix+1)<Ith(x_lb, ix+1)) Ith(x_lb, ix+1) = Ith(x, ix+1);
+            if(Ith(x, ix+1)>Ith(x_ub, ix+1)) Ith(x_ub, ix+1) = Ith(x, ix+1);
+        }
+        
+        /* a slow reaction fires */
+        if ( flag == CV_ROOT_RETURN ) {
+            ssaPropensities( sim_mem->data, problem, t, x, work->alpha );
+            alpha0 = 0;
+            for (iv=0; iv<nv; iv++)
+                if ( work->critical[iv] ) alpha0 += work->alpha[iv];
+            if ( alpha0 > 0 )
+                ssaFire( sim_mem, problem, ssaSelect( work->alpha, work->critical, nv, rngUniform( rng ) * alpha0 ), 1 );
+            hybrid->xi = -log( rngUniform( rng ) );
+            Ith(y, nx+1) = 0;
+        }
+    }
+    
+    return 1;
+}
+
 /* Initialize the UserData structure for use with CVodes */
-void initializeDataCVODES( SimMemory sim_mem, double tstart, int *abortSignal, mxArray *arcondition, double *qpositivex, int ic, int nsplines, int sensitivitySubset )
+void initializeDataCVODES( SimMemory sim_mem, double tstart, int *abortSignal, mxArray *arcondition, double *qpositivex, int im, int ic, int nsplines, int sensitivitySubset )
 {
     int j;
     UserData data = sim_mem->data;
@@ -1690,40 +3761,83 @@ void initializeDataCVODES( SimMemory sim_mem, double tstart, int *abortSignal, m
     data->nsplines = 0;
     
     if ( nsplines > 0 ) {
-        data->splines = (double**) malloc(nsplines * sizeof(double*));
-        data->splineIndices = (int *) malloc(nsplines * sizeof(int));
+        /* The spline caches which cspline allocates later come from the same arena */
+        data->splines = (double**) arenaAlloc(sim_mem->arena, nsplines * sizeof(double*));
+        data->splineIndices = (int *) arenaAlloc(sim_mem->arena, nsplines * sizeof(int));
+        if ( ( data->splines == NULL ) || ( data->splineIndices == NULL ) ) { terminate_x_calc( sim_mem, 1 ); return; }   
         data->nsplines = nsplines;
         
         /* Initialize the pointers */
         for ( j = 0; j < nsplines; j++ )
             data->splines[j] = NULL;
-        
-        if (data->splines == NULL) { terminate_x_calc( sim_mem, 1 ); return; }   
     }
     
     if ( sensitivitySubset == 1 )
-        data->sensIndices = (int32_T *) mxGetData(mxGetField(arcondition, ic, "sensIndices"));
+        data->sensIndices = (int32_T *) mxGetData(conditionField(arcondition, im, ic, CF_sensIndices));
 	else
         data->sensIndices = NULL;
     
 	data->abort = abortSignal;
 	data->t = tstart;
+    data->prec = NULL;
+    data->cse = NULL;
 
 	data->qpositivex = qpositivex;
-	data->u = mxGetData(mxGetField(arcondition, ic, "uNum"));
-	data->p = mxGetData(mxGetField(arcondition, ic, "pNum"));
-	data->v = mxGetData(mxGetField(arcondition, ic, "vNum"));
-	data->dvdx = mxGetData(mxGetField(arcondition, ic, "dvdxNum"));
-	data->dvdu = mxGetData(mxGetField(arcondition, ic, "dvduNum"));
-	data->dvdp = mxGetData(mxGetField(arcondition, ic, "dvdpNum"));
+	data->u = mxGetData(conditionField(arcondition, im, ic, CF_uNum));
+	data->p = mxGetData(conditionField(arcondition, im, ic, CF_pNum));
+	data->v = mxGetData(conditionField(arcondition, im, ic, CF_vNum));
+	data->dvdx = mxGetData(conditionField(arcondition, im, ic, CF_dvdxNum));
+	data->dvdu = mxGetData(conditionField(arcondition, im, ic, CF_dvduNum));
+	data->dvdp = mxGetData(conditionField(arcondition, im, ic, CF_dvdpNum));
 
 	if ( sim_mem->sensi == 1 ) {
-        data->su = mxGetData(mxGetField(arcondition, ic, "suNum"));
-        data->sv = mxGetData(mxGetField(arcondition, ic, "svNum"));
+        data->su = mxGetData(conditionField(arcondition, im, ic, CF_suNum));
+        data->sv = mxGetData(conditionField(arcondition, im, ic, CF_svNum));
     }
 }
 
-int initializeEvents( SimMemory sim_mem, mxArray *arcondition, int ic, double tstart )
+/* Redirect the outputs and work arrays of a sensitivity block to private copies, so that the block */
+/* does not write to fields of ar which the first block of the condition is filling at the same time. */
+int privateBlockBuffers( SimMemory sim_mem, mxArray *arcondition, int im, int ic, double **returnx, double **returnu, double **returnv, double **returnsu, double **returndxdt, double **returndfdp0, double **teq )
+{
+    UserData data = sim_mem->data;
+    int fields[14] = { CF_xExpSimu, CF_uExpSimu, CF_vExpSimu, CF_suExpSimu, CF_dxdt, CF_ddxdtdp, CF_tEq,
+                       CF_uNum, CF_suNum, CF_vNum, CF_svNum, CF_dvdxNum, CF_dvduNum, CF_dvdpNum };
+    double **targets[14];
+    mxArray *field;
+    int j, n;
+    int total = 0;
+    
+    if ( fine == 1 ) {
+        fields[0] = CF_xFineSimu;
+        fields[1] = CF_uFineSimu;
+        fields[2] = CF_vFineSimu;
+        fields[3] = CF_suFineSimu;
+    }
+    targets[0] = returnx;       targets[1] = returnu;       targets[2] = returnv;       targets[3] = returnsu;
+    targets[4] = returndxdt;    targets[5] = returndfdp0;   targets[6] = teq;
+    targets[7] = &(data->u);    targets[8] = &(data->su);   targets[9] = &(data->v);    targets[10] = &(data->sv);
+    targets[11] = &(data->dvdx); targets[12] = &(data->dvdu); targets[13] = &(data->dvdp);
+    
+    for ( j = 0; j < 14; j++ )
+        total += (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, fields[j]));
+    
+    sim_mem->scratch = (double *) arenaAlloc( sim_mem->arena, ( total + 1 ) * sizeof(double) );
+    if ( sim_mem->scratch == NULL ) { terminate_x_calc( sim_mem, 1 ); return 0; }
+    
+    total = 0;
+    for ( j = 0; j < 14; j++ ) {
+        field = conditionField(arcondition, im, ic, fields[j]);
+        n = (int) mxGetNumberOfElements(field);
+        if ( n > 0 ) memcpy( sim_mem->scratch + total, mxGetData(field), n * sizeof(double) );
+        *(targets[j]) = sim_mem->scratch + total;
+        total += n;
+    }
+    
+    return 1;
+}
+
+int initializeEvents( SimMemory sim_mem, mxArray *arcondition, int im, int ic, double tstart )
 {
     int flag;
     int np = sim_mem->np;
@@ -1732,33 +3846,106 @@ int initializeEvents( SimMemory sim_mem, mxArray *arcondition, int ic, double ts
     EventData event_data = sim_mem->event_data;
     
 	/* Initialize event list (points where solver needs to be reinitialized) */
-	qEvents = init_list(arcondition, ic, tstart, &(event_data->n), &(event_data->t), &(event_data->i), "qEvents", "tEvents");        
+	qEvents = init_list(conditionField(arcondition, im, ic, CF_qEvents), conditionField(arcondition, im, ic, CF_tEvents), tstart, &(event_data->n), &(event_data->t), &(event_data->i));        
 
 	/* Allow state values and sensitivity values to be overwritten at events */
 	event_data->overrides = 1;
 
 	/* Grab additional data required for assignment operations */
 	/* Assignment operations are of the form Ax+B where X is the state variable */
-	flag = fetch_vector( arcondition, ic, &(event_data->value_A), "modx_A", neq*event_data->n );
+	flag = fetch_vector( conditionField(arcondition, im, ic, CF_modx_A), &(event_data->value_A), neq*event_data->n );
 	if ( flag < 0 ) { event_data->overrides = 0; };
-	flag = fetch_vector( arcondition, ic, &(event_data->value_B), "modx_B", neq*event_data->n );
+	flag = fetch_vector( conditionField(arcondition, im, ic, CF_modx_B), &(event_data->value_B), neq*event_data->n );
 	if ( flag < 0 ) { event_data->overrides = 0; };
-	flag = fetch_vector( arcondition, ic, &(event_data->sensValue_A), "modsx_A", neq*np*event_data->n );
+	flag = fetch_vector( conditionField(arcondition, im, ic, CF_modsx_A), &(event_data->sensValue_A), neq*np*event_data->n );
 	if ( flag < 0 ) { event_data->overrides = 0; };
-	flag = fetch_vector( arcondition, ic, &(event_data->sensValue_B), "modsx_B", neq*np*event_data->n );
+	flag = fetch_vector( conditionField(arcondition, im, ic, CF_modsx_B), &(event_data->sensValue_B), neq*np*event_data->n );
     if ( flag < 0 ) { event_data->overrides = 0; };
     
     return qEvents;
 }
 
+/* Prepare the state dependent events of model im (ar.model.triggerA, triggerB and triggerDirection). */
+/* Returns the number of triggers and -1 if the fields do not match the model.                     */
+int initializeTriggers( SimMemory sim_mem, int im )
+{
+    int j, nRoots;
+    int np = sim_mem->np;
+    int neq = sim_mem->neq;
+    double *direction;
+    mxArray *directionField = modelField(im, MF_triggerDirection);
+    mxArray *AField = modelField(im, MF_triggerA);
+    mxArray *BField = modelField(im, MF_triggerB);
+    EventData event_data = sim_mem->event_data;
+    
+    event_data->nRoots = 0;
+    if ( ( neq == 0 ) || ( directionField == NULL ) || ( mxGetNumberOfElements(directionField) == 0 ) )
+        return 0;
+    
+    nRoots = (int) mxGetNumberOfElements(directionField);
+    if ( ( AField == NULL ) || ( BField == NULL ) || ( (int) mxGetNumberOfElements(AField) != nRoots*neq ) || ( (int) mxGetNumberOfElements(BField) != nRoots*neq ) )
+        return -1;
+    
+    event_data->rootValue_A     = mxGetData(AField);
+    event_data->rootValue_B     = mxGetData(BField);
+    event_data->rootsFound      = (int *) arenaAlloc(sim_mem->arena, nRoots * sizeof(int));
+    event_data->rootDirection   = (int *) arenaAlloc(sim_mem->arena, nRoots * sizeof(int));
+    event_data->dgdx            = (double *) arenaAlloc(sim_mem->arena, nRoots * neq * sizeof(double));
+    event_data->dgdp            = (double *) arenaAlloc(sim_mem->arena, ( nRoots * np + 1 ) * sizeof(double));
+    event_data->dgdt            = (double *) arenaAlloc(sim_mem->arena, nRoots * sizeof(double));
+    event_data->fPre            = (double *) arenaAlloc(sim_mem->arena, neq * sizeof(double));
+    event_data->fPost           = (double *) arenaAlloc(sim_mem->arena, neq * sizeof(double));
+    if ( !event_data->rootsFound || !event_data->rootDirection || !event_data->dgdx || !event_data->dgdp || !event_data->dgdt || !event_data->fPre || !event_data->fPost )
+        return -1;
+    
+    direction = mxGetData(directionField);
+    for ( j = 0; j < nRoots; j++ )
+        event_data->rootDirection[j] = (int) direction[j];
+    
+    event_data->nRoots = nRoots;
+    return nRoots;
+}
+
+/* Prepare the banded preconditioner of the Krylov solvers (krylovPrecSetup), the sparse Jacobian of the */
+/* model is evaluated into Js. Returns 0 if the memory could not be allocated.                          */
+int initializeKrylov( SimMemory sim_mem, int im, int isim, int nnz )
+{
+    int neq = sim_mem->neq;
+    int bw = krylovBandwidth;
+    KrylovPrec *prec;
+    
+    if ( bw > neq - 1 ) bw = neq - 1;
+    if ( bw < 0 ) bw = 0;
+    
+    prec = (KrylovPrec *) arenaAlloc(sim_mem->arena, sizeof(KrylovPrec));
+    if ( prec == NULL ) return 0;
+    prec->im = im;
+    prec->ic = isim;
+    prec->N = neq;
+    prec->bandwidth = bw;
+    prec->Js = (SlsMat) arenaAlloc(sim_mem->arena, sizeof *prec->Js);
+    prec->Jband = (double *) arenaAlloc(sim_mem->arena, ( 2 * bw + 1 ) * neq * sizeof(double));
+    prec->P = (double *) arenaAlloc(sim_mem->arena, ( 3 * bw + 1 ) * neq * sizeof(double));
+    prec->ipiv = (mwSignedIndex *) arenaAlloc(sim_mem->arena, neq * sizeof(mwSignedIndex));
+    if ( !prec->Js || !prec->Jband || !prec->P || !prec->ipiv ) return 0;
+    
+    prec->Js->M = neq;
+    prec->Js->N = neq;
+    prec->Js->NNZ = nnz;
+    prec->Js->data = (realtype *) arenaAlloc(sim_mem->arena, nnz * sizeof(realtype));
+    prec->Js->rowvals = (int *) arenaAlloc(sim_mem->arena, nnz * sizeof(int));
+    prec->Js->colptrs = (int *) arenaAlloc(sim_mem->arena, ( neq + 1 ) * sizeof(int));
+    if ( !prec->Js->data || !prec->Js->rowvals || !prec->Js->colptrs ) return 0;
+    
+    sim_mem->data->prec = prec;
+    return 1;
+}
+
 /* This function loads a vector/matrix from MATLAB and checks it against desired length */
-int fetch_vector( mxArray* arcondition, int ic, double **vector, const char* fieldname, int desiredLength ) {
+int fetch_vector( mxArray* field, double **vector, int desiredLength ) {
     
-    mxArray *field;
     int nPoints;      
     
-    field = mxGetField(arcondition, ic, fieldname);
-
     if ( field != NULL )
     {
         /* Check whether vector has the desired length */
@@ -1771,7 +3958,7 @@ int fetch_vector( mxArray* arcondition, int ic, double **vector, const char* fie
         /* Wrong length => warn! */
         if (nPoints != desiredLength)
         {
-           printf( "Warning, mod vector has incorrect size -> overrides disabled\n" );
+           logPrint( "Warning, mod vector has incorrect size -> overrides disabled\n" );
            return -1;
         }
 
@@ -1789,7 +3976,7 @@ void terminate_x_calc( SimMemory sim_mem, double status )
     /* Something is seriously wrong */
 	if ( sim_mem == NULL )
     {
-        mexPrintf( "FATAL ERROR: Simulation memory is null upon terminate_x_calc!" );
+        logPrint( "FATAL ERROR: Simulation memory is null upon terminate_x_calc!" );
 		return;
     }
 
@@ -1804,14 +3991,15 @@ void terminate_x_calc( SimMemory sim_mem, double status )
 }
 
 /* This function initializes time point lists */
-int init_list( mxArray* arcondition, int ic, double tstart, int* nPoints, double** timePoints, int* currentIndex, const char* flagFieldName, const char* timePointFieldName ) {
+int init_list( mxArray* flagField, mxArray* timePointField, double tstart, int* nPoints, double** timePoints, int* currentIndex ) {
     int ID, flag;
     double *time;
           
-    flag = (int) mxGetScalar(mxGetField(arcondition, ic, flagFieldName));
+    /* Conditions which were linked without this list */
+    if ( flagField == NULL ) return 0;
+    
+    flag = (int) mxGetScalar(flagField);
     if (flag==1) {
-        mxArray *timePointField = mxGetField(arcondition, ic, timePointFieldName);
-
         if ( timePointField != NULL ) {
              time = (double*) mxGetData( timePointField );
              *nPoints = (int) mxGetNumberOfElements( timePointField );
@@ -1854,35 +4042,35 @@ void z_calc(int im, int ic, int isim, mxArray *arcondition, int sensi) {
     
     /* MATLAB values */
     if(fine == 1){
-        t = mxGetData(mxGetField(arcondition, ic, "tFine"));
-        nt = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tFine"));
+        t = mxGetData(conditionField(arcondition, im, ic, CF_tFine));
+        nt = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tFine));
         
-        u = mxGetData(mxGetField(arcondition, ic, "uFineSimu"));
-        x = mxGetData(mxGetField(arcondition, ic, "xFineSimu"));
-        z = mxGetData(mxGetField(arcondition, ic, "zFineSimu"));
+        u = mxGetData(conditionField(arcondition, im, ic, CF_uFineSimu));
+        x = mxGetData(conditionField(arcondition, im, ic, CF_xFineSimu));
+        z = mxGetData(conditionField(arcondition, im, ic, CF_zFineSimu));
         if (sensi == 1) {
-            su = mxGetData(mxGetField(arcondition, ic, "suFineSimu"));
-            sx = mxGetData(mxGetField(arcondition, ic, "sxFineSimu"));
-            sz = mxGetData(mxGetField(arcondition, ic, "szFineSimu"));
+            su = mxGetData(conditionField(arcondition, im, ic, CF_suFineSimu));
+            sx = mxGetData(conditionField(arcondition, im, ic, CF_sxFineSimu));
+            sz = mxGetData(conditionField(arcondition, im, ic, CF_szFineSimu));
         }
     }
     else{
-        t = mxGetData(mxGetField(arcondition, ic, "tExp"));
-        nt = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tExp"));
+        t = mxGetData(conditionField(arcondition, im, ic, CF_tExp));
+        nt = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tExp));
         
-        u = mxGetData(mxGetField(arcondition, ic, "uExpSimu"));
-        x = mxGetData(mxGetField(arcondition, ic, "xExpSimu"));
-        z = mxGetData(mxGetField(arcondition, ic, "zExpSimu"));
-	dzdx = mxGetData(mxGetField(arcondition, ic, "dzdx"));
+        u = mxGetData(conditionField(arcondition, im, ic, CF_uExpSimu));
+        x = mxGetData(conditionField(arcondition, im, ic, CF_xExpSimu));
+        z = mxGetData(conditionField(arcondition, im, ic, CF_zExpSimu));
+	dzdx = mxGetData(conditionField(arcondition, im, ic, CF_dzdx));
         if (sensi == 1) {
-            su = mxGetData(mxGetField(arcondition, ic, "suExpSimu"));
-            sx = mxGetData(mxGetField(arcondition, ic, "sxExpSimu"));
-            sz = mxGetData(mxGetField(arcondition, ic, "szExpSimu"));
+            su = mxGetData(conditionField(arcondition, im, ic, CF_suExpSimu));
+            sx = mxGetData(conditionField(arcondition, im, ic, CF_sxExpSimu));
+            sz = mxGetData(conditionField(arcondition, im, ic, CF_szExpSimu));
         }
     }
-    p = mxGetData(mxGetField(arcondition, ic, "pNum"));
-    np = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "pNum"));
-    nx = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "dxdt"));
+    p = mxGetData(conditionField(arcondition, im, ic, CF_pNum));
+    np = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_pNum));
+    nx = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_dxdt));
     
     /* loop over output points */
     for (it=0; it < nt; it++) {
@@ -1932,63 +4120,63 @@ void y_calc(int im, int id, mxArray *ardata, mxArray *arcondition, int sensi) {
     
     
     /* MATLAB values */
-    ic = (int) mxGetScalar(mxGetField(ardata, id, "cLink")) - 1;
-    has_yExp = safeGetToggle(ardata, id, "has_yExp");
+    ic = (int) mxGetScalar(dataField(ardata, im, id, DF_cLink)) - 1;
+    has_yExp = safeGetToggle(dataField(ardata, im, id, DF_has_yExp));
     
-    ny = (int) mxGetNumberOfElements(mxGetField(ardata, id, "y"));
-    qlogy = mxGetData(mxGetField(ardata, id, "logfitting"));
+    ny = (int) mxGetNumberOfElements(dataField(ardata, im, id, DF_y));
+    qlogy = mxGetData(dataField(ardata, im, id, DF_logfitting));
     /*qlogp = mxGetData(mxGetField(ardata, id, "qLog10"));*/
-    p = mxGetData(mxGetField(ardata, id, "pNum"));
-    np = (int) mxGetNumberOfElements(mxGetField(ardata, id, "pNum"));
+    p = mxGetData(dataField(ardata, im, id, DF_pNum));
+    np = (int) mxGetNumberOfElements(dataField(ardata, im, id, DF_pNum));
     
     if(fine == 1){
-        t = mxGetData(mxGetField(ardata, id, "tFine"));
-        nt = (int) mxGetNumberOfElements(mxGetField(ardata, id, "tFine"));
-        tlink = mxGetData(mxGetField(ardata, id, "tLinkFine"));
-        ntlink = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tFine"));
+        t = mxGetData(dataField(ardata, im, id, DF_tFine));
+        nt = (int) mxGetNumberOfElements(dataField(ardata, im, id, DF_tFine));
+        tlink = mxGetData(dataField(ardata, im, id, DF_tLinkFine));
+        ntlink = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tFine));
         
-        y = mxGetData(mxGetField(ardata, id, "yFineSimu"));
-        ystd = mxGetData(mxGetField(ardata, id, "ystdFineSimu"));
+        y = mxGetData(dataField(ardata, im, id, DF_yFineSimu));
+        ystd = mxGetData(dataField(ardata, im, id, DF_ystdFineSimu));
         
-        u = mxGetData(mxGetField(arcondition, ic, "uFineSimu"));
-        x = mxGetData(mxGetField(arcondition, ic, "xFineSimu"));
-        z = mxGetData(mxGetField(arcondition, ic, "zFineSimu"));
+        u = mxGetData(conditionField(arcondition, im, ic, CF_uFineSimu));
+        x = mxGetData(conditionField(arcondition, im, ic, CF_xFineSimu));
+        z = mxGetData(conditionField(arcondition, im, ic, CF_zFineSimu));
         
         if (sensi == 1) {
-            sy = mxGetData(mxGetField(ardata, id, "syFineSimu"));
-            systd = mxGetData(mxGetField(ardata, id, "systdFineSimu"));
+            sy = mxGetData(dataField(ardata, im, id, DF_syFineSimu));
+            systd = mxGetData(dataField(ardata, im, id, DF_systdFineSimu));
             
-            su = mxGetData(mxGetField(arcondition, ic, "suFineSimu"));
-            sx = mxGetData(mxGetField(arcondition, ic, "sxFineSimu"));
-            sz = mxGetData(mxGetField(arcondition, ic, "szFineSimu"));
+            su = mxGetData(conditionField(arcondition, im, ic, CF_suFineSimu));
+            sx = mxGetData(conditionField(arcondition, im, ic, CF_sxFineSimu));
+            sz = mxGetData(conditionField(arcondition, im, ic, CF_szFineSimu));
         }
     }
     else{
-        t = mxGetData(mxGetField(ardata, id, "tExp"));
-        nt = (int) mxGetNumberOfElements(mxGetField(ardata, id, "tExp"));
-        tlink = mxGetData(mxGetField(ardata, id, "tLinkExp"));
-        ntlink = (int) mxGetNumberOfElements(mxGetField(arcondition, ic, "tExp"));
+        t = mxGetData(dataField(ardata, im, id, DF_tExp));
+        nt = (int) mxGetNumberOfElements(dataField(ardata, im, id, DF_tExp));
+        tlink = mxGetData(dataField(ardata, im, id, DF_tLinkExp));
+        ntlink = (int) mxGetNumberOfElements(conditionField(arcondition, im, ic, CF_tExp));
         
-        y = mxGetData(mxGetField(ardata, id, "yExpSimu"));
-        ystd = mxGetData(mxGetField(ardata, id, "ystdExpSimu"));
+        y = mxGetData(dataField(ardata, im, id, DF_yExpSimu));
+        ystd = mxGetData(dataField(ardata, im, id, DF_ystdExpSimu));
         
-	y_scale = mxGetData(mxGetField(ardata, id, "y_scale"));
-	dzdx = mxGetData(mxGetField(arcondition, ic, "dzdx"));
-        u = mxGetData(mxGetField(arcondition, ic, "uExpSimu"));
-        x = mxGetData(mxGetField(arcondition, ic, "xExpSimu"));
-        z = mxGetData(mxGetField(arcondition, ic, "zExpSimu"));
+	y_scale = mxGetData(dataField(ardata, im, id, DF_y_scale));
+	dzdx = mxGetData(conditionField(arcondition, im, ic, CF_dzdx));
+        u = mxGetData(conditionField(arcondition, im, ic, CF_uExpSimu));
+        x = mxGetData(conditionField(arcondition, im, ic, CF_xExpSimu));
+        z = mxGetData(conditionField(arcondition, im, ic, CF_zExpSimu));
         
         if (sensi == 1) {
-            sy = mxGetData(mxGetField(ardata, id, "syExpSimu"));
-            systd = mxGetData(mxGetField(ardata, id, "systdExpSimu"));
+            sy = mxGetData(dataField(ardata, im, id, DF_syExpSimu));
+            systd = mxGetData(dataField(ardata, im, id, DF_systdExpSimu));
             
-            su = mxGetData(mxGetField(arcondition, ic, "suExpSimu"));
-            sx = mxGetData(mxGetField(arcondition, ic, "sxExpSimu"));
-            sz = mxGetData(mxGetField(arcondition, ic, "szExpSimu"));
+            su = mxGetData(conditionField(arcondition, im, ic, CF_suExpSimu));
+            sx = mxGetData(conditionField(arcondition, im, ic, CF_sxExpSimu));
+            sz = mxGetData(conditionField(arcondition, im, ic, CF_szExpSimu));
         }
         
         if (has_yExp == 1) {
-            yexp = mxGetData(mxGetField(ardata, id, "yExp"));
+            yexp = mxGetData(dataField(ardata, im, id, DF_yExp));
         }
     }
     
@@ -2007,7 +4195,7 @@ void y_calc(int im, int id, mxArray *ardata, mxArray *arcondition, int sensi) {
         for (iy=0; iy<ny; iy++) {
             if(qlogy[iy] > 0.5){
                 if(y[it + (iy*nt)]<-cvodes_atol){ 
-                    printf("WARNING, check for concentrations <= 0 in data %d and observable %d !!!\n", id+1, iy+1);
+                    logPrint("WARNING, check for concentrations <= 0 in data %d and observable %d !!!\n", id+1, iy+1);
                 }else{
                     y[it + (iy*nt)] = log10(y[it + (iy*nt)]);
                 }
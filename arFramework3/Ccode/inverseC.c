@@ -1,97 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "inverseC.h"
-#include "blas.h"
+#include "udata.h"
+#include "arLog.h"
+#include "klu.h"
 #include "lapack.h"
 
-#define DEBUGPRINT0(DBGMODE, LVL, STR) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR ); mexEvalString("drawnow;"); } }
-#define DEBUGPRINT1(DBGMODE, LVL, STR, ARG1) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1 ); mexEvalString("drawnow;"); } }
-#define DEBUGPRINT2(DBGMODE, LVL, STR, ARG1, ARG2) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1, ARG2 ); mexEvalString("drawnow;"); } }
-#define DEBUGPRINT3(DBGMODE, LVL, STR, ARG1, ARG2, ARG3) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1, ARG2, ARG3 ); mexEvalString("drawnow;"); } }
-#define DEBUGPRINT4(DBGMODE, LVL, STR, ARG1, ARG2, ARG3, ARG4) { if ( DBGMODE > LVL ) { mexPrintf( " [D] " ); mexPrintf( STR, ARG1, ARG2, ARG3, ARG4 ); mexEvalString("drawnow;"); } }
+#define DEBUGPRINT0(DBGMODE, LVL, STR) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR ); } }
+#define DEBUGPRINT1(DBGMODE, LVL, STR, ARG1) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1 ); } }
+#define DEBUGPRINT2(DBGMODE, LVL, STR, ARG1, ARG2) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1, ARG2 ); } }
+#define DEBUGPRINT3(DBGMODE, LVL, STR, ARG1, ARG2, ARG3) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1, ARG2, ARG3 ); } }
+#define DEBUGPRINT4(DBGMODE, LVL, STR, ARG1, ARG2, ARG3, ARG4) { if ( DBGMODE > LVL ) { logPrint( " [D] " ); logPrint( STR, ARG1, ARG2, ARG3, ARG4 ); } }
 
-/* Invert a matrix using LAPACK */
-void invert(double* mat, mwSignedIndex workSize, double *workmem, mwSignedIndex *ipiv, mwSignedIndex N)
+/* Maximum norm of a vector */
+double maxNorm( double *f, int N )
 {
-    mwSignedIndex errorCode;
-    
-    dgetrf(&N,&N,mat,&N,ipiv,&errorCode);
-    dgetri(&N,mat,&N,ipiv,workmem,&workSize,&errorCode);
-};
+    int i;
+    double maxAbs = 0.0;
 
-/* Matrix multiply for the rootfinding using BLAS */
-void mmultiply(double* invdfdx, double* f, double *result, mwSignedIndex N)
-{
-    char *chn1 = "N";
-    char *chn2 = "N";
-    mwSignedIndex intone = 1;
-    double one = 1.0;
-    double zero = 0.0;
-    
-    dgemm(chn1, chn2, &N, &intone, &N, &one, invdfdx, &N, f, &N, &zero, result, &N);
-};
+    for ( i = 0; i < N; i++ )
+        maxAbs = ( maxAbs > fabs(f[i]) ) ? maxAbs : fabs(f[i]);
 
-/* Single Newton-Raphson step */
-double NRstep( double *xptr, double* dfdx, double* f, double *tmp, mwSignedIndex workSize, double *workmem, mwSignedIndex *ipiv, int N )
+    return maxAbs;
+}
+
+/* Evaluate dfdx at x and factorize it. Dense Jacobians are LU factored by LAPACK. For sparse Jacobians the */
+/* ordering of KLU is computed once; subsequent factorizations reuse the pivot sequence (klu_refactor)       */
+/* and only fall back to a fresh factorization when refactoring fails.                                      */
+int newtonFactor( NewtonSystem *sys, int im, int isim, double t, N_Vector x, void *user_data )
 {
-    double maxAbs;
-    int i;
-           
-    invert(dfdx, workSize, workmem, ipiv, N);
-    mmultiply( dfdx, f, tmp, N );
+    mwSignedIndex N = sys->N;
+    mwSignedIndex info;
 
-    maxAbs = 0.0;
-    for ( i = 0; i < N; i++ )
+    if ( sys->sparse )
     {
-        xptr[i] = xptr[i] - tmp[i];
-        maxAbs = ( maxAbs > fabs(tmp[i]) ) ? maxAbs : fabs(tmp[i]);
+        getdfxdx_sparse( im, isim, t, x, sys->Js, user_data );
+        if ( sys->symbolic == NULL )
+        {
+            sys->symbolic = klu_analyze( sys->N, sys->Js->colptrs, sys->Js->rowvals, &(sys->common) );
+            if ( sys->symbolic == NULL ) return -1;
+        }
+        if ( ( sys->numeric != NULL ) && klu_refactor( sys->Js->colptrs, sys->Js->rowvals, sys->Js->data, sys->symbolic, sys->numeric, &(sys->common) ) )
+            return 0;
+
+        if ( sys->numeric != NULL ) klu_free_numeric( &(sys->numeric), &(sys->common) );
+        sys->numeric = klu_factor( sys->Js->colptrs, sys->Js->rowvals, sys->Js->data, sys->symbolic, &(sys->common) );
+        return ( sys->numeric == NULL ) ? -1 : 0;
     }
-    
-    return maxAbs;
-};
 
-/* Simple rootfinding function */
-double solveSS( int debugMode, mxArray *arcondition, int im, int ic, int isim, double t, N_Vector x, void *user_data, double tol )
+    getdfxdx( im, isim, t, x, sys->J, user_data );
+    dgetrf( &N, &N, sys->J, &N, sys->ipiv, &info );
+    return ( info == 0 ) ? 0 : -1;
+}
+
+/* Solve dfdx dx = b with the current factorization. b is overwritten with dx */
+int newtonSolve( NewtonSystem *sys, double *b )
 {
-    int i;
+    mwSignedIndex N = sys->N;
+    mwSignedIndex nrhs = 1;
+    mwSignedIndex info;
+
+    if ( sys->sparse )
+        return klu_solve( sys->symbolic, sys->numeric, sys->N, 1, b, &(sys->common) ) ? 0 : -1;
+
+    dgetrs( "N", &N, &nrhs, sys->J, &N, sys->ipiv, b, &N, &info );
+    return ( info == 0 ) ? 0 : -1;
+}
+
+/* LU factorization of the dense N x N matrix A (column major), A is overwritten by its factors */
+int denseFactor( double *A, mwSignedIndex *ipiv, int N )
+{
+    mwSignedIndex n = N;
+    mwSignedIndex info;
+
+    dgetrf( &n, &n, A, &n, ipiv, &info );
+    return ( info == 0 ) ? 0 : -1;
+}
+
+/* Solve A x = b with the factors of denseFactor. b is overwritten with x */
+int denseSolve( double *A, mwSignedIndex *ipiv, double *b, int N )
+{
+    mwSignedIndex n = N;
+    mwSignedIndex nrhs = 1;
+    mwSignedIndex info;
+
+    dgetrs( "N", &n, &nrhs, A, &n, ipiv, b, &n, &info );
+    return ( info == 0 ) ? 0 : -1;
+}
+
+/* Free the factorization and the Jacobian of the Newton iteration */
+static void freeNewtonSystem( NewtonSystem *sys )
+{
+    if ( sys->sparse ) {
+        if ( sys->numeric != NULL ) klu_free_numeric( &(sys->numeric), &(sys->common) );
+        if ( sys->symbolic != NULL ) klu_free_symbolic( &(sys->symbolic), &(sys->common) );
+        if ( sys->Js != NULL ) DestroySparseMat( sys->Js );
+    } else {
+        free( sys->J );
+        free( sys->ipiv );
+    }
+}
+
+/* Damped Newton iteration for f(x) = 0, started from and returning the solution in x. The factorization of  */
+/* dfdx is kept for as long as full steps reduce max|f| fast enough (chord iterations). Otherwise the step is */
+/* halved until the residual decreases sufficiently; if that fails with an outdated Jacobian, dfdx is        */
+/* refreshed and the step repeated. Returns 0 when max|f| < tol and -1 if the iteration does not converge,   */
+/* in which case x holds the last accepted iterate, and -2 if the memory could not be allocated.            */
+int solveSS( int debugMode, int im, int isim, double t, N_Vector x, void *user_data, double tol, int sparse, int nnz )
+{
+    NewtonSystem sys;
+    int i, k;
     int N;
-    int iterationLimit;
-    double maxAbs;
+    int factored, fresh, accepted, result;
     double *xptr;
-	double *dfdx;
     double *f;
-    double *tmp;
-    mwSignedIndex *ipiv;
-    double *workmem;
-    mwSignedIndex workSize;
-       
-    xptr            = N_VGetArrayPointer(x);
-    dfdx            = mxGetData(mxGetField(arcondition, ic, "dfdxNum"));
-    f               = mxGetData(mxGetField(arcondition, ic, "dxdt"));
-    N               = mxGetNumberOfElements(mxGetField(arcondition, ic, "dxdt"));
-    workSize        = N*N;
-    iterationLimit  = 100;
-    maxAbs          = 100000000.0;
-    
+    double *dx;
+    double *xold;
+    double fnorm, fnormTrial, lambda;
+
+    xptr    = N_VGetArrayPointer(x);
+    N       = NV_LENGTH_S(x);
+
+    sys.N           = N;
+    sys.sparse      = sparse;
+    sys.J           = NULL;
+    sys.ipiv        = NULL;
+    sys.Js          = NULL;
+    sys.symbolic    = NULL;
+    sys.numeric     = NULL;
+    if ( sparse ) {
+        klu_defaults( &(sys.common) );
+        sys.Js      = NewSparseMat( N, N, nnz );
+    } else {
+        sys.J       = (double *) malloc( sizeof(double) * N * N );
+        sys.ipiv    = (mwSignedIndex *) malloc( sizeof(mwSignedIndex) * N );
+    }
+
     /* Allocate temporary storage for calculations */
-    tmp = (double *)malloc( sizeof( double ) * N );
-    ipiv = (mwSignedIndex *) malloc( sizeof(mwSignedIndex) * (N+1) );
-    workmem = (double *) malloc( sizeof(double) * workSize );    
-    
-    /* Perform Newton Raphson until convergence or abort */
-    i = 0;
-    while( ( maxAbs > tol ) && ( i < iterationLimit ) )
+    f       = (double *) malloc( sizeof(double) * N );
+    dx      = (double *) malloc( sizeof(double) * N );
+    xold    = (double *) malloc( sizeof(double) * N );
+
+    if ( ( sparse ? ( sys.Js == NULL ) : ( !sys.J || !sys.ipiv ) ) || !f || !dx || !xold ) {
+        freeNewtonSystem( &sys );
+        free(f);
+        free(dx);
+        free(xold);
+        return -2;
+    }
+
+    fx( t, x, f, user_data, im, isim );
+    fnorm       = maxNorm( f, N );
+    factored    = 0;
+    fresh       = 0;
+    result      = -1;
+
+    for ( i = 0; i < SS_NEWTON_MAXITER; i++ )
     {
-        DEBUGPRINT3( debugMode, 9, "Rootfinding iteration %d: Maximum absolute dx: %g (tolerance = %g)\n", i, maxAbs, tol );
-        fx( t, x, f, user_data, im, isim );                                 /* Compute RHS and store in f */
-        getdfxdx( im, isim, t, x, dfdx, user_data );                        /* Updates dvdx and stores dfxdx */
-        maxAbs = NRstep( xptr, dfdx, f, tmp, workSize, workmem, ipiv, N );  /* Perform Newton-Raphson step */
-        i++;
+        DEBUGPRINT3( debugMode, 9, "Rootfinding iteration %d: max|f| = %g (tolerance = %g)\n", i, fnorm, tol );
+        if ( !mxIsFinite( fnorm ) ) break;
+        if ( fnorm < tol ) { result = 0; break; }
+
+        if ( !factored )
+        {
+            if ( newtonFactor( &sys, im, isim, t, x, user_data ) < 0 ) {
+                DEBUGPRINT0( debugMode, 4, "Rootfinding: singular Jacobian\n" );
+                break;
+            }
+            factored = 1;
+            fresh = 1;
+        }
+
+        /* Newton direction */
+        for ( k = 0; k < N; k++ ) dx[k] = -f[k];
+        if ( newtonSolve( &sys, dx ) < 0 ) break;
+
+        /* Backtracking until the residual decreases sufficiently */
+        memcpy( xold, xptr, sizeof(double) * N );
+        accepted = 0;
+        for ( lambda = 1.0; lambda >= SS_NEWTON_MINSTEP; lambda *= 0.5 )
+        {
+            for ( k = 0; k < N; k++ ) xptr[k] = xold[k] + lambda * dx[k];
+            fx( t, x, f, user_data, im, isim );
+            fnormTrial = maxNorm( f, N );
+            if ( mxIsFinite( fnormTrial ) && ( fnormTrial <= ( 1.0 - SS_NEWTON_DECREASE * lambda ) * fnorm ) ) {
+                accepted = 1;
+                break;
+            }
+        }
+
+        if ( !accepted )
+        {
+            memcpy( xptr, xold, sizeof(double) * N );
+            fx( t, x, f, user_data, im, isim );
+
+            /* Not even the current Jacobian yields descent */
+            if ( fresh ) {
+                DEBUGPRINT1( debugMode, 4, "Rootfinding: line search failed at max|f| = %g\n", fnorm );
+                break;
+            }
+            factored = 0;
+            continue;
+        }
+
+        /* Keep the factorization while full steps converge fast enough */
+        if ( ( lambda < 1.0 ) || ( fnormTrial > SS_NEWTON_RATE * fnorm ) ) factored = 0;
+        fresh = 0;
+        fnorm = fnormTrial;
     }
-    DEBUGPRINT3( debugMode, 9, "Final absolute at interation %d = dx: %g (tolerance = %g)\n", i, maxAbs, tol );
+    if ( ( result != 0 ) && mxIsFinite( fnorm ) && ( fnorm < tol ) ) result = 0;
+    DEBUGPRINT3( debugMode, 9, "Rootfinding finished after %d iterations: max|f| = %g (tolerance = %g)\n", i, fnorm, tol );
+
+    freeNewtonSystem( &sys );
+    free(f);
+    free(dx);
+    free(xold);
+
+    return result;
+}
+
+/* Preconditioner setup of the Krylov solvers. The band of the sparse Jacobian is only re-evaluated when   */
+/* CVODES signals that the saved one is outdated (jok false); I - gamma*J is factorized by LAPACK (dgbtrf). */
+/* A singular P is reported as a recoverable failure, so that CVODES retries with a smaller step.          */
+int krylovPrecSetup( realtype t, N_Vector x, N_Vector fx, booleantype jok, booleantype *jcurPtr, realtype gamma, void *user_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3 )
+{
+    KrylovPrec *prec = (KrylovPrec *) ((UserData) user_data)->prec;
+    mwSignedIndex N = prec->N;
+    mwSignedIndex kl = prec->bandwidth;
+    mwSignedIndex ldj = 2 * kl + 1;
+    mwSignedIndex ldab = 3 * kl + 1;
+    mwSignedIndex info;
+    int i, j, k;
+
+    if ( jok ) {
+        *jcurPtr = FALSE;
+    } else {
+        getdfxdx_sparse( prec->im, prec->ic, t, x, prec->Js, user_data );
+        memset( prec->Jband, 0, ldj * N * sizeof(double) );
+        for ( j = 0; j < N; j++ ) {
+            for ( k = prec->Js->colptrs[j]; k < prec->Js->colptrs[j+1]; k++ ) {
+                i = prec->Js->rowvals[k];
+                if ( abs( i - j ) <= kl )
+                    prec->Jband[ kl + i - j + j * ldj ] = prec->Js->data[k];
+            }
+        }
+        *jcurPtr = TRUE;
+    }
+
+    /* P = I - gamma*J, rows kl ... 3kl of each column hold the band, the leading kl rows the fill-in of dgbtrf */
+    memset( prec->P, 0, ldab * N * sizeof(double) );
+    for ( j = 0; j < N; j++ ) {
+        for ( k = 0; k < ldj; k++ )
+            prec->P[ kl + k + j * ldab ] = -gamma * prec->Jband[ k + j * ldj ];
+        prec->P[ 2 * kl + j * ldab ] += 1.0;
+    }
+    dgbtrf( &N, &N, &kl, &kl, prec->P, &ldab, prec->ipiv, &info );
+
+    return ( info == 0 ) ? 0 : 1;
+}
+
+/* Preconditioner solve of the Krylov solvers: z = P^-1 r */
+int krylovPrecSolve( realtype t, N_Vector x, N_Vector fx, N_Vector r, N_Vector z, realtype gamma, realtype delta, int lr, void *user_data, N_Vector tmp )
+{
+    KrylovPrec *prec = (KrylovPrec *) ((UserData) user_data)->prec;
+    mwSignedIndex N = prec->N;
+    mwSignedIndex kl = prec->bandwidth;
+    mwSignedIndex ldab = 3 * kl + 1;
+    mwSignedIndex nrhs = 1;
+    mwSignedIndex info;
+
+    N_VScale( 1.0, r, z );
+    dgbtrs( "N", &N, &kl, &kl, &nrhs, prec->P, &ldab, prec->ipiv, N_VGetArrayPointer(z), &N, &info );
+
+    return ( info == 0 ) ? 0 : -1;
+}
+
+/* Steady state sensitivities of a system with conserved moieties. The trailing columns of Q in dfdx P = Q R   */
+/* span the left null space W of dfdx. The stacked system [dfdx; W'] sx = [-dfdp; W' sx0] is then solved in    */
+/* the least squares sense; its residual vanishes when the conservation laws do not depend on the parameters. */
+int conservedSensitivities( double *dfdx, double *dfdp, double *sx0, double *sx, int N, int np )
+{
+    mwSignedIndex n, nrhs, m, mmax, rank, info, lwork, lworkQR, lworkLS;
+    mwSignedIndex *jpvt;
+    double *A, *M, *B, *tau, *work, *scale;
+    double query, rmax, residual;
+    int i, j, k, ip, nc, result;
     
-    free(tmp);
-    free(ipiv);
-    free(workmem);
+    n       = N;
+    nrhs    = np;
+    mmax    = 2*N;
     
-    return maxAbs;
+    A       = (double *) malloc( sizeof(double) * N * N );
+    M       = (double *) malloc( sizeof(double) * mmax * N );
+    B       = (double *) malloc( sizeof(double) * mmax * np );
+    tau     = (double *) malloc( sizeof(double) * N );
+    scale   = (double *) malloc( sizeof(double) * np );
+    jpvt    = (mwSignedIndex *) malloc( sizeof(mwSignedIndex) * N );
+    work    = NULL;
+    
+    /* Workspace for the largest possible stacked system */
+    if ( A && M && B && tau && scale && jpvt ) {
+        lwork = -1;
+        dgeqp3( &n, &n, A, &n, jpvt, tau, &query, &lwork, &info );
+        lworkQR = (mwSignedIndex) query;
+        dgels( "N", &mmax, &n, &nrhs, M, &mmax, B, &mmax, &query, &lwork, &info );
+        lworkLS = (mwSignedIndex) query;
+        lwork = 4*N;
+        if ( lworkQR > lwork ) lwork = lworkQR;
+        if ( lworkLS > lwork ) lwork = lworkLS;
+        work = (double *) malloc( sizeof(double) * lwork );
+    }
+    
+    result = -1;
+    if ( A && M && B && tau && scale && work && jpvt ) {
+        memcpy( A, dfdx, sizeof(double) * N * N );
+        for ( k = 0; k < N; k++ ) jpvt[k] = 0;
+        dgeqp3( &n, &n, A, &n, jpvt, tau, work, &lwork, &info );
+        
+        if ( info == 0 ) {
+            rmax = fabs( A[0] );
+            rank = 0;
+            for ( k = 0; k < N; k++ )
+                if ( fabs( A[k + k*N] ) > SS_SENSI_RANKTOL * rmax ) rank++;
+            nc = N - (int) rank;
+            m = N + nc;
+            dorgqr( &n, &n, &n, A, &n, tau, work, &lwork, &info );
+        }
+        
+        if ( info == 0 ) {
+            /* Stack dfdx sx = -dfdp and W' sx = W' sx0 */
+            for ( k = 0; k < N; k++ ) {
+                for ( i = 0; i < N; i++ ) M[i + k*m] = dfdx[i + k*N];
+                for ( j = 0; j < nc; j++ ) M[N + j + k*m] = A[k + (rank + j)*N];
+            }
+            for ( ip = 0; ip < np; ip++ ) {
+                scale[ip] = 0.0;
+                for ( i = 0; i < N; i++ ) {
+                    B[i + ip*m] = -dfdp[i + ip*N];
+                    scale[ip] += dfdp[i + ip*N] * dfdp[i + ip*N];
+                }
+                for ( j = 0; j < nc; j++ ) {
+                    B[N + j + ip*m] = 0.0;
+                    for ( k = 0; k < N; k++ ) B[N + j + ip*m] += A[k + (rank + j)*N] * sx0[k + ip*N];
+                    scale[ip] += B[N + j + ip*m] * B[N + j + ip*m];
+                }
+                scale[ip] = sqrt( scale[ip] );
+            }
+            dgels( "N", &m, &n, &nrhs, M, &m, B, &m, work, &lwork, &info );
+        }
+        
+        if ( info == 0 ) {
+            /* Rows N ... m-1 hold the residual of the stacked system */
+            result = 0;
+            for ( ip = 0; ip < np; ip++ ) {
+                residual = 0.0;
+                for ( i = N; i < m; i++ ) residual += B[i + ip*m] * B[i + ip*m];
+                if ( sqrt( residual ) > SS_SENSI_CONSISTENCY * ( 1.0 + scale[ip] ) ) result = 1;
+                for ( i = 0; i < N; i++ ) sx[i + ip*N] = B[i + ip*m];
+            }
+        }
+    }
+    
+    free( A );
+    free( M );
+    free( B );
+    free( tau );
+    free( scale );
+    free( work );
+    free( jpvt );
+    
+    return result;
 }
 
+/* Steady state sensitivities from the implicit function theorem: solves dfdx sx = -dfdp for all np columns    */
+/* with an LU factorization of dfdx. A singular dfdx (conserved moieties) is handed to conservedSensitivities. */
+/* dfdx is N x N, dfdp, sx0 and sx are N x np (column major). Returns 0 on success, 1 if the conservation laws */
+/* do not determine the sensitivities (e.g. compartment sizes which are parameters) and -1 if LAPACK fails.   */
+int steadyStateSensitivities( double *dfdx, double *dfdp, double *sx0, double *sx, int N, int np )
+{
+    mwSignedIndex n, nrhs, info;
+    mwSignedIndex *ipiv, *iwork;
+    double *A, *work;
+    double anorm, rcond;
+    int k, regular;
+    
+    if ( ( N == 0 ) || ( np == 0 ) ) return 0;
+    
+    n       = N;
+    nrhs    = np;
+    A       = (double *) malloc( sizeof(double) * N * N );
+    work    = (double *) malloc( sizeof(double) * 4 * N );
+    ipiv    = (mwSignedIndex *) malloc( sizeof(mwSignedIndex) * N );
+    iwork   = (mwSignedIndex *) malloc( sizeof(mwSignedIndex) * N );
+    
+    regular = 0;
+    info    = -1;
+    if ( A && work && ipiv && iwork ) {
+        memcpy( A, dfdx, sizeof(double) * N * N );
+        for ( k = 0; k < N * np; k++ ) sx[k] = -dfdp[k];
+        
+        anorm = dlange( "1", &n, &n, A, &n, work );
+        dgetrf( &n, &n, A, &n, ipiv, &info );
+        if ( info == 0 ) {
+            dgecon( "1", &n, A, &n, &anorm, &rcond, work, iwork, &info );
+            regular = ( info == 0 ) && ( rcond > SS_SENSI_RCOND );
+        }
+        if ( regular ) dgetrs( "N", &n, &nrhs, A, &n, ipiv, sx, &n, &info );
+    }
+    
+    free( A );
+    free( work );
+    free( ipiv );
+    free( iwork );
+    
+    if ( regular ) return ( info == 0 ) ? 0 : -1;
+    
+    return conservedSensitivities( dfdx, dfdp, sx0, sx, N, np );
+}
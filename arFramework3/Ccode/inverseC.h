@@ -6,14 +6,69 @@
 #include <sundials/sundials_math.h>  /* definition of ABS */
 #include <mex.h>
 
-/* Simple rootfinding function */
-double solveSS( int debugMode, mxArray *arcondition, int im, int ic, int isim, double t, N_Vector x, void *user_data, double tol );
+#include <klu.h>
 
-/* Single Newton-Raphson step */
-double NRstep( double *xptr, double* dfdx, double* f, double *tmp, mwSignedIndex workSize, double *workmem, mwSignedIndex *ipiv, int N );
+#define SS_NEWTON_MAXITER       100     /* Newton iterations before the rootfinding gives up */
+#define SS_NEWTON_MINSTEP       0.015625 /* smallest damping factor of the line search (1/64) */
+#define SS_NEWTON_DECREASE      1e-4    /* required relative decrease of max|f| per unit step length */
+#define SS_NEWTON_RATE          0.5     /* slower contraction of max|f| triggers a new Jacobian */
 
-/* Invert a matrix using LAPACK */
-void invert(double* mat, mwSignedIndex workSize, double *workmem, mwSignedIndex *ipiv, mwSignedIndex N);
+/* Factorization of dfdx which is reused over several Newton iterations */
+typedef struct {
+    int             N;
+    int             sparse;     /* use KLU instead of dense LAPACK */
+    double          *J;         /* dense: LU factors of dfdx */
+    mwSignedIndex   *ipiv;
+    SlsMat          Js;         /* sparse: dfdx in CSC format */
+    klu_common      common;
+    klu_symbolic    *symbolic;  /* ordering, computed once */
+    klu_numeric     *numeric;
+    } NewtonSystem;
 
-/* Matrix multiply for the rootfinding using BLAS */
-void mmultiply(double* invdfdx, double* f, double *result, mwSignedIndex N);
+/* Banded preconditioner P = I - gamma*J for the Krylov solvers (useSparseJac 2 and 3). J is the band of */
+/* the generated sparse dfdx, entries further than bandwidth from the diagonal are dropped.              */
+typedef struct {
+    int             im, ic;
+    int             N;
+    int             bandwidth;
+    SlsMat          Js;         /* dfdx in CSC format */
+    double          *Jband;     /* band of dfdx, kept while CVODES reuses the Jacobian */
+    double          *P;         /* LU factors of I - gamma*Jband in LAPACK band storage */
+    mwSignedIndex   *ipiv;
+    } KrylovPrec;
+
+/* Generated model functions (arSimuCalcFunctions.c) */
+void fx(realtype t, N_Vector x, double *xdot, void *user_data, int im, int ic);
+void getdfxdx(int im, int ic, realtype t, N_Vector x, realtype *J, void *user_data);
+void getdfxdx_sparse(int im, int ic, realtype t, N_Vector x, SlsMat J, void *user_data);
+
+/* Maximum norm of a vector */
+double maxNorm( double *f, int N );
+
+/* Evaluate dfdx at x and factorize it (LAPACK or KLU) */
+int newtonFactor( NewtonSystem *sys, int im, int isim, double t, N_Vector x, void *user_data );
+
+/* Solve dfdx dx = b with the current factorization. b is overwritten with dx */
+int newtonSolve( NewtonSystem *sys, double *b );
+
+/* CVSpilsPrecSetupFn: evaluate the band of dfdx (unless CVODES allows reuse) and factorize I - gamma*J */
+int krylovPrecSetup( realtype t, N_Vector x, N_Vector fx, booleantype jok, booleantype *jcurPtr, realtype gamma, void *user_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3 );
+
+/* CVSpilsPrecSolveFn: solve P z = r with the factorization of krylovPrecSetup */
+int krylovPrecSolve( realtype t, N_Vector x, N_Vector fx, N_Vector r, N_Vector z, realtype gamma, realtype delta, int lr, void *user_data, N_Vector tmp );
+
+/* LU factorization of the dense N x N matrix A (column major), A is overwritten by its factors */
+int denseFactor( double *A, mwSignedIndex *ipiv, int N );
+
+/* Solve A x = b with the factors of denseFactor. b is overwritten with x */
+int denseSolve( double *A, mwSignedIndex *ipiv, double *b, int N );
+
+/* Damped Newton rootfinding for the steady state; returns 0 on convergence and -1 otherwise */
+int solveSS( int debugMode, int im, int isim, double t, N_Vector x, void *user_data, double tol, int sparse, int nnz );
+
+#define SS_SENSI_RCOND          1e-12   /* dfdx with a smaller reciprocal condition number is treated as singular */
+#define SS_SENSI_RANKTOL        1e-10   /* relative size of the pivots of dfdx which span its null space */
+#define SS_SENSI_CONSISTENCY    1e-6    /* allowed violation of dfdx sx = -dfdp after adding the conservation laws */
+
+/* Steady state sensitivities from the implicit function theorem, accounting for conserved moieties */
+int steadyStateSensitivities( double *dfdx, double *dfdp, double *sx0, double *sx, int N, int np );
@@ -5,17 +5,8 @@
 
 #include <stdlib.h>
 
-/* TO DOs: */
-/* There is a reason the long splines use a fixed define for the length. 
- * Allocating this memory on the heap would be slower. The define is undesirable 
- * and should ideally be replaced with a compilation-time generated number for the 
- * maximal spline length. Another potential large performance gain could be achieved 
- * by keeping dx, dy and ms in static memory; but this would require passing a thread 
- * ID, as every thread should get its own static variable to avoid dangerous race 
- * conditions */
-
-#define MAX_LONG_SPLINE 10000
-
+/* Long splines have no length limit: the slopes and interval widths are kept in c and d */
+/* until they are overwritten by the final coefficients, so no work arrays are needed.  */
 int longMonotoneSpline( const int n, const double x[], const double y[], double b[], double c[], double d[] )
 {
     int i;
@@ -24,39 +15,33 @@ int longMonotoneSpline( const int n, const double x[], const double y[], double
     double invDx;
     double common;
     
-    /* For long splines, MAX_LONG_SPLINE is the maximum length */
-    double dy[MAX_LONG_SPLINE];
-    double dx[MAX_LONG_SPLINE];
-    double ms[MAX_LONG_SPLINE];
-    
-    /* Slopes and differences */
+    /* Slopes (in c) and differences (in d) */
     for ( i = 0; i < (n-1); i++ )
     {
-        dx[i] = x[i+1] - x[i];
-        dy[i] = y[i+1] - y[i];
-        ms[i] = dy[i]  / dx[i];
+        d[i] = x[i+1] - x[i];
+        c[i] = ( y[i+1] - y[i] ) / d[i];
     }
     
     /* Degree one coefficients */
-    b[0] = ms[0];
+    b[0] = c[0];
     for ( i = 0; i < (n-2); i++ )
     {
-        if ( ms[i]*ms[i+1] <= 0 )
+        if ( c[i]*c[i+1] <= 0 )
             b[i+1] = 0;
         else
         {
-            common = dx[i] + dx[i+1];
-            b[i+1] = (3*common/((common + dx[i+1])/ms[i] + (common+dx[i])/(ms[i+1])));
+            common = d[i] + d[i+1];
+            b[i+1] = (3*common/((common + d[i+1])/c[i] + (common+d[i])/(c[i+1])));
         }
     }
-    b[n-1] = ms[n-2];
+    b[n-1] = c[n-2];
     
-	/* Degree two and three coefficients */
+	/* Degree two and three coefficients (replacing slope and difference of the same interval) */
 	for ( i = 0; i < (n-1); i++ )
     {
         coeff    = b[i];
-        m        = ms[i];
-        invDx    = 1/dx[i];
+        m        = c[i];
+        invDx    = 1/d[i];
         common   = coeff + b[i + 1] - m - m;
         
         c[i] = (m-coeff-common)*invDx;
@@ -68,6 +53,58 @@ int longMonotoneSpline( const int n, const double x[], const double y[], double
     return 1;
 }
 
+/* Degree one coefficient b[k] of longMonotoneSpline, computed from the neighbouring intervals only */
+double longMonotoneSlope( const int n, const double x[], const double y[], int k )
+{
+    double m0, m1, dx0, dx1, common;
+    
+    if ( k == 0 )
+        return ( y[1] - y[0] ) / ( x[1] - x[0] );
+    if ( k == n-1 )
+        return ( y[n-1] - y[n-2] ) / ( x[n-1] - x[n-2] );
+    
+    dx0 = x[k] - x[k-1];
+    dx1 = x[k+1] - x[k];
+    m0  = ( y[k] - y[k-1] ) / dx0;
+    m1  = ( y[k+1] - y[k] ) / dx1;
+    if ( m0*m1 <= 0 )
+        return 0;
+    
+    common = dx0 + dx1;
+    return (3*common/((common + dx1)/m0 + (common+dx0)/m1));
+}
+
+/* Evaluate the spline of longMonotoneSpline at u without computing all coefficients. Only the */
+/* interval containing u is constructed, which costs a binary search instead of O(n) work.    */
+double longMonotoneSplineEval( const int n, const double x[], const double y[], double u )
+{
+    int i, j, k;
+    double b0, b1, m, invDx, common, w;
+    
+    /* Same interval search as seval (u beyond x[n-1] extrapolates with the last slope) */
+    i = 0;
+    j = n;
+    do
+    {
+        k = (i + j) / 2;
+        if (u < x[k])  j = k;
+        if (u >= x[k]) i = k;
+    }
+    while (j > i+1);
+    
+    w  = u - x[i];
+    b0 = longMonotoneSlope( n, x, y, i );
+    if ( i == n-1 )
+        return y[i] + w * b0;
+    
+    b1      = longMonotoneSlope( n, x, y, i+1 );
+    m       = ( y[i+1] - y[i] ) / ( x[i+1] - x[i] );
+    invDx   = 1/( x[i+1] - x[i] );
+    common  = b0 + b1 - m - m;
+    
+    return y[i] + w * ( b0 + w * ( (m-b0-common)*invDx + w * (common*invDx*invDx) ) );
+}
+
 int monotoneSpline( const int n, const double x[], const double y[], double b[], double c[], double d[] )
 {
     int i;
@@ -1,13 +1,62 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "udata.h"
 
+#ifdef HAS_PTHREAD
+#include <pthread.h>
+#endif
+
+/* Solver cache: hash table of CVODES instances keyed by condition. An entry is handed out to one */
+/* simulation at a time (inUse) and returned by simFree when the simulation was successful.      */
+#define SOLVER_BUCKETS 1024
+
+SolverCache solverBuckets[SOLVER_BUCKETS];
+#ifdef HAS_PTHREAD
+pthread_mutex_t solverMutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void destroySolver( SolverCache cache );
+void releaseSolver( SolverCache cache );
+
+/* Arenas: chunks are only given back to the system when the arena is reset with more than one   */
+/* chunk (they are merged into one) or more than ARENA_KEEP bytes, so that a thread which runs    */
+/* similar simulations over and over does not call malloc at all once its arena has grown.       */
+#define ARENA_CHUNK     65536               /* size of the first chunk */
+#define ARENA_KEEP      ( 16 * 1048576 )    /* larger arenas shrink back to ARENA_CHUNK on reset */
+#define ARENA_ALIGN     16
+#define ARENA_HEADER    ( ( sizeof(ArenaChunk) + ARENA_ALIGN - 1 ) & ~( (size_t) ARENA_ALIGN - 1 ) )
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;    /* older (full) chunks */
+    size_t  size;
+    size_t  used;
+    } ArenaChunk;
+
+struct SimArenaData {
+    ArenaChunk  *chunks;        /* current chunk first */
+    ArenaStats  stats;
+    };
+
+struct SimArenaData mainArena = { NULL, { 0, 0, 0, 0 } };
+#ifdef HAS_PTHREAD
+struct SimArenaData threadArenas[NMAXTHREADS];
+pthread_key_t   arenaKey;
+int             arenaKeyCreated = 0;
+#endif
+
+ArenaChunk *newChunk( SimArena arena, size_t size );
+void freeChunks( SimArena arena );
+
 SimMemory simCreate( int *threadStatus, double* status )
 {
     /* If object creation fails, abort! */
-    SimMemory sim_mem = (SimMemory) malloc(sizeof *sim_mem);
+    SimArena arena = currentArena();
+    SimMemory sim_mem = (SimMemory) arenaAlloc(arena, sizeof *sim_mem);
 	if ( sim_mem == NULL )
         return NULL;
+    
+    sim_mem->arena          = arena;
 
 	/* Initialize all to NULL to facilitate easier cleanup */
     
@@ -20,10 +69,16 @@ SimMemory simCreate( int *threadStatus, double* status )
 	sim_mem->sx          	= NULL;
 	sim_mem->atols_ss    	= NULL;
 	sim_mem->atolV_ss    	= NULL;
+    sim_mem->xB             = NULL;
+    sim_mem->qB             = NULL;
     
 	/* SSA */
 	sim_mem->x_lb           = NULL;
     sim_mem->x_ub           = NULL;
+    sim_mem->xHybrid        = NULL;
+    
+    sim_mem->scratch        = NULL;
+    sim_mem->cache          = NULL;
     
 	sim_mem->neq            = 0;
 	sim_mem->np             = 0;
@@ -40,32 +95,45 @@ SimMemory simCreate( int *threadStatus, double* status )
 
 void simFree( SimMemory sim_mem )
 {
-    int j;
-    
     /* Something is seriously wrong. Anything we free would cause a segfault */
 	if ( sim_mem == NULL )
 		return;
     
-	/* CVODES memory */
-	if ( sim_mem->data )
+	/* UserData, EventData, the spline caches and the scratch buffer are released with the arena */
+    
+    /* Hand the solver back to the cache for the next simulation of this condition. After a failure */
+    /* the solver may be in an unusable state, so it is freed instead.                              */
+    if ( sim_mem->cache )
     {
-        if ( sim_mem->data->splines )
+        if ( ( sim_mem->status[0] == 0 ) && ( sim_mem->cvode_mem ) )
         {
-            /* Free spline memory */
-            for ( j = 0; j < sim_mem->data->nsplines; j++ ) {
-                if ( sim_mem->data->splines[j] )
-                    free( sim_mem->data->splines[j] );
-            }
-            free(sim_mem->data->splines);
-            free(sim_mem->data->splineIndices);
+            sim_mem->cache->cvode_mem   = sim_mem->cvode_mem;
+            sim_mem->cache->x           = sim_mem->x;
+            sim_mem->cache->atolV       = sim_mem->atolV;
+            sim_mem->cache->sx          = sim_mem->sx;
+            sim_mem->cache->atols_ss    = sim_mem->atols_ss;
+            sim_mem->cache->atolV_ss    = sim_mem->atolV_ss;
+            sim_mem->cache->npSensi     = sim_mem->npSensi;
             
-            sim_mem->data->splines = NULL;
+            sim_mem->cvode_mem  = NULL;
+            sim_mem->x          = NULL;
+            sim_mem->atolV      = NULL;
+            sim_mem->sx         = NULL;
+            sim_mem->atols_ss   = NULL;
+            sim_mem->atolV_ss   = NULL;
+        } else {
+            sim_mem->cache->cvode_mem   = NULL;
+            sim_mem->cache->x           = NULL;
+            sim_mem->cache->atolV       = NULL;
+            sim_mem->cache->sx          = NULL;
+            sim_mem->cache->atols_ss    = NULL;
+            sim_mem->cache->atolV_ss    = NULL;
+            sim_mem->cache->solverInit  = 0;
+            sim_mem->cache->sensInit    = 0;
         }
-            
-		free(sim_mem->data);
+        releaseSolver( sim_mem->cache );
     }
-	if ( sim_mem->event_data )
-		free(sim_mem->event_data);
+    
 	if ( sim_mem->cvode_mem ) 
 		CVodeFree(&(sim_mem->cvode_mem));
 	if ( sim_mem->x )
@@ -78,12 +146,249 @@ void simFree( SimMemory sim_mem )
 		N_VDestroy_Serial(sim_mem->atols_ss);
 	if ( sim_mem->atolV_ss )
 		N_VDestroyVectorArray_Serial(sim_mem->atolV_ss, sim_mem->npSensi);
+	if ( sim_mem->xB )
+		N_VDestroy_Serial(sim_mem->xB);
+	if ( sim_mem->qB )
+		N_VDestroy_Serial(sim_mem->qB);
 
 	/* SSA memory */
 	if ( sim_mem->x_lb )
 		N_VDestroy_Serial(sim_mem->x_lb);
 	if ( sim_mem->x_ub )
 		N_VDestroy_Serial(sim_mem->x_ub);
+	if ( sim_mem->xHybrid )
+		N_VDestroy_Serial(sim_mem->xHybrid);
+    
+    /* sim_mem itself lives in the arena, so this has to come last */
+    arenaReset( sim_mem->arena );
+}
+
+/* Create the key of the thread arenas (main thread only, before any worker is started) */
+void arenaInit( void )
+{
+#ifdef HAS_PTHREAD
+    if ( arenaKeyCreated == 0 ) {
+        pthread_key_create( &arenaKey, NULL );
+        arenaKeyCreated = 1;
+    }
+#endif
+}
+
+/* Let the calling thread allocate from the arena of worker id (unbound threads use the main arena) */
+void bindArena( int id )
+{
+#ifdef HAS_PTHREAD
+    if ( ( arenaKeyCreated == 1 ) && ( id >= 0 ) && ( id < NMAXTHREADS ) )
+        pthread_setspecific( arenaKey, &(threadArenas[id]) );
+#endif
+}
+
+/* Arena of the calling thread */
+SimArena currentArena( void )
+{
+#ifdef HAS_PTHREAD
+    SimArena arena = NULL;
+    
+    if ( arenaKeyCreated == 1 )
+        arena = (SimArena) pthread_getspecific( arenaKey );
+    if ( arena != NULL )
+        return arena;
+#endif
+    return &mainArena;
+}
+
+ArenaChunk *newChunk( SimArena arena, size_t size )
+{
+    ArenaChunk *chunk = (ArenaChunk *) malloc( ARENA_HEADER + size );
+    if ( chunk == NULL )
+        return NULL;
+    
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->stats.capacity += size;
+    arena->stats.systemAllocations++;
+    
+    return chunk;
+}
+
+/* Allocate size bytes which stay valid until the next arenaReset */
+void *arenaAlloc( SimArena arena, size_t size )
+{
+    ArenaChunk *chunk = arena->chunks;
+    size_t grow;
+    void *ptr;
+    
+    size = ( size + ARENA_ALIGN - 1 ) & ~( (size_t) ARENA_ALIGN - 1 );
+    if ( ( chunk == NULL ) || ( chunk->used + size > chunk->size ) ) {
+        grow = ( arena->stats.capacity > ARENA_CHUNK ) ? arena->stats.capacity : ARENA_CHUNK;
+        if ( grow < size ) grow = size;
+        chunk = newChunk( arena, grow );
+        if ( chunk == NULL )
+            return NULL;
+    }
+    
+    ptr = (char *) chunk + ARENA_HEADER + chunk->used;
+    chunk->used += size;
+    
+    arena->stats.allocations++;
+    arena->stats.bytes += size;
+    
+    return ptr;
+}
+
+/* Allocate from the arena of the calling thread (used by the spline caches in arInputFunctionsC.c) */
+void *simAlloc( size_t size )
+{
+    return arenaAlloc( currentArena(), size );
+}
+
+/* Release everything which was allocated from the arena */
+void arenaReset( SimArena arena )
+{
+    size_t capacity = arena->stats.capacity;
+    
+    /* Merge grown arenas into a single chunk, which is kept for the next simulation */
+    if ( ( arena->chunks != NULL ) && ( ( arena->chunks->next != NULL ) || ( capacity > ARENA_KEEP ) ) ) {
+        freeChunks( arena );
+        newChunk( arena, ( capacity > ARENA_KEEP ) ? ARENA_CHUNK : capacity );
+    }
+    if ( arena->chunks != NULL )
+        arena->chunks->used = 0;
+    
+    arena->stats.allocations = 0;
+    arena->stats.systemAllocations = 0;
+    arena->stats.bytes = 0;
+}
+
+/* Allocation statistics since the last reset */
+void arenaStats( SimArena arena, ArenaStats *stats )
+{
+    *stats = arena->stats;
+}
+
+void freeChunks( SimArena arena )
+{
+    ArenaChunk *chunk, *next;
+    
+    for ( chunk = arena->chunks; chunk != NULL; chunk = next ) {
+        next = chunk->next;
+        free( chunk );
+    }
+    arena->chunks = NULL;
+    arena->stats.capacity = 0;
+}
+
+/* Give all arenas back to the system. Must not be called while simulations are running. */
+void freeArenas( void )
+{
+#ifdef HAS_PTHREAD
+    int j;
+    
+    for ( j = 0; j < NMAXTHREADS; j++ )
+        freeChunks( &(threadArenas[j]) );
+#endif
+    freeChunks( &mainArena );
+}
+
+/* Get the cache entry for key and mark it as in use. Memory which was set up for a different */
+/* problem structure than signature is freed. Returns NULL if the entry is in use already.   */
+SolverCache fetchSolver( const int *key, const int *signature )
+{
+    SolverCache cache;
+    int j;
+    unsigned int bucket = 0;
     
-    free( sim_mem );
+    for ( j = 0; j < SOLVER_KEY_SIZE; j++ )
+        bucket = bucket * 31 + (unsigned int) ( key[j] + 1 );
+    bucket = bucket % SOLVER_BUCKETS;
+    
+#ifdef HAS_PTHREAD
+    pthread_mutex_lock( &solverMutex );
+#endif
+    cache = solverBuckets[bucket];
+    while ( ( cache != NULL ) && ( memcmp( cache->key, key, sizeof(cache->key) ) != 0 ) )
+        cache = cache->next;
+    
+    if ( cache == NULL ) {
+        cache = (SolverCache) calloc( 1, sizeof *cache );
+        if ( cache != NULL ) {
+            memcpy( cache->key, key, sizeof(cache->key) );
+            memcpy( cache->signature, signature, sizeof(cache->signature) );
+            cache->next = solverBuckets[bucket];
+            solverBuckets[bucket] = cache;
+        }
+    }
+    
+    if ( ( cache != NULL ) && ( cache->inUse ) ) {
+        cache = NULL;
+    } else if ( cache != NULL ) {
+        if ( memcmp( cache->signature, signature, sizeof(cache->signature) ) != 0 ) {
+            destroySolver( cache );
+            memcpy( cache->signature, signature, sizeof(cache->signature) );
+        }
+        cache->inUse = 1;
+    }
+#ifdef HAS_PTHREAD
+    pthread_mutex_unlock( &solverMutex );
+#endif
+    
+    return cache;
+}
+
+/* Mark a cache entry as available again */
+void releaseSolver( SolverCache cache )
+{
+#ifdef HAS_PTHREAD
+    pthread_mutex_lock( &solverMutex );
+#endif
+    cache->inUse = 0;
+#ifdef HAS_PTHREAD
+    pthread_mutex_unlock( &solverMutex );
+#endif
+}
+
+/* Free the CVODES memory held by a cache entry */
+void destroySolver( SolverCache cache )
+{
+	if ( cache->cvode_mem ) 
+		CVodeFree(&(cache->cvode_mem));
+	if ( cache->x )
+		N_VDestroy_Serial(cache->x);	
+	if ( cache->atolV )
+		N_VDestroy_Serial(cache->atolV);
+	if ( cache->sx )
+		N_VDestroyVectorArray_Serial(cache->sx, cache->npSensi);
+	if ( cache->atols_ss )
+		N_VDestroy_Serial(cache->atols_ss);
+	if ( cache->atolV_ss )
+		N_VDestroyVectorArray_Serial(cache->atolV_ss, cache->npSensi);
+    
+    cache->cvode_mem    = NULL;
+    cache->x            = NULL;
+    cache->atolV        = NULL;
+    cache->sx           = NULL;
+    cache->atols_ss     = NULL;
+    cache->atolV_ss     = NULL;
+    cache->solverInit   = 0;
+    cache->sensInit     = 0;
+}
+
+/* Free all cached solvers. Must not be called while simulations are running. */
+void clearSolverCache( void )
+{
+    SolverCache cache, next;
+    int j;
+    
+    for ( j = 0; j < SOLVER_BUCKETS; j++ ) {
+        cache = solverBuckets[j];
+        while ( cache != NULL ) {
+            next = cache->next;
+            destroySolver( cache );
+            free( cache );
+            cache = next;
+        }
+        solverBuckets[j] = NULL;
+    }
 }
\ No newline at end of file
@@ -18,9 +18,12 @@ typedef struct {
     int     nsplines;
     double  **splines;
     int     *splineIndices;
+    double  *cse;           /* common subexpressions of the fluxes (fcse_<condition>) followed by the state, */
+    double  cseT;           /* parameters and inputs they were evaluated at, allocated on first use */
 	double  t;
     int     *abort;
     int32_T *sensIndices;
+    void    *prec;          /* preconditioner of the Krylov solvers (KrylovPrec, see inverseC.h) */
 	} *UserData;
 
     
@@ -37,13 +40,58 @@ typedef struct {
    double* sensValue_A;
    double* sensValue_B;
 
-   /* Multiple shooting (currently not implemented) */
+   /* State dependent events (roots of the generated trigger functions, see arAddTrigger) */
+   /* Reassignments x -> Ax+b per trigger, the sensitivities additionally jump because    */
+   /* the event time depends on the parameters                                           */
+   int     nRoots;
+   int*    rootsFound;
+   int*    rootDirection;
+   double* rootValue_A;
+   double* rootValue_B;
+   double* dgdx;            /* work memory for the sensitivity jumps */
+   double* dgdp;
+   double* dgdt;
+   double* fPre;
+   double* fPost;
+
+   /* Multiple shooting: nodes of the segment, the integration never steps past them */
    double* tMS;
    int     nMS;
    int     iMS;
    
    } *EventData;
 
+/* CVODES memory which is kept alive between simulations of the same condition (see fetchSolver) */
+#define SOLVER_KEY_SIZE         4   /* condition list, model, condition, sensitivity block */
+#define SOLVER_SIGNATURE_SIZE   9   /* problem structure the solver was set up for */
+
+typedef struct SolverCacheEntry {
+    int         key[SOLVER_KEY_SIZE];
+    int         signature[SOLVER_SIGNATURE_SIZE];
+    int         inUse;
+    int         solverInit;     /* CVodeInit was called and the linear solver attached */
+    int         sensInit;       /* CVodeSensInit1 was called */
+    int         npSensi;        /* length of sx and atolV_ss */
+    void        *cvode_mem;
+    N_Vector    x;
+    N_Vector    atolV;
+    N_Vector    atols_ss;
+    N_Vector    *sx;
+    N_Vector    *atolV_ss;
+    struct SolverCacheEntry *next;
+    } *SolverCache;
+
+/* Per-thread bump allocator for the small allocations of a simulation (UserData, EventData,  */
+/* spline caches, private block buffers). simFree releases all of them with one arenaReset.   */
+typedef struct SimArenaData *SimArena;
+
+typedef struct {
+    long    allocations;        /* arenaAlloc calls since the last reset */
+    long    systemAllocations;  /* of which needed a new chunk from malloc */
+    size_t  bytes;              /* bytes handed out since the last reset */
+    size_t  capacity;           /* bytes held by the arena */
+    } ArenaStats;
+
 /* Global memory structure */
 typedef struct {
     /* State vector */
@@ -55,6 +103,10 @@ typedef struct {
 	N_Vector    atols_ss;
 	N_Vector    *sx;
 	EventData   event_data;
+    
+    /* Adjoint states and quadratures of the backward problem */
+    N_Vector    xB;
+    N_Vector    qB;
 	void        *cvode_mem;
 	UserData    data;
     
@@ -66,6 +118,16 @@ typedef struct {
 	/* SSA integration */
 	N_Vector    x_lb;
 	N_Vector    x_ub;    
+    N_Vector    xHybrid;        /* hybrid SSA: species and integrated propensity of the slow reactions */
+    
+    /* Private output buffers of sensitivity blocks */
+    double      *scratch;
+    
+    /* Cache entry the CVODES memory is returned to (NULL = free it) */
+    SolverCache cache;
+    
+    /* Arena of the thread running the simulation, everything except CVODES memory lives here */
+    SimArena    arena;
     
     /* Logging purposes */
     int         *threadStatus;
@@ -76,4 +138,16 @@ typedef struct {
 SimMemory simCreate( int *threadStatus, double* status );
 void simFree( SimMemory sim_mem );
 
+SolverCache fetchSolver( const int *key, const int *signature );
+void clearSolverCache( void );
+
+void arenaInit( void );
+void bindArena( int id );
+SimArena currentArena( void );
+void *arenaAlloc( SimArena arena, size_t size );
+void *simAlloc( size_t size );
+void arenaReset( SimArena arena );
+void arenaStats( SimArena arena, ArenaStats *stats );
+void freeArenas( void );
+
 #endif /* _MY_UDATA */
@@ -6,6 +6,25 @@
 % nruns:    number of runs                          [10]
 % scaling:  rescaling factor from species           [{ones}]
 %           concentration to number of molecules
+%
+% The runs of a condition are spread over ar.config.nCore threads. Every
+% run draws its random numbers from its own stream, keyed by
+% ar.config.ssa_seed, the condition and the run, so for a fixed seed the
+% trajectories do not depend on the number of threads.
+%
+% With ar.config.ssa_method = 1 the next reaction method (Gibson and Bruck,
+% J Phys Chem A, 2000) is used instead of the direct method. arSSA derives
+% the reaction dependency graph from the stoichiometry N and the species in
+% the flux expressions, so that after an event only the propensities of the
+% affected reactions are recomputed.
+%
+% Models with fast reactions stop with the direct method once the mean
+% reaction time falls below ar.config.ssa_min_tau. They can be simulated
+% with explicit (ssa_method = 2) or implicit (3, for stiff models)
+% tau-leaping, where ar.config.ssa_tau_eps bounds the relative change of
+% the propensities within a leap, or with the hybrid method (4), which
+% integrates reactions that fire more than ar.config.ssa_hybrid_threshold
+% times per output interval as ODEs and the others stochastically.
     
 function arSSA(nruns, scaling)
 
@@ -41,6 +60,31 @@ for m=1:length(ar.model)
         end
     end
     
+    % reaction dependency graph for the next reaction method: dep(j,k) if
+    % the flux of reaction k uses a species which reaction j changes.
+    % Fluxes with inputs, derived variables or time are updated after every
+    % reaction, fluxes with derived variables depend on all species.
+    nv = length(ar.model(m).fv);
+    usesX = false(length(ar.model(m).x), nv);
+    qTimeDep = false(1, nv);
+    for j=1:nv
+        vars = symvar(ar.model(m).fv{j});
+        usesX(:,j) = ismember(ar.model(m).x(:), vars);
+        if(any(ismember(vars, [ar.model(m).u(:); ar.model(m).z(:); {ar.model(m).t}])))
+            qTimeDep(j) = true;
+            if(any(ismember(vars, ar.model(m).z)))
+                usesX(:,j) = true;
+            end
+        end
+    end
+    dep = (double(ar.model(m).N ~= 0)' * double(usesX)) > 0;
+    dep(logical(eye(nv))) = true;
+    dep(:,qTimeDep) = true;
+    [kdep, ~] = find(dep');
+    ar.model(m).ssaDepPtr = int32([0 cumsum(sum(dep,2))']);
+    ar.model(m).ssaDepIdx = int32(kdep(:)' - 1);
+    ar.model(m).ssaInputDep = double(any(qTimeDep));
+    
     % setup arrays
     for c=1:length(ar.model(m).condition)
         ar.model(m).condition(c).xFineSSA = nan(length(ar.model(m).condition(c).tFine), ...
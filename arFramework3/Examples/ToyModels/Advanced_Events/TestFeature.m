@@ -52,4 +52,22 @@ if ((norm(ar.model.data(1).res)+norm(ar.model.data(2).res)+norm(ar.model.data(3)
     fprintf(2, 'PASSED\n');
 else
     error( 'FINAL ERROR TOO LARGE' );
-end
\ No newline at end of file
+end
+
+fprintf( 2, 'Testing reuse of cached solvers... ' );
+ar.config.useSolverCache = 0;
+arSimu(true,false,true);
+sres_fresh = ar.sres + 0;
+res_fresh = [ar.model.data(1).res, ar.model.data(2).res, ar.model.data(3).res];
+
+ar.config.useSolverCache = 1;
+arSimu(true,false,true);    % fills the cache
+arSetPars('k_deg', -1.5);
+arSimu(false,false,true);   % reused without sensitivities
+arSetPars('k_deg', -1);
+arSimu(true,false,true);    % reused with sensitivities switched back on
+res_cached = [ar.model.data(1).res, ar.model.data(2).res, ar.model.data(3).res];
+if ( ( sum( (res_cached - res_fresh).^2 ) > ar.config.atol * 1000 ) || ( sum( sum( (ar.sres - sres_fresh).^2 ) ) > ar.config.atol * 1000 ) )
+    error( 'CACHED SOLVER DOES NOT REPRODUCE THE FRESH SIMULATION' );
+end
+fprintf(2, 'PASSED\n');
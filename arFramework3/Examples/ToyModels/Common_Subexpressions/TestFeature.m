@@ -0,0 +1,30 @@
+function TestFeature()
+
+global ar;
+
+fprintf( 2, 'INTEGRATION TEST FOR COMMON SUBEXPRESSIONS\n' );
+
+% Without useSensiRHS, CVODES computes the sensitivities by difference
+% quotients and perturbs the parameters at the same (t, x)
+useCSE = [false, true];
+sx = cell(size(useCSE));
+for j = 1 : numel( useCSE )
+    fprintf( 2, 'Simulating with useCSE = %d and difference quotient sensitivities... ', useCSE(j) );
+    arInit;
+    ar.config.useCSE = useCSE(j);
+    ar.config.useSensiRHS = false;
+    arLoadModel('hill');
+    arCompileAll(true);
+    
+    arSetPars('n_hill', log10(2), 1, 1, -1, 1);
+    arSimu(true, true, true);
+    sx{j} = ar.model.condition.sxFineSimu;
+    fprintf( 2, 'PASSED\n' );
+end
+
+fprintf( 2, 'Testing the sensitivities with and without common subexpressions... ' );
+if ( any( sx{1}(:) ~= 0 ) ) && ( max( abs( sx{2}(:) - sx{1}(:) ) ) < 1e-4 * max( abs( sx{1}(:) ) ) )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'SENSITIVITIES DEPEND ON THE COMMON SUBEXPRESSIONS' );
+end
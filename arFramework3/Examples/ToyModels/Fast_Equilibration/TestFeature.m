@@ -8,21 +8,35 @@ fprintf( 2, 'Loading model for fast equilibration test (not reduced) ... ' );
 arInit;
 ar.config.fastEquilibration = 0;
 arLoadModel('equilibration2');
+arCompileAll(true);
 fprintf( 2, ' [ OK ]\n' );
 
-fprintf( 2, 'Testing whether it correctly throws an error when attempting to use fast equilibration ...' );
+fprintf( 2, 'Activating fast sensitivities on a model with conserved moieties ... ' );
+arFastSensis
+fprintf( 2, '[ OK ]\n' );
+
+arClearEvents; % Clears events
+arFindInputs;
+arSteadyState(1, 1, 1, -1e7);  
+
+fprintf( 2, 'Simulating sensitivities implicitly and explicitly ... ' );
+ar.config.rtol = 1e-10; ar.config.atol = 1e-10;
+rtol = 1e-6; atol = 1e-6;
+for d = 1 : numel( ar.model.ss_condition )
+    ar.config.turboSSSensi=1;
+    arCalcMerit;
+    sxEq = reshape(ar.model.ss_condition(d).sxFineSimu(end,:,:), 1, numel(ar.model.ss_condition(d).sxFineSimu(end,:,:))) + 0;
 
-% This should throw!
-thrown = 0;
-try
-    arFastSensis
-catch
-    thrown = 1;
+    ar.config.turboSSSensi=0;
+    arCalcMerit;
+    sxTrue = reshape(ar.model.ss_condition(d).sxFineSimu(end,:,:), 1, numel(ar.model.ss_condition(d).sxFineSimu(end,:,:))) + 0;
 end
-if ( thrown )
-    fprintf( 2, '[ OK ]\n' );
+
+fail = sum( (abs((sxEq-sxTrue)./(sxTrue))>rtol) & (abs(sxEq-sxTrue)>atol) );
+if ( fail )
+    error( 'Failure: Sensitivity difference is too large for the model with conserved moieties' );
 else
-    error( 'Attempt to use fast steady state sensis should have thrown an error on a model with conserved moieties' );
+    fprintf( 2, '[ OK ]\n' );
 end
 
 fprintf( 2, 'Loading model for fast equilibration test (with data, reduced) ... ' );
@@ -166,3 +180,35 @@ if ( fail )
 else
     fprintf( 2, '[ OK ]\n' );
 end
+
+fprintf( 2, 'Loading model with a conservation law that depends on an estimated compartment size ... ' );
+arInit;
+arLoadModel('equilibration_volume');
+arCompileAll(true);
+fprintf( 2, '[ OK ]\n' );
+
+arFastSensis
+arClearEvents; % Clears events
+arFindInputs;
+arSteadyState(1, 1, 1, -1e7);
+
+fprintf( 2, 'Testing the fallback to integrated sensitivities (status 67) ... ' );
+ar.config.rtol = 1e-10; ar.config.atol = 1e-10;
+rtol = 1e-6; atol = 1e-6;
+ar.config.turboSSSensi=1;
+arCalcMerit;
+sxEq = reshape(ar.model.ss_condition(1).sxFineSimu(end,:,:), 1, numel(ar.model.ss_condition(1).sxFineSimu(end,:,:))) + 0;
+if ( ar.config.turboSSSensi ~= 1 )
+    error( 'Failure: turboSSSensi was not restored after the fallback' );
+end
+
+ar.config.turboSSSensi=0;
+arCalcMerit;
+sxTrue = reshape(ar.model.ss_condition(1).sxFineSimu(end,:,:), 1, numel(ar.model.ss_condition(1).sxFineSimu(end,:,:))) + 0;
+
+fail = sum( (abs((sxEq-sxTrue)./(sxTrue))>rtol) & (abs(sxEq-sxTrue)>atol) );
+if ( fail )
+    error( 'Failure: Sensitivity difference is too large for the conservation law with an estimated compartment size' );
+else
+    fprintf( 2, '[ OK ]\n' );
+end
@@ -28,4 +28,21 @@ if (ar.chi2 < 1e-4)
     fprintf( 'PASSED\n' );
 else
     error( 'FINAL ERROR TOO LARGE' );
-end
\ No newline at end of file
+end
+
+fprintf( 2, 'Comparing adjoint and forward sensitivity gradients... ' );
+ar.p = ar.p + 0.1;
+arCalcMerit(true, ar.p(ar.qFit==1));
+gForward = 2*ar.res*ar.sres(:, ar.qFit==1);
+ar.config.useAdjoint = true;
+arCalcMerit(true, ar.p(ar.qFit==1), [], [], true);
+ar.config.useAdjoint = false;
+if ( isempty( ar.adjointGrad ) )
+    error( 'ADJOINT GRADIENT WAS NOT COMPUTED' );
+end
+gAdjoint = 2*ar.res(ar.res_type~=1)*ar.sres(:, ar.qFit==1) + ar.adjointGrad(ar.qFit==1);
+if ( max( abs( gAdjoint - gForward ) ./ max( abs( gForward ), 1 ) ) < 1e-3 )
+    fprintf( 'PASSED\n' );
+else
+    error( 'ADJOINT GRADIENT DOES NOT MATCH FORWARD SENSITIVITIES' );
+end
@@ -0,0 +1,80 @@
+function TestFeature()
+
+global ar;
+
+fprintf( 2, 'INTEGRATION TEST FOR MULTIPLE SHOOTING\n' );
+
+fprintf( 2, 'Loading model and data in five shooting segments... ' );
+arInit;
+arLoadModel('predatorPrey');
+arLoadData('oscillation', 1, 'csv', false, 'DpPerShoot', 5);
+arCompileAll(true);
+
+arSetPars('alpha', 1, 1, 0, 0, 10);
+arSetPars('beta', 0.5, 1, 0, 0, 10);
+arSetPars('delta', 0.25, 1, 0, 0, 10);
+arSetPars('gamma', 1, 1, 0, 0, 10);
+arSetPars('init_prey', 2, 1, 0, 0, 100);
+arSetPars('init_predator', 1, 1, 0, 0, 100);
+qNode = strncmp(ar.pLabel, 'init_MS', 7);
+for jp = find(qNode)
+    arSetPars(ar.pLabel{jp}, 1, 1, 0, 0, 100);
+end
+
+if ( ( ar.config.useMS == 1 ) && ( size( ar.model.ms_link, 1 ) == 4 ) && ( sum( qNode ) == 8 ) )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'SHOOTING SEGMENTS OR NODE PARAMETERS NOT SET UP CORRECTLY' );
+end
+
+fprintf( 2, 'Testing continuity for node states from a single shooting... ' );
+[~, order] = sort( ar.model.ms_link(:,3) );
+for jms = order(:)'
+    arSimu(false, false, true);
+    c1 = ar.model.ms_link(jms,1);
+    c2 = ar.model.ms_link(jms,2);
+    for jx = 1 : length( ar.model.x )
+        jp = find( ~cellfun( @isempty, regexp( ar.model.condition(c2).p, ['^init_MS\d+_' ar.model.x{jx} '$'] ) ) );
+        arSetPars( ar.model.condition(c2).p{jp}, ar.model.condition(c1).xExpSimu(ar.model.ms_link(jms,4),jx) );
+    end
+end
+arCalcMerit(true);
+if ( max( ar.ms_violation ) < 1e-8 ) && ( abs( ar.model.condition(c2).xFineSimu(end,1) - 1.921511 ) < 1e-3 )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'SEGMENTS WITH EXACT NODE STATES ARE NOT CONTINUOUS' );
+end
+
+fprintf( 2, 'Testing continuity residual sensitivities against finite differences... ' );
+arSetPars('alpha', 1.2);
+qNode = find( strncmp(ar.pLabel, 'init_MS', 7) );
+arSetPars(ar.pLabel{qNode(1)}, ar.p(qNode(1)) + 0.5);
+arCalcMerit(true);
+qRes = ar.res_type == 6;
+sres = ar.sres(qRes,:);
+h = 1e-6;
+for ip = [find(strcmp(ar.pLabel, 'alpha')), qNode(1)]
+    p0 = ar.p(ip);
+    ar.p(ip) = p0 + h;
+    arCalcMerit(false);
+    resUp = ar.res(qRes);
+    ar.p(ip) = p0 - h;
+    arCalcMerit(false);
+    resDown = ar.res(qRes);
+    ar.p(ip) = p0;
+    if ( max( abs( sres(:,ip) - (resUp(:) - resDown(:))/(2*h) ) ) > 1e-3 * max( 1, max( abs( sres(:,ip) ) ) ) )
+        error( 'SENSITIVITY OF THE CONTINUITY RESIDUALS W.R.T. %s DOES NOT MATCH FINITE DIFFERENCES', ar.pLabel{ip} );
+    end
+end
+fprintf(2, 'PASSED\n');
+
+fprintf( 2, 'Fitting from a perturbed starting point... ' );
+arSetPars('alpha', 0.7);
+arSetPars('gamma', 1.4);
+ar.ms_strength = 100;
+arFit(true);
+if ( abs( arGetPars('alpha', 0) - 1 ) < 1e-2 ) && ( max( ar.ms_violation ) < 1e-4 )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'MULTIPLE SHOOTING FIT DID NOT CONVERGE' );
+end
@@ -0,0 +1,84 @@
+function TestFeature()
+
+global ar;
+
+fprintf( 2, 'INTEGRATION TEST FOR PARALLEL STOCHASTIC SIMULATIONS\n' );
+
+fprintf( 2, 'Loading birth death model... ' );
+arInit;
+arLoadModel('birthDeath');
+arCompileAll(true);
+
+arSetPars('k_birth', 10, 1, 0, 0, 100);
+arSetPars('k_death', 0.1, 1, 0, 0, 100);
+fprintf( 2, 'PASSED\n' );
+
+fprintf( 2, 'Testing reproducibility for a fixed seed on several threads... ' );
+nruns = 1000;
+ar.config.ssa_seed = 42;
+ar.config.nCore = 4;
+arSSA(nruns);
+xParallel = ar.model.condition.xFineSSA;
+ar.config.nCore = 1;
+arSSA(nruns);
+xSerial = ar.model.condition.xFineSSA;
+if ( isequal( xParallel, xSerial ) ) && ( ~any( isnan( xSerial(:) ) ) )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'STOCHASTIC SIMULATION DEPENDS ON THE NUMBER OF THREADS' );
+end
+
+fprintf( 2, 'Testing different runs and seeds... ' );
+ar.config.ssa_seed = 43;
+arSSA(nruns);
+if ( ~isequal( xSerial(:,:,1), xSerial(:,:,2) ) ) && ( ~isequal( ar.model.condition.xFineSSA, xSerial ) )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'RUNS OR SEEDS SHARE THEIR RANDOM NUMBERS' );
+end
+
+fprintf( 2, 'Testing the mean against the deterministic solution... ' );
+t = ar.model.condition.tFine(end);
+meanA = mean( xSerial(end,1,:) );
+if ( abs( meanA - 100 * ( 1 - exp( -0.1 * t ) ) ) < 2 )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'MEAN OF THE STOCHASTIC SIMULATIONS DOES NOT MATCH' );
+end
+
+fprintf( 2, 'Testing the next reaction method... ' );
+ar.config.ssa_method = 1;
+ar.config.ssa_seed = 42;
+ar.config.nCore = 4;
+arSSA(nruns);
+xNRM = ar.model.condition.xFineSSA;
+ar.config.nCore = 1;
+arSSA(nruns);
+ar.config.ssa_method = 0;
+meanNRM = mean( xNRM(end,1,:) );
+if ( isequal( xNRM, ar.model.condition.xFineSSA ) ) && ( ~any( isnan( xNRM(:) ) ) ) ...
+        && ( abs( meanNRM - 100 * ( 1 - exp( -0.1 * t ) ) ) < 2 ) && ( abs( var( xNRM(end,1,:) ) - var( xSerial(end,1,:) ) ) < 0.3 * var( xSerial(end,1,:) ) )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'NEXT REACTION METHOD DOES NOT MATCH THE DIRECT METHOD' );
+end
+
+fprintf( 2, 'Testing tau-leaping and the hybrid method for fast reactions... ' );
+arSetPars('k_birth', 10000, 1, 0, 0, 1e5);
+nruns = 100;
+ar.config.ssa_method = 0;
+arSSA(nruns);
+if ( ~any( isnan( ar.model.condition.xFineSSA(end,1,:) ) ) )
+    error( 'DIRECT METHOD WAS EXPECTED TO STOP FOR FAST REACTIONS' );
+end
+meanDet = 1e5 * ( 1 - exp( -0.1 * t ) );
+for method = 2:4
+    ar.config.ssa_method = method;
+    arSSA(nruns);
+    xLeap = ar.model.condition.xFineSSA;
+    if ( any( isnan( xLeap(:) ) ) ) || ( abs( mean( xLeap(end,1,:) ) - meanDet ) > 0.01 * meanDet )
+        error( 'STOCHASTIC SIMULATION WITH SSA_METHOD %i DOES NOT MATCH', method );
+    end
+end
+ar.config.ssa_method = 0;
+fprintf(2, 'PASSED\n');
@@ -54,3 +54,16 @@ if ( norm(ar.model.data(arFindData('monotone')).res) < 3e-3 )
 else
     error( 'FINAL ERROR TOO LARGE' );
 end
+
+fprintf( 2, 'Checking that repeated simulations reuse the arena... ' );
+useParallel = ar.config.useParallel;
+ar.config.useParallel = 0;
+arSimu(true, true, true);
+arSimu(true, true, true);
+ar.config.useParallel = useParallel;
+allocStats = ar.model.condition(1).allocStats;
+if ( ( allocStats(1) > 0 ) && ( allocStats(2) == 0 ) )
+    fprintf('PASSED\n');
+else
+    error( 'SIMULATION MEMORY WAS NOT RECYCLED (allocations %d, mallocs %d)', allocStats(1), allocStats(2) );
+end
@@ -0,0 +1,49 @@
+function TestFeature()
+
+global ar;
+
+fprintf( 2, 'INTEGRATION TEST FOR STATE DEPENDENT EVENTS\n' );
+
+fprintf( 2, 'Loading model with a trigger... ' );
+arInit;
+arLoadModel('redosing');
+
+% Redose 10 nmol/l whenever the drug falls below the threshold
+arAddTrigger(1, 'drug - threshold', -1, 'drug', 1, 10);
+arCompileAll(true);
+
+arSetPars('k_el', 0.5, 1, 0, 0, 10);
+arSetPars('threshold', 2, 1, 0, 0, 10);
+fprintf( 2, 'PASSED\n' );
+
+fprintf( 2, 'Testing the redosing against the analytical solution... ' );
+arSimu(true, true, true);
+k = 0.5; thr = 2; tEnd = ar.model.condition.tFine(end);
+t1 = log(10/thr)/k;
+T = log((thr+10)/thr)/k;
+n = floor((tEnd - t1)/T) + 1;
+drugEnd = (thr+10) * exp(-k*(tEnd - t1 - (n-1)*T));
+if ( abs( ar.model.condition.xFineSimu(end,1) - drugEnd ) < 1e-4 ) && ( min(ar.model.condition.xFineSimu(:,1)) > thr - 1e-3 )
+    fprintf(2, 'PASSED\n');
+else
+    error( 'STATE DEPENDENT EVENT NOT TRIGGERED CORRECTLY' );
+end
+
+fprintf( 2, 'Testing sensitivities against finite differences... ' );
+sx = squeeze( ar.model.condition.sxFineSimu(end,1,:) );
+h = 1e-6;
+for jp = 1 : length( ar.model.condition.p )
+    ip = find( strcmp( ar.pLabel, ar.model.condition.p{jp} ) );
+    p0 = ar.p(ip);
+    ar.p(ip) = p0 + h;
+    arSimu(false, true, true);
+    xUp = ar.model.condition.xFineSimu(end,1);
+    ar.p(ip) = p0 - h;
+    arSimu(false, true, true);
+    xDown = ar.model.condition.xFineSimu(end,1);
+    ar.p(ip) = p0;
+    if ( abs( sx(jp) - (xUp - xDown)/(2*h) ) > 1e-3 * max( 1, abs(sx(jp)) ) )
+        error( 'SENSITIVITY OF %s DOES NOT MATCH FINITE DIFFERENCES', ar.model.condition.p{jp} );
+    end
+end
+fprintf(2, 'PASSED\n');
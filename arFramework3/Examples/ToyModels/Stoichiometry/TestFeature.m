@@ -47,3 +47,17 @@ else
 end
 
 
+
+fprintf( 2, 'Testing Krylov linear solvers against the dense solver... ' );
+sxDense = ar.model.condition.sxFineSimu;
+for solver = [2, 3]
+    ar.config.useSparseJac = solver;
+    arSimu(true, true, true);
+    if ( max( abs( ar.model.condition.xFineSimu(:) - Xall(:) ) ) > 1e-4 ) || ...
+        ( max( abs( ar.model.condition.sxFineSimu(:) - sxDense(:) ) ) > 1e-3 )
+        ar.config.useSparseJac = 0;
+        error( 'KRYLOV SOLVER %d DEVIATES FROM DENSE SOLVER', solver );
+    end
+end
+ar.config.useSparseJac = 0;
+fprintf('PASSED\n');
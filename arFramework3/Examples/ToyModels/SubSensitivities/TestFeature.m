@@ -87,4 +87,50 @@ for a = 1 : numel( patterns )
     end
 end
 
-fprintf( 2, 'PASSED\n' );
\ No newline at end of file
+fprintf( 2, 'PASSED\n' );
+
+fprintf( 2, 'Testing sensitivity blocks... ' );
+ar.qFit=ones(size(ar.qFit));
+for subset = 0 : 1
+    ar.config.sensitivitySubset=subset;
+    ar.config.sensiBlockSize=0;
+    arSimu(true, true, true); arCalcMerit(true);
+    sres_without = ar.sres + 0;
+
+    ar.config.sensiBlockSize=3;
+    arSimu(true, true, true); arCalcMerit(true);
+    sres_with = ar.sres + 0;
+    ar.config.sensiBlockSize=0;
+    
+    diff = sres_with - sres_without;
+    if ( sum( sum( (diff).^2 ) ) > ar.config.atol * 1000 )
+        error( 'FAILED FOR SENSITIVITY BLOCKS! Error was: %d', sum( sum( (diff).^2 ) ) );
+    end
+end
+ar.config.sensitivitySubset=0;
+
+fprintf( 2, 'PASSED\n' );
+
+fprintf( 2, 'Testing fused sensitivity right hand side... ' );
+ar.qFit=ones(size(ar.qFit));
+ar.qFit(patterns{3})=0;
+for subset = 0 : 1
+    ar.config.sensitivitySubset=subset;
+    ar.config.useSensiRHS=1;
+    arSimu(true, true, true); arCalcMerit(true);
+    sres_without = ar.sres + 0;
+
+    ar.config.useSensiRHS=2;
+    arSimu(true, true, true); arCalcMerit(true);
+    sres_with = ar.sres + 0;
+    ar.config.useSensiRHS=1;
+    
+    diff = sres_with(:,ar.qFit==1) - sres_without(:,ar.qFit==1);
+    if ( sum( sum( (diff).^2 ) ) > ar.config.atol * 1000 )
+        error( 'FAILED FOR FUSED SENSITIVITY RHS! Error was: %d', sum( sum( (diff).^2 ) ) );
+    end
+end
+ar.config.sensitivitySubset=0;
+ar.qFit=ones(size(ar.qFit));
+
+fprintf( 2, 'PASSED\n' );
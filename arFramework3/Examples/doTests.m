@@ -15,7 +15,8 @@
 %     'ErrorFittingTest', 'Flux_Estimation', 'MultiCondition_Test', 'TurboSplines', 
 %     'ResponseCurve', 'PreProcessorTest', 'State_Reduction', 'Fast_Equilibration',  
 %     'Predictor_Test', 'FieldTester', 'SteadyStateBounds', 'DataFilterTest', 
-%     'Benchmark_Simu_Test'
+%     'Benchmark_Simu_Test', 'State_Events', 'Multiple_Shooting',
+%     'SSA_Runs'
 function doTests( varargin )
     global ar;
     global arOutputLevel;
@@ -34,11 +35,12 @@ function doTests( varargin )
                 'Stoichiometry', 'DallaMan2007_GlucoseInsulinSystem', 'Step_Estimation', ...
                 'ErrorFittingTest', 'Flux_Estimation', 'MultiCondition_Test', 'TurboSplines', ...
                 'ResponseCurve', 'PreProcessorTest', 'State_Reduction', 'Fast_Equilibration', ... 
-                'Predictor_Test', 'FieldTester', 'SteadyStateBounds', 'SD_Test', 'Benchmark_Simu_Test' };
+                'Predictor_Test', 'FieldTester', 'SteadyStateBounds', 'SD_Test', 'Benchmark_Simu_Test', 'State_Events', 'Multiple_Shooting', ...
+                'SSA_Runs', 'Common_Subexpressions' };
             
     longtests = { 'Benchmark_Simu_Test' };
     
-    dependencies = { {}, {}, {}, {}, {}, {'TranslateSBML'}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {} };
+    dependencies = { {}, {}, {}, {}, {}, {'TranslateSBML'}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {}, {} };
     
     if ( nargin > 0 && strcmp( varargin{1}, 'long' ) )
         varargin = setdiff( varargin, 'long' );
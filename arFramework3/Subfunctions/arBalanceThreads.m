@@ -0,0 +1,118 @@
+% Repartition the conditions over the simulation threads using the
+% computation times which arSimuCalc measured during previous simulations.
+% Conditions are assigned longest processing time first, i.e. sorted by
+% decreasing cost and each one given to the thread with the lowest load.
+% Separate cost estimates are kept for simulations with and without
+% sensitivities.
+%
+% arBalanceThreads(sensi, ss_conditions, record)
+%   sensi:          balance for simulations with sensitivities     [true]
+%   ss_conditions:  balance ar.config.ss_threads instead of
+%                   ar.config.threads                              [false]
+%   record:         do not repartition, but store the timings of the
+%                   last simulation in .cost(1+sensi) of every
+%                   condition (running average in microseconds)    [false]
+%
+% arSimu records after every simulation and repartitions before the next
+% one when ar.config.useCostBalancing is set.
+
+function arBalanceThreads(sensi, ss_conditions, record)
+
+global ar
+
+if(~exist('sensi','var') || isempty(sensi))
+    sensi = true;
+end
+if(~exist('ss_conditions','var') || isempty(ss_conditions))
+    ss_conditions = false;
+end
+if(~exist('record','var') || isempty(record))
+    record = false;
+end
+
+if(ss_conditions)
+    thread_fieldname = 'ss_threads';
+    condition_fieldname = 'ss_condition';
+else
+    thread_fieldname = 'threads';
+    condition_fieldname = 'condition';
+end
+icost = 1 + (sensi~=0);
+
+if(record)
+    for m = 1:length(ar.model)
+        if(isfield(ar.model(m), condition_fieldname))
+            for c = 1:length(ar.model(m).(condition_fieldname))
+                ticks = ar.model(m).(condition_fieldname)(c).stop - ar.model(m).(condition_fieldname)(c).start;
+
+                % skipped conditions do not record any timings
+                if(ar.model(m).(condition_fieldname)(c).stop <= 0 || ticks < 0)
+                    continue;
+                end
+
+                if(isnan(ar.model(m).(condition_fieldname)(c).cost(icost)))
+                    ar.model(m).(condition_fieldname)(c).cost(icost) = ticks;
+                else
+                    ar.model(m).(condition_fieldname)(c).cost(icost) = ...
+                        0.5 * ar.model(m).(condition_fieldname)(c).cost(icost) + 0.5 * ticks;
+                end
+            end
+        end
+    end
+    return
+end
+
+if(~isfield(ar.config, thread_fieldname) || isempty(ar.config.(thread_fieldname)))
+    return
+end
+nthreads = length(ar.config.(thread_fieldname));
+if(nthreads < 2)
+    return
+end
+
+% collect tasks, balancing is only possible once every condition was timed
+ms = [];
+cs = [];
+nds = [];
+costs = [];
+for m = 1:length(ar.model)
+    if(isfield(ar.model(m), condition_fieldname))
+        for c = 1:length(ar.model(m).(condition_fieldname))
+            if(isnan(ar.model(m).(condition_fieldname)(c).cost(icost)))
+                return
+            end
+            ms(end+1) = m-1; %#ok<AGROW>
+            cs(end+1) = c-1; %#ok<AGROW>
+            nds(end+1) = length(ar.model(m).(condition_fieldname)(c).dLink); %#ok<AGROW>
+            costs(end+1) = ar.model(m).(condition_fieldname)(c).cost(icost); %#ok<AGROW>
+        end
+    end
+end
+
+% longest processing time first
+[~, order] = sort(costs, 'descend');
+threadLoad = zeros(1, nthreads);
+assignment = zeros(size(costs));
+for j = order
+    [~, ithread] = min(threadLoad);
+    threadLoad(ithread) = threadLoad(ithread) + costs(j);
+    assignment(j) = ithread;
+end
+
+threads = ar.config.(thread_fieldname);
+for ithread = 1:nthreads
+    % keep each list sorted by decreasing cost, so that threads which run
+    % out of work steal the cheapest remaining conditions
+    tasks = order(assignment(order)==ithread);
+    threads(ithread).id = ithread-1;
+    threads(ithread).n = length(tasks);
+    threads(ithread).nd = sum(nds(tasks));
+    threads(ithread).ms = int32(ms(tasks));
+    threads(ithread).cs = int32(cs(tasks));
+end
+ar.config.(thread_fieldname) = threads;
+
+% the thread layout does not change the results, keep the cache valid
+if(isfield(ar, 'cache') && isfield(ar.cache, thread_fieldname))
+    ar.cache.(thread_fieldname) = threads;
+end
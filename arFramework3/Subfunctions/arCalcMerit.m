@@ -15,12 +15,17 @@
 %   Detailed description: 
 %   (taken from arChi2):
 % 
-% arCalcMerit(sensi, pTrial, dynamics, doSimu)
+% arCalcMerit(sensi, pTrial, dynamics, doSimu, gradOnly)
 %   sensi:          propagate sensitivities         [false]
 %                   this argument is passed to arSimu
 %   pTrial:         trial parameter of fitting
 %   dynamics:       force evaluation of dynamics    [false]
 %   doSimu          should arSimu be called         [true]
+%   gradOnly        the caller only needs the gradient of the
+%                   objective, not ar.sres of the data. With
+%                   ar.config.useAdjoint the data part of the
+%                   gradient is then computed by the adjoint
+%                   method and stored in ar.adjointGrad     [false]
 % 
 % or
 %
@@ -57,6 +62,9 @@
 %           doSimu  can be set to false, then the residuals are calculated
 %           without updating the model trajectories (e.g. if ar.qFit or ar.
 %           model.data.qFit) has been changed.
+%
+% arCalcMerit(sensi,ptrial,dynamics,doSimu,gradOnly)
+%           gradOnly is set by the fmincon objective of arFit
 
 
 
@@ -104,6 +112,12 @@ else
     doSimu = true;
 end
 
+if nargs>=5 && ~isempty(varargin{5})
+    adjoint = sensi && varargin{5} && adjointApplicable;
+else
+    adjoint = false;
+end
+
 if(~isfield(ar, 'fevals'))
     ar.fevals = 0; 
 end
@@ -126,9 +140,9 @@ for i = 1:nCVRestart
     try
         if doSimu
             if(qglobalar)  % since ar is overwritten anyway in arSimu, the possiblity to use of qglobalar obsolete
-                arSimu(sensi, false, dynamics);
+                arSimu(sensi, false, dynamics, adjoint);
             else
-                ar = arSimu(ar, sensi, false, dynamics);
+                ar = arSimu(ar, sensi, false, dynamics, adjoint);
             end
         end
         has_error = false;
@@ -192,7 +206,7 @@ for m=1:length(ar.model)
     end
 end
 
-arCollectRes(sensi);
+arCollectRes(sensi, 0, adjoint);
 
 % set Inf for errors
 if(has_error)
@@ -204,7 +218,11 @@ end
 
 % calculate first order optimality criterion
 if(sensi)
-    res = [ar.res ar.constr];
+    if(adjoint)
+        res = [ar.res(ar.res_type~=1) ar.constr];
+    else
+        res = [ar.res ar.constr];
+    end
     sres = [];
     if(~isempty(ar.sres))
         sres = ar.sres(:, ar.qFit==1);
@@ -213,6 +231,12 @@ if(sensi)
         sres = [sres; ar.sconstr(:, ar.qFit==1)];
     end
     g = -2*res*sres; % gradient
+    if(adjoint && ~isempty(ar.adjointGrad))
+        if(isempty(g))
+            g = 0;
+        end
+        g = g - ar.adjointGrad(ar.qFit==1);
+    end
     if(~isempty(g))
         onbound = [my_equals(ar.p(ar.qFit==1),ar.ub(ar.qFit==1)); my_equals(ar.p(ar.qFit==1),ar.lb(ar.qFit==1))];
         exbounds = [g>0; g<0];
@@ -238,6 +262,43 @@ if ~silent
     arGetMerit
 end
 
+% The adjoint gradient covers the data chi2 with fixed errors. Everything
+% which needs the data rows of ar.sres or sensitivities of states at
+% special time points falls back to forward sensitivities.
+function ok = adjointApplicable
+global ar
+
+ok = isfield(ar.config, 'useAdjoint') && ar.config.useAdjoint && ar.config.useSensis;
+ok = ok && ar.config.fiterrors ~= 1 && ~(ar.config.fiterrors==0 && sum(ar.qFit(ar.qError==1)<2)>0);
+ok = ok && ~ar.config.useFitErrorMatrix && ~ar.config.useMS;
+ok = ok && ~(isfield(ar.config, 'sensitivitySubset') && ar.config.sensitivitySubset == 1);
+ok = ok && ~(isfield(ar.config, 'user_residual_fun') && ~isempty(ar.config.user_residual_fun));
+ok = ok && ~any(ar.type == 3 | ar.type == 5);
+ok = ok && ~(isfield(ar, 'ss_conditions') && ar.ss_conditions);
+ok = ok && ~(isfield(ar, 'conditionconstraints') && ~isempty(ar.conditionconstraints));
+if(~ok)
+    return
+end
+
+for m = 1:length(ar.model)
+    for c = 1:length(ar.model(m).condition)
+        if(ar.config.useEvents && ar.model(m).condition(c).qEvents)
+            ok = false;
+        elseif(isfield(ar.model(m).condition(c), 'qSteadyState') && any(ar.model(m).condition(c).qSteadyState==1))
+            ok = false;
+        elseif(any(isinf(ar.model(m).condition(c).tExp)))
+            ok = false;
+        end
+    end
+    if(isfield(ar.model(m), 'data'))
+        for d = 1:length(ar.model(m).data)
+            if(isfield(ar.model(m).data(d), 'resfunction') && isstruct(ar.model(m).data(d).resfunction) && ar.model(m).data(d).resfunction.active)
+                ok = false;
+            end
+        end
+    end
+end
+
 function c = my_equals(a,b)
 c = a(:)==b(:);
 c = c';
@@ -1,4 +1,4 @@
-% arCollectRes(sensi, [debugres])
+% arCollectRes(sensi, [debugres], [adjoint])
 %
 % Collects all residuals, sres and chi2 of the individual data sets and 
 % calculates the number of data points. Additional the priors, constr,
@@ -7,6 +7,10 @@
 %   sensi          boolean, collect sensitivities
 %   debugres  [0]  boolean, fill ar.resinfo with 
 %                  additional information 
+%   adjoint   [0]  boolean, arSimu computed the gradient of the data chi2
+%                  by the adjoint method: ar.sres only holds the rows of
+%                  the remaining residuals and the data part of the
+%                  gradient is collected in ar.adjointGrad
 %
 % Function collects residuals and chi2 calculated by arCalcRes(true)
 % from the data structs to the top level of the ar struct  
@@ -15,17 +19,21 @@
 %   - prior                     -> ar.res , ar.type=3
 %   - constr                    -> ar.constr
 %   - random                    -> ar.res , ar.type=4
+%   - multiple shooting         -> ar.res , ar.type=6
 %   - ar.model.data.sres        -> ar.sres 
 %   - ar.model.data.chi2        -> ar.chi2
 
 
-function arCollectRes(sensi, debugres)
+function arCollectRes(sensi, debugres, adjoint)
 
 global ar 
 
 if ( nargin < 2 )
     debugres = 0;
 end
+if ( nargin < 3 )
+    adjoint = false;
+end
 if ~isfield(ar,'ndata_res')
     arCalcRes(true)
 end
@@ -64,7 +72,15 @@ end
 
 np = length(ar.p);
 
-useMSextension = false;
+if(adjoint && sensi)
+    ar.sres = zeros(0, np);
+    ar.adjointGrad = zeros(1, np);
+else
+    ar.adjointGrad = [];
+end
+
+% continuity residuals of multiple shooting (see arLoadData, option 'DpPerShoot')
+useMSextension = isfield(ar, 'ms_count_snips') && ar.ms_count_snips>0 && ar.config.useMS==1;
 
 resindex = 1;
 sresindex = 1;
@@ -80,54 +96,53 @@ for jm = 1:length(ar.model)
             if(ar.model(jm).data(jd).has_yExp)
                 ar.chi2 = ar.chi2 + sum(ar.model(jm).data(jd).chi2(ar.model(jm).data(jd).qFit==1));
                 
-                if(useMSextension && isfield(ar, 'ms_count_snips') && ~isempty(ar.model(jm).data(jd).ms_index))
-                    
-                else
-                    % collect residuals for fitting
-                    tmpres = ar.model(jm).data(jd).res(:,ar.model(jm).data(jd).qFit==1);
-                    ar.res(resindex:(resindex+length(tmpres(:))-1)) = tmpres;
-                    ar.res_type(resindex:(resindex+length(tmpres(:))-1)) = 1;
-                    
+                % collect residuals for fitting
+                tmpres = ar.model(jm).data(jd).res(:,ar.model(jm).data(jd).qFit==1);
+                ar.res(resindex:(resindex+length(tmpres(:))-1)) = tmpres;
+                ar.res_type(resindex:(resindex+length(tmpres(:))-1)) = 1;
+                
+                if ( debugres )
+                    for jr = 1 : numel( tmpres )
+                        ar.resinfo(resindex + jr - 1).type = 'data';
+                        ar.resinfo(resindex + jr - 1).m = jm;
+                        ar.resinfo(resindex + jr - 1).d = jd;
+                    end
+                end
+                resindex = resindex+length(tmpres(:));
+                
+                if( fiterrors )                        
+                    ar.chi2err = ar.chi2err + sum(ar.model(jm).data(jd).chi2err(ar.model(jm).data(jd).qFit==1));
+                    tmpreserr = ar.model(jm).data(jd).reserr(:,ar.model(jm).data(jd).qFit==1);
+                    ar.res(resindex:(resindex+length(tmpreserr(:))-1)) = tmpreserr;
+                    ar.res_type(resindex:(resindex+length(tmpreserr(:))-1)) = 2;
                     if ( debugres )
-                        for jr = 1 : numel( tmpres )
-                            ar.resinfo(resindex + jr - 1).type = 'data';
+                        for jr = 1 : numel( tmpreserr )
+                            ar.resinfo(resindex + jr - 1).type = 'error model';
                             ar.resinfo(resindex + jr - 1).m = jm;
                             ar.resinfo(resindex + jr - 1).d = jd;
                         end
                     end
-                    resindex = resindex+length(tmpres(:));
-                    
-                    if( fiterrors )                        
-                        ar.chi2err = ar.chi2err + sum(ar.model(jm).data(jd).chi2err(ar.model(jm).data(jd).qFit==1));
-                        tmpreserr = ar.model(jm).data(jd).reserr(:,ar.model(jm).data(jd).qFit==1);
-                        ar.res(resindex:(resindex+length(tmpreserr(:))-1)) = tmpreserr;
-                        ar.res_type(resindex:(resindex+length(tmpreserr(:))-1)) = 2;
-                        if ( debugres )
-                            for jr = 1 : numel( tmpreserr )
-                                ar.resinfo(resindex + jr - 1).type = 'error model';
-                                ar.resinfo(resindex + jr - 1).m = jm;
-                                ar.resinfo(resindex + jr - 1).d = jd;
-                            end
-                        end
-                        resindex = resindex+length(tmpreserr(:));
-                    end
+                    resindex = resindex+length(tmpreserr(:));
+                end
+                
+                % collect sensitivities for fitting
+                if(ar.config.useSensis && sensi && adjoint)
+                    ar.adjointGrad(ar.model(jm).data(jd).pLink) = ar.adjointGrad(ar.model(jm).data(jd).pLink) + ...
+                        arTrafoParameters(ar.model(jm).data(jd).chi2Grad, jm, jd, true);
+                elseif(ar.config.useSensis && sensi)
+                    tmptmpsres = ar.model(jm).data(jd).sres(:,ar.model(jm).data(jd).qFit==1,:);
+                    tmpsres = zeros(length(tmpres(:)), np);
+                    tmpsres(:,ar.model(jm).data(jd).pLink) = reshape(tmptmpsres, ...
+                        length(tmpres(:)), sum(ar.model(jm).data(jd).pLink));
+                    ar.sres(sresindex:(sresindex+length(tmpres(:))-1),:) = tmpsres;
+                    sresindex = sresindex+length(tmpres(:));
                     
-                    % collect sensitivities for fitting
-                    if(ar.config.useSensis && sensi)
-                        tmptmpsres = ar.model(jm).data(jd).sres(:,ar.model(jm).data(jd).qFit==1,:);
-                        tmpsres = zeros(length(tmpres(:)), np);
-                        tmpsres(:,ar.model(jm).data(jd).pLink) = reshape(tmptmpsres, ...
-                            length(tmpres(:)), sum(ar.model(jm).data(jd).pLink));
-                        ar.sres(sresindex:(sresindex+length(tmpres(:))-1),:) = tmpsres;
+                    if ( fiterrors )
+                        tmpsreserr = zeros(length(tmpreserr(:)), np);
+                        tmpsreserr(:,ar.model(jm).data(jd).pLink) = reshape(ar.model(jm).data(jd).sreserr(:,ar.model(jm).data(jd).qFit==1,:), ...
+                            length(tmpreserr(:)), sum(ar.model(jm).data(jd).pLink));
+                        ar.sres(sresindex:(sresindex+length(tmpres(:))-1),:) = tmpsreserr;
                         sresindex = sresindex+length(tmpres(:));
-                        
-                        if ( fiterrors )
-                            tmpsreserr = zeros(length(tmpreserr(:)), np);
-                            tmpsreserr(:,ar.model(jm).data(jd).pLink) = reshape(ar.model(jm).data(jd).sreserr(:,ar.model(jm).data(jd).qFit==1,:), ...
-                                length(tmpreserr(:)), sum(ar.model(jm).data(jd).pLink));
-                            ar.sres(sresindex:(sresindex+length(tmpres(:))-1),:) = tmpsreserr;
-                            sresindex = sresindex+length(tmpres(:));
-                        end
                     end
                 end
             end
@@ -135,6 +150,16 @@ for jm = 1:length(ar.model)
     end
 end
 
+% adjoint gradients of the dynamic parameters
+if(ar.config.useSensis && sensi && adjoint)
+    for jm = 1:length(ar.model)
+        for jc = 1:length(ar.model(jm).condition)
+            ar.adjointGrad(ar.model(jm).condition(jc).pLink) = ar.adjointGrad(ar.model(jm).condition(jc).pLink) + ...
+                arTrafoParameters(ar.model(jm).condition(jc).chi2Grad, jm, jc, false);
+        end
+    end
+end
+
 % constraints
 constrindex = 1;
 sconstrindex = 1;
@@ -486,87 +511,51 @@ if(isfield(ar, 'random'))
     end
 end
 
-% % multiple shooting (difference penality)
-% if(isfield(ar,'ms_count_snips'))
-%     ar.ms_violation = 0;
-%     for jm = 1:length(ar.model)
-%         for jms = 1:size(ar.model(jm).ms_link,1)
-%             tmpres1 = ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).xExpSimu(ar.model(jm).ms_link(jms,4),:);
-%             tmpres2 = ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).xExpSimu(ar.model(jm).ms_link(jms,5),:);
-%             ar.ms_violation = [ar.ms_violation (log10(tmpres1) - log10(tmpres2)).^2];
-%             
-%             if(ar.ms_strength>0)
-%                 tmpres = sqrt(ar.ms_strength) * (tmpres1 - tmpres2);
-%                 ar.res(resindex:(resindex+length(tmpres(:))-1)) = tmpres;
-%                 resindex = resindex+length(tmpres(:));
-%                 
-%                 if(ar.config.useSensis && sensi)
-%                     tmpsres1 = zeros(length(tmpres(:)), np);
-%                     tmpsres1(:,ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).pLink) = ...
-%                         reshape(ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).sxExpSimu(...
-%                         ar.model(jm).ms_link(jms,4),:,:), length(tmpres(:)), ...
-%                         sum(ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).pLink));
-%                     
-%                     tmpsres2 = zeros(length(tmpres(:)), np);
-%                     tmpsres2(:,ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).pLink) = ...
-%                         reshape(ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).sxExpSimu(...
-%                         ar.model(jm).ms_link(jms,5),:,:), length(tmpres(:)), ...
-%                         sum(ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).pLink));
-%                     
-%                     tmpsres = sqrt(ar.ms_strength) * (tmpsres1 - tmpsres2);
-%                     
-%                     for j=find(ar.qLog10==1)
-%                         tmpsres(:,j) = tmpsres(:,j) * 10.^ar.p(j) * log(10);
-%                     end
-%                     
-%                     ar.sres(sresindex:(sresindex+length(tmpres(:))-1),:) = tmpsres;
-%                     sresindex = sresindex+length(tmpres(:));
-%                 end
-%             end
-%         end
-%     end
-% end
-
-% % multiple shooting (log ratio penalty)
-% if(isfield(ar,'ms_count_snips'))
-%     ar.ms_violation = [];
-%     for jm = 1:length(ar.model)
-%         for jms = 1:size(ar.model(jm).ms_link,1)
-%             tmpres1 = ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).xExpSimu(ar.model(jm).ms_link(jms,4),:);
-%             tmpres2 = ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).xExpSimu(ar.model(jm).ms_link(jms,5),:);
-%             ar.ms_violation = [ar.ms_violation (log10(tmpres1) - log10(tmpres2)).^2];
-%             
-%             if(ar.ms_strength>0)
-%                 tmpres = sqrt(ar.ms_strength) * (log10(tmpres1) - log10(tmpres2));
-%                 ar.res(resindex:(resindex+length(tmpres(:))-1)) = tmpres;
-%                 resindex = resindex+length(tmpres(:));
-%                 
-%                 if(ar.config.useSensis && sensi)
-%                     tmpsres1 = zeros(length(tmpres(:)), np);
-%                     tmpsres1(:,ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).pLink) = ...
-%                         reshape(ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).sxExpSimu(...
-%                         ar.model(jm).ms_link(jms,4),:,:), length(tmpres(:)), ...
-%                         sum(ar.model(jm).condition(ar.model(jm).ms_link(jms,1)).pLink));
-%                     
-%                     tmpsres2 = zeros(length(tmpres(:)), np);
-%                     tmpsres2(:,ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).pLink) = ...
-%                         reshape(ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).sxExpSimu(...
-%                         ar.model(jm).ms_link(jms,5),:,:), length(tmpres(:)), ...
-%                         sum(ar.model(jm).condition(ar.model(jm).ms_link(jms,2)).pLink));
-%                     
-%                     tmpsres = sqrt(ar.ms_strength) * (tmpsres1./(tmpres1'*ones(1,np)) - (tmpsres2./(tmpres2'*ones(1,np)))) / log(10);
-%                     
-%                     for j=find(ar.qLog10==1)
-%                         tmpsres(:,j) = tmpsres(:,j) * 10.^ar.p(j) * log(10);
-%                     end
-%                     
-%                     ar.sres(sresindex:(sresindex+length(tmpres(:))-1),:) = tmpsres;
-%                     sresindex = sresindex+length(tmpres(:));
-%                 end
-%             end
-%         end
-%     end
-% end
+% multiple shooting: continuity of the states at the nodes between the segments
+if(useMSextension)
+    ar.ms_violation = [];
+    for jm = 1:length(ar.model)
+        if(~isfield(ar.model(jm), 'ms_link') || isempty(ar.model(jm).ms_link))
+            continue;
+        end
+        for jms = 1:size(ar.model(jm).ms_link,1)
+            c1 = ar.model(jm).ms_link(jms,1);
+            c2 = ar.model(jm).ms_link(jms,2);
+            tmpres1 = ar.model(jm).condition(c1).xExpSimu(ar.model(jm).ms_link(jms,4),:);
+            tmpres2 = ar.model(jm).condition(c2).xExpSimu(ar.model(jm).ms_link(jms,5),:);
+            ar.ms_violation = [ar.ms_violation (tmpres1 - tmpres2).^2];
+            
+            if(ar.ms_strength>0)
+                tmpres = sqrt(ar.ms_strength) * (tmpres1 - tmpres2);
+                ar.res(resindex:(resindex+length(tmpres(:))-1)) = tmpres;
+                ar.res_type(resindex:(resindex+length(tmpres(:))-1)) = 6;
+                if ( debugres )
+                    for jr = 1 : numel( tmpres )
+                        ar.resinfo(resindex + jr - 1).type = 'multiple shooting';
+                        ar.resinfo(resindex + jr - 1).m = jm;
+                        ar.resinfo(resindex + jr - 1).c = [c1 c2];
+                    end
+                end
+                resindex = resindex+length(tmpres(:));
+                ar.ndata = ar.ndata + length(tmpres(:));
+                ar.chi2 = ar.chi2 + sum(tmpres.^2);
+                
+                if(ar.config.useSensis && sensi)
+                    sens1 = arTrafoParameters(ar.model(jm).condition(c1).sxExpSimu(ar.model(jm).ms_link(jms,4),:,:), jm, c1, false);
+                    sens2 = arTrafoParameters(ar.model(jm).condition(c2).sxExpSimu(ar.model(jm).ms_link(jms,5),:,:), jm, c2, false);
+                    
+                    tmpsres = zeros(length(tmpres(:)), np);
+                    tmpsres(:,ar.model(jm).condition(c1).pLink) = reshape(sens1, length(tmpres(:)), sum(ar.model(jm).condition(c1).pLink));
+                    tmpsres(:,ar.model(jm).condition(c2).pLink) = tmpsres(:,ar.model(jm).condition(c2).pLink) - ...
+                        reshape(sens2, length(tmpres(:)), sum(ar.model(jm).condition(c2).pLink));
+                    
+                    ar.sres(sresindex:(sresindex+length(tmpres(:))-1),:) = sqrt(ar.ms_strength) * tmpsres;
+                    sresindex = sresindex+length(tmpres(:));
+                end
+            end
+        end
+    end
+end
 
 %% user-defined residuals (calculated by ar.config.user_residual_fun)
 if isfield(ar.res_user,'res')
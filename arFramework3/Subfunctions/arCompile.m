@@ -30,17 +30,14 @@ else
     end
 end
 
-enableRootfinding = 0;
-if ( isfield( ar.config, 'fastEquilibration' ) )
-    enableRootfinding = ar.config.fastEquilibration;
+% fast equilibration enables the rootfinding from within C
+if ( isfield( ar.config, 'fastEquilibration' ) && ar.config.fastEquilibration )
+    ar.config.C_rootfinding = 1;
 end
 
-includeBLAS = 0;
-includeLAPACK = 0;
-if ( enableRootfinding )
-    includeBLAS     = 1;
-    includeLAPACK   = 1;
-end
+% inverseC (rootfinding and steady state sensitivities) uses the LAPACK
+% which ships with MATLAB
+includeLAPACK = 1;
 
 global arOutputLevel;
 if isempty( arOutputLevel )
@@ -68,15 +65,8 @@ if ( arOutputLevel > 3 )
 end
 
 mexopt = {'-largeArrayDims'};
-if ( includeBLAS )
-    mexopt{end+1} = '-lblas';
-end
 if ( includeLAPACK )
-    mexopt{end+1} = '-llapack';
-end
-if ( enableRootfinding )
-    mexopt{end+1} = '-DROOT_FINDING';
-    ar.config.C_rootfinding = 1;
+    mexopt{end+1} = '-lmwlapack';
 end
 if isfield( ar.config, 'defines' )
     mexopt = union( mexopt, ar.config.defines );
@@ -363,10 +353,8 @@ objects = {
     'sundials_math.o';
     'nvector_serial.o';
     'arInputFunctionsC.o';
+    'inverseC.o';
     };
-if ( enableRootfinding )
-    objects{end+1} = 'inverseC.o';
-end
 if(ispc)
     objects = strrep(objects, '.o', '.obj');
 end
@@ -413,14 +401,19 @@ else
     arFprintf(2, 'compiling input functions...skipped\n');
 end
 
-if ( enableRootfinding )
-    if(~exist(objects_inp, 'file') || forceFullCompile)
-        mex('-c',verbose{:},mexopt{:},'-outdir',['Compiled/' ar.info.c_version_code '/' mexext '/'], ...
-            includesstr{:}, which('inverseC.c'));
-        arFprintf(2, 'compiling rootfinding functions...done\n');
-    else
-        arFprintf(2, 'compiling rootfinding functions...skipped\n');
-    end
+%% pre-compile rootfinding and steady state sensitivity functions
+if(~ispc)
+    objects_inv = ['./Compiled/' ar.info.c_version_code '/' mexext '/inverseC.o'];
+else
+    objects_inv = ['./Compiled/' ar.info.c_version_code '/' mexext '/inverseC.obj'];
+end
+
+if(~exist(objects_inv, 'file') || forceFullCompile)
+    mex('-c',verbose{:},mexopt{:},'-outdir',['Compiled/' ar.info.c_version_code '/' mexext '/'], ...
+        includesstr{:}, which('inverseC.c'));
+    arFprintf(2, 'compiling rootfinding functions...done\n');
+else
+    arFprintf(2, 'compiling rootfinding functions...skipped\n');
 end
 
 
@@ -429,55 +422,70 @@ end
 %     objectsstr = [objectsstr {objects_inp}];
 % end
 
+%% object cache and compile jobs for conditions and data
+% Condition and data objects are cached by a checksum of their sources and
+% the compiler flags, so that they are reused across code versions and
+% projects. Cache misses are compiled by the parallel pool if one is open
+% and by ar.config.nCompileJobs mex processes otherwise.
+job.verbose = verbose;
+job.mexopt = mexopt;
+job.includesstr = includesstr;
+job.outdir = ['./Compiled/' c_version_code '/' mexext '/'];
+job.usePool = usePool;
+job.forceFullCompile = forceFullCompile;
+job.nJobs = 1;
+if(isfield(ar.config, 'nCompileJobs'))
+    job.nJobs = ar.config.nCompileJobs;
+end
+job.cache = '';
+if(isfield(ar.config, 'useObjectCache') && ar.config.useObjectCache)
+    if(isfield(ar.config, 'objectCachePath') && ~isempty(ar.config.objectCachePath))
+        job.cache = [ar.config.objectCachePath '/' mexext '/'];
+    else
+        job.cache = [ar_path '/Compiled/cache/' mexext '/'];
+    end
+    if(~exist(job.cache, 'dir') && ~mkdir(job.cache))
+        arFprintf(2, 'object cache %s is not writable, not used\n', job.cache);
+        job.cache = '';
+    end
+end
+try
+    cc = mex.getCompilerConfigurations('C', 'Selected');
+    compiler = [cc(1).Name ' ' cc(1).Version];
+catch
+    compiler = '';
+end
+% every header the objects can include: the framework, SUNDIALS and KLU
+headers = [dir([ar_path '/Ccode/**/*.h']); dir([sundials_path 'include/**/*.h']); ...
+    dir([sundials_path 'src/cvodes/*.h']); dir([KLU_path '**/Include/*.h'])];
+headers = strcat({headers.folder}, '/', {headers.name});
+job.flags = [verbose mexopt {mexext, version, compiler, sundials_path, objectKey(headers, {})}];
+if(isempty(compiled_cluster_path))
+    job.source_dir = [source_dir '/Compiled/' c_version_code '/'];
+else
+    job.source_dir = [compiled_cluster_path '/' c_version_code '/'];
+end
+
 %% pre-compile conditions
 objects_con = {};
 file_con = {};
-ms = [];
-cs = [];
+label_con = {};
 for jm = 1:length(ar.model)
     for jc = 1:length(ar.model(jm).condition)
+        if(ismember([ar.model(jm).condition(jc).codefkt '.c'], file_con))
+            continue % conditions sharing their code are compiled once
+        end
         if(~ispc)
-            objects_con{end+1} = ['./Compiled/' ar.info.c_version_code '/' mexext '/' ar.model(jm).condition(jc).fkt '.o']; %#ok<AGROW>
+            objects_con{end+1} = ['./Compiled/' ar.info.c_version_code '/' mexext '/' ar.model(jm).condition(jc).codefkt '.o']; %#ok<AGROW>
         else
-            objects_con{end+1} = ['./Compiled/' ar.info.c_version_code '/' mexext '/' ar.model(jm).condition(jc).fkt '.obj']; %#ok<AGROW>
+            objects_con{end+1} = ['./Compiled/' ar.info.c_version_code '/' mexext '/' ar.model(jm).condition(jc).codefkt '.obj']; %#ok<AGROW>
         end
-        file_con{end+1} = [ar.model(jm).condition(jc).fkt '.c']; %#ok<AGROW>
-        ms(end+1) = jm; %#ok<AGROW>
-        cs(end+1) = jc; %#ok<AGROW>
+        file_con{end+1} = [ar.model(jm).condition(jc).codefkt '.c']; %#ok<AGROW>
+        label_con{end+1} = sprintf('condition m%i c%i, %s', jm, jc, file_con{end}); %#ok<AGROW>
     end
 end
 
-if(usePool)
-    parfor j=1:length(objects_con)
-        if(~exist(objects_con{j}, 'file') || forceFullCompile)
-            if(isempty(compiled_cluster_path))
-                mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                    includesstr{:}, [source_dir '/Compiled/' c_version_code '/' file_con{j}]);  %#ok<PFBNS>
-            else
-                mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                    includesstr{:}, [compiled_cluster_path '/' c_version_code '/' file_con{j}]);
-            end
-            arFprintf(2, 'compiling condition m%i c%i, %s...done\n', ms(j), cs(j), file_con{j});
-        else
-            arFprintf(2, 'compiling condition m%i c%i, %s...skipped\n', ms(j), cs(j), file_con{j});
-        end
-    end
-else
-    for j=1:length(objects_con)
-        if(~exist(objects_con{j}, 'file') || forceFullCompile)
-            if(isempty(compiled_cluster_path))
-                mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                    includesstr{:}, [source_dir '/Compiled/' c_version_code '/' file_con{j}]);
-            else
-                mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                    includesstr{:}, [compiled_cluster_path '/' c_version_code '/' file_con{j}]);
-            end
-            arFprintf(2, 'compiling condition m%i c%i, %s...done\n', ms(j), cs(j), file_con{j});
-        else
-            arFprintf(2, 'compiling condition m%i c%i, %s...skipped\n', ms(j), cs(j), file_con{j});
-        end
-    end
-end
+compileObjects(objects_con, file_con, label_con, job);
 
 if(~debug_mode)
     objectsstr = [objectsstr objects_con];
@@ -487,8 +495,7 @@ end
 if(isfield(ar.model, 'data'))
     objects_dat = {};
     file_dat = {};
-    ms = [];
-    ds = [];
+    label_dat = {};
     
     for jm = 1:length(ar.model)
         for jd = 1:length(ar.model(jm).data)
@@ -498,42 +505,11 @@ if(isfield(ar.model, 'data'))
                 objects_dat{end+1} = ['./Compiled/' ar.info.c_version_code '/' mexext '/' ar.model(jm).data(jd).fkt '.obj']; %#ok<AGROW>
             end
             file_dat{end+1} = [ar.model(jm).data(jd).fkt '.c']; %#ok<AGROW>
-            ms(end+1) = jm; %#ok<AGROW>
-            ds(end+1) = jd; %#ok<AGROW>
+            label_dat{end+1} = sprintf('data m%i d%i, %s', jm, jd, file_dat{end}); %#ok<AGROW>
         end
     end
     
-    if(usePool)
-        parfor j=1:length(objects_dat)
-            if(~exist(objects_dat{j}, 'file') || forceFullCompile)
-                if(isempty(compiled_cluster_path))
-                    mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                        includesstr{:}, [source_dir '/Compiled/' c_version_code '/' file_dat{j}]);  %#ok<PFBNS>
-                else
-                    mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                        includesstr{:}, [compiled_cluster_path '/' c_version_code '/' file_dat{j}]);
-                end
-                arFprintf(2, 'compiling data m%i d%i, %s...done\n', ms(j), ds(j), file_dat{j});
-            else
-                arFprintf(2, 'compiling data m%i d%i, %s...skipped\n', ms(j), ds(j), file_dat{j});
-            end
-        end
-    else
-        for j=1:length(objects_dat)
-            if(~exist(objects_dat{j}, 'file') || forceFullCompile)
-                if(isempty(compiled_cluster_path))
-                    mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                        includesstr{:}, [source_dir '/Compiled/' c_version_code '/' file_dat{j}]);
-                else
-                    mex('-c',verbose{:},mexopt{:},'-outdir',['./Compiled/' c_version_code '/' mexext '/'], ...
-                        includesstr{:}, [compiled_cluster_path '/' c_version_code '/' file_dat{j}]);
-                end
-                arFprintf(2, 'compiling data m%i d%i, %s...done\n', ms(j), ds(j), file_dat{j});
-            else
-                arFprintf(2, 'compiling data m%i d%i, %s...skipped\n', ms(j), ds(j), file_dat{j});
-            end
-        end
-    end
+    compileObjects(objects_dat, file_dat, label_dat, job);
     
     if(~debug_mode)
         objectsstr = [objectsstr objects_dat];
@@ -565,11 +541,11 @@ if(~exist([ar.fkt '.' mexext],'file') || forceFullCompile || forceCompileLast)
             fprintf( 'Compiling system\n' );
             mex(mexopt{:},verbose{:},'-output', ar.fkt, includesstr{:}, '-DHAS_PTHREAD=1', ...
                 sprintf('-DNMAXTHREADS=%i', ar.config.nMaxThreads), ...
-                which('udata.c'), which('arSimuCalc.c'), libNames{:});
+                which('udata.c'), which('arLog.c'), which('arSimuCalc.c'), libNames{:});
         else
             mex(mexopt{:},verbose{:},'-output', ar.fkt, includesstr{:}, '-DHAS_PTHREAD=1', ...
                 sprintf('-DNMAXTHREADS=%i', ar.config.nMaxThreads), ...
-                which('udata.c'), which('arSimuCalc.c'), objectsstr{:});
+                which('udata.c'), which('arLog.c'), which('arSimuCalc.c'), objectsstr{:});
         end
     else
         chunkSize = getChunkSize( objectsstr );
@@ -606,11 +582,11 @@ if(~exist([ar.fkt '.' mexext],'file') || forceFullCompile || forceCompileLast)
             fprintf( 'Linking chunks\n' );
             mex(mexopt{:},verbose{:},'-output', ar.fkt, includesstr{:}, '-DHAS_PTHREAD=1', ...
                            sprintf('-DNMAXTHREADS=%i', ar.config.nMaxThreads), ...
-                           which('udata.c'), which('arSimuCalc.c'), libNames{:});
+                           which('udata.c'), which('arLog.c'), which('arSimuCalc.c'), libNames{:});
         else
             mex(mexopt{:},verbose{:},'-output', ar.fkt, includesstr{:}, '-DHAS_PTHREAD=1', ...
             sprintf('-DNMAXTHREADS=%i', ar.config.nMaxThreads), ...
-            which('udata.c'), which('arSimuCalc.c'), objectsstr{:});
+            which('udata.c'), which('arLog.c'), which('arSimuCalc.c'), objectsstr{:});
         end
     end
     arFprintf(2, 'compiling and linking %s...done\n', ar.fkt);
@@ -639,3 +615,115 @@ chunkSize = floor( (0.5 * maxArgSize) / maxLen );
 % Empirically, the maxfile limit seems to be 500 on my system. Not sure
 % how to find this number in a platform independent manner.
 chunkSize = min( [chunkSize, 500] );
+
+% Fetch the objects from the cache or compile them
+function compileObjects(objects, files, labels, job)
+keys = cell(size(objects));
+todo = false(size(objects));
+for j=1:length(objects)
+    if(exist(objects{j}, 'file') && ~job.forceFullCompile)
+        arFprintf(2, 'compiling %s...skipped\n', labels{j});
+        continue
+    end
+    if(~isempty(job.cache))
+        [~, name] = fileparts(files{j});
+        keys{j} = objectKey({[job.source_dir files{j}], [job.source_dir name '.h']}, job.flags);
+        [~, ~, ext] = fileparts(objects{j});
+        if(exist([job.cache keys{j} ext], 'file') && ~job.forceFullCompile)
+            copyfile([job.cache keys{j} ext], objects{j}, 'f');
+            arFprintf(2, 'compiling %s...cached\n', labels{j});
+            continue
+        end
+    end
+    todo(j) = true;
+end
+
+todo = find(todo);
+if(job.usePool)
+    verbose = job.verbose;
+    mexopt = job.mexopt;
+    includesstr = job.includesstr;
+    outdir = job.outdir;
+    sources = strcat(job.source_dir, files(todo));
+    jlabels = labels(todo);
+    parfor j=1:length(todo)
+        mex('-c',verbose{:},mexopt{:},'-outdir',outdir, includesstr{:}, sources{j});
+        arFprintf(2, 'compiling %s...done\n', jlabels{j});
+    end
+elseif(job.nJobs>1 && length(todo)>1 && ~ispc)
+    compileInBackground(strcat(job.source_dir, files(todo)), labels(todo), job);
+else
+    for j=todo
+        mex('-c',job.verbose{:},job.mexopt{:},'-outdir',job.outdir, job.includesstr{:}, [job.source_dir files{j}]);
+        arFprintf(2, 'compiling %s...done\n', labels{j});
+    end
+end
+
+% copy to a temporary name first, other sessions may read the cache
+if(~isempty(job.cache))
+    for j=todo
+        [~, ~, ext] = fileparts(objects{j});
+        [~, tmp] = fileparts(tempname);
+        copyfile(objects{j}, [job.cache keys{j} '_' tmp ext], 'f');
+        movefile([job.cache keys{j} '_' tmp ext], [job.cache keys{j} ext], 'f');
+    end
+end
+
+% Compile by up to job.nJobs mex processes in the background, without the
+% Parallel Computing Toolbox
+function compileInBackground(sources, labels, job)
+mexbin = ['"' fullfile(matlabroot, 'bin', 'mex') '"'];
+args = sprintf(' %s', job.verbose{:}, job.mexopt{:}, job.includesstr{:});
+logs = cell(size(sources));
+for j=1:length(sources)
+    logs{j} = tempname;
+end
+
+failed = [];
+running = [];
+next = 1;
+while(next<=length(sources) || ~isempty(running))
+    while(next<=length(sources) && length(running)<job.nJobs)
+        system(sprintf('(%s -c%s -outdir "%s" "%s" > "%s.log" 2>&1; echo $? > "%s.tmp"; mv "%s.tmp" "%s.done") &', ...
+            mexbin, args, job.outdir, sources{next}, logs{next}, logs{next}, logs{next}, logs{next}));
+        running(end+1) = next; %#ok<AGROW>
+        next = next + 1;
+    end
+    pause(0.05);
+    for j=running
+        if(exist([logs{j} '.done'], 'file'))
+            if(str2double(fileread([logs{j} '.done']))==0)
+                arFprintf(2, 'compiling %s...done\n', labels{j});
+            else
+                fprintf('%s', fileread([logs{j} '.log']));
+                arFprintf(2, 'compiling %s...failed\n', labels{j});
+                failed(end+1) = j; %#ok<AGROW>
+            end
+            delete([logs{j} '.log'], [logs{j} '.done']);
+            running(running==j) = [];
+        end
+    end
+end
+
+if(~isempty(failed))
+    error('compiling %s failed', strjoin(labels(failed), ', '));
+end
+
+% Key of an object in the cache: checksum of the files (its source and
+% header) and the compiler flags, which include the checksum of all headers
+function key = objectKey(files, flags)
+checksum = java.security.MessageDigest.getInstance('MD5');
+for f=1:length(files)
+    if(exist(files{f}, 'file'))
+        str = fileread(files{f});
+        if(~isempty(str))
+            checksum.update(uint8(str(:)));
+        end
+    end
+end
+str = [flags{:}];
+if(~isempty(str))
+    checksum.update(uint8(str(:)));
+end
+key = dec2hex(typecast(checksum.digest,'uint8'))';
+key = key(:)';
@@ -10,7 +10,7 @@ function ar = arInitFields(ar)
     % !!  NOTE: Every time you add or remove a field, increment this value by one.
     % !! 
     % !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-    arFormatVersion = 6;
+    arFormatVersion = 19;
     
     % Without arguments, just return the version number
     if ( nargin < 1 )
@@ -29,6 +29,7 @@ function ar = arInitFields(ar)
     % Config options
     defaults = { ...
         {'fastEquilibration',           false}, ...                     % Faster equilibration (BETA). Set to 1 before compiling if you want to enable rootfinding from within C.
+        {'C_rootfinding',               false}, ...                     % Rootfinding (ar.config.rootfinding) by damped Newton in C, falls back to integration if it does not converge
         {'turboSplines',                false}, ...                     % Faster splines (BETA).
         {'turboSSSensi',                false}, ...                     % Faster equilibration (BETA). Toggle with arFastSensis. DO NOT TOGGLE BY HAND.
         {'sensitivitySubset',           0}, ...                         % Only compute subset of sensitivities when certain qFit's are 0 (BETA)
@@ -44,6 +45,11 @@ function ar = arInitFields(ar)
         {'nCore',                       feature('numCores')}, ...       %   number of available cores
         {'nParallel',                   2*feature('numCores')}, ...
         {'nMaxThreads',                 64}, ...
+        {'useDynamicScheduling',        true}, ...                      %   idle threads take over pending conditions from busy threads
+        {'usePersistentThreads',        true}, ...                      %   keep worker threads alive between simulations (false = create threads on every call)
+        {'useCostBalancing',            true}, ...                      %   distribute conditions over threads by their measured computation time (see arBalanceThreads)
+        {'sensiBlockSize',              0}, ...                         %   split conditions with more sensitivity parameters over several threads (0 = off). Results agree within the integration tolerance.
+        {'useSolverCache',              true}, ...                      %   keep the CVODES memory of every condition between simulations and restart it with CVodeReInit
         ...                                                             % Plotting
         {'savepath',                    []}, ...                        %   field for saving the output path
         {'backup_modelAndData',         true},...                       %   makes copies of model and data files corresponding for each value of ar.checkstr
@@ -59,6 +65,10 @@ function ar = arInitFields(ar)
         ...                                                             % Stochastic simulation
         {'ssa_min_tau',                 1e-3}, ...                      
         {'ssa_runs',                    1}, ...
+        {'ssa_seed',                    0}, ...                         %   seed of the random numbers, runs are reproducible for a fixed seed (0 = new seed on every call)
+        {'ssa_method',                  0}, ...                         %   0 = direct method (Gillespie), 1 = next reaction method (Gibson and Bruck), faster for many weakly coupled reactions, 2 = explicit tau-leaping, 3 = implicit tau-leaping (stiff models), 4 = hybrid: fast reactions as ODEs
+        {'ssa_tau_eps',                 0.03}, ...                      %   tau-leaping: allowed relative change of the propensities within one leap
+        {'ssa_hybrid_threshold',        100}, ...                       %   hybrid: reactions with more firings per output interval and more molecules of each reactant are fast
         ...                                                             % Fit error handling
         {'fiterrors',                   0}, ...                         %   Fit error models?
         {'fiterrors_correction',        1}, ...                         %   Field for storing the Bessel-like error correction
@@ -72,8 +82,11 @@ function ar = arInitFields(ar)
         {'useSensis',                   true}, ...                      %   Use sensitivities
         {'sensiSkip',                   false}, ...                     %   Skip sensitivities during fitting when only func is requested (speed-up for some optimizers)
         {'useJacobian',                 true}, ...                      %   Use Jacobian
-        {'useSparseJac',                false}, ...                     %   Use Sparse Jacobian
-        {'useSensiRHS',                 true}, ...                      %   Use sensitivities of RHS during simulation
+        {'useSparseJac',                false}, ...                     %   Linear solver of CVODES: 0 dense, 1 sparse (KLU), 2 SPGMR, 3 SPBCG (Krylov, for very large models)
+        {'krylovBandwidth',             2}, ...                         %   Half bandwidth of the preconditioner of the Krylov solvers (band of the sparse Jacobian)
+        {'useSensiRHS',                 true}, ...                      %   Use sensitivities of RHS during simulation (2: one call for all parameters instead of one per parameter)
+        {'useCSE',                      true}, ...                      %   Evaluate powers and function calls shared by the fluxes and their derivatives once per (t, x)
+        {'useAdjoint',                  false}, ...                     %   fmincon only: compute the chi2 gradient by backward integration of the adjoint system instead of forward sensitivities
         {'atolV',                       false}, ...                     %   Observation scaled tolerances
         {'atolV_Sens',                  false}, ...                     %   Sensi tolerances?
         {'optimizer',                   1}, ...                         %   Default optimizer
@@ -89,7 +102,7 @@ function ar = arInitFields(ar)
         {'maxsteps',                    1000}, ...                      %   Maximum number of steps before timeout
         {'maxstepsize',                 1e6}, ...                       %   Maximum stepsize
         {'useEvents',                   0}, ...                         %   Use event system
-        {'useMS',                       0}, ...                         %   Use multiple shooting (DEPRECATED)
+        {'useMS',                       0}, ...                         %   Use multiple shooting (set by arLink for data loaded with DpPerShoot)
         {'nCVRestart',                  NaN}, ...                        %   Maximum number of automatic restarts
         ...                                                             % Simulation based equilibration settings
         {'init_eq_step',                100.0}, ...                     %   Simulation time of initial equilibration attempt
@@ -104,6 +117,9 @@ function ar = arInitFields(ar)
         ...
         {'instantaneous_termination',   1}, ...                    	% Poll utIsInterruptPending() to respond to CTRL+C
         {'no_optimization',             0}, ...                         % Disable compiler optimization                                                         
+        {'useObjectCache',              true}, ...                      % Reuse compiled condition and data objects with the same sources and compiler flags across code versions and projects
+        {'objectCachePath',             ''}, ...                        %   folder of the object cache ('' = Compiled/cache of arFramework3)
+        {'nCompileJobs',                feature('numCores')}, ...       %   mex processes compiling in parallel when no parallel pool is open
         };
       
     % Apply the default general settings where no fields are present
@@ -258,6 +274,16 @@ function ar = arInitFields(ar)
         ar.info.arsimucalc_flags{21+je} = sprintf('equilibration failure: %s', ar.info.cvodes_flags{je});
     end
     
+    ar.info.arsimucalc_flags{61} = 'CVodeAdjInit()';
+    ar.info.arsimucalc_flags{62} = 'CVodeCreateB()';
+    ar.info.arsimucalc_flags{63} = 'CVodeInitB()';
+    ar.info.arsimucalc_flags{64} = 'CVodeQuadInitB()';
+    ar.info.arsimucalc_flags{65} = 'CVodeB()';
+    ar.info.arsimucalc_flags{66} = sprintf('adjoint gradient setup.\nEvents, steady state time points (Inf) and structs without chi2Grad are not supported');
+    ar.info.arsimucalc_flags{67} = 'steady state sensitivities (singular dfdx)';
+    ar.info.arsimucalc_flags{68} = 'state dependent events (invalid trigger setup or chattering)';
+    ar.info.arsimucalc_flags{69} = 'stochastic simulation (reaction dependency graph missing, see arSSA)';
+    
     ar.info.arFormatVersion  = arFormatVersion;
     
     ar.info.path = pwd;
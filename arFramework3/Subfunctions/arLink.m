@@ -57,6 +57,7 @@ end
 for m=1:length(ar.model)
     for c=1:length(ar.model(m).condition)
         ar.model(m).condition(c).stepsTaken = int64(0);
+        ar.model(m).condition(c).allocStats = int64([0 0 0]);
         if(~isfield(ar.model(m).condition(c), 'tEvents'))
             ar.model(m).condition(c).tEvents = [];
         end
@@ -192,7 +193,13 @@ for m=1:length(ar.model)
         end
         
         % collect time points for multiple shooting
-        if(isfield(ar, 'ms_count_snips') && ar.ms_count_snips>0)
+        for c=1:length(ar.model(m).condition)
+            ar.model(m).condition(c).tMS = [];
+        end
+        if(isfield(ar.model(m), 'ms_link'))
+            ar.model(m).ms_link = [];
+        end
+        if(isfield(ar, 'ms_count_snips') && ar.ms_count_snips>0 && isfield(ar.model(m), 'ms_count'))
             arFprintf(2, '\n');
             for jms=1:ar.model(m).ms_count
                 for c=1:length(ar.model(m).condition)
@@ -211,19 +218,21 @@ for m=1:length(ar.model)
                                 tlink = ar.model(m).condition(c2).ms_snip_start;
                                 arFprintf(2, 'linking condition %i and %i for multiple shooting at t = %f\n', c, c2, tlink);
                                 
-                                % Add multiple shooting points to the event list
-                                ar.model(m).condition(c).tEvents = ...
-                                    union(ar.model(m).condition(c).tEvents, tlink); %R2013a compatible
-                                ar.model(m).condition(c2).tEvents = ...
-                                    union(ar.model(m).condition(c2).tEvents, tlink); %R2013a compatible
+                                % The node ends segment c and starts segment c2, the
+                                % integration of c stops exactly at the node (see x_calc)
+                                ar.model(m).condition(c).tMS = ...
+                                    union(ar.model(m).condition(c).tMS, tlink); %R2013a compatible
+                                ar.model(m).condition(c2).tMS = ...
+                                    union(ar.model(m).condition(c2).tMS, tlink); %R2013a compatible
                                 
-                                if(~isfield(ar.model(m), 'ms_link'))
+                                if(~isfield(ar.model(m), 'ms_link') || isempty(ar.model(m).ms_link))
                                     ar.model(m).ms_link = [c c2 tlink];
                                 else
                                     ar.model(m).ms_link(end+1,1) = c;
                                     ar.model(m).ms_link(end,2) = c2;
                                     ar.model(m).ms_link(end,3) = tlink;
                                 end
+                                ar.config.useMS = 1;
                             end
                         end
                     end
@@ -238,15 +247,15 @@ for m=1:length(ar.model)
             end
         end
         
-        % Add events to tFine and tExp (if it exists)
+        % Add events and multiple shooting nodes to tFine and tExp (if it exists)
         for c = 1 : length( ar.model(m).condition )
             if isfield(ar.model(m).condition(c), 'tExp')
                 ar.model(m).condition(c).tExp = ...
-                    union(ar.model(m).condition(c).tExp, ar.model(m).condition(c).tEvents);
+                    union(ar.model(m).condition(c).tExp, union(ar.model(m).condition(c).tEvents, ar.model(m).condition(c).tMS));
             end
             
             ar.model(m).condition(c).tFine = ...
-                union(ar.model(m).condition(c).tFine, ar.model(m).condition(c).tEvents);
+                union(ar.model(m).condition(c).tFine, union(ar.model(m).condition(c).tEvents, ar.model(m).condition(c).tMS));
         end
         
         % Add tExp to tFine (if it exists)
@@ -377,6 +386,7 @@ for m = 1:length(ar.model)
             
             ar.model(m).data(d).yFineSimu = zeros(ntf, ny);
             ar.model(m).data(d).ystdFineSimu = zeros(ntf, ny);
+            ar.model(m).data(d).chi2Grad = zeros(1, np);
         end
     end
     for c = 1:length(ar.model(m).condition)
@@ -397,6 +407,7 @@ for m = 1:length(ar.model)
         ar.model(m).condition(c).suNum = zeros(nu, np);
         ar.model(m).condition(c).svNum = zeros(1, nv);
         ar.model(m).condition(c).y_atol = zeros(nx,1);
+        ar.model(m).condition(c).chi2Grad = zeros(1, np);
         
         if(isfield(ar.model(m).condition(c), 'tExp'))
             nt = length(ar.model(m).condition(c).tExp);
@@ -462,6 +473,7 @@ for m = 1:length(ar.model)
         ar.model(m).condition(c).start = 0;
         ar.model(m).condition(c).stop = 0;
         ar.model(m).condition(c).stop_data = 0;
+        ar.model(m).condition(c).cost = nan(1,2); % see arBalanceThreads
         
         % conditions with events
         if(~isempty(ar.model(m).condition(c).tEvents))
@@ -470,6 +482,14 @@ for m = 1:length(ar.model)
         else
             ar.model(m).condition(c).qEvents = 0;
         end
+        
+        % segments of multiple shooting
+        if(isfield(ar.model(m).condition(c), 'tMS') && ~isempty(ar.model(m).condition(c).tMS))
+            ar.model(m).condition(c).qMS = 1;
+        else
+            ar.model(m).condition(c).tMS = [];
+            ar.model(m).condition(c).qMS = 0;
+        end
     end
 end
 
@@ -699,6 +719,8 @@ function populate_threads( thread_fieldname, condition_fieldname, ntask_fieldnam
 global ar;
 
 % populate threads
+% with ar.config.useDynamicScheduling these lists are only the initial
+% assignment, idle threads in arSimuCalc take over pending conditions
 ar.config.(thread_fieldname) = [];
 ar.config.(thread_fieldname)(1).id = 0;
 ar.config.(thread_fieldname)(1).n = 0;
@@ -0,0 +1,122 @@
+% arAddTrigger([m], trigger, [direction], [statename], [A], [B])
+%
+% Add a state dependent event to a model
+%
+%   m             index of model                                     [1]
+%   trigger       expression in states, parameters and time; the event
+%                 fires when it crosses zero
+%   direction     only detect crossings with  1: increasing trigger
+%                                            -1: decreasing trigger
+%                                             0: both directions    [0]
+%   statename     string or cell of strings; the states that are changed
+%   A             change value of state with "statename" to Ax+B where x represents
+%   B             the old state variable before the event (numeric values).
+%
+% In contrast to arAddEvent, the time of a state dependent event is not
+% known beforehand. It is located by the rootfinding of CVODES during the
+% integration of every condition of the model. At the event, the states are
+% reset to Ax+B. The sensitivities are corrected for the parameter
+% dependence of the event time, so that the gradient of the objective
+% function remains exact.
+%
+% Triggers are part of the generated code. They have to be added after
+% arLoadModel and before arLoadData, the model has to be compiled with
+% arCompileAll afterwards. Inputs and derived variables cannot be used in
+% a trigger, and state dependent events cannot be combined with adjoint
+% sensitivities.
+%
+% Example (redosing whenever the drug drops below a threshold):
+%   arLoadModel('drug');
+%   arAddTrigger(1, 'drug - threshold', -1, 'drug', 1, 10);
+%   arLoadData('drug_data');
+%   arCompileAll;
+
+function arAddTrigger( varargin )
+
+    global ar;
+
+    if ( nargin < 1 )
+        error( 'Function needs at least a trigger expression.' );
+    end
+    if ( ischar( varargin{1} ) )
+        varargin = [{1}, varargin];
+    end
+
+    m           = varargin{1};
+    trigger     = varargin{2};
+    direction   = 0;
+    statename   = {};
+    A           = [];
+    B           = [];
+    if ( length( varargin ) > 2 ) && ~isempty( varargin{3} ), direction = varargin{3}; end
+    if ( length( varargin ) > 3 ), statename = varargin{4}; end
+    if ( length( varargin ) > 4 ), A = varargin{5}; end
+    if ( length( varargin ) > 5 ), B = varargin{6}; end
+
+    if ( m > length( ar.model ) )
+        error( 'Model %d does not exist.', m );
+    end
+    if ( isfield( ar.model(m), 'data' ) && ~isempty( ar.model(m).data ) )
+        error( 'arAddTrigger has to be called between arLoadModel and arLoadData.' );
+    end
+    if ( ~ismember( direction, [-1, 0, 1] ) )
+        error( 'The direction of a trigger has to be -1, 0 or 1.' );
+    end
+
+    if ( ischar( statename ) )
+        statename = {statename};
+    end
+    if ( isempty( A ) ), A = ones( 1, length( statename ) ); end
+    if ( isempty( B ) ), B = zeros( 1, length( statename ) ); end
+    if ( ~isnumeric( A ) || ~isnumeric( B ) )
+        error( 'A and B have to be numeric.' );
+    end
+    if ( ( numel( A ) ~= length( statename ) ) || ( numel( B ) ~= length( statename ) ) )
+        error( 'A and B need one entry per state that is changed by the event.' );
+    end
+
+    % Check the trigger expression
+    varlist = symvar( arMyStr2Sym( trigger ) );
+    if ( ~isempty( varlist ) )
+        varlist = cellfun( @char, num2cell( varlist ), 'UniformOutput', false );
+    else
+        varlist = {};
+    end
+    if ( any( ismember( varlist, ar.model(m).u ) ) )
+        error( 'Inputs cannot be used in the trigger %s.', trigger );
+    end
+    if ( any( ismember( varlist, ar.model(m).z ) ) )
+        error( 'Derived variables cannot be used in the trigger %s.', trigger );
+    end
+
+    % New parameters become dynamic parameters of the model
+    newp = setdiff( varlist, [ar.model(m).x, ar.model(m).u, ar.model(m).z, ar.model(m).p, {ar.model(m).t}] );
+    if ( ~isempty( newp ) )
+        ar.model(m).px = union( ar.model(m).px, newp );
+        [ar.model(m).p, order] = sort( [ar.model(m).p, newp(:)'] );
+        fp = [ar.model(m).fp; newp(:)];
+        ar.model(m).fp = fp( order );
+    end
+
+    % Reset Ax+B of the states
+    if ( ~isfield( ar.model(m), 'triggers' ) || isempty( ar.model(m).triggers ) )
+        ar.model(m).triggers = {};
+        ar.model(m).triggerDirection = zeros(1,0);
+        ar.model(m).triggerA = zeros(0,length(ar.model(m).x));
+        ar.model(m).triggerB = zeros(0,length(ar.model(m).x));
+    end
+    rowA = ones( 1, length( ar.model(m).x ) );
+    rowB = zeros( 1, length( ar.model(m).x ) );
+    for js = 1 : length( statename )
+        jx = find( strcmp( ar.model(m).x, statename{js} ) );
+        if ( isempty( jx ) )
+            error( 'State %s does not exist in model %d.', statename{js}, m );
+        end
+        rowA( jx ) = A( js );
+        rowB( jx ) = B( js );
+    end
+
+    ar.model(m).triggers{end+1} = trigger;
+    ar.model(m).triggerDirection(end+1) = direction;
+    ar.model(m).triggerA(end+1,:) = rowA;
+    ar.model(m).triggerB(end+1,:) = rowB;
@@ -142,6 +142,14 @@ for m=1:length(ar.model)
     % calc model
     arCalcModel(m, matlab_version, ar.config.networkgraph);
     
+    % state dependent events (see arAddTrigger)
+    if(~isfield(ar.model(m), 'triggers') || isempty(ar.model(m).triggers))
+        ar.model(m).triggers = {};
+        ar.model(m).triggerDirection = zeros(1,0);
+        ar.model(m).triggerA = zeros(0,length(ar.model(m).x));
+        ar.model(m).triggerB = zeros(0,length(ar.model(m).x));
+    end
+    
     % extract conditions
     ar.model(m).condition = [];
     if(isfield(ar.model(m), 'data'))
@@ -158,6 +166,9 @@ for m=1:length(ar.model)
             checksum_cond = addToCheckSum(ar.model(m).cLink, checksum_cond);
             checksum_cond = addToCheckSum(ar.model(m).z, checksum_cond);
             checksum_cond = addToCheckSum(ar.model(m).fz, checksum_cond);
+            if(~isempty(ar.model(m).triggers))
+                checksum_cond = addToCheckSum(ar.model(m).triggers, checksum_cond);
+            end
             checksum_cond = addToCheckSum(ar.model(m).data(d).fp(qdynparas), checksum_cond);
             if isfield( ar.model(m), 'reducedForm' ) && ( ar.model(m).reducedForm == 1 )
                 % Store whether we express the model in totals or not
@@ -239,8 +250,10 @@ for m=1:length(ar.model)
         
         % skip calc conditions
         doskip = nan(1,length(ar.model(m).condition));
+        codefkt = cell(1,length(ar.model(m).condition));
         for c=1:length(ar.model(m).condition)
-            doskip(c) = ~forcedCompile && exist([source_dir '/Compiled/' ar.info.c_version_code '/' ar.model(m).condition(c).fkt '.c'],'file');
+            codefkt{c} = linkedConditionFiles([source_dir '/Compiled/' ar.info.c_version_code '/'], ar.model(m).condition(c).fkt);
+            doskip(c) = ~forcedCompile && ~isempty(codefkt{c});
         end
         
         % calc conditions
@@ -259,6 +272,7 @@ for m=1:length(ar.model)
         model.vs = ar.model(m).vs;
         model.zs = ar.model(m).zs;
         model.N = ar.model(m).N;
+        model.triggers = ar.model(m).triggers;
         
         model.dvdx = ar.model(m).sym.dvdx;
         model.dvdu = ar.model(m).sym.dvdu;
@@ -292,18 +306,7 @@ for m=1:length(ar.model)
                 constVars{c} = condition_sym.constVars;
                 
                 if(~doskip(c))
-                    % header
-                    fid_odeH = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], 'W');
-                    arWriteHFilesCondition(fid_odeH, config, condition_sym);
-                    fclose(fid_odeH);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.h'],'f');
-                    % body
-                    fid_ode = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], 'W');
-                    arWriteCFilesCondition(fid_ode, matlab_version, config, model, condition_sym, m, c, timedebug);
-                    fclose(fid_ode);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.c'],'f');
+                    codefkt{c} = writeConditionFiles([source_dir '/Compiled/' c_version_code '/'], config, model, condition_sym, m, c, matlab_version, timedebug);
                 end
             end
             for c=1:length(condition)
@@ -321,28 +324,26 @@ for m=1:length(ar.model)
                 constVars{c} = condition_sym.constVars;
                 
                 if(~doskip(c))
-                    % header
-                    fid_odeH = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], 'W');
-                    arWriteHFilesCondition(fid_odeH, config, condition_sym);
-                    fclose(fid_odeH);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.h'],'f');
-                    % body
-                    fid_ode = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], 'W');
-                    arWriteCFilesCondition(fid_ode, matlab_version, config, model, condition_sym, m, c, timedebug);
-                    fclose(fid_ode);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.c'],'f');
+                    codefkt{c} = writeConditionFiles([source_dir '/Compiled/' c_version_code '/'], config, model, condition_sym, m, c, matlab_version, timedebug);
                 end
             end
         end
         
+        % store the written code, after parfor: conditions sharing their
+        % code must not write the same file in parallel
+        stored = {};
+        for c=find(~doskip)
+            storeConditionFiles([source_dir '/Compiled/' c_version_code '/'], ar.model(m).condition(c).fkt, codefkt{c}, ismember(codefkt{c}, stored));
+            stored{end+1} = codefkt{c}; %#ok<AGROW>
+        end
+        
         % assign conditions
         for c=1:length(ar.model(m).condition)
             ar.model(m).condition(c).p = newp{c};
             ar.model(m).condition(c).fp = newfp{c};
             ar.model(m).condition(c).pold = newpold{c};
             ar.model(m).condition(c).px0 = newpx0{c};
+            ar.model(m).condition(c).codefkt = codefkt{c};
             ar.model(m).condition(c).splines = splines{c};
             ar.model(m).condition(c).constVars = constVars{c};
         end
@@ -439,6 +440,9 @@ for m=1:length(ar.model)
         checksum_cond = addToCheckSum(ar.model(m).z, checksum_cond);
         checksum_cond = addToCheckSum(ar.model(m).fz, checksum_cond);
         checksum_cond = addToCheckSum(ar.model(m).fp, checksum_cond);
+        if(~isempty(ar.model(m).triggers))
+            checksum_cond = addToCheckSum(ar.model(m).triggers, checksum_cond);
+        end
         
         if isfield( ar.model(m), 'reducedForm' ) && ( ar.model(m).reducedForm == 1 )
             % Store whether we express the model in totals or not
@@ -467,8 +471,10 @@ for m=1:length(ar.model)
         
         % skip calc conditions
         doskip = nan(1,length(ar.model(m).condition));
+        codefkt = cell(1,length(ar.model(m).condition));
         for c=1:length(ar.model(m).condition)
-            doskip(c) = ~forcedCompile && exist([source_dir '/Compiled/' ar.info.c_version_code '/' ar.model(m).condition(c).fkt '.c'],'file');
+            codefkt{c} = linkedConditionFiles([source_dir '/Compiled/' ar.info.c_version_code '/'], ar.model(m).condition(c).fkt);
+            doskip(c) = ~forcedCompile && ~isempty(codefkt{c});
         end
 
         % calc conditions
@@ -487,6 +493,7 @@ for m=1:length(ar.model)
         model.vs = ar.model(m).vs;
         model.zs = ar.model(m).zs;
         model.N = ar.model(m).N;
+        model.triggers = ar.model(m).triggers;
         model.dvdx = ar.model(m).sym.dvdx;
         model.dvdu = ar.model(m).sym.dvdu;
         if isfield( ar.model(m), 'removedStates' ) && ( ar.model(m).reducedForm == 1 )
@@ -511,18 +518,7 @@ for m=1:length(ar.model)
                 newpold{c} = condition_sym.pold;
                 newpx0{c} = condition_sym.px0;
                 if(~doskip(c))
-                    % header
-                    fid_odeH = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], 'W'); % create header file
-                    arWriteHFilesCondition(fid_odeH, config, condition_sym);
-                    fclose(fid_odeH);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.h'],'f');
-                    % body
-                    fid_ode = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], 'W');
-                    arWriteCFilesCondition(fid_ode, matlab_version, config, model, condition_sym, m, c, timedebug);
-                    fclose(fid_ode);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.c'],'f');
+                    codefkt{c} = writeConditionFiles([source_dir '/Compiled/' c_version_code '/'], config, model, condition_sym, m, c, matlab_version, timedebug);
                 end
             end
         else        
@@ -533,28 +529,26 @@ for m=1:length(ar.model)
                 newpold{c} = condition_sym.pold;
                 newpx0{c} = condition_sym.px0;
                 if(~doskip(c))
-                    % header
-                    fid_odeH = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], 'W'); % create header file
-                    arWriteHFilesCondition(fid_odeH, config, condition_sym);
-                    fclose(fid_odeH);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.h'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.h'],'f');
-                    % body
-                    fid_ode = fopen([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], 'W');
-                    arWriteCFilesCondition(fid_ode, matlab_version, config, model, condition_sym, m, c, timedebug);
-                    fclose(fid_ode);
-                    movefile([source_dir '/Compiled/' c_version_code '/' condition(c).fkt '_tmp.c'], ...
-                        [source_dir '/Compiled/' c_version_code '/' condition(c).fkt '.c'],'f');
+                    codefkt{c} = writeConditionFiles([source_dir '/Compiled/' c_version_code '/'], config, model, condition_sym, m, c, matlab_version, timedebug);
                 end
             end
         end
 
+        % store the written code, after parfor: conditions sharing their
+        % code must not write the same file in parallel
+        stored = {};
+        for c=find(~doskip)
+            storeConditionFiles([source_dir '/Compiled/' c_version_code '/'], ar.model(m).condition(c).fkt, codefkt{c}, ismember(codefkt{c}, stored));
+            stored{end+1} = codefkt{c}; %#ok<AGROW>
+        end
+        
         % assign conditions
         for c=1:length(ar.model(m).condition)
             ar.model(m).condition(c).p = newp{c};
             ar.model(m).condition(c).fp = newfp{c};
             ar.model(m).condition(c).pold = newpold{c};
             ar.model(m).condition(c).px0 = newpx0{c};
+            ar.model(m).condition(c).codefkt = codefkt{c};
         end
         
         % plot setup
@@ -802,6 +796,8 @@ condition.sym.fz = mySym(model.fz, specialFunc);
 condition.sym.fz = mysubsrepeated(condition.sym.fz, model.sym.z, condition.sym.fz, matlab_version); % Substitute references to derived variables
 condition.sym.fz = arSubs(condition.sym.fz, condition.sym.p, condition.sym.fp, matlab_version);
 condition.sym.C = arSubs(model.sym.C, condition.sym.p, condition.sym.fp, matlab_version);
+condition.sym.froot = mySym(model.triggers, specialFunc);
+condition.sym.froot = arSubs(condition.sym.froot, condition.sym.p, condition.sym.fp, matlab_version);
 
 % Replace inline arrays (e.g. [3,4,2,5,2] with variable names, declaring
 % the array elsewhere as a static const (used for the fixed input spline)
@@ -824,13 +820,14 @@ condition.constVars = sprintf( '%s;\n', constVars{:} );
 condition.sym.fv = arSubs(condition.sym.fv, arMyStr2Sym(model.t), arMyStr2Sym('t'), matlab_version);
 condition.sym.fu = arSubs(condition.sym.fu, arMyStr2Sym(model.t), arMyStr2Sym('t'), matlab_version);
 condition.sym.fz = arSubs(condition.sym.fz, arMyStr2Sym(model.t), arMyStr2Sym('t'), matlab_version);
+condition.sym.froot = arSubs(condition.sym.froot, arMyStr2Sym(model.t), arMyStr2Sym('t'), matlab_version);
 
 % remaining initial conditions
 varlist = symvar(condition.sym.fpx0);
 condition.px0 = sym2str(varlist);
 
 % remaining parameters
-varlist = union( symvar([condition.sym.fv(:); condition.sym.fu(:); condition.sym.fz(:); condition.sym.fpx0(:)]), symvar( condition.sym.C ) );
+varlist = union( symvar([condition.sym.fv(:); condition.sym.fu(:); condition.sym.fz(:); condition.sym.fpx0(:); condition.sym.froot(:)]), symvar( condition.sym.C ) );
 condition.pold = condition.p;
 condition.p = setdiff(setdiff(setdiff(setdiff(setdiff(sym2str(varlist), model.x), model.u), model.z), 't'), cVars);
 condition.dfxdx_rowVals = [];
@@ -898,6 +895,9 @@ condition.sym.fz = arSubs(condition.sym.fz, condition.sym.p, condition.sym.ps, m
 
 condition.sym.fpx0 = arSubs(condition.sym.fpx0, condition.sym.p, condition.sym.ps, matlab_version);
 
+condition.sym.froot = arSubs(condition.sym.froot, model.sym.x, model.sym.xs, matlab_version);
+condition.sym.froot = arSubs(condition.sym.froot, condition.sym.p, condition.sym.ps, matlab_version);
+
 % remove zero inputs
 condition.qfu_nonzero = logical(condition.sym.fu ~= 0);
 if(~isempty(model.sym.us))
@@ -989,6 +989,22 @@ if(config.useSensis || config.useJacobian)
     end
 end
 condition.dfxdx_colptrs = [condition.dfxdx_colptrs length(condition.dfxdx_rowVals)];
+
+% Jacobian times vector for the Krylov solvers, only the nonzero entries of dfxdx enter
+if(config.useSensis || config.useJacobian)
+    condition.vJ = cell(length(model.xs), 1);
+    for j=1:length(model.xs)
+        condition.vJ{j} = sprintf('vJ[%i]', j);
+    end
+    condition.sym.vJ = arMyStr2Sym(condition.vJ);
+    condition.sym.fJv = arMyStr2Sym(zeros(length(model.xs), 1));
+    for i=1:length(model.xs)
+        js = find(condition.qdfxdx_nonzero(i,:));
+        if(~isempty(js))
+            condition.sym.fJv(i) = condition.sym.dfxdx(i,js) * condition.sym.vJ(js);
+        end
+    end
+end
 condition.sym.dfzdu = myJacobian(condition.sym.fz, model.sym.us);
 condition.sym.dfzdx = myJacobian(condition.sym.fz, model.sym.xs);
 
@@ -1084,9 +1100,23 @@ if(config.useSensis)
         condition.sym.dfxdp  = condition.sym.dfxdp  + condition.sym.dfcdp;
     end
     
+    % adjoint system for gradients by backward integration
+    condition.xB = cell(length(model.xs), 1);
+    for j=1:length(model.xs)
+        condition.xB{j} = sprintf('xB[%i]', j);
+    end
+    condition.sym.xB = arMyStr2Sym(condition.xB);
+    condition.sym.fxB = -transpose(condition.sym.dfxdx) * condition.sym.xB;
+    condition.sym.fqB = -transpose(condition.sym.dfxdp) * condition.sym.xB;
+    
     % derivatives fz
     condition.sym.dfzdp = myJacobian(condition.sym.fz, condition.sym.ps);
     
+    % derivatives of the triggers (state dependent events)
+    condition.sym.dfrootdx = myJacobian(condition.sym.froot, model.sym.xs);
+    condition.sym.dfrootdp = myJacobian(condition.sym.froot, condition.sym.ps);
+    condition.sym.dfrootdt = myJacobian(condition.sym.froot, arMyStr2Sym('t'));
+    
     % sz
     condition.sz = cell(length(model.zs), 1);
     for j=1:length(model.zs)
@@ -1108,6 +1138,10 @@ end
 %condition.sym.d2fxdxdp = jacobian(condition.sym.dfxdx, condition.p);
 %condition.sym.d2fxdpdq = jacobian(condition.sym.dfxdp, condition.p);
 
+% Evaluate powers and function calls which the fluxes and their derivatives
+% share only once per (t, x)
+condition = commonSubexpressions( condition, config.useCSE, matlab_version );
+
 % We need room for the spline coefficients if we use turbosplines
 if ( config.turboSplines == 1 )
     condition = uniqueSplines( condition );
@@ -1579,6 +1613,99 @@ function out = mysubsrepeated(in, old, new, matlab_version)
         k = k + 1;
     end
 
+% Common subexpressions of fv, dfvdx, dfvdu and dfvdp. Powers with
+% non-integer exponents and function calls (exp, log, Hill terms, ...) which
+% occur more than once are replaced by cse[k] in copies of these matrices
+% (fvcse, dfvdxcse, ...). fcse evaluates cse once for each (t, x), fv, dvdx,
+% dvdu and dvdp read the cached values. The original matrices are kept for
+% fvreaction, which evaluates single fluxes.
+function condition = commonSubexpressions( condition, useCSE, matlab_version )
+    names = {'fv', 'dfvdx', 'dfvdu', 'dfvdp'};
+    for j = 1 : length( names )
+        condition.sym.([names{j} 'cse']) = condition.sym.(names{j});
+    end
+    condition.sym.cse = arMyStr2Sym(zeros(0,1));
+    if ( ~useCSE )
+        return;
+    end
+    
+    % Count the occurrences, inner terms come before the terms containing them
+    keys = containers.Map();
+    terms = {};
+    counts = [];
+    for j = 1 : length( names )
+        F = condition.sym.(names{j});
+        for k = 1 : numel( F )
+            [ terms, counts ] = collectSubexpressions( F(k), terms, counts, keys );
+        end
+    end
+    shared = terms( counts > 1 );
+    if ( isempty( shared ) )
+        return;
+    end
+    
+    symbols = cell( length( shared ), 1 );
+    for k = 1 : length( shared )
+        symbols{k} = sprintf( 'cse[%i]', k );
+    end
+    symbols = arMyStr2Sym( symbols );
+    
+    % Replace the outermost terms first, the definitions of the temporaries
+    % refer to the inner ones
+    defs = shared;
+    for k = length( shared ) : -1 : 1
+        for j = 1 : length( names )
+            field = [names{j} 'cse'];
+            condition.sym.(field) = arSubs( condition.sym.(field), shared{k}, symbols(k), matlab_version );
+        end
+        for i = k+1 : length( shared )
+            defs{i} = arSubs( defs{i}, shared{k}, symbols(k), matlab_version );
+        end
+    end
+    condition.sym.cse = arMyStr2Sym(zeros(length(shared),1));
+    for k = 1 : length( shared )
+        condition.sym.cse(k) = defs{k};
+    end
+
+% Post-order traversal of f, counting the candidates for common subexpressions
+function [ terms, counts ] = collectSubexpressions( f, terms, counts, keys )
+    op = char( feval( symengine, 'op', f, 0 ) );
+    if ( strcmp( op, 'FAIL' ) || strcmp( op, '_index' ) )
+        return;
+    end
+    
+    args = children( f );
+    for j = 1 : numel( args )
+        if ( iscell( args ) )
+            [ terms, counts ] = collectSubexpressions( args{j}, terms, counts, keys );
+        else
+            [ terms, counts ] = collectSubexpressions( args(j), terms, counts, keys );
+        end
+    end
+    
+    if ( strcmp( op, '_power' ) )
+        if ( iscell( args ) )
+            ex = args{2};
+        else
+            ex = args(2);
+        end
+        candidate = ~isempty( symvar( ex ) ) || ( mod( double( ex ), 1 ) ~= 0 );
+    else
+        candidate = ( op(1) ~= '_' );
+    end
+    if ( ~candidate )
+        return;
+    end
+    
+    key = char( f );
+    if ( isKey( keys, key ) )
+        counts( keys(key) ) = counts( keys(key) ) + 1;
+    else
+        terms{end+1} = f;
+        counts(end+1) = 1;
+        keys(key) = length( terms );
+    end
+
 % Allocate room for the persistent spline coefficients
 function condition = uniqueSplines( condition )
     [fu, nsfu] = repSplines( condition.sym.fu, 0 );
@@ -1647,6 +1774,59 @@ checkstr = checkstr(:)';
 
 clear checksum
 
+% Write header and body of a condition. Conditions whose code only differs in
+% its name (e.g. conditions which only differ in the values of their
+% parameters) share one pair of files, named by the checksum of the code.
+% The files are written to <condition.fkt>_tmp.h/.c and stored under the
+% returned name by storeConditionFiles.
+function fkt = writeConditionFiles(folder, config, model, condition, m, c, matlab_version, timedebug)
+
+fid_odeH = fopen([folder condition.fkt '_tmp.h'], 'W'); % create header file
+arWriteHFilesCondition(fid_odeH, config, condition);
+fclose(fid_odeH);
+fid_ode = fopen([folder condition.fkt '_tmp.c'], 'W');
+arWriteCFilesCondition(fid_ode, matlab_version, config, model, condition, m, c, timedebug);
+fclose(fid_ode);
+
+hstr = fileread([folder condition.fkt '_tmp.h']);
+cstr = fileread([folder condition.fkt '_tmp.c']);
+
+checksum = addToCheckSum(strrep(hstr, condition.fkt, ''));
+checksum = addToCheckSum(strrep(cstr, condition.fkt, ''), checksum);
+fkt = [model.name '_' getCheckStr(checksum)];
+
+fid_odeH = fopen([folder condition.fkt '_tmp.h'], 'W');
+fprintf(fid_odeH, '%s', strrep(hstr, condition.fkt, fkt));
+fclose(fid_odeH);
+fid_ode = fopen([folder condition.fkt '_tmp.c'], 'W');
+fprintf(fid_ode, '%s', strrep(cstr, condition.fkt, fkt));
+fclose(fid_ode);
+
+% Move the files written by writeConditionFiles to the shared code fkt,
+% unless another condition stored it already, and refer the condition to it
+% by the link file <condfkt>.link
+function storeConditionFiles(folder, condfkt, fkt, shared)
+if(shared)
+    delete([folder condfkt '_tmp.h'], [folder condfkt '_tmp.c']);
+else
+    movefile([folder condfkt '_tmp.h'], [folder fkt '.h'], 'f');
+    movefile([folder condfkt '_tmp.c'], [folder fkt '.c'], 'f');
+end
+
+fid_link = fopen([folder condfkt '.link'], 'W');
+fprintf(fid_link, '%s', fkt);
+fclose(fid_link);
+
+% Name of the files a condition is linked to, empty if not written yet
+function fkt = linkedConditionFiles(folder, condfkt)
+fkt = '';
+if(exist([folder condfkt '.link'],'file'))
+    linked = strtrim(fileread([folder condfkt '.link']));
+    if(exist([folder linked '.h'],'file') && exist([folder linked '.c'],'file'))
+        fkt = linked;
+    end
+end
+
 % write ODE headers
 function arWriteHFilesCondition(fid, config, condition)
 
@@ -1670,7 +1850,11 @@ fprintf(fid,'\n\n\n');
 
 fprintf(fid, ' void fu_%s(void *user_data, double t);\n', condition.fkt);
 fprintf(fid, ' void fsu_%s(void *user_data, double t);\n', condition.fkt);
+if(~isempty(condition.sym.cse))
+    fprintf(fid, ' double *fcse_%s(realtype t, N_Vector x, void *user_data);\n', condition.fkt);
+end
 fprintf(fid, ' void fv_%s(realtype t, N_Vector x, void *user_data);\n', condition.fkt);
+fprintf(fid, ' void fvreaction_%s(realtype t, N_Vector x, int iv, void *user_data);\n', condition.fkt);
 fprintf(fid, ' void dvdx_%s(realtype t, N_Vector x, void *user_data);\n', condition.fkt);
 fprintf(fid, ' void dvdu_%s(realtype t, N_Vector x, void *user_data);\n', condition.fkt);
 fprintf(fid, ' void dvdp_%s(realtype t, N_Vector x, void *user_data);\n', condition.fkt);
@@ -1685,6 +1869,7 @@ fprintf(fid, ' int dfxdx_out_%s(realtype t, N_Vector x, realtype* J, void *user_
 fprintf(fid, ' int dfxdx_sparse_%s(realtype t, N_Vector x,', condition.fkt); % sundials 2.6.1 with KLU/SuperLU
 fprintf(fid, 'N_Vector fx, SlsMat J, void *user_data,'); %DlsMat for Dense solver
 fprintf(fid, 'N_Vector tmp1, N_Vector tmp2, N_Vector tmp3);\n');
+fprintf(fid, ' int dfxdx_times_%s(N_Vector v, N_Vector Jv, realtype t, N_Vector x, N_Vector fx, void *user_data, N_Vector tmp);\n', condition.fkt); % Krylov solvers
 if(config.useSensiRHS)
     fprintf(fid, ' int fsx_%s(int Ns, realtype t, N_Vector x, N_Vector xdot,', condition.fkt);
     fprintf(fid, 'int ip, N_Vector sx, N_Vector sxdot, void *user_data,');
@@ -1692,15 +1877,25 @@ if(config.useSensiRHS)
     fprintf(fid, ' int subfsx_%s(int Ns, realtype t, N_Vector x, N_Vector xdot,', condition.fkt);
     fprintf(fid, 'int ip, N_Vector sx, N_Vector sxdot, void *user_data,');
     fprintf(fid, 'N_Vector tmp1, N_Vector tmp2);\n');
+    fprintf(fid, ' int fsxall_%s(int Ns, realtype t, N_Vector x, N_Vector xdot,', condition.fkt);
+    fprintf(fid, 'N_Vector *sx, N_Vector *sxdot, void *user_data,');
+    fprintf(fid, 'N_Vector tmp1, N_Vector tmp2);\n');
 end
 fprintf(fid, ' void fsx0_%s(int ip, N_Vector sx0, void *user_data);\n', condition.fkt);
 fprintf(fid, ' void subfsx0_%s(int ip, N_Vector sx0, void *user_data);\n', condition.fkt);
 fprintf(fid, ' void csv_%s(realtype t, N_Vector x, int ip, N_Vector sx, void *user_data);\n', condition.fkt);
 fprintf(fid, ' void dfxdp0_%s(realtype t, N_Vector x, double *dfxdp0, void *user_data);\n\n', condition.fkt);
 fprintf(fid, ' void dfxdp_%s(realtype t, N_Vector x, double *dfxdp, void *user_data);\n\n', condition.fkt);
+fprintf(fid, ' int fxB_%s(realtype t, N_Vector x, N_Vector xB, N_Vector xBdot, void *user_data);\n', condition.fkt);
+fprintf(fid, ' int fqB_%s(realtype t, N_Vector x, N_Vector xB, N_Vector qBdot, void *user_data);\n', condition.fkt);
+fprintf(fid, ' int dfxBdxB_%s(long int NeqB, realtype t, N_Vector x, N_Vector xB,', condition.fkt);
+fprintf(fid, 'N_Vector fxB, DlsMat JB, void *user_data,');
+fprintf(fid, 'N_Vector tmp1B, N_Vector tmp2B, N_Vector tmp3B);\n\n');
 fprintf(fid, ' void fz_%s(double t, int nt, int it, int nz, int nx, int nu, int iruns, double *z, double *p, double *u, double *x);\n', condition.fkt);
 fprintf(fid, ' void fsz_%s(double t, int nt, int it, int np, double *sz, double *p, double *u, double *x, double *z, double *su, double *sx);\n\n', condition.fkt);
 fprintf(fid, ' void dfzdx_%s(double t, int nt, int it, int nz, int nx, int nu, int iruns, double *dfzdxs, double *z, double *p, double *u, double *x);\n', condition.fkt);
+fprintf(fid, ' int froot_%s(realtype t, N_Vector x, realtype *gout, void *user_data);\n', condition.fkt);
+fprintf(fid, ' void dfrootdxp_%s(realtype t, N_Vector x, double *dgdx_tmp, double *dgdp_tmp, double *dgdt_tmp, void *user_data);\n', condition.fkt);
 fprintf(fid, '#endif /* _MY_%s */\n', condition.fkt);
 
 fprintf(fid,'\n\n\n');
@@ -1756,6 +1951,40 @@ if(config.useSensis)
 end
 fprintf(fid, '\n  return;\n}\n\n\n');
 
+% write the common subexpressions of v and its derivatives, they are kept in
+% data->cse together with the (t, x, p, u) they were evaluated at. p and u
+% are part of the key, CVODES perturbs p in place for difference quotient
+% sensitivities (no useSensiRHS) at the same (t, x).
+if(~isempty(condition.sym.cse))
+    ncse = length(condition.sym.cse);
+    nkey = [length(model.xs) length(condition.p) length(model.us)];
+    keys = {'x_tmp', 'p', 'u'};
+    fprintf(fid, ' double *fcse_%s(realtype t, N_Vector x, void *user_data)\n{\n', condition.fkt);
+    fprintf(fid, '  UserData data = (UserData) user_data;\n');
+    fprintf(fid, '  double *p = data->p;\n');
+    fprintf(fid, '  double *u = data->u;\n');
+    fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+    fprintf(fid, '  double *cse = data->cse;\n');
+    fprintf(fid, '  int is, same;\n');
+    fprintf(fid, '  if(cse == NULL) {\n');
+    fprintf(fid, '    cse = (double *) simAlloc(%i * sizeof(double));\n', ncse + sum(nkey));
+    fprintf(fid, '    if(cse == NULL) { *(data->abort) = 1; return NULL; }\n');
+    fprintf(fid, '    data->cse = cse;\n');
+    fprintf(fid, '  } else if(t == data->cseT) {\n');
+    fprintf(fid, '    same = 1;\n');
+    for k=find(nkey>0)
+        fprintf(fid, '    for (is=0; same && is<%i; is++) same = (%s[is] == cse[%i+is]);\n', nkey(k), keys{k}, ncse + sum(nkey(1:k-1)));
+    end
+    fprintf(fid, '    if(same) return cse;\n');
+    fprintf(fid, '  }\n');
+    writeCcode(fid, matlab_version, condition, 'fcse');
+    fprintf(fid, '  data->cseT = t;\n');
+    for k=find(nkey>0)
+        fprintf(fid, '  for (is=0; is<%i; is++) cse[%i+is] = %s[is];\n', nkey(k), ncse + sum(nkey(1:k-1)), keys{k});
+    end
+    fprintf(fid, '\n  return cse;\n}\n\n\n');
+end
+
 % write v
 fprintf(fid, ' void fv_%s(realtype t, N_Vector x, void *user_data)\n{\n', condition.fkt);
 if(timedebug) 
@@ -1766,11 +1995,27 @@ if(~isempty(model.xs))
     fprintf(fid, '  double *p = data->p;\n');
     fprintf(fid, '  double *u = data->u;\n');
     fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+    writeCseReference(fid, condition);
     writeCcode(fid, matlab_version, condition, 'fv');
 end
 
 fprintf(fid, '\n  return;\n}\n\n\n');
 
+% write v of a single reaction (next reaction method of the SSA)
+fprintf(fid, ' void fvreaction_%s(realtype t, N_Vector x, int iv, void *user_data)\n{\n', condition.fkt);
+if(~isempty(model.xs))
+    fprintf(fid, '  UserData data = (UserData) user_data;\n');
+    fprintf(fid, '  double *p = data->p;\n');
+    fprintf(fid, '  double *u = data->u;\n');
+    fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+    fprintf(fid, '  data->v[iv] = 0.0;\n');
+    fprintf(fid, '  switch ( iv ) {\n');
+    writeCcode(fid, matlab_version, condition, 'fvreaction');
+    fprintf(fid, '  }\n');
+end
+
+fprintf(fid, '\n  return;\n}\n\n\n');
+
 
 % write dvdx
 fprintf(fid, ' void dvdx_%s(realtype t, N_Vector x, void *user_data)\n{\n', condition.fkt);
@@ -1783,6 +2028,7 @@ if(~isempty(model.xs))
         fprintf(fid, '  double *p = data->p;\n');
         fprintf(fid, '  double *u = data->u;\n');
         fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+        writeCseReference(fid, condition);
         writeCcode(fid, matlab_version, condition, 'dvdx');
     end
 end
@@ -1799,6 +2045,7 @@ if(~isempty(model.us) && ~isempty(model.xs))
         fprintf(fid, '  double *p = data->p;\n');
         fprintf(fid, '  double *u = data->u;\n');
         fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+        writeCseReference(fid, condition);
         writeCcode(fid, matlab_version, condition, 'dvdu');
     end
 end
@@ -1816,6 +2063,7 @@ if(~isempty(model.xs))
         fprintf(fid, '  double *u = data->u;\n');
         fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
         if(~isempty(condition.sym.dfvdp))
+            writeCseReference(fid, condition);
             writeCcode(fid, matlab_version, condition, 'dvdp');
         end
     end
@@ -1896,13 +2144,9 @@ if(~isempty(model.xs))
         fprintf(fid, '  double *dvdx = data->dvdx;\n');
         % fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
         fprintf(fid, '  dvdx_%s(t, x, data);\n', condition.fkt);
-        fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(model.xs)^2);
-        fprintf(fid, '    J->data[is] = 0.0;\n');
-        fprintf(fid, '  }\n');
+        % CVODES sets J to zero before calling the Jacobian function
         writeCcode(fid, matlab_version, condition, 'dfxdx');
-        fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(model.xs)^2);
-        fprintf(fid, '    if(mxIsNaN(J->data[is])) J->data[is] = 0.0;\n');
-        fprintf(fid, '  }\n');
+        writeNaNCheck(fid, condition.sym.dfxdx, 'J->data');
     end
 end
 fprintf(fid, '\n  return(0);\n}\n\n\n');
@@ -1921,8 +2165,30 @@ if(~isempty(model.xs))
         fprintf(fid, '    J[is] = 0.0;\n');
         fprintf(fid, '  }\n');
         writeCcode(fid, matlab_version, condition, 'dfxdx_out');
-        fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(model.xs)^2);
-        fprintf(fid, '    if(mxIsNaN(J[is])) J[is] = 0.0;\n');
+        writeNaNCheck(fid, condition.sym.dfxdx, 'J');
+    end
+end
+fprintf(fid, '\n  return(0);\n}\n\n\n');
+
+% write Jacobian times vector (Krylov solvers)
+fprintf(fid, ' int dfxdx_times_%s(N_Vector v, N_Vector Jv, realtype t, N_Vector x, \n', condition.fkt);
+fprintf(fid, '  \tN_Vector fx, void *user_data, N_Vector tmp)\n{\n');
+if(~isempty(model.xs))
+    if(config.useSensis || config.useJacobian)
+        fprintf(fid, '  int is;\n');
+        fprintf(fid, '  UserData data = (UserData) user_data;\n');
+        fprintf(fid, '  double *p = data->p;\n');
+        fprintf(fid, '  double *u = data->u;\n');
+        fprintf(fid, '  double *dvdx = data->dvdx;\n');
+        fprintf(fid, '  double *vJ = N_VGetArrayPointer(v);\n');
+        fprintf(fid, '  double *Jv_tmp = N_VGetArrayPointer(Jv);\n');
+        fprintf(fid, '  dvdx_%s(t, x, data);\n', condition.fkt);
+        fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(model.xs));
+        fprintf(fid, '    Jv_tmp[is] = 0.0;\n');
+        fprintf(fid, '  }\n');
+        writeCcode(fid, matlab_version, condition, 'fJv');
+        fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(model.xs));
+        fprintf(fid, '    if(mxIsNaN(Jv_tmp[is])) Jv_tmp[is] = 0.0;\n');
         fprintf(fid, '  }\n');
     end
 end
@@ -1943,26 +2209,21 @@ if(~isempty(model.xs))
         fprintf(fid, '  double *p = data->p;\n');
         fprintf(fid, '  double *u = data->u;\n');
         fprintf(fid, '  double *dvdx = data->dvdx;\n');
+        fprintf(fid, '  static const int dfxdx_rowvals[%i] = {%s};\n', max(length(condition.dfxdx_rowVals),1), ...
+            intList(condition.dfxdx_rowVals));
+        fprintf(fid, '  static const int dfxdx_colptrs[%i] = {%s};\n', length(condition.dfxdx_colptrs), ...
+            intList(condition.dfxdx_colptrs));
         fprintf(fid, '  dvdx_%s(t, x, data);\n', condition.fkt);
         
-%         fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(condition.dfxdx_rowVals));
-%         fprintf(fid, '    J->data[is] = 0.0;\n');
-%         fprintf(fid, '  }\n');         
-        fprintf(fid, '  SlsSetToZero(J);\n');
-        for j=1:length(condition.dfxdx_rowVals)
-            fprintf(fid, '    J->rowvals[%i] = %i', j-1, condition.dfxdx_rowVals(j)); 
-            fprintf(fid, ';\n'); 
-        end
-        fprintf(fid, '\n');
-        for j=1:length(condition.dfxdx_colptrs)
-            fprintf(fid, '    J->colptrs[%i] = %i', j-1, condition.dfxdx_colptrs(j)); 
-            fprintf(fid, ';\n'); 
-        end
-        fprintf(fid, '\n');
-        writeCcode(fid, matlab_version, condition, 'dfxdx_sparse');
+        % the sparsity pattern is fixed, every entry of J->data is assigned
         fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(condition.dfxdx_rowVals));
-        fprintf(fid, '    if(mxIsNaN(J->data[is])) J->data[is] = RCONST(0.0);\n');
+        fprintf(fid, '    J->rowvals[is] = dfxdx_rowvals[is];\n');
+        fprintf(fid, '  }\n');
+        fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(condition.dfxdx_colptrs));
+        fprintf(fid, '    J->colptrs[is] = dfxdx_colptrs[is];\n');
         fprintf(fid, '  }\n');
+        writeCcode(fid, matlab_version, condition, 'dfxdx_sparse');
+        writeNaNCheck(fid, condition.sym.dfxdx_nonzero, 'J->data');
     end
 end
 fprintf(fid, '\n  return(0);\n}\n\n\n');
@@ -2045,6 +2306,83 @@ if(config.useSensiRHS)
     fprintf(fid, '   return fsx_%s(Ns, t, x, xdot, data->sensIndices[ip], sx, sxdot, user_data, tmp1, tmp2);\n', condition.fkt);
     %fprintf(fid, ' return 0;');
     fprintf(fid, ' };\n\n');    
+    
+    % All sensitivities at once (CVSensRhsFn, useSensiRHS = 2). The flux
+    % derivatives are evaluated once per (t, x) and then applied to every
+    % column of sx, instead of once per parameter as in fsx.
+    fprintf(fid, ' int fsxall_%s(int Ns, realtype t, N_Vector x, N_Vector xdot, \n', condition.fkt);
+    fprintf(fid, '  \tN_Vector *sx, N_Vector *sxdot, void *user_data, \n');
+    fprintf(fid, '  \tN_Vector tmp1, N_Vector tmp2)\n{\n');
+    
+    if(~isempty(model.xs))
+        if(config.useSensis)
+            % sparsity pattern of dvdp (CSC), so that only its nonzero entries are added
+            [dvdp_rows, dvdp_cols] = find(condition.qdvdp_nonzero);
+            dvdp_colptrs = zeros(1, size(condition.qdvdp_nonzero,2)+1);
+            for j2=1:size(condition.qdvdp_nonzero,2)
+                dvdp_colptrs(j2+1) = dvdp_colptrs(j2) + sum(dvdp_cols==j2);
+            end
+            fprintf(fid, '  int is, js, ip, k;\n');
+            colstr = sprintf('%i, ', dvdp_colptrs);
+            rowstr = sprintf('%i, ', dvdp_rows - 1);
+            if(isempty(dvdp_rows))
+                rowstr = '0, ';
+            end
+            fprintf(fid, '  static const int dvdp_colptrs[%i] = {%s};\n', length(dvdp_colptrs), colstr(1:end-2));
+            fprintf(fid, '  static const int dvdp_rows[%i] = {%s};\n', max(length(dvdp_rows),1), rowstr(1:end-2));
+            fprintf(fid, '  UserData data = (UserData) user_data;\n');
+            fprintf(fid, '  double *p = data->p;\n');
+            fprintf(fid, '  double *u = data->u;\n');
+            fprintf(fid, '  double *sv = data->sv;\n');
+            fprintf(fid, '  double *dvdx = data->dvdx;\n');
+            fprintf(fid, '  double *dvdu = data->dvdu;\n');
+            fprintf(fid, '  double *dvdp = data->dvdp;\n');
+            fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+            fprintf(fid, '  double *su = data->su;\n');
+            fprintf(fid, '  double *sx_tmp;\n');
+            fprintf(fid, '  double *sxdot_tmp;\n');
+            
+            if(timedebug)
+                fprintf(fid, '  printf("%%g \\t fsxall\\n", t);\n');
+            end
+            fprintf(fid, '  fsu_%s(data, t);\n', condition.fkt);
+            fprintf(fid, '  dvdx_%s(t, x, data);\n', condition.fkt);
+            fprintf(fid, '  dvdu_%s(t, x, data);\n', condition.fkt);
+            fprintf(fid, '  dvdp_%s(t, x, data);\n', condition.fkt);
+            
+            fprintf(fid, '  for (js=0; js<Ns; js++) {\n');
+            fprintf(fid, '  ip = ( data->sensIndices == NULL ) ? js : data->sensIndices[js];\n');
+            fprintf(fid, '  sx_tmp = N_VGetArrayPointer(sx[js]);\n');
+            fprintf(fid, '  sxdot_tmp = N_VGetArrayPointer(sxdot[js]);\n');
+            
+            % sv = dvdx*sx + dvdu*su + dvdp(:,ip)
+            fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(condition.sv));
+            fprintf(fid, '    sv[is] = 0.0;\n');
+            fprintf(fid, '  }\n');
+            writeCcode(fid, matlab_version, condition, 'fsv1');
+            fprintf(fid, '  for (k=dvdp_colptrs[ip]; k<dvdp_colptrs[ip+1]; k++) {\n');
+            fprintf(fid, '    sv[dvdp_rows[k]] += dvdp[dvdp_rows[k] + %i*ip];\n', length(condition.sv));
+            fprintf(fid, '  }\n');
+            writeCcode(fid, matlab_version, condition, 'fsx');
+            
+            % Add sensitivity RHS contributions corresponding to the compartment volumes
+            if ( isfield( condition.sym, 'dfcdp2' ) )
+                fprintf(fid, '  switch (ip) {\n');
+                for j2=1:size(condition.sym.dvdp,2)
+                    fprintf(fid, '    case %i: {\n', j2-1);
+                    writeCcode(fid, matlab_version, condition, 'dfcdp2', j2);
+                    fprintf(fid, '    } break;\n');
+                end
+                fprintf(fid, '  }\n');
+            end
+            
+            fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(model.xs));
+            fprintf(fid, '    if(mxIsNaN(sxdot_tmp[is])) sxdot_tmp[is] = 0.0;\n');
+            fprintf(fid, '  }\n');
+            fprintf(fid, '  }\n');
+        end
+    end
+    fprintf(fid, '\n  return(0);\n}\n\n\n');
 end
 
 % compute flux sensitivity (only for output)
@@ -2139,9 +2477,7 @@ if(~isempty(model.xs))
             fprintf(fid, '  double *dvdu = data->dvdu;\n');
             fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
             writeCcode(fid, matlab_version, condition, 'dfxdp0');
-            fprintf(fid, '  for (is=0; is<%i; is++) {\n', numel(condition.sym.dfxdp0));
-            fprintf(fid, '    if(mxIsNaN(dfxdp0[is])) dfxdp0[is] = 0.0;\n');
-            fprintf(fid, '  }\n');
+            writeNaNCheck(fid, condition.sym.dfxdp0, 'dfxdp0');
         end
     end
 end
@@ -2164,12 +2500,124 @@ if(~isempty(model.xs))
             fprintf(fid, '  double *dvdu = data->dvdu;\n');
             fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
             writeCcode(fid, matlab_version, condition, 'dfxdp');
-            fprintf(fid, '  for (is=0; is<%i; is++) {\n', numel(condition.sym.dfxdp));
-            fprintf(fid, '    if(mxIsNaN(dfxdp[is])) dfxdp[is] = 0.0;\n');
+            writeNaNCheck(fid, condition.sym.dfxdp, 'dfxdp');
+        end
+    end
+end
+fprintf(fid, '\n  return;\n}\n\n\n');
+
+% write fxB (right hand side of the adjoint system, -dfxdx' * xB)
+fprintf(fid, ' int fxB_%s(realtype t, N_Vector x, N_Vector xB, N_Vector xBdot, void *user_data)\n{\n', condition.fkt);
+if(timedebug) 
+	fprintf(fid, '  printf("%%g \\t fxB\\n", t);\n');
+end
+fprintf(fid, '  UserData data = (UserData) user_data;\n');
+if(~isempty(model.xs))
+    if(config.useSensis)
+        fprintf(fid, '  int is;\n');
+        fprintf(fid, '  double *p = data->p;\n');
+        fprintf(fid, '  double *u = data->u;\n');
+        fprintf(fid, '  double *dvdx = data->dvdx;\n');
+        fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+        fprintf(fid, '  double *xB_tmp = N_VGetArrayPointer(xB);\n');
+        fprintf(fid, '  double *xBdot_tmp = N_VGetArrayPointer(xBdot);\n');
+        fprintf(fid, '  fu_%s(data, t);\n', condition.fkt);
+        fprintf(fid, '  dvdx_%s(t, x, data);\n', condition.fkt);
+        writeCcode(fid, matlab_version, condition, 'fxB');
+        fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(model.xs));
+        fprintf(fid, '    if(mxIsNaN(xBdot_tmp[is])) xBdot_tmp[is] = 0.0;\n');
+        fprintf(fid, '  }\n');
+    end
+end
+fprintf(fid, '\n  return(*(data->abort));\n}\n\n\n');
+
+% write fqB (integrand of the adjoint gradient, -dfxdp' * xB)
+fprintf(fid, ' int fqB_%s(realtype t, N_Vector x, N_Vector xB, N_Vector qBdot, void *user_data)\n{\n', condition.fkt);
+if(timedebug) 
+	fprintf(fid, '  printf("%%g \\t fqB\\n", t);\n');
+end
+fprintf(fid, '  UserData data = (UserData) user_data;\n');
+if(~isempty(model.xs))
+    if(config.useSensis)
+        if(~isempty(condition.sym.fqB))
+            fprintf(fid, '  int is;\n');
+            fprintf(fid, '  double *p = data->p;\n');
+            fprintf(fid, '  double *u = data->u;\n');
+            fprintf(fid, '  double *dvdp = data->dvdp;\n');
+            fprintf(fid, '  double *dvdu = data->dvdu;\n');
+            fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+            fprintf(fid, '  double *xB_tmp = N_VGetArrayPointer(xB);\n');
+            fprintf(fid, '  double *qBdot_tmp = N_VGetArrayPointer(qBdot);\n');
+            fprintf(fid, '  fu_%s(data, t);\n', condition.fkt);
+            fprintf(fid, '  dvdu_%s(t, x, data);\n', condition.fkt);
+            fprintf(fid, '  dvdp_%s(t, x, data);\n', condition.fkt);
+            writeCcode(fid, matlab_version, condition, 'fqB');
+            fprintf(fid, '  for (is=0; is<%i; is++) {\n', numel(condition.sym.fqB));
+            fprintf(fid, '    if(mxIsNaN(qBdot_tmp[is])) qBdot_tmp[is] = 0.0;\n');
             fprintf(fid, '  }\n');
         end
     end
 end
+fprintf(fid, '\n  return(*(data->abort));\n}\n\n\n');
+
+% write dfxBdxB (Jacobian of the adjoint system)
+fprintf(fid, ' int dfxBdxB_%s(long int NeqB, realtype t, N_Vector x, N_Vector xB, \n', condition.fkt);
+fprintf(fid, '  \tN_Vector fxB, DlsMat JB, void *user_data, \n');
+fprintf(fid, '  \tN_Vector tmp1B, N_Vector tmp2B, N_Vector tmp3B)\n{\n');
+if(timedebug)
+    fprintf(fid, '  printf("%%g \\t dfxBdxB\\n", t);\n');
+end
+if(~isempty(model.xs))
+    if(config.useSensis)
+        fprintf(fid, '  int is;\n');
+        fprintf(fid, '  UserData data = (UserData) user_data;\n');
+        fprintf(fid, '  double *p = data->p;\n');
+        fprintf(fid, '  double *u = data->u;\n');
+        fprintf(fid, '  double *dvdx = data->dvdx;\n');
+        fprintf(fid, '  dvdx_%s(t, x, data);\n', condition.fkt);
+        % CVODES sets JB to zero before calling the Jacobian function
+        writeCcode(fid, matlab_version, condition, 'dfxBdxB');
+        writeNaNCheck(fid, -transpose(condition.sym.dfxdx), 'JB->data');
+    end
+end
+fprintf(fid, '\n  return(0);\n}\n\n\n');
+
+% write triggers of the state dependent events (CVRootFn)
+fprintf(fid, ' int froot_%s(realtype t, N_Vector x, realtype *gout, void *user_data)\n{\n', condition.fkt);
+if(~isempty(model.xs) && ~isempty(condition.sym.froot))
+    fprintf(fid, '  int is;\n');
+    fprintf(fid, '  UserData data = (UserData) user_data;\n');
+    fprintf(fid, '  double *p = data->p;\n');
+    fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+    fprintf(fid, '  for (is=0; is<%i; is++) {\n', length(condition.sym.froot));
+    fprintf(fid, '    gout[is] = 0.0;\n');
+    fprintf(fid, '  }\n');
+    writeCcode(fid, matlab_version, condition, 'froot');
+end
+fprintf(fid, '\n  return(0);\n}\n\n\n');
+
+% write trigger derivatives (sensitivities of the event times)
+fprintf(fid, ' void dfrootdxp_%s(realtype t, N_Vector x, double *dgdx_tmp, double *dgdp_tmp, double *dgdt_tmp, void *user_data)\n{\n', condition.fkt);
+if(~isempty(model.xs) && ~isempty(condition.sym.froot) && config.useSensis)
+    fprintf(fid, '  int is;\n');
+    fprintf(fid, '  UserData data = (UserData) user_data;\n');
+    fprintf(fid, '  double *p = data->p;\n');
+    fprintf(fid, '  double *x_tmp = N_VGetArrayPointer(x);\n');
+    fprintf(fid, '  for (is=0; is<%i; is++) {\n', numel(condition.sym.dfrootdx));
+    fprintf(fid, '    dgdx_tmp[is] = 0.0;\n');
+    fprintf(fid, '  }\n');
+    fprintf(fid, '  for (is=0; is<%i; is++) {\n', numel(condition.sym.dfrootdp));
+    fprintf(fid, '    dgdp_tmp[is] = 0.0;\n');
+    fprintf(fid, '  }\n');
+    fprintf(fid, '  for (is=0; is<%i; is++) {\n', numel(condition.sym.dfrootdt));
+    fprintf(fid, '    dgdt_tmp[is] = 0.0;\n');
+    fprintf(fid, '  }\n');
+    writeCcode(fid, matlab_version, condition, 'dfrootdx');
+    if(~isempty(condition.sym.dfrootdp))
+        writeCcode(fid, matlab_version, condition, 'dfrootdp');
+    end
+    writeCcode(fid, matlab_version, condition, 'dfrootdt');
+end
 fprintf(fid, '\n  return;\n}\n\n\n');
 
 % write z
@@ -2290,19 +2738,66 @@ end
 fprintf(fid, '\n  return;\n}\n\n\n');
 
 % write C code
+% Replace NaN by zero in the entries of F which are not constant. Structural
+% zeros and numbers cannot become NaN, so only the remaining entries are
+% checked (listed in a static table unless all of them have to be checked).
+function writeNaNCheck(fid, F, cvar)
+F = F(:);
+qvar = false(numel(F), 1);
+for j=1:numel(F)
+    qvar(j) = ~isempty(symvar(F(j)));
+end
+if(~any(qvar))
+    return;
+end
+if(all(qvar))
+    fprintf(fid, '  for (is=0; is<%i; is++) {\n', numel(F));
+    fprintf(fid, '    if(mxIsNaN(%s[is])) %s[is] = 0.0;\n', cvar, cvar);
+    fprintf(fid, '  }\n');
+else
+    fprintf(fid, '  {\n');
+    fprintf(fid, '    static const int nonconst[%i] = {%s};\n', sum(qvar), intList(find(qvar)-1));
+    fprintf(fid, '    for (is=0; is<%i; is++) {\n', sum(qvar));
+    fprintf(fid, '      if(mxIsNaN(%s[nonconst[is]])) %s[nonconst[is]] = 0.0;\n', cvar, cvar);
+    fprintf(fid, '    }\n');
+    fprintf(fid, '  }\n');
+end
+
+% comma separated list for the initializer of a static array
+function str = intList(vals)
+if(isempty(vals))
+    str = '0';
+else
+    str = sprintf('%i, ', vals);
+    str = str(1:end-2);
+end
+
+% common subexpressions of the current (t, x), see commonSubexpressions
+function writeCseReference(fid, condition)
+if(~isempty(condition.sym.cse))
+    fprintf(fid, '  double *cse = fcse_%s(t, x, data);\n', condition.fkt);
+    fprintf(fid, '  if(cse == NULL) return;\n');
+end
+
 function writeCcode(fid, matlab_version, cond_data, svar, ip)
     
-if(strcmp(svar,'fv'))
+if(strcmp(svar,'fcse'))
+    cstr = ccode2(cond_data.sym.cse(:), matlab_version);
+    cvar =  'cse';
+elseif(strcmp(svar,'fv'))
+    cstr = ccode2(cond_data.sym.fvcse(:), matlab_version);
+    cvar =  'data->v';
+elseif(strcmp(svar,'fvreaction'))
     cstr = ccode2(cond_data.sym.fv(:), matlab_version);
     cvar =  'data->v';
 elseif(strcmp(svar,'dvdx'))
-    cstr = ccode2(cond_data.sym.dfvdx(:), matlab_version);
+    cstr = ccode2(cond_data.sym.dfvdxcse(:), matlab_version);
     cvar =  'data->dvdx';
 elseif(strcmp(svar,'dvdu'))
-    cstr = ccode2(cond_data.sym.dfvdu(:), matlab_version);
+    cstr = ccode2(cond_data.sym.dfvducse(:), matlab_version);
     cvar =  'data->dvdu';
 elseif(strcmp(svar,'dvdp'))
-    cstr = ccode2(cond_data.sym.dfvdp(:), matlab_version);
+    cstr = ccode2(cond_data.sym.dfvdpcse(:), matlab_version);
     cvar =  'data->dvdp';
 elseif(strcmp(svar,'fx'))
     cstr = ccode2(cond_data.sym.fx(:), matlab_version);
@@ -2319,6 +2814,9 @@ elseif(strcmp(svar,'dfxdx'))
 %         cstr = [cstr sprintf('\n  T[%i][0] = 0.0;',j-1)]; %#ok<AGROW>
 %     end
     cvar =  'J->data';
+elseif(strcmp(svar,'fJv'))
+    cstr = ccode2(cond_data.sym.fJv(:), matlab_version);
+    cvar =  'Jv_tmp';
 elseif(strcmp(svar,'dfxdx_sparse'))
     cstr = ccode2(cond_data.sym.dfxdx_nonzero(:), matlab_version);    
     cvar =  'J->data';
@@ -2352,6 +2850,18 @@ elseif(strcmp(svar,'fsu'))
 elseif(strcmp(svar,'fz'))
     cstr = ccode2(cond_data.sym.fz(:), matlab_version);
     cvar =  'z';
+elseif(strcmp(svar,'froot'))
+    cstr = ccode2(cond_data.sym.froot(:), matlab_version);
+    cvar =  'gout';
+elseif(strcmp(svar,'dfrootdx'))
+    cstr = ccode2(cond_data.sym.dfrootdx(:), matlab_version);
+    cvar =  'dgdx_tmp';
+elseif(strcmp(svar,'dfrootdp'))
+    cstr = ccode2(cond_data.sym.dfrootdp(:), matlab_version);
+    cvar =  'dgdp_tmp';
+elseif(strcmp(svar,'dfrootdt'))
+    cstr = ccode2(cond_data.sym.dfrootdt(:), matlab_version);
+    cvar =  'dgdt_tmp';
 elseif(strcmp(svar,'dfzdx'))
     cstr = ccode2(cond_data.sym.dfzdx(:), matlab_version);
     cvar =  '    dfzdxs';
@@ -2385,6 +2895,21 @@ elseif(strcmp(svar,'dfxdp0'))
 elseif(strcmp(svar,'dfxdp'))
     cstr = ccode2(cond_data.sym.dfxdp(:), matlab_version);
     cvar =  'dfxdp';
+elseif(strcmp(svar,'fxB'))
+    cstr = ccode2(cond_data.sym.fxB(:), matlab_version);
+    for j=find(cond_data.sym.fxB(:)' == 0)
+        cstr = [cstr sprintf('\n  T[%i][0] = 0.0;',j-1)]; %#ok<AGROW>
+    end
+    cvar =  'xBdot_tmp';
+elseif(strcmp(svar,'fqB'))
+    cstr = ccode2(cond_data.sym.fqB(:), matlab_version);
+    for j=find(cond_data.sym.fqB(:)' == 0)
+        cstr = [cstr sprintf('\n  T[%i][0] = 0.0;',j-1)]; %#ok<AGROW>
+    end
+    cvar =  'qBdot_tmp';
+elseif(strcmp(svar,'dfxBdxB'))
+    cstr = ccode2(reshape(-transpose(cond_data.sym.dfxdx), [], 1), matlab_version);
+    cvar =  'JB->data';
 else
     error('unknown %s', svar);
 end
@@ -2470,6 +2995,10 @@ if(~(length(cstr)==1 && isempty(cstr{1})))
         cstr = strrep(cstr, '=', '+=');
         cstr = strrep(cstr, 'x[', 'x_tmp[');
 		cstr = strrep(cstr, 'dvdx_tmp', 'dvdx');
+    elseif(strcmp(svar,'fxB') || strcmp(svar,'fqB'))
+        cstr = strrep(cstr, 'xB[', 'xB_tmp[');
+        cstr = strrep(cstr, 'x[', 'x_tmp[');
+		cstr = strrep(cstr, 'dvdx_tmp', 'dvdx');
         
     else
         cstr = strrep(cstr, 'x[', 'x_tmp[');
@@ -2477,6 +3006,12 @@ if(~(length(cstr)==1 && isempty(cstr{1})))
     end
 end
 
+% one case per nonzero flux, the others keep v = 0
+if(strcmp(svar,'fvreaction'))
+    cstr = regexprep(cstr, '^\s*data->v\[(\d+)\]\s*=\s*(.*)$', '    case $1:\n      data->v[$1] = $2\n      break;', ...
+        'lineanchors', 'dotexceptnewline');
+end
+
 fprintf(fid, '%s\n', cstr);
 
 % % debug
@@ -2490,12 +3025,17 @@ global ar
 % Functions
 fid = fopen(['./Compiled/' ar.info.c_version_code '/arSimuCalcFunctions.c'], 'W');
 
+included = {};
 for m=1:length(ar.model)
     for c=1:length(ar.model(m).condition)
+        if(ismember(ar.model(m).condition(c).codefkt, included))
+            continue % conditions sharing their code
+        end
+        included{end+1} = ar.model(m).condition(c).codefkt; %#ok<AGROW>
         if(~debug_mode)
-            fprintf(fid, '#include "%s.h"\n', ar.model(m).condition(c).fkt);
+            fprintf(fid, '#include "%s.h"\n', ar.model(m).condition(c).codefkt);
         else
-            fprintf(fid, '#include "%s.c"\n', ar.model(m).condition(c).fkt);
+            fprintf(fid, '#include "%s.c"\n', ar.model(m).condition(c).codefkt);
         end
     end
     
@@ -2511,295 +3051,212 @@ for m=1:length(ar.model)
 end
 fprintf(fid, '\n');
 
-% map CVodeInit to fx
-fprintf(fid, ' int AR_CVodeInit(void *cvode_mem, N_Vector x, double t, int im, int ic){\n');
+% Tables of the generated functions, indexed by model and condition (data set)
+fprintf(fid, '#include <arFunctionTable.h>\n\n');
+condFields = {'fx', 'fxdouble', 'fx0', 'dfxdx', 'dfxdx_sparse', 'dfxdx_out', 'dfxdx_times', ...
+    'fxB', 'fqB', 'dfxBdxB', 'froot', 'dfrootdxp', 'fsx0', 'subfsx0', 'fsx', 'subfsx', 'fsxall', 'csv', ...
+    'fu', 'fsu', 'fv', 'fvreaction', 'dvdx', 'dvdu', 'dvdp', 'dfxdp0', 'dfxdp', 'fz', 'dfzdx', 'fsz'};
+qSensiRHS = ismember(condFields, {'fsx', 'subfsx', 'fsxall'});
+dataFields = {'fy', 'fy_scale', 'fystd', 'fsy', 'fsystd'};
+condTables = cell(1, length(ar.model));
+dataTables = cell(1, length(ar.model));
 for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) return CVodeInit(cvode_mem, fx_%s, RCONST(t), x);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
+    condTables{m} = 'NULL';
+    if(~isempty(ar.model(m).condition))
+        condTables{m} = sprintf('conditionFunctions_%i', m-1);
+        fprintf(fid, 'static const ConditionFunctions %s[] = {\n', condTables{m});
+        for c=1:length(ar.model(m).condition)
+            entries = strcat(condFields, '_', ar.model(m).condition(c).codefkt);
+            if(~ar.config.useSensiRHS)
+                entries(qSensiRHS) = {'NULL'};
+            end
+            fprintf(fid, '  { %s },\n', strjoin(entries, ', '));
+        end
+        fprintf(fid, '};\n\n');
+    end
+    
+    dataTables{m} = 'NULL';
+    if(isfield(ar.model(m), 'data') && ~isempty(ar.model(m).data))
+        dataTables{m} = sprintf('dataFunctions_%i', m-1);
+        fprintf(fid, 'static const DataFunctions %s[] = {\n', dataTables{m});
+        for d=1:length(ar.model(m).data)
+            fprintf(fid, '  { %s },\n', strjoin(strcat(dataFields, '_', ar.model(m).data(d).fkt), ', '));
+        end
+        fprintf(fid, '};\n\n');
     end
 end
-fprintf(fid, '  return(-1);\n');
+fprintf(fid, 'static const ConditionFunctions *conditionFunctions[] = { %s };\n', strjoin(condTables, ', '));
+fprintf(fid, 'static const DataFunctions *dataFunctions[] = { %s };\n\n', strjoin(dataTables, ', '));
+
+% map CVodeInit to fx
+fprintf(fid, ' int AR_CVodeInit(void *cvode_mem, N_Vector x, double t, int im, int ic){\n');
+fprintf(fid, '  return CVodeInit(cvode_mem, conditionFunctions[im][ic].fx, RCONST(t), x);\n');
 fprintf(fid, '}\n\n');
 
 % map fx
 fprintf(fid, ' void fx(realtype t, N_Vector x, double *xdot, void *user_data, int im, int ic){\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) fxdouble_%s(t, x, xdot, user_data);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fxdouble(t, x, xdot, user_data);\n');
 fprintf(fid, '}\n\n');
 
 % map fx0
 fprintf(fid, ' void fx0(N_Vector x0, void *user_data, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) fx0_%s(x0, data);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fx0(x0, user_data);\n');
 fprintf(fid, '}\n\n');
 
 % map CVDlsSetDenseJacFn to dfxdx
 fprintf(fid, ' int AR_CVDlsSetDenseJacFn(void *cvode_mem, int im, int ic, int setSparse){\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i) & (setSparse==0)){ \n return CVDlsSetDenseJacFn(cvode_mem, dfxdx_%s);\n', ...   
-            m-1, c-1, ar.model(m).condition(c).fkt);
-        fprintf(fid, ' \n }else if((im==%i) & (ic==%i) & (setSparse==1)){ \n return CVSlsSetSparseJacFn(cvode_mem, dfxdx_sparse_%s);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-        fprintf(fid, '\n}\n');
-    end
-end
+fprintf(fid, '  if(setSparse==0) return CVDlsSetDenseJacFn(cvode_mem, conditionFunctions[im][ic].dfxdx);\n');
+fprintf(fid, '  if(setSparse==1) return CVSlsSetSparseJacFn(cvode_mem, conditionFunctions[im][ic].dfxdx_sparse);\n');
 fprintf(fid, '  return(-1);\n');
 fprintf(fid, '}\n\n');
 
+% map CVodeInitB to fxB and CVodeQuadInitB to fqB (adjoint gradients)
+fprintf(fid, ' int AR_CVodeInitB(void *cvode_mem, int which, N_Vector xB, double tB, int im, int ic){\n');
+fprintf(fid, '  return CVodeInitB(cvode_mem, which, conditionFunctions[im][ic].fxB, RCONST(tB), xB);\n');
+fprintf(fid, '}\n\n');
+
+fprintf(fid, ' int AR_CVodeQuadInitB(void *cvode_mem, int which, N_Vector qB, int im, int ic){\n');
+fprintf(fid, '  return CVodeQuadInitB(cvode_mem, which, conditionFunctions[im][ic].fqB, qB);\n');
+fprintf(fid, '}\n\n');
+
+% map CVDlsSetDenseJacFnB to dfxBdxB
+fprintf(fid, ' int AR_CVDlsSetDenseJacFnB(void *cvode_mem, int which, int im, int ic){\n');
+fprintf(fid, '  return CVDlsSetDenseJacFnB(cvode_mem, which, conditionFunctions[im][ic].dfxBdxB);\n');
+fprintf(fid, '}\n\n');
+
 % map dfxdx output function
 fprintf(fid, ' void getdfxdx(int im, int ic, realtype t, N_Vector x, realtype *J, void *user_data){\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) { dfxdx_out_%s(t, x, J, user_data); return; }\n', ...   
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
-fprintf(fid, '\n}\n\n');
+fprintf(fid, '  conditionFunctions[im][ic].dfxdx_out(t, x, J, user_data);\n');
+fprintf(fid, '}\n\n');
+
+% map CVodeRootInit to the triggers of the state dependent events
+fprintf(fid, ' int AR_CVodeRootInit(void *cvode_mem, int nroot, int im, int ic){\n');
+fprintf(fid, '  return CVodeRootInit(cvode_mem, nroot, conditionFunctions[im][ic].froot);\n');
+fprintf(fid, '}\n\n');
+
+% map trigger derivatives
+fprintf(fid, ' void getdfrootdxp(int im, int ic, realtype t, N_Vector x, double *dgdx, double *dgdp, double *dgdt, void *user_data){\n');
+fprintf(fid, '  conditionFunctions[im][ic].dfrootdxp(t, x, dgdx, dgdp, dgdt, user_data);\n');
+fprintf(fid, '}\n\n');
+
+% map Jacobian times vector (Krylov solvers)
+fprintf(fid, ' int AR_CVSpilsSetJacTimesVecFn(void *cvode_mem, int im, int ic){\n');
+fprintf(fid, '  return CVSpilsSetJacTimesVecFn(cvode_mem, conditionFunctions[im][ic].dfxdx_times);\n');
+fprintf(fid, '}\n\n');
+
+% map sparse dfxdx output function (rootfinding with KLU)
+fprintf(fid, ' void getdfxdx_sparse(int im, int ic, realtype t, N_Vector x, SlsMat J, void *user_data){\n');
+fprintf(fid, '  conditionFunctions[im][ic].dfxdx_sparse(t, x, NULL, J, user_data, NULL, NULL, NULL);\n');
+fprintf(fid, '}\n\n');
 
 % map fsx0
 fprintf(fid, ' void fsx0(int is, N_Vector sx_is, void *user_data, int im, int ic, int sensitivitySubset) {\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-fprintf(fid, '  if ( sensitivitySubset == 0 ) {\n' );
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '    if((im==%i) & (ic==%i)) fsx0_%s(is, sx_is, data);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
-fprintf(fid, '  } else {\n' );
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '    if((im==%i) & (ic==%i)) subfsx0_%s(is, sx_is, data);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
-fprintf(fid, '  }\n' );
+fprintf(fid, '  if ( sensitivitySubset == 0 )\n');
+fprintf(fid, '    conditionFunctions[im][ic].fsx0(is, sx_is, user_data);\n');
+fprintf(fid, '  else\n');
+fprintf(fid, '    conditionFunctions[im][ic].subfsx0(is, sx_is, user_data);\n');
 fprintf(fid, '}\n\n');
 
 % map flux sensitivities <== csv is here
 fprintf(fid, ' void csv(realtype t, N_Vector x, int ip, N_Vector sx, void *user_data, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) csv_%s(t, x, ip, sx, data);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
+fprintf(fid, '  conditionFunctions[im][ic].csv(t, x, ip, sx, user_data);\n');
 fprintf(fid, '}\n\n');
 
-% map CVodeSensInit1 to fsx
+% map CVodeSensInit1 to fsx, the right hand sides are NULL (difference quotients) without useSensiRHS
 fprintf(fid, ' int AR_CVodeSensInit1(void *cvode_mem, int nps, int sensi_meth, int sensirhs, N_Vector *sx, int im, int ic, int sensitivitySubset){\n');
-if(ar.config.useSensiRHS)
-    fprintf(fid, '  if (sensirhs == 1) {\n');
-    fprintf(fid, '    if (sensitivitySubset == 0) {\n');
-    for m=1:length(ar.model)
-        for c=1:length(ar.model(m).condition)
-            fprintf(fid, '      if((im==%i) & (ic==%i)) return CVodeSensInit1(cvode_mem, nps, sensi_meth, fsx_%s, sx);\n', ...
-                m-1, c-1, ar.model(m).condition(c).fkt);
-        end
-    end
-    fprintf(fid, '    } else {\n');
-    for m=1:length(ar.model)
-        for c=1:length(ar.model(m).condition)
-            fprintf(fid, '      if((im==%i) & (ic==%i)) return CVodeSensInit1(cvode_mem, nps, sensi_meth, subfsx_%s, sx);\n', ...
-                m-1, c-1, ar.model(m).condition(c).fkt);
-        end
-    end
-    fprintf(fid, '  }\n');
-    fprintf(fid, '  } else {\n');
-end
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '    if((im==%i) & (ic==%i)) return CVodeSensInit1(cvode_mem, nps, sensi_meth, NULL, sx);\n', ...
-            m-1, c-1);
-    end
-end
-if(ar.config.useSensiRHS)
-    fprintf(fid, '  }\n');
-end
-fprintf(fid, '  return(-1);\n');
+fprintf(fid, '  const ConditionFunctions *f = &conditionFunctions[im][ic];\n');
+fprintf(fid, '  if ((sensirhs == 2) && (f->fsxall != NULL)) return CVodeSensInit(cvode_mem, nps, sensi_meth, f->fsxall, sx);\n');
+fprintf(fid, '  if (sensirhs == 1) return CVodeSensInit1(cvode_mem, nps, sensi_meth, (sensitivitySubset == 0) ? f->fsx : f->subfsx, sx);\n');
+fprintf(fid, '  return CVodeSensInit1(cvode_mem, nps, sensi_meth, NULL, sx);\n');
 fprintf(fid, '}\n\n');
 
 % map fu
 fprintf(fid, ' void fu(void *user_data, double t, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-	for c=1:length(ar.model(m).condition)
-		fprintf(fid, '  if((im==%i) & (ic==%i)) fu_%s(data, t);\n', ...
-			m-1, c-1, ar.model(m).condition(c).fkt);
-	end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fu(user_data, t);\n');
 fprintf(fid, '}\n\n');
 
 % map fsu
 fprintf(fid, ' void fsu(void *user_data, double t, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-	for c=1:length(ar.model(m).condition)
-		fprintf(fid, '  if((im==%i) & (ic==%i)) fsu_%s(data, t);\n', ...
-			m-1, c-1, ar.model(m).condition(c).fkt);
-	end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fsu(user_data, t);\n');
 fprintf(fid, '}\n\n');
 
 % map fv
 fprintf(fid, ' void fv(void *user_data, double t, N_Vector x, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-	for c=1:length(ar.model(m).condition)
-		fprintf(fid, '  if((im==%i) & (ic==%i)) fv_%s(t, x, data);\n', ...
-			m-1, c-1, ar.model(m).condition(c).fkt);
-	end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fv(t, x, user_data);\n');
 fprintf(fid, '}\n\n');
 
 % map fsv
 fprintf(fid, ' void fsv(void *user_data, double t, N_Vector x, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-	for c=1:length(ar.model(m).condition)
-		fprintf(fid, '  if((im==%i) & (ic==%i)) {\n\tdvdp_%s(t, x, data);\n\tdvdu_%s(t, x, data);\n\tdvdx_%s(t, x, data);\n}\n', ...
-			m-1, c-1, ar.model(m).condition(c).fkt, ar.model(m).condition(c).fkt, ar.model(m).condition(c).fkt);
-	end
-end
+fprintf(fid, '  const ConditionFunctions *f = &conditionFunctions[im][ic];\n');
+fprintf(fid, '  f->dvdp(t, x, user_data);\n');
+fprintf(fid, '  f->dvdu(t, x, user_data);\n');
+fprintf(fid, '  f->dvdx(t, x, user_data);\n');
 fprintf(fid, '}\n\n');
 
 % map dfxdp0
 fprintf(fid, ' void dfxdp0(void *user_data, double t, N_Vector x, double *dfxdp0, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-	for c=1:length(ar.model(m).condition)
-		fprintf(fid, '  if((im==%i) & (ic==%i)) dfxdp0_%s(t, x, dfxdp0, data);\n', ...
-			m-1, c-1, ar.model(m).condition(c).fkt);
-	end
-end
+fprintf(fid, '  conditionFunctions[im][ic].dfxdp0(t, x, dfxdp0, user_data);\n');
 fprintf(fid, '}\n\n');
 
 % map dfxdp
 fprintf(fid, ' void dfxdp(void *user_data, double t, N_Vector x, double *dfxdp, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-	for c=1:length(ar.model(m).condition)
-		fprintf(fid, '  if((im==%i) & (ic==%i)) dfxdp_%s(t, x, dfxdp, data);\n', ...
-			m-1, c-1, ar.model(m).condition(c).fkt);
-	end
-end
+fprintf(fid, '  conditionFunctions[im][ic].dfxdp(t, x, dfxdp, user_data);\n');
 fprintf(fid, '}\n\n');
 
 % map fz
 fprintf(fid, 'void fz(double t, int nt, int it, int nz, int nx, int nu, int iruns, double *z, double *p, double *u, double *x, int im, int ic){\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) fz_%s(t, nt, it, nz, nx, nu, iruns, z, p, u, x);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fz(t, nt, it, nz, nx, nu, iruns, z, p, u, x);\n');
 fprintf(fid, '}\n\n');
 
 % map dfzdx
 fprintf(fid, 'void dfzdx(double t, int nt, int it, int nz, int nx, int nu, int iruns, double *dfzdx, double *z, double *p, double *u, double *x, int im, int ic){\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) dfzdx_%s(t, nt, it, nz, nx, nu, iruns, dfzdx, z, p, u, x);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
+fprintf(fid, '  conditionFunctions[im][ic].dfzdx(t, nt, it, nz, nx, nu, iruns, dfzdx, z, p, u, x);\n');
 fprintf(fid, '}\n\n');
 
 % map fsz
 fprintf(fid, 'void fsz(double t, int nt, int it, int np, double *sz, double *p, double *u, double *x, double *z, double *su, double *sx, int im, int ic){\n');
-for m=1:length(ar.model)
-    for c=1:length(ar.model(m).condition)
-        fprintf(fid, '  if((im==%i) & (ic==%i)) fsz_%s(t, nt, it, np, sz, p, u, x, z, su, sx);\n', ...
-            m-1, c-1, ar.model(m).condition(c).fkt);
-    end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fsz(t, nt, it, np, sz, p, u, x, z, su, sx);\n');
 fprintf(fid, '}\n\n');
 
 % map fy
 fprintf(fid, ' void fy(double t, int nt, int it, int ntlink, int itlink, int ny, int nx, int nz, int iruns, double *y, double *p, double *u, double *x, double *z, int im, int id){\n');
-for m=1:length(ar.model)
-    if(isfield(ar.model(m), 'data'))
-        for d=1:length(ar.model(m).data)
-            fprintf(fid, '  if((im==%i) & (id==%i)) fy_%s(t, nt, it, ntlink, itlink, ny, nx, nz, iruns, y, p, u, x, z);\n', ...
-                m-1, d-1, ar.model(m).data(d).fkt);
-        end
-    end
-end
+fprintf(fid, '  dataFunctions[im][id].fy(t, nt, it, ntlink, itlink, ny, nx, nz, iruns, y, p, u, x, z);\n');
 fprintf(fid, '}\n\n');
 
 % map fy_scale
 fprintf(fid, ' void fy_scale(double t, int nt, int it, int ntlink, int itlink, int ny, int nx, int nz, int iruns, double *y_scale, double *p, double *u, double *x, double *z, double *dfzdx, int im, int id){\n');
-for m=1:length(ar.model)
-    if(isfield(ar.model(m), 'data'))
-        for d=1:length(ar.model(m).data)
-            fprintf(fid, '  if((im==%i) & (id==%i)) fy_scale_%s(t, nt, it, ntlink, itlink, ny, nx, nz, iruns, y_scale, p, u, x, z, dfzdx);\n', ...
-                m-1, d-1, ar.model(m).data(d).fkt);
-        end
-    end
-end
+fprintf(fid, '  dataFunctions[im][id].fy_scale(t, nt, it, ntlink, itlink, ny, nx, nz, iruns, y_scale, p, u, x, z, dfzdx);\n');
 fprintf(fid, '}\n\n');
 
 % map fystd
 fprintf(fid, ' void fystd(double t, int nt, int it, int ntlink, int itlink, double *ystd, double *y, double *p, double *u, double *x, double *z, int im, int id){\n');
-for m=1:length(ar.model)
-    if(isfield(ar.model(m), 'data'))
-        for d=1:length(ar.model(m).data)
-            fprintf(fid, '  if((im==%i) & (id==%i)) fystd_%s(t, nt, it, ntlink, itlink, ystd, y, p, u, x, z);\n', ...
-                m-1, d-1, ar.model(m).data(d).fkt);
-        end
-    end
-end
+fprintf(fid, '  dataFunctions[im][id].fystd(t, nt, it, ntlink, itlink, ystd, y, p, u, x, z);\n');
 fprintf(fid, '}\n\n');
 
 % map fsy
 fprintf(fid, ' void fsy(double t, int nt, int it, int ntlink, int itlink, double *sy, double *p, double *u, double *x, double *z, double *su, double *sx, double *sz, int im, int id){\n');
-for m=1:length(ar.model)
-    if(isfield(ar.model(m), 'data'))
-        for d=1:length(ar.model(m).data)
-            fprintf(fid, '  if((im==%i) & (id==%i)) fsy_%s(t, nt, it, ntlink, itlink, sy, p, u, x, z, su, sx, sz);\n', ...
-                m-1, d-1, ar.model(m).data(d).fkt);
-        end
-    end
-end
+fprintf(fid, '  dataFunctions[im][id].fsy(t, nt, it, ntlink, itlink, sy, p, u, x, z, su, sx, sz);\n');
 fprintf(fid, '}\n\n');
 
 % map fsystd
 fprintf(fid, ' void fsystd(double t, int nt, int it, int ntlink, int itlink, double *systd, double *p, double *y, double *u, double *x, double *z, double *sy, double *su, double *sx, double *sz, int im, int id){\n');
-for m=1:length(ar.model)
-    if(isfield(ar.model(m), 'data'))
-        for d=1:length(ar.model(m).data)
-            fprintf(fid, '  if((im==%i) & (id==%i)) fsystd_%s(t, nt, it, ntlink, itlink, systd, p, y, u, x, z, sy, su, sx, sz);\n', ...
-                m-1, d-1, ar.model(m).data(d).fkt);
-        end
-    end
-end
+fprintf(fid, '  dataFunctions[im][id].fsystd(t, nt, it, ntlink, itlink, systd, p, y, u, x, z, sy, su, sx, sz);\n');
 fprintf(fid, '}\n\n');
 
 % for arSSACalc
 % call to fu and fv
 fprintf(fid, '/* for arSSACalc.c */\n\n');
 fprintf(fid, ' void fvSSA(void *user_data, double t, N_Vector x, int im, int ic){\n');
-fprintf(fid, '  UserData data = (UserData) user_data;\n');
-for m=1:length(ar.model)
-	for c=1:length(ar.model(m).condition)
-		fprintf(fid, '  if((im==%i) & (ic==%i)) {\n', m-1, c-1);
-        fprintf(fid, '    fu_%s(data, t);\n', ar.model(m).condition(c).fkt);
-        fprintf(fid, '    fv_%s(t, x, data);\n', ar.model(m).condition(c).fkt);
-        fprintf(fid, '  }\n');
-	end
-end
+fprintf(fid, '  conditionFunctions[im][ic].fu(user_data, t);\n');
+fprintf(fid, '  conditionFunctions[im][ic].fv(t, x, user_data);\n');
+fprintf(fid, '}\n\n');
+
+% inputs and the flux of reaction iv (next reaction method)
+fprintf(fid, ' void fuSSA(void *user_data, double t, int im, int ic){\n');
+fprintf(fid, '  conditionFunctions[im][ic].fu(user_data, t);\n');
+fprintf(fid, '}\n\n');
+fprintf(fid, ' void fvSSAreaction(void *user_data, double t, N_Vector x, int im, int ic, int iv){\n');
+fprintf(fid, '  conditionFunctions[im][ic].fvreaction(t, x, iv, user_data);\n');
 fprintf(fid, '}\n\n');
 
 fclose(fid);
@@ -111,6 +111,13 @@ else
     ar.config.optim.Jacobian = 'off';
 end
 
+if(~isfield(ar.config, 'useAdjoint'))
+    ar.config.useAdjoint = false;
+end
+if(ar.config.useAdjoint && ar.config.optimizer ~= 2)
+    error('ar.config.useAdjoint requires ar.config.optimizer = 2 (fmincon), the other optimizers need the residual sensitivities.');
+end
+
 removeL1path = false;
 if (any(ar.type==3) || any(ar.type==5))
     if(~isfield(ar.config, 'l1trdog'))
@@ -174,6 +181,11 @@ elseif(ar.config.optimizer == 2)
     % options.Hessian = 'fin-diff-grads';
     options.Hessian = 'user-supplied';
     options.HessFcn = @fmincon_hessianfcn;
+    if(ar.config.useAdjoint)
+        % without the data rows of ar.sres there is no Gauss-Newton Hessian
+        options.Hessian = 'lbfgs';
+        options.HessFcn = [];
+    end
     % options2.InitBarrierParam = 1e+6;
     % options2.InitTrustRegionRadius = 1e-1;
     
@@ -713,11 +725,15 @@ end
 % fmincon
 function [l, g, H] = merit_fkt_fmincon(pTrial)
 global ar
-arCalcMerit(ar.config.useSensis, pTrial);
+arCalcMerit(ar.config.useSensis, pTrial, [], [], ar.config.useAdjoint && nargout<3);
 arLogFit(ar);
 l = sum(ar.res.^2);
 if(nargout>1)
-    g = 2*ar.res*ar.sres(:, ar.qFit==1);
+    if(isfield(ar, 'adjointGrad') && ~isempty(ar.adjointGrad))
+        g = 2*ar.res(ar.res_type~=1)*ar.sres(:, ar.qFit==1) + ar.adjointGrad(ar.qFit==1);
+    else
+        g = 2*ar.res*ar.sres(:, ar.qFit==1);
+    end
 end
 if(nargout>2)
     type3_ind = ar.type == 3;
@@ -750,7 +766,7 @@ end
 
 function [c, ceq, gc, gceq] = confun(pTrial)
 global ar
-arCalcMerit(ar.config.useSensis, pTrial);
+arCalcMerit(ar.config.useSensis, pTrial, [], [], ar.config.useAdjoint);
 arLogFit(ar);
 % Nonlinear inequality constraints
 c = [];
@@ -50,6 +50,16 @@
 %                       with names of inputs that should be ignored (the 
 %                       model default will be used instead).
 % 
+% 'DpPerShoot'          Multiple shooting: split the data into segments with
+%                       the given number of data points each (1: one segment
+%                       between every two time points). Each segment is
+%                       simulated as a separate condition, starting from
+%                       fitted node states init_MS<i>_<state>. The
+%                       continuity of the states at the nodes enters the
+%                       residuals weighted with ar.ms_strength [1].
+%                       Example:
+%                           arLoadData('oscillation', 1, 'csv', true, 'DpPerShoot', 5);
+%
 % 'DataPath'            Path to the data files.
 %                       Default: DataPath = 'Data/'
 % 
@@ -194,12 +204,14 @@ end
 if( opts.dppershoot )
     if( opts.dppershoot_args>0 )
         if(~isfield(ar,'ms_count_snips'))
-            ar.model(m).ms_count = 0;
             ar.ms_count_snips = 0;
-            ar.ms_strength = 0;
+            ar.ms_strength = 1;
             ar.ms_threshold = 1e-5;
             ar.ms_violation = [];
         end
+        if(~isfield(ar.model(m),'ms_count') || isempty(ar.model(m).ms_count))
+            ar.model(m).ms_count = 0;
+        end
         dpPerShoot = opts.dppershoot_args;
     end
 else
@@ -1,13 +1,17 @@
 % Simulate for current parameter settings
 %
-% arSimu(sensi, fine, dynamics)
+% arSimu(sensi, fine, dynamics, adjoint)
 %   sensi:          calculate sensitivities         [true]
 %   fine:           fine grid for plotting          [false]
 %   dynamics:       evaluate dynamics               [true]
+%   adjoint:        instead of the sensitivities, compute only the
+%                   gradient of the data chi2 by backward integration
+%                   (condition.chi2Grad and data.chi2Grad, see
+%                   arCollectRes). Only used with sensi and ~fine.  [false]
 % 
 % or
 %
-% ar = arSimu(ar, sensi, fine, dynamics)
+% ar = arSimu(ar, sensi, fine, dynamics, adjoint)
 %   ar:             d2d model/data structure
 
 function varargout = arSimu(varargin)
@@ -40,6 +44,16 @@ if(length(varargin)>2 && ~isempty(varargin{3}))
 else
     dynamics = 0;
 end
+if(length(varargin)>3 && ~isempty(varargin{4}))
+    adjoint = varargin{4} && sensi && ~fine;
+else
+    adjoint = false;
+end
+
+% The adjoint gradient is not cached
+if ( adjoint )
+    dynamics = 1;
+end
 
 % If dynamics are not forced, check whether the dynamics of the last simulation
 % were identical. If not, we have to resimulate.
@@ -130,6 +144,8 @@ end
 if(sensi)
     if ( fine )
         ar = initFineSensis(ar, dynamics);
+    elseif ( adjoint )
+        ar = initAdjointGrads(ar);
     else
         ar = initExpSensis(ar, dynamics);
     end
@@ -139,7 +155,7 @@ end
 % options for steady state simulation:
 %   1. Full simulation of everything (slow)
 %       turboSSSensi = 0, rootFinding = 0
-%   2. Fast simulation (simulate system without sensitivities, then determine sensis with implicit func theorem) (REQUIRES REDUCED SYSTEM)
+%   2. Fast simulation (simulate system without sensitivities, then determine sensis with implicit func theorem in arSimuCalc)
 %       turboSSSensi = 1, rootFinding = 0
 %   3. Rootfinding; no guarantee that the determined steady state is the steady state the system would equilibrate to when multiple steady states exist (REQUIRES REDUCED SYSTEM)
 %       rootFinding = 1
@@ -150,13 +166,13 @@ if ( ss_presimulation && dynamics )
     end
     if ( ~rootFinding )
         if ( isfield( ar.config, 'turboSSSensi' ) && ( ar.config.turboSSSensi == 1 ) )
-            % Steady state determination by simulation without sensitivities and then determining them via implicit func theorem (only valid when conserved moieties have been removed from the model)
-            for m=1:length(ar.model)
-                fastSteadyState( m, sensi, dynamics );
-            end
+            % Steady state determination by simulation without sensitivities and then determining them via implicit func theorem
+            fastSteadyState( sensi, dynamics );
         else
             % Steady state determination by full simulation
+            balanceThreads( ar.config.useSensis && sensi, true, dynamics );
             feval(ar.fkt, ar, true, ar.config.useSensis && sensi, dynamics, false, 'ss_condition', 'ss_threads', ar.config.skipSim);
+            recordThreadCosts( ar.config.useSensis && sensi, true, dynamics );
         end
     else
         % Steady state determination by rootfinding
@@ -235,13 +251,15 @@ end
 
 
 % call mex function to simulate models
+balanceThreads( ar.config.useSensis && sensi, false, dynamics );
 if ( isfield( ar.config, 'onlySS' ) && ( ar.config.onlySS == 1 ) )
     % Even if we only simulate steady states, we still need to propagate
     % the initial sensi to the observables.
-    feval(ar.fkt, ar, fine, ar.config.useSensis && sensi, dynamics, false, 'condition', 'threads', 1)
+    feval(ar.fkt, ar, fine, ar.config.useSensis && sensi, dynamics, false, 'condition', 'threads', 1, adjoint)
 else
-    feval(ar.fkt, ar, fine, ar.config.useSensis && sensi, dynamics, false, 'condition', 'threads', ar.config.skipSim)
+    feval(ar.fkt, ar, fine, ar.config.useSensis && sensi, dynamics, false, 'condition', 'threads', ar.config.skipSim, adjoint)
 end
+recordThreadCosts( ar.config.useSensis && sensi, false, dynamics );
 
 % integration error ?
 for m=1:length(ar.model)
@@ -260,7 +278,7 @@ end
 if(~fine)
     % arCalcRes_test;  % the test can be performed here or outside of arSimu
     % (see comments in arCalcRes_test.m)
-    arCalcRes(sensi)
+    arCalcRes(sensi && ~adjoint)
 
     %calculate y_scale_max
     if(ar.config.atolV)
@@ -295,7 +313,7 @@ if ( dynamics )
         ar.cache.fineSensi          = sensi + 0;
     else
         ar.cache.exp                = ar.p + 0;
-        ar.cache.expSensi           = sensi + 0;
+        ar.cache.expSensi           = (sensi && ~adjoint) + 0;
     end
 end
 
@@ -356,6 +374,21 @@ if ( isfield( ar.config, 'onlySS' ) && ( ar.config.onlySS == 1 ) )
 end
 
 
+% (Re-)Initialize the arrays the adjoint gradients are written to
+function ar = initAdjointGrads(ar)
+
+for m = 1:length(ar.model)
+    if(isfield(ar.model(m), 'data'))
+        for d = 1:length(ar.model(m).data)
+            ar.model(m).data(d).chi2Grad = zeros(1, length(ar.model(m).data(d).p));
+        end
+    end
+    for c = 1:length(ar.model(m).condition)
+        ar.model(m).condition(c).chi2Grad = zeros(1, length(ar.model(m).condition(c).p));
+    end
+end
+
+
 function ar = initSteadyStateSensis(ar, dynamics)
 
 if ( dynamics )
@@ -373,34 +406,65 @@ if ( dynamics )
     end
 end
 
-function fastSteadyState( m, sensi, dynamics )
+function fastSteadyState( sensi, dynamics )
     global ar;
 
-    % Steady state determination by simulation
+    % Steady state determination by simulation. With ar.config.turboSSSensi
+    % set, arSimuCalc integrates only the states and solves
+    % dfdx * Sx = -dfdp at the equilibrium for the sensitivities.
     %                 fine  sensi  dynamics  ssa    which condition field
-    feval(ar.fkt, ar, true, false, dynamics, false, 'ss_condition', 'ss_threads', ar.config.skipSim);
-	if ( ar.config.useSensis && sensi )
-        for c = 1 : numel(ar.model(m).ss_condition)
-            method = 1;
-            dfdx = ar.model(m).ss_condition(c).dfdxNum + 0;
-            dfdp = ar.model(m).ss_condition(c).dfdpNum + 0;
-            
-            if ( method == 2 )
-                [Sx, r] = linsolve(-dfdx,dfdp); % For invertibility, model may not have conserved moieties
-                        
-                %if ( r < eps(1) )
-                %    error( 'Model has conserved moieties or has not been sufficiently equilibrated. Fast equilibration result may be unreliable. Unless you know what you are doing, turn ar.config.turboSSSensi off by invoking ar.config.turboSSSensi = 0 or reduce the model prior to compilation (see help arReduce)' );
-                %end
-            else
-                Sx = pinv(-dfdx)*dfdp;
-                %Sx = dfdx.' \ dfdp;
+    balanceThreads( false, true, dynamics );
+    feval(ar.fkt, ar, true, ar.config.useSensis && sensi, dynamics, false, 'ss_condition', 'ss_threads', ar.config.skipSim);
+    recordThreadCosts( false, true, dynamics );
+    
+    % Conservation laws which depend on the parameters (e.g. estimated
+    % compartment sizes) do not determine the sensitivities, integrate them
+    % (arSimuCalc only simulates conditions with status 0)
+    failed = false;
+    for m = 1:length(ar.model)
+        for c = 1:length(ar.model(m).ss_condition)
+            if ( ar.model(m).ss_condition(c).status == 67 )
+                failed = true;
+                ar.model(m).ss_condition(c).status = 0;
+                ar.model(m).ss_condition(c).start = 0;
+                ar.model(m).ss_condition(c).stop = 0;
+                ar.model(m).ss_condition(c).stop_data = 0;
             end
-            ar.model(m).ss_condition(c).sxFineSimu(end,:,:) = Sx + 0;
-            
-            % Compute flux sensitivities
-            dvdp = ar.model(m).ss_condition(c).dvdpNum;
-            dvdx = ar.model(m).ss_condition(c).dvdxNum;
-            Sv = dvdx * Sx + dvdp;
-            ar.model(m).ss_condition(c).svFineSimu(end,:,:) = Sv + 0;
         end
-	end
\ No newline at end of file
+    end
+    if ( failed )
+        ar.config.turboSSSensi = 0;
+        try
+            feval(ar.fkt, ar, true, ar.config.useSensis && sensi, dynamics, false, 'ss_condition', 'ss_threads', ar.config.skipSim);
+        catch err
+            ar.config.turboSSSensi = 1;
+            rethrow(err);
+        end
+        ar.config.turboSSSensi = 1;
+    end
+
+% Distribute the conditions over the threads according to their measured
+% computation times (see arBalanceThreads)
+function balanceThreads( sensi, ss_conditions, dynamics )
+    if ( useCostBalancing( ss_conditions, dynamics ) )
+        arBalanceThreads( sensi, ss_conditions );
+    end
+
+% Store the computation times of the simulation that just finished. Only
+% dynamic simulations are representative for the cost of a condition.
+function recordThreadCosts( sensi, ss_conditions, dynamics )
+    if ( useCostBalancing( ss_conditions, dynamics ) )
+        arBalanceThreads( sensi, ss_conditions, true );
+    end
+
+% Balancing needs more than one thread
+function use = useCostBalancing( ss_conditions, dynamics )
+    global ar;
+    
+    if ( ss_conditions )
+        threads = 'ss_threads';
+    else
+        threads = 'threads';
+    end
+    use = dynamics && isfield( ar.config, 'useCostBalancing' ) && ar.config.useCostBalancing ...
+        && isfield( ar.config, threads ) && ( length( ar.config.(threads) ) > 1 );